@@ -0,0 +1,230 @@
+#ifndef AGENT_HASH_H
+#define AGENT_HASH_H
+
+#include <cmath>
+#include <vector>
+#include <random>
+#include <thread>
+#include <chrono>
+#include <iostream>
+#include <algorithm>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+// Moving agents bucketed by the x/z cell they stand in, rebuilt from scratch
+// every tick instead of updated. Build() is a counting sort by bucket: each
+// thread counts its share of agents, the counts become each thread's write
+// offsets, and each thread scatters its agents into place. Afterwards a
+// bucket's agents sit next to each other with their positions, so a
+// neighbor query reads a few short runs of memory.
+class AgentHash
+{
+public:
+    explicit AgentHash(GLfloat cellSize = 1.0f) : cellSize(cellSize)
+    {
+    }
+
+    // Buckets agents 0 to positions.size() - 1
+    void Build(const std::vector<glm::vec3> &positions)
+    {
+        GLuint n = (GLuint)positions.size();
+        GLuint buckets = 64;
+        while (buckets < 2 * n)
+            buckets *= 2;
+        GLuint threads = n < PARALLEL_MIN ? 1 : std::max(1u, std::thread::hardware_concurrency());
+        GLuint chunk = (n + threads - 1) / threads, span = (buckets + threads - 1) / threads;
+        this->mask = buckets - 1;
+        this->keys.resize(n);
+        this->counts.assign((size_t)threads * buckets, 0);
+        this->starts.resize(buckets + 1);
+        this->agents.resize(n);
+        this->x.resize(n);
+        this->z.resize(n);
+        std::vector<GLuint> spanTotals(threads, 0);
+
+        // 1. every thread counts its slice of agents into its own row
+        run(threads, [&](GLuint t) {
+            GLuint *row = &this->counts[(size_t)t * buckets];
+            for (GLuint i = t * chunk; i < std::min(n, (t + 1) * chunk); i++) {
+                this->keys[i] = this->bucket(positions[i].x, positions[i].z);
+                row[this->keys[i]]++;
+            }
+        });
+        // 2. turn counts into offsets, bucket by bucket and then thread by
+        // thread within a bucket; each thread takes a span of buckets
+        run(threads, [&](GLuint t) {
+            GLuint total = 0;
+            for (GLuint b = t * span; b < std::min(buckets, (t + 1) * span); b++)
+                for (GLuint r = 0; r < threads; r++)
+                    total += this->counts[(size_t)r * buckets + b];
+            spanTotals[t] = total;
+        });
+        for (GLuint t = 0, sum = 0; t < threads; t++) {
+            GLuint total = spanTotals[t];
+            spanTotals[t] = sum;
+            sum += total;
+        }
+        run(threads, [&](GLuint t) {
+            GLuint offset = spanTotals[t];
+            for (GLuint b = t * span; b < std::min(buckets, (t + 1) * span); b++) {
+                this->starts[b] = offset;
+                for (GLuint r = 0; r < threads; r++) {
+                    GLuint count = this->counts[(size_t)r * buckets + b];
+                    this->counts[(size_t)r * buckets + b] = offset;
+                    offset += count;
+                }
+            }
+        });
+        this->starts[buckets] = n;
+        // 3. every thread scatters its slice to its offsets
+        run(threads, [&](GLuint t) {
+            GLuint *row = &this->counts[(size_t)t * buckets];
+            for (GLuint i = t * chunk; i < std::min(n, (t + 1) * chunk); i++) {
+                GLuint to = row[this->keys[i]]++;
+                this->agents[to] = i;
+                this->x[to] = positions[i].x;
+                this->z[to] = positions[i].z;
+            }
+        });
+    }
+
+    // Replaces found with the agents within radius of position on x and z,
+    // in no particular order. Radius can be anything; one cell or less keeps
+    // it to at most four cells.
+    void Neighbors(const glm::vec3 &position, GLfloat radius, std::vector<GLuint> &found) const
+    {
+        found.clear();
+        if (this->agents.empty())
+            return;
+        GLint x0 = (GLint)std::floor((position.x - radius) / this->cellSize), x1 = (GLint)std::floor((position.x + radius) / this->cellSize);
+        GLint z0 = (GLint)std::floor((position.z - radius) / this->cellSize), z1 = (GLint)std::floor((position.z + radius) / this->cellSize);
+        // Cells can share a bucket; a bucket is read once, or for a query
+        // wider than MAX_CELLS the repeats are taken out afterwards
+        bool wide = (x1 - x0 + 1) * (z1 - z0 + 1) > (GLint)MAX_CELLS;
+        GLuint seen[MAX_CELLS];
+        GLuint visited = 0;
+        GLfloat r2 = radius * radius;
+        for (GLint cx = x0; cx <= x1; cx++) {
+            for (GLint cz = z0; cz <= z1; cz++) {
+                GLuint b = this->hash(cx, cz);
+                if (!wide) {
+                    if (std::find(seen, seen + visited, b) != seen + visited)
+                        continue;
+                    seen[visited++] = b;
+                }
+                for (GLuint i = this->starts[b]; i < this->starts[b + 1]; i++) {
+                    GLfloat dx = this->x[i] - position.x, dz = this->z[i] - position.z;
+                    if (dx * dx + dz * dz < r2)
+                        found.push_back(this->agents[i]);
+                }
+            }
+        }
+        if (wide) {
+            std::sort(found.begin(), found.end());
+            found.erase(std::unique(found.begin(), found.end()), found.end());
+        }
+    }
+
+    GLuint Count() const
+    {
+        return (GLuint)this->agents.size();
+    }
+
+    // Times a tick of 1k to 100k agents at the same density: the rebuild,
+    // then every agent asking for its neighbors, against checking all pairs
+    static void Benchmark(std::ostream &out)
+    {
+        const GLuint counts[] = { 1000, 10000, 100000 };
+        const GLfloat radius = 1.0f;
+        std::mt19937 random(41);
+        for (int n = 0; n < 3; n++) {
+            GLuint count = counts[n];
+            GLfloat side = std::sqrt((GLfloat)count) * 2.0f; // one agent per 4 square units
+            std::uniform_real_distribution<GLfloat> position(0.0f, side), step(-0.2f, 0.2f);
+            std::vector<glm::vec3> agents(count);
+            for (GLuint i = 0; i < count; i++)
+                agents[i] = glm::vec3(position(random), 0.0f, position(random));
+            AgentHash hash(radius);
+            hash.Build(agents); // warm up the allocations
+            for (GLuint i = 0; i < count; i++)
+                agents[i] += glm::vec3(step(random), 0.0f, step(random));
+
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            hash.Build(agents);
+            double buildTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            GLuint threads = std::max(1u, std::thread::hardware_concurrency());
+            std::vector<size_t> found(threads, 0);
+            start = std::chrono::steady_clock::now();
+            run(threads, [&](GLuint t) {
+                std::vector<GLuint> neighbors;
+                for (GLuint i = t; i < count; i += threads) {
+                    hash.Neighbors(agents[i], radius, neighbors);
+                    found[t] += neighbors.size() - 1; // not itself
+                }
+            });
+            double queryTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            size_t pairs = 0;
+            for (GLuint t = 0; t < threads; t++)
+                pairs += found[t];
+
+            // All pairs, on one thread, only as far as it takes to time
+            GLuint checked = std::min(count, 1000u);
+            size_t bruteFound = 0;
+            start = std::chrono::steady_clock::now();
+            for (GLuint i = 0; i < checked; i++)
+                for (GLuint j = 0; j < count; j++) {
+                    GLfloat dx = agents[j].x - agents[i].x, dz = agents[j].z - agents[i].z;
+                    bruteFound += j != i && dx * dx + dz * dz < radius * radius;
+                }
+            double bruteTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() * count / checked;
+            size_t hashFound = 0;
+            std::vector<GLuint> neighbors;
+            for (GLuint i = 0; i < checked; i++) {
+                hash.Neighbors(agents[i], radius, neighbors);
+                hashFound += neighbors.size() - 1;
+            }
+
+            out << count << " agents: build " << buildTime * 1000.0 << " ms, all neighbor queries " << queryTime * 1000.0 << " ms on "
+                << threads << " threads (" << (double)pairs / count << " neighbors each), all pairs " << bruteTime * 1000.0 << " ms on one"
+                << (hashFound == bruteFound ? "" : ", MISMATCH") << std::endl;
+        }
+    }
+
+private:
+    static const GLuint PARALLEL_MIN = 8192;
+    static const GLuint MAX_CELLS = 16;
+
+    GLfloat cellSize;
+    GLuint mask;
+    std::vector<GLuint> keys;    // each agent's bucket
+    std::vector<GLuint> counts;  // a row of bucket counts, then offsets, per thread
+    std::vector<GLuint> starts;  // where each bucket's run begins, and the end
+    std::vector<GLuint> agents;  // agent numbers in bucket order
+    std::vector<GLfloat> x, z;   // their positions, in the same order
+
+    GLuint hash(GLint cx, GLint cz) const
+    {
+        return (((GLuint)cx * 73856093u) ^ ((GLuint)cz * 19349663u)) & this->mask;
+    }
+
+    GLuint bucket(GLfloat px, GLfloat pz) const
+    {
+        return this->hash((GLint)std::floor(px / this->cellSize), (GLint)std::floor(pz / this->cellSize));
+    }
+
+    // f(0) to f(threads - 1), each on a thread of its own but the first
+    template <class F>
+    static void run(GLuint threads, F f)
+    {
+        std::vector<std::thread> workers;
+        for (GLuint t = 1; t < threads; t++)
+            workers.push_back(std::thread(f, t));
+        f(0);
+        for (size_t i = 0; i < workers.size(); i++)
+            workers[i].join();
+    }
+};
+
+#endif
@@ -0,0 +1,337 @@
+#ifndef BOX_GRID_H
+#define BOX_GRID_H
+
+#include <cmath>
+#include <cfloat>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <iostream>
+#include <algorithm>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define BOX_GRID_SSE 1
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// Axis-aligned boxes, each with its own half extents, bucketed by a uniform
+// grid over x and z so a query only looks at the boxes near it, however many
+// there are. Cells hash into a bucket table that grows with the box count.
+// Buckets keep their boxes' bounds as separate min/max arrays per axis, and
+// the overlap test runs on four of them at a time.
+//
+// Boxes can move (Move()); those that stay in their cells are updated in
+// place. A box wider than MAX_SPAN cells goes in a list every query checks.
+class BoxGrid
+{
+public:
+    explicit BoxGrid(GLfloat cellSize = 2.0f) : cellSize(cellSize), query(0)
+    {
+        this->buckets.resize(MIN_BUCKETS);
+    }
+
+    // Returns the box's id; ids count up from 0
+    GLuint Add(const glm::vec3 &center, const glm::vec3 &halfExtent)
+    {
+        GLuint id = (GLuint)this->centers.size();
+        this->centers.push_back(center);
+        this->halfExtents.push_back(halfExtent);
+        this->stamps.push_back(0);
+        if (this->centers.size() > 2 * this->buckets.size())
+            this->rehash(this->buckets.size() * 4);
+        else
+            this->insert(id);
+        return id;
+    }
+
+    void Move(GLuint id, const glm::vec3 &center, const glm::vec3 &halfExtent)
+    {
+        Cells before = this->cells(this->centers[id], this->halfExtents[id]);
+        this->centers[id] = center;
+        this->halfExtents[id] = halfExtent;
+        Cells after = this->cells(center, halfExtent);
+        if (before == after) {
+            this->forEachBucket(after, id, &BoxGrid::update);
+        } else {
+            this->forEachBucket(before, id, &BoxGrid::remove);
+            this->insert(id);
+        }
+    }
+
+    void Move(GLuint id, const glm::vec3 &center)
+    {
+        this->Move(id, center, this->halfExtents[id]);
+    }
+
+    const glm::vec3 &Center(GLuint id) const
+    {
+        return this->centers[id];
+    }
+
+    const glm::vec3 &HalfExtent(GLuint id) const
+    {
+        return this->halfExtents[id];
+    }
+
+    GLuint Count() const
+    {
+        return (GLuint)this->centers.size();
+    }
+
+    // Replaces hits with the ids, ascending, of the boxes that overlap the
+    // open box from min to max (touching faces don't count)
+    void Query(const glm::vec3 &min, const glm::vec3 &max, std::vector<GLuint> &hits)
+    {
+        hits.clear();
+        if (++this->query == 0) { // wrapped; forget every stamp
+            std::fill(this->stamps.begin(), this->stamps.end(), 0);
+            this->query = 1;
+        }
+        this->test(this->large, min, max, hits);
+        Cells c = this->cells((min + max) * 0.5f, (max - min) * 0.5f);
+        if (c.Large) { // a query that wide looks at everything
+            for (size_t b = 0; b < this->buckets.size(); b++)
+                this->test(this->buckets[b], min, max, hits);
+        } else {
+            this->visited.clear();
+            for (GLint x = c.X0; x <= c.X1; x++) {
+                for (GLint z = c.Z0; z <= c.Z1; z++) {
+                    size_t b = this->bucket(x, z);
+                    if (std::find(this->visited.begin(), this->visited.end(), b) != this->visited.end())
+                        continue;
+                    this->visited.push_back(b);
+                    this->test(this->buckets[b], min, max, hits);
+                }
+            }
+        }
+        std::sort(hits.begin(), hits.end());
+    }
+
+    // Times player-sized queries against 3 to 100k boxes at the same density,
+    // and a linear scan over the same boxes
+    static void Benchmark(std::ostream &out)
+    {
+        const GLuint counts[] = { 3, 1000, 10000, 100000 };
+        const GLuint queries = 100000, linearQueries = 1000;
+        std::mt19937 random(167);
+        std::vector<GLuint> hits;
+        for (int n = 0; n < 4; n++) {
+            GLuint count = counts[n];
+            GLfloat side = std::sqrt((GLfloat)count) * 4.0f; // one box per 16 square units
+            std::uniform_real_distribution<GLfloat> position(0.0f, side), extent(0.25f, 1.0f), height(-0.5f, 3.0f);
+            BoxGrid grid;
+            for (GLuint i = 0; i < count; i++)
+                grid.Add(glm::vec3(position(random), height(random), position(random)), glm::vec3(extent(random), extent(random), extent(random)));
+            std::vector<glm::vec3> points(queries);
+            for (GLuint i = 0; i < queries; i++)
+                points[i] = glm::vec3(position(random), 0.0f, position(random));
+            const glm::vec3 reach(0.2f, FLT_MAX, 0.2f);
+            size_t found = 0;
+
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            for (GLuint i = 0; i < queries; i++) {
+                grid.Query(points[i] - reach, points[i] + reach, hits);
+                found += hits.size();
+            }
+            double gridTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            start = std::chrono::steady_clock::now();
+            for (GLuint i = 0; i < linearQueries; i++) {
+                glm::vec3 lo = points[i] - reach, hi = points[i] + reach;
+                for (GLuint j = 0; j < count; j++) {
+                    glm::vec3 bmin = grid.centers[j] - grid.halfExtents[j], bmax = grid.centers[j] + grid.halfExtents[j];
+                    if (bmin.x < hi.x && bmax.x > lo.x && bmin.y < hi.y && bmax.y > lo.y && bmin.z < hi.z && bmax.z > lo.z)
+                        found++;
+                }
+            }
+            double linearTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            // Every box moves a little, as dynamic ones would each frame
+            std::uniform_real_distribution<GLfloat> step(-0.1f, 0.1f);
+            start = std::chrono::steady_clock::now();
+            for (GLuint i = 0; i < count; i++)
+                grid.Move(i, grid.centers[i] + glm::vec3(step(random), 0.0f, step(random)));
+            double moveTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            out << count << " boxes: " << gridTime * 1e9 / queries << " ns per query, linear scan " << linearTime * 1e9 / linearQueries
+                << " ns, " << moveTime * 1e9 / count << " ns per move (" << found << " hits)" << std::endl;
+        }
+    }
+
+private:
+    static const size_t MIN_BUCKETS = 256;
+    static const GLint MAX_SPAN = 16;
+
+    // One bucket's boxes; a box is in every bucket its cells hash to
+    struct Bucket
+    {
+        std::vector<GLfloat> MinX, MinY, MinZ, MaxX, MaxY, MaxZ;
+        std::vector<GLuint> Ids;
+    };
+
+    // The cells a box covers, or Large if that's more than MAX_SPAN a side
+    struct Cells
+    {
+        GLint X0, Z0, X1, Z1;
+        bool Large;
+
+        bool operator==(const Cells &other) const
+        {
+            return this->Large == other.Large && (this->Large || (this->X0 == other.X0 && this->Z0 == other.Z0 && this->X1 == other.X1 && this->Z1 == other.Z1));
+        }
+    };
+
+    GLfloat cellSize;
+    std::vector<Bucket> buckets;
+    Bucket large;
+    std::vector<glm::vec3> centers, halfExtents;
+    std::vector<GLuint> stamps; // query number that last reported each box
+    GLuint query;
+    std::vector<size_t> visited;
+
+    Cells cells(const glm::vec3 &center, const glm::vec3 &halfExtent) const
+    {
+        Cells c;
+        GLfloat x0 = std::floor((center.x - halfExtent.x) / this->cellSize), x1 = std::floor((center.x + halfExtent.x) / this->cellSize);
+        GLfloat z0 = std::floor((center.z - halfExtent.z) / this->cellSize), z1 = std::floor((center.z + halfExtent.z) / this->cellSize);
+        c.Large = !(x1 - x0 < MAX_SPAN && z1 - z0 < MAX_SPAN); // also catches infinities and NaN
+        c.X0 = c.Large ? 0 : (GLint)x0;
+        c.X1 = c.Large ? 0 : (GLint)x1;
+        c.Z0 = c.Large ? 0 : (GLint)z0;
+        c.Z1 = c.Large ? 0 : (GLint)z1;
+        return c;
+    }
+
+    size_t bucket(GLint x, GLint z) const
+    {
+        return (((GLuint)x * 73856093u) ^ ((GLuint)z * 19349663u)) & (this->buckets.size() - 1);
+    }
+
+    void insert(GLuint id)
+    {
+        this->forEachBucket(this->cells(this->centers[id], this->halfExtents[id]), id, &BoxGrid::append);
+    }
+
+    // Calls f once for each distinct bucket of cells
+    void forEachBucket(const Cells &c, GLuint id, void (BoxGrid::*f)(Bucket &, GLuint))
+    {
+        if (c.Large) {
+            (this->*f)(this->large, id);
+            return;
+        }
+        this->visited.clear();
+        for (GLint x = c.X0; x <= c.X1; x++) {
+            for (GLint z = c.Z0; z <= c.Z1; z++) {
+                size_t b = this->bucket(x, z);
+                if (std::find(this->visited.begin(), this->visited.end(), b) != this->visited.end())
+                    continue;
+                this->visited.push_back(b);
+                (this->*f)(this->buckets[b], id);
+            }
+        }
+    }
+
+    void append(Bucket &b, GLuint id)
+    {
+        glm::vec3 min = this->centers[id] - this->halfExtents[id], max = this->centers[id] + this->halfExtents[id];
+        b.MinX.push_back(min.x);
+        b.MinY.push_back(min.y);
+        b.MinZ.push_back(min.z);
+        b.MaxX.push_back(max.x);
+        b.MaxY.push_back(max.y);
+        b.MaxZ.push_back(max.z);
+        b.Ids.push_back(id);
+    }
+
+    void update(Bucket &b, GLuint id)
+    {
+        size_t i = std::find(b.Ids.begin(), b.Ids.end(), id) - b.Ids.begin();
+        glm::vec3 min = this->centers[id] - this->halfExtents[id], max = this->centers[id] + this->halfExtents[id];
+        b.MinX[i] = min.x;
+        b.MinY[i] = min.y;
+        b.MinZ[i] = min.z;
+        b.MaxX[i] = max.x;
+        b.MaxY[i] = max.y;
+        b.MaxZ[i] = max.z;
+    }
+
+    void remove(Bucket &b, GLuint id)
+    {
+        size_t i = std::find(b.Ids.begin(), b.Ids.end(), id) - b.Ids.begin(), last = b.Ids.size() - 1;
+        b.MinX[i] = b.MinX[last];
+        b.MinY[i] = b.MinY[last];
+        b.MinZ[i] = b.MinZ[last];
+        b.MaxX[i] = b.MaxX[last];
+        b.MaxY[i] = b.MaxY[last];
+        b.MaxZ[i] = b.MaxZ[last];
+        b.Ids[i] = b.Ids[last];
+        b.MinX.pop_back();
+        b.MinY.pop_back();
+        b.MinZ.pop_back();
+        b.MaxX.pop_back();
+        b.MaxY.pop_back();
+        b.MaxZ.pop_back();
+        b.Ids.pop_back();
+    }
+
+    void rehash(size_t count)
+    {
+        this->buckets.assign(count, Bucket());
+        this->large = Bucket();
+        for (GLuint id = 0; id < this->centers.size(); id++)
+            this->insert(id);
+    }
+
+    void hit(GLuint id, std::vector<GLuint> &hits)
+    {
+        if (this->stamps[id] != this->query) {
+            this->stamps[id] = this->query;
+            hits.push_back(id);
+        }
+    }
+
+    // Narrowphase: every box of b against the query box
+    void test(const Bucket &b, const glm::vec3 &min, const glm::vec3 &max, std::vector<GLuint> &hits)
+    {
+        size_t n = b.Ids.size(), i = 0;
+#ifdef BOX_GRID_SSE
+        __m128 loX = _mm_set1_ps(min.x), loY = _mm_set1_ps(min.y), loZ = _mm_set1_ps(min.z);
+        __m128 hiX = _mm_set1_ps(max.x), hiY = _mm_set1_ps(max.y), hiZ = _mm_set1_ps(max.z);
+        for (; i + 4 <= n; i += 4) {
+            __m128 x = _mm_and_ps(_mm_cmplt_ps(_mm_loadu_ps(&b.MinX[i]), hiX), _mm_cmpgt_ps(_mm_loadu_ps(&b.MaxX[i]), loX));
+            __m128 y = _mm_and_ps(_mm_cmplt_ps(_mm_loadu_ps(&b.MinY[i]), hiY), _mm_cmpgt_ps(_mm_loadu_ps(&b.MaxY[i]), loY));
+            __m128 z = _mm_and_ps(_mm_cmplt_ps(_mm_loadu_ps(&b.MinZ[i]), hiZ), _mm_cmpgt_ps(_mm_loadu_ps(&b.MaxZ[i]), loZ));
+            int mask = _mm_movemask_ps(_mm_and_ps(x, _mm_and_ps(y, z)));
+            while (mask) {
+                this->hit(b.Ids[i + lowest(mask)], hits);
+                mask &= mask - 1;
+            }
+        }
+#endif
+        for (; i < n; i++)
+            if (b.MinX[i] < max.x && b.MaxX[i] > min.x && b.MinY[i] < max.y && b.MaxY[i] > min.y && b.MinZ[i] < max.z && b.MaxZ[i] > min.z)
+                this->hit(b.Ids[i], hits);
+    }
+
+#ifdef BOX_GRID_SSE
+    // Index of the lowest set bit of a nonzero mask
+    static unsigned lowest(int mask)
+    {
+#ifdef _MSC_VER
+        unsigned long bit;
+        _BitScanForward(&bit, (unsigned long)mask);
+        return (unsigned)bit;
+#else
+        return (unsigned)__builtin_ctz((unsigned)mask);
+#endif
+    }
+#endif
+};
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef CACHE_FILE_H
+#define CACHE_FILE_H
+
+#include <string>
+#include <cstdio>
+
+#include <unistd.h>
+
+// What TextureCache and ShaderCache share about their entries on disk: the
+// hash their entries are named and keyed by, and how an entry is written.
+class CacheFile
+{
+public:
+    // 64-bit FNV-1a over size bytes, continued from h
+    static unsigned long long Hash(const void *data, size_t size, unsigned long long h = 14695981039346656037ULL)
+    {
+        const unsigned char *bytes = (const unsigned char *)data;
+        for (size_t i = 0; i < size; i++) {
+            h ^= bytes[i];
+            h *= 1099511628211ULL;
+        }
+        return h;
+    }
+
+    static unsigned long long Hash(const std::string &s, unsigned long long h = 14695981039346656037ULL)
+    {
+        return Hash(s.data(), s.size(), h);
+    }
+
+    // Writes head then body to a temporary name and renames it over path, so
+    // a crash never leaves half an entry; false if any step failed
+    static bool Write(const std::string &path, const void *head, size_t headSize, const void *body, size_t bodySize)
+    {
+        std::string temp = path + ".tmp";
+        FILE *f = fopen(temp.c_str(), "wb");
+        if (!f)
+            return false;
+        bool ok = fwrite(head, 1, headSize, f) == headSize && fwrite(body, 1, bodySize, f) == bodySize;
+        ok = fclose(f) == 0 && ok;
+        if (ok && rename(temp.c_str(), path.c_str()) == 0)
+            return true;
+        unlink(temp.c_str());
+        return false;
+    }
+};
+
+#endif
@@ -0,0 +1,144 @@
+#ifndef ENTITY_STORE_H
+#define ENTITY_STORE_H
+
+#include <vector>
+#include <thread>
+#include <algorithm>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+// Names an entity for as long as it lives; a destroyed entity's handle stops
+// being Alive() even after its slot is reused
+struct Entity
+{
+    GLuint Slot, Generation;
+};
+
+// Robots and props as parallel arrays, one element per live entity with no
+// gaps, so a system walks each component it needs front to back. Destroying
+// an entity moves the last one into its place; handles go through a slot
+// table that follows those moves, so indices are only good until the next
+// Destroy().
+class EntityStore
+{
+public:
+    enum Mesh { ROBOT, BOX };
+
+    // Transform
+    std::vector<glm::vec3> Position;
+    std::vector<glm::vec3> Previous; // Position when the animation last ran
+    std::vector<GLfloat> Yaw;        // turn about y, in degrees
+    // Bounds
+    std::vector<glm::vec3> Extent;   // half extents
+    // Animation: limbs hang straight at phase 0 and 2 and are fully swung at
+    // 1 and 3; the vertex shader adds Speed per second to Phase
+    std::vector<GLfloat> Phase;
+    std::vector<GLfloat> Speed;
+    // Rendering
+    std::vector<GLuint> Model;       // a Mesh
+    std::vector<GLint> Layer;        // material texture layer
+    std::vector<Entity> Handle;
+
+    Entity Create(Mesh mesh, GLint layer, const glm::vec3 &position, const glm::vec3 &extent)
+    {
+        Entity e;
+        if (this->freeSlots.empty()) {
+            e.Slot = (GLuint)this->slots.size();
+            this->slots.push_back(Slot());
+            this->slots.back().Generation = 0;
+        } else {
+            e.Slot = this->freeSlots.back();
+            this->freeSlots.pop_back();
+        }
+        e.Generation = this->slots[e.Slot].Generation;
+        this->slots[e.Slot].Index = this->Count();
+        this->Position.push_back(position);
+        this->Previous.push_back(position);
+        this->Yaw.push_back(0.0f);
+        this->Extent.push_back(extent);
+        this->Phase.push_back(0.0f);
+        this->Speed.push_back(0.0f);
+        this->Model.push_back(mesh);
+        this->Layer.push_back(layer);
+        this->Handle.push_back(e);
+        return e;
+    }
+
+    void Destroy(Entity e)
+    {
+        if (!this->Alive(e))
+            return;
+        GLuint i = this->slots[e.Slot].Index, last = this->Count() - 1;
+        this->Position[i] = this->Position[last];
+        this->Previous[i] = this->Previous[last];
+        this->Yaw[i] = this->Yaw[last];
+        this->Extent[i] = this->Extent[last];
+        this->Phase[i] = this->Phase[last];
+        this->Speed[i] = this->Speed[last];
+        this->Model[i] = this->Model[last];
+        this->Layer[i] = this->Layer[last];
+        this->Handle[i] = this->Handle[last];
+        this->slots[this->Handle[i].Slot].Index = i;
+        this->Position.pop_back();
+        this->Previous.pop_back();
+        this->Yaw.pop_back();
+        this->Extent.pop_back();
+        this->Phase.pop_back();
+        this->Speed.pop_back();
+        this->Model.pop_back();
+        this->Layer.pop_back();
+        this->Handle.pop_back();
+        this->slots[e.Slot].Generation++;
+        this->freeSlots.push_back(e.Slot);
+    }
+
+    bool Alive(Entity e) const
+    {
+        return e.Slot < this->slots.size() && this->slots[e.Slot].Generation == e.Generation;
+    }
+
+    // Where e's components are now
+    GLuint Index(Entity e) const
+    {
+        return this->slots[e.Slot].Index;
+    }
+
+    GLuint Count() const
+    {
+        return (GLuint)this->Handle.size();
+    }
+
+    // Calls f(begin, end) on slices of [0, count), on as many threads as
+    // there are cores. Below PARALLEL_MIN it stays on this thread, where
+    // starting threads would cost more than the work.
+    template <class F>
+    static void ParallelFor(GLuint count, F f)
+    {
+        GLuint threads = std::thread::hardware_concurrency();
+        if (count < PARALLEL_MIN || threads < 2) {
+            f(0, count);
+            return;
+        }
+        GLuint chunk = (count + threads - 1) / threads;
+        std::vector<std::thread> workers;
+        for (GLuint begin = chunk; begin < count; begin += chunk)
+            workers.push_back(std::thread(f, begin, std::min(count, begin + chunk)));
+        f(0, chunk);
+        for (size_t i = 0; i < workers.size(); i++)
+            workers[i].join();
+    }
+
+private:
+    static const GLuint PARALLEL_MIN = 4096;
+
+    struct Slot
+    {
+        GLuint Index, Generation;
+    };
+
+    std::vector<Slot> slots;
+    std::vector<GLuint> freeSlots;
+};
+
+#endif
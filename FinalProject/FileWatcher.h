@@ -0,0 +1,113 @@
+#ifndef FILE_WATCHER_H
+#define FILE_WATCHER_H
+
+#include <string>
+#include <vector>
+#include <chrono>
+
+#include <unistd.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/inotify.h>
+#endif
+
+// Reports which of a set of files were written since the last Poll(),
+// without ever blocking. On Linux it reads inotify events for the files'
+// directories, because editors often save by renaming a new file over the old
+// one, which an inotify watch on the file itself would lose. Elsewhere it
+// compares modification times a few times a second.
+class FileWatcher
+{
+public:
+    FileWatcher() : fd(-1)
+    {
+#ifdef __linux__
+        this->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#endif
+        this->lastScan = std::chrono::steady_clock::now();
+    }
+
+    ~FileWatcher()
+    {
+        if (this->fd >= 0)
+            close(this->fd);
+    }
+
+    void Watch(const std::string &path)
+    {
+        File file;
+        file.Path = path;
+        size_t slash = path.rfind('/');
+        std::string dir = slash == std::string::npos ? "." : path.substr(0, slash);
+        file.Name = slash == std::string::npos ? path : path.substr(slash + 1);
+        file.Modified = modified(path);
+        file.Watch = -1;
+#ifdef __linux__
+        if (this->fd >= 0)
+            file.Watch = inotify_add_watch(this->fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+#endif
+        this->files.push_back(file);
+    }
+
+    // Paths written since the last call, each listed once
+    std::vector<std::string> Poll()
+    {
+        std::vector<bool> changed(this->files.size(), false);
+#ifdef __linux__
+        if (this->fd >= 0) {
+            char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+            ssize_t length;
+            while ((length = read(this->fd, buffer, sizeof(buffer))) > 0) {
+                for (char *p = buffer; p < buffer + length; p += sizeof(struct inotify_event) + ((struct inotify_event *)p)->len) {
+                    const struct inotify_event *event = (const struct inotify_event *)p;
+                    for (size_t i = 0; i < this->files.size(); i++)
+                        if (event->len > 0 && this->files[i].Watch == event->wd && this->files[i].Name == event->name)
+                            changed[i] = true;
+                }
+            }
+        }
+#endif
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        bool scan = now - this->lastScan > std::chrono::milliseconds(250);
+        if (scan)
+            this->lastScan = now;
+        for (size_t i = 0; i < this->files.size(); i++) {
+            if (this->files[i].Watch >= 0 || !scan)
+                continue;
+            time_t m = modified(this->files[i].Path);
+            if (m != this->files[i].Modified) {
+                this->files[i].Modified = m;
+                changed[i] = true;
+            }
+        }
+        std::vector<std::string> paths;
+        for (size_t i = 0; i < this->files.size(); i++)
+            if (changed[i])
+                paths.push_back(this->files[i].Path);
+        return paths;
+    }
+
+private:
+    struct File
+    {
+        std::string Path, Name;
+        time_t Modified;
+        int Watch; // inotify watch descriptor of the directory, or -1 to poll
+    };
+
+    int fd;
+    std::vector<File> files;
+    std::chrono::steady_clock::time_point lastScan;
+
+    FileWatcher(const FileWatcher &);
+    FileWatcher &operator=(const FileWatcher &);
+
+    static time_t modified(const std::string &path)
+    {
+        struct stat st;
+        return stat(path.c_str(), &st) == 0 ? st.st_mtime : 0;
+    }
+};
+
+#endif
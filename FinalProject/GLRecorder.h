@@ -0,0 +1,923 @@
+#ifndef GL_RECORDER_H
+#define GL_RECORDER_H
+
+#include <map>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+#include <GL/glew.h>
+
+// Records every GL call that changes state into a compact binary stream, a
+// frame at a time, so draw and state-change counts can be checked on
+// machines without a GPU (a software context is enough) and the stream can
+// be replayed later to time it on its own. Queries are not recorded, except
+// glGetUniformLocation, whose result replay has to remap.
+//
+// Recording swaps GLEW's function pointers for wrappers that log the call and
+// forward it. GL 1.1 entry points are plain exports, not GLEW pointers, so
+// this header #defines the ones the game uses to go through Dispatch();
+// include it before any other header that calls GL.
+//
+// Stream: "GLR1", then one record per call, an opcode byte followed by its
+// arguments as 32-bit words; pointer arguments are a byte count and the
+// bytes. The first END_FRAME closes setup, each one after it a frame.
+class GLRecorder
+{
+public:
+    // GL 1.1 entry points the game calls, routed through here
+    struct Core
+    {
+        void (GLAPIENTRY *BindTexture)(GLenum, GLuint);
+        void (GLAPIENTRY *Clear)(GLbitfield);
+        void (GLAPIENTRY *ClearColor)(GLfloat, GLfloat, GLfloat, GLfloat);
+        void (GLAPIENTRY *DeleteTextures)(GLsizei, const GLuint *);
+        void (GLAPIENTRY *DepthFunc)(GLenum);
+        void (GLAPIENTRY *DrawArrays)(GLenum, GLint, GLsizei);
+        void (GLAPIENTRY *DrawBuffer)(GLenum);
+        void (GLAPIENTRY *Enable)(GLenum);
+        void (GLAPIENTRY *GenTextures)(GLsizei, GLuint *);
+        void (GLAPIENTRY *PixelStorei)(GLenum, GLint);
+        void (GLAPIENTRY *ReadBuffer)(GLenum);
+        void (GLAPIENTRY *TexImage2D)(GLenum, GLint, GLint, GLsizei, GLsizei, GLint, GLenum, GLenum, const void *);
+        void (GLAPIENTRY *TexParameterfv)(GLenum, GLenum, const GLfloat *);
+        void (GLAPIENTRY *TexParameteri)(GLenum, GLenum, GLint);
+        void (GLAPIENTRY *Viewport)(GLint, GLint, GLsizei, GLsizei);
+    };
+
+    static Core &Dispatch()
+    {
+        static Core core = { ::glBindTexture, ::glClear, ::glClearColor, ::glDeleteTextures, ::glDepthFunc, ::glDrawArrays, ::glDrawBuffer, ::glEnable,
+                             ::glGenTextures, ::glPixelStorei, ::glReadBuffer, ::glTexImage2D, ::glTexParameterfv, ::glTexParameteri, ::glViewport };
+        return core;
+    }
+
+    // Per-frame totals of a stream
+    struct Summary
+    {
+        GLuint Frames;
+        unsigned long long Calls, Draws, Vertices, StateChanges, Uniforms, BufferBytes, TextureBytes;
+        unsigned long long SetupCalls; // before the first frame
+    };
+
+    // Starts recording to path; call right after glewInit, before anything
+    // is created, so the stream can be replayed from scratch
+    static bool Start(const std::string &path)
+    {
+        Stream &s = stream();
+        s.file = fopen(path.c_str(), "wb");
+        if (!s.file)
+            return false;
+        fwrite("GLR1", 1, 4, s.file);
+        real() = Saved::Current();
+        hook();
+        return true;
+    }
+
+    // Closes setup the first time, then the current frame, and writes it out
+    static void EndFrame()
+    {
+        Stream &s = stream();
+        if (!s.file)
+            return;
+        s.op(END_FRAME);
+        fwrite(&s.buffer[0], 1, s.buffer.size(), s.file);
+        s.buffer.clear();
+    }
+
+    // Puts the real entry points back and closes the file
+    static void Stop()
+    {
+        Stream &s = stream();
+        if (!s.file)
+            return;
+        if (!s.buffer.empty())
+            fwrite(&s.buffer[0], 1, s.buffer.size(), s.file);
+        fclose(s.file);
+        s.file = NULL;
+        s.buffer.clear();
+        real().Restore();
+    }
+
+    static bool Recording()
+    {
+        return stream().file != NULL;
+    }
+
+    // Counts what a stream does without running it; false if it's malformed
+    static bool Summarize(const std::string &path, Summary &summary)
+    {
+        memset(&summary, 0, sizeof(summary));
+        std::vector<unsigned char> data;
+        if (!load(path, data))
+            return false;
+        Reader r(data);
+        while (r.ok && r.more()) {
+            GLubyte op = r.op();
+            if (op == END_FRAME) {
+                summary.Frames++; // one too many until the end
+                continue;
+            }
+            if (summary.Frames == 0)
+                summary.SetupCalls++;
+            else
+                summary.Calls++;
+            bool frame = summary.Frames > 0;
+            switch (op) {
+                case DRAW_ARRAYS: r.u(); r.u(); { GLuint count = r.u(); if (frame) { summary.Draws++; summary.Vertices += count; } } break;
+                case DRAW_ARRAYS_INSTANCED: r.u(); r.u(); { GLuint count = r.u(), instances = r.u(); if (frame) { summary.Draws++; summary.Vertices += (unsigned long long)count * instances; } } break;
+                case USE_PROGRAM: case BIND_VERTEX_ARRAY: case ACTIVE_TEXTURE: case ENABLE: case DEPTH_FUNC: case DRAW_BUFFER: case READ_BUFFER:
+                    r.u(); if (frame) summary.StateChanges++; break;
+                case BIND_FRAMEBUFFER: case BIND_TEXTURE: case BIND_BUFFER:
+                    r.u(); r.u(); if (frame) summary.StateChanges++; break;
+                case VIEWPORT: r.u(); r.u(); r.u(); r.u(); if (frame) summary.StateChanges++; break;
+                case UNIFORM_1I: case UNIFORM_1F: r.u(); r.u(); if (frame) summary.Uniforms++; break;
+                case UNIFORM_3F: r.u(); r.u(); r.u(); r.u(); if (frame) summary.Uniforms++; break;
+                case UNIFORM_3FV: r.u(); r.u(); r.bytes(); if (frame) summary.Uniforms++; break;
+                case UNIFORM_MATRIX_4FV: r.u(); r.u(); r.u(); r.bytes(); if (frame) summary.Uniforms++; break;
+                case BUFFER_DATA: r.u(); { GLuint n = r.u(); r.bytes(); r.u(); if (frame) summary.BufferBytes += n; } break;
+                case TEX_IMAGE_2D: case TEX_IMAGE_3D: case TEX_SUB_IMAGE_3D: case COMPRESSED_TEX_IMAGE_2D: case COMPRESSED_TEX_IMAGE_3D: case COMPRESSED_TEX_SUB_IMAGE_3D:
+                    { GLuint words = imageWords(op); for (GLuint i = 0; i < words; i++) r.u(); GLuint n = 0; r.bytes(&n); if (frame) summary.TextureBytes += n; } break;
+                default:
+                    if (!skip(r, op))
+                        return false;
+            }
+        }
+        if (summary.Frames > 0)
+            summary.Frames--;
+        return r.ok;
+    }
+
+    static void PrintSummary(const Summary &s, std::ostream &out)
+    {
+        double frames = s.Frames ? s.Frames : 1;
+        out << "GL stream: " << s.SetupCalls << " setup calls, " << s.Frames << " frames; per frame " << s.Calls / frames << " calls, "
+            << s.Draws / frames << " draws (" << s.Vertices / frames << " vertices), " << s.StateChanges / frames << " state changes, "
+            << s.Uniforms / frames << " uniform uploads, " << s.BufferBytes / frames << " buffer bytes, " << s.TextureBytes / frames << " texture bytes" << std::endl;
+    }
+
+    // False, with the reasons printed, if the stream at path draws, changes
+    // state or uploads more per frame than the one at baseline
+    static bool Check(const std::string &path, const std::string &baseline, std::ostream &out)
+    {
+        Summary now, before;
+        if (!Summarize(path, now) || !Summarize(baseline, before) || now.Frames == 0 || before.Frames == 0) {
+            out << "Can not read GL streams " << path << " and " << baseline << std::endl;
+            return false;
+        }
+        PrintSummary(now, out);
+        const char *names[] = { "draws", "state changes", "uniform uploads", "buffer bytes", "texture bytes" };
+        unsigned long long a[] = { now.Draws, now.StateChanges, now.Uniforms, now.BufferBytes, now.TextureBytes };
+        unsigned long long b[] = { before.Draws, before.StateChanges, before.Uniforms, before.BufferBytes, before.TextureBytes };
+        bool ok = true;
+        for (int i = 0; i < 5; i++) {
+            double x = (double)a[i] / now.Frames, y = (double)b[i] / before.Frames;
+            if (x > y + 1e-9) {
+                out << "Regression: " << x << " " << names[i] << " per frame, baseline " << y << std::endl;
+                ok = false;
+            }
+        }
+        return ok;
+    }
+
+    // Runs a stream against the current context and prints how long its
+    // frames take to submit, and to finish on the GPU
+    static bool Replay(const std::string &path, std::ostream &out)
+    {
+        std::vector<unsigned char> data;
+        if (!load(path, data))
+            return false;
+        Reader r(data);
+        Names names;
+        GLuint frames = 0;
+        double submit = 0.0, total = 0.0;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        while (r.ok && r.more()) {
+            GLubyte op = r.op();
+            if (op == END_FRAME) {
+                std::chrono::steady_clock::time_point submitted = std::chrono::steady_clock::now();
+                glFinish();
+                std::chrono::steady_clock::time_point finished = std::chrono::steady_clock::now();
+                if (frames++ > 0) { // the first one is setup
+                    submit += std::chrono::duration<double>(submitted - start).count();
+                    total += std::chrono::duration<double>(finished - start).count();
+                }
+                start = std::chrono::steady_clock::now();
+                continue;
+            }
+            if (!replay(r, op, names))
+                return false;
+        }
+        if (!r.ok)
+            return false;
+        frames = frames > 0 ? frames - 1 : 0;
+        double timed = frames > 0 ? frames : 1;
+        out << "Replayed " << frames << " frames: " << submit * 1000.0 / timed << " ms to submit, " << total * 1000.0 / timed << " ms to finish per frame" << std::endl;
+        return true;
+    }
+
+private:
+    enum Op
+    {
+        END_FRAME, USE_PROGRAM, BIND_VERTEX_ARRAY, BIND_FRAMEBUFFER, ACTIVE_TEXTURE, BIND_TEXTURE, BIND_BUFFER, ENABLE, VIEWPORT,
+        CLEAR, CLEAR_COLOR, DRAW_BUFFER, READ_BUFFER, DRAW_ARRAYS, DRAW_ARRAYS_INSTANCED, GET_UNIFORM_LOCATION, UNIFORM_1I, UNIFORM_3F,
+        UNIFORM_3FV, UNIFORM_MATRIX_4FV, GEN_TEXTURES, GEN_BUFFERS, GEN_VERTEX_ARRAYS, GEN_FRAMEBUFFERS, DELETE_TEXTURES,
+        DELETE_BUFFERS, DELETE_VERTEX_ARRAYS, CREATE_PROGRAM, CREATE_SHADER, SHADER_SOURCE, COMPILE_SHADER, ATTACH_SHADER,
+        LINK_PROGRAM, DELETE_SHADER, DELETE_PROGRAM, PROGRAM_PARAMETERI, PROGRAM_BINARY, BUFFER_DATA, VERTEX_ATTRIB_POINTER,
+        ENABLE_VERTEX_ATTRIB_ARRAY, TEX_PARAMETERI, TEX_PARAMETERFV, PIXEL_STOREI, TEX_IMAGE_2D, TEX_IMAGE_3D, TEX_SUB_IMAGE_3D,
+        COMPRESSED_TEX_IMAGE_2D, COMPRESSED_TEX_IMAGE_3D, COMPRESSED_TEX_SUB_IMAGE_3D, FRAMEBUFFER_TEXTURE_2D, VERTEX_ATTRIB_DIVISOR,
+        UNIFORM_1F, TEX_BUFFER, DEPTH_FUNC
+    };
+
+    struct Stream
+    {
+        FILE *file;
+        std::vector<unsigned char> buffer;
+        GLint unpackAlignment;
+
+        Stream() : file(NULL), unpackAlignment(4)
+        {
+        }
+        Stream &op(Op op)
+        {
+            this->buffer.push_back((unsigned char)op);
+            return *this;
+        }
+        Stream &u(GLuint v)
+        {
+            this->buffer.insert(this->buffer.end(), (unsigned char *)&v, (unsigned char *)(&v + 1));
+            return *this;
+        }
+        Stream &f(GLfloat v)
+        {
+            GLuint bits;
+            memcpy(&bits, &v, sizeof(bits));
+            return this->u(bits);
+        }
+        Stream &bytes(const void *data, size_t size)
+        {
+            this->u(data ? (GLuint)size : 0);
+            if (data)
+                this->buffer.insert(this->buffer.end(), (const unsigned char *)data, (const unsigned char *)data + size);
+            return *this;
+        }
+    };
+
+    static Stream &stream()
+    {
+        static Stream s;
+        return s;
+    }
+
+    struct Reader
+    {
+        const unsigned char *p, *end;
+        bool ok;
+
+        Reader(const std::vector<unsigned char> &data) : p(&data[0] + 4), end(&data[0] + data.size()), ok(true)
+        {
+        }
+        bool more() const
+        {
+            return this->p < this->end;
+        }
+        GLubyte op()
+        {
+            return *this->p++;
+        }
+        GLuint u()
+        {
+            GLuint v = 0;
+            if (this->end - this->p < 4)
+                this->ok = false;
+            else
+                memcpy(&v, this->p, 4);
+            this->p += this->ok ? 4 : 0;
+            return v;
+        }
+        GLfloat f()
+        {
+            GLuint bits = this->u();
+            GLfloat v;
+            memcpy(&v, &bits, sizeof(v));
+            return v;
+        }
+        // NULL for a null pointer argument
+        const void *bytes(GLuint *size = NULL)
+        {
+            GLuint n = this->u();
+            if (size)
+                *size = n;
+            if (!this->ok || (size_t)(this->end - this->p) < n) {
+                this->ok = false;
+                return NULL;
+            }
+            const void *data = n ? this->p : NULL;
+            this->p += n;
+            return data;
+        }
+    };
+
+    static bool load(const std::string &path, std::vector<unsigned char> &data)
+    {
+        FILE *f = fopen(path.c_str(), "rb");
+        if (!f)
+            return false;
+        unsigned char chunk[65536];
+        size_t n;
+        while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0)
+            data.insert(data.end(), chunk, chunk + n);
+        fclose(f);
+        return data.size() >= 4 && memcmp(&data[0], "GLR1", 4) == 0;
+    }
+
+    // Bytes glTexImage reads for an uncompressed image
+    static size_t imageSize(GLsizei w, GLsizei h, GLsizei d, GLenum format, GLenum type)
+    {
+        size_t components = format == GL_RGBA || format == GL_BGRA ? 4 : format == GL_RGB || format == GL_BGR ? 3 : format == GL_RG ? 2 : 1;
+        size_t size = type == GL_FLOAT || type == GL_UNSIGNED_INT || type == GL_INT ? 4 : type == GL_UNSIGNED_SHORT || type == GL_SHORT || type == GL_HALF_FLOAT ? 2 : 1;
+        size_t alignment = stream().unpackAlignment, row = w * components * size;
+        row = (row + alignment - 1) / alignment * alignment;
+        return row * h * d;
+    }
+
+    // Words before the pixel bytes of each image record
+    static GLuint imageWords(GLubyte op)
+    {
+        switch (op) {
+            case TEX_IMAGE_2D: return 8;
+            case TEX_IMAGE_3D: return 9;
+            case TEX_SUB_IMAGE_3D: return 10;
+            case COMPRESSED_TEX_IMAGE_2D: return 6;
+            case COMPRESSED_TEX_IMAGE_3D: return 7;
+            default: return 9; // COMPRESSED_TEX_SUB_IMAGE_3D
+        }
+    }
+
+    // The entry points that were there before recording started
+    struct Saved
+    {
+        Core core;
+        PFNGLUSEPROGRAMPROC UseProgram;
+        PFNGLBINDVERTEXARRAYPROC BindVertexArray;
+        PFNGLBINDFRAMEBUFFERPROC BindFramebuffer;
+        PFNGLACTIVETEXTUREPROC ActiveTexture;
+        PFNGLBINDBUFFERPROC BindBuffer;
+        PFNGLDRAWARRAYSINSTANCEDPROC DrawArraysInstanced;
+        PFNGLGETUNIFORMLOCATIONPROC GetUniformLocation;
+        PFNGLUNIFORM1IPROC Uniform1i;
+        PFNGLUNIFORM1FPROC Uniform1f;
+        PFNGLUNIFORM3FPROC Uniform3f;
+        PFNGLUNIFORM3FVPROC Uniform3fv;
+        PFNGLUNIFORMMATRIX4FVPROC UniformMatrix4fv;
+        PFNGLGENBUFFERSPROC GenBuffers;
+        PFNGLGENVERTEXARRAYSPROC GenVertexArrays;
+        PFNGLGENFRAMEBUFFERSPROC GenFramebuffers;
+        PFNGLDELETEBUFFERSPROC DeleteBuffers;
+        PFNGLDELETEVERTEXARRAYSPROC DeleteVertexArrays;
+        PFNGLCREATEPROGRAMPROC CreateProgram;
+        PFNGLCREATESHADERPROC CreateShader;
+        PFNGLSHADERSOURCEPROC ShaderSource;
+        PFNGLCOMPILESHADERPROC CompileShader;
+        PFNGLATTACHSHADERPROC AttachShader;
+        PFNGLLINKPROGRAMPROC LinkProgram;
+        PFNGLDELETESHADERPROC DeleteShader;
+        PFNGLDELETEPROGRAMPROC DeleteProgram;
+        PFNGLPROGRAMPARAMETERIPROC ProgramParameteri;
+        PFNGLPROGRAMBINARYPROC ProgramBinary;
+        PFNGLBUFFERDATAPROC BufferData;
+        PFNGLVERTEXATTRIBPOINTERPROC VertexAttribPointer;
+        PFNGLENABLEVERTEXATTRIBARRAYPROC EnableVertexAttribArray;
+        PFNGLVERTEXATTRIBDIVISORPROC VertexAttribDivisor;
+        PFNGLTEXBUFFERPROC TexBuffer;
+        PFNGLTEXIMAGE3DPROC TexImage3D;
+        PFNGLTEXSUBIMAGE3DPROC TexSubImage3D;
+        PFNGLCOMPRESSEDTEXIMAGE2DPROC CompressedTexImage2D;
+        PFNGLCOMPRESSEDTEXIMAGE3DPROC CompressedTexImage3D;
+        PFNGLCOMPRESSEDTEXSUBIMAGE3DPROC CompressedTexSubImage3D;
+        PFNGLFRAMEBUFFERTEXTURE2DPROC FramebufferTexture2D;
+
+        static Saved Current()
+        {
+            Saved s;
+            s.core = Dispatch();
+            s.UseProgram = __glewUseProgram;
+            s.BindVertexArray = __glewBindVertexArray;
+            s.BindFramebuffer = __glewBindFramebuffer;
+            s.ActiveTexture = __glewActiveTexture;
+            s.BindBuffer = __glewBindBuffer;
+            s.DrawArraysInstanced = __glewDrawArraysInstanced;
+            s.GetUniformLocation = __glewGetUniformLocation;
+            s.Uniform1i = __glewUniform1i;
+            s.Uniform1f = __glewUniform1f;
+            s.Uniform3f = __glewUniform3f;
+            s.Uniform3fv = __glewUniform3fv;
+            s.UniformMatrix4fv = __glewUniformMatrix4fv;
+            s.GenBuffers = __glewGenBuffers;
+            s.GenVertexArrays = __glewGenVertexArrays;
+            s.GenFramebuffers = __glewGenFramebuffers;
+            s.DeleteBuffers = __glewDeleteBuffers;
+            s.DeleteVertexArrays = __glewDeleteVertexArrays;
+            s.CreateProgram = __glewCreateProgram;
+            s.CreateShader = __glewCreateShader;
+            s.ShaderSource = __glewShaderSource;
+            s.CompileShader = __glewCompileShader;
+            s.AttachShader = __glewAttachShader;
+            s.LinkProgram = __glewLinkProgram;
+            s.DeleteShader = __glewDeleteShader;
+            s.DeleteProgram = __glewDeleteProgram;
+            s.ProgramParameteri = __glewProgramParameteri;
+            s.ProgramBinary = __glewProgramBinary;
+            s.BufferData = __glewBufferData;
+            s.VertexAttribPointer = __glewVertexAttribPointer;
+            s.EnableVertexAttribArray = __glewEnableVertexAttribArray;
+            s.VertexAttribDivisor = __glewVertexAttribDivisor;
+            s.TexBuffer = __glewTexBuffer;
+            s.TexImage3D = __glewTexImage3D;
+            s.TexSubImage3D = __glewTexSubImage3D;
+            s.CompressedTexImage2D = __glewCompressedTexImage2D;
+            s.CompressedTexImage3D = __glewCompressedTexImage3D;
+            s.CompressedTexSubImage3D = __glewCompressedTexSubImage3D;
+            s.FramebufferTexture2D = __glewFramebufferTexture2D;
+            return s;
+        }
+
+        void Restore() const
+        {
+            Dispatch() = this->core;
+            __glewUseProgram = this->UseProgram;
+            __glewBindVertexArray = this->BindVertexArray;
+            __glewBindFramebuffer = this->BindFramebuffer;
+            __glewActiveTexture = this->ActiveTexture;
+            __glewBindBuffer = this->BindBuffer;
+            __glewDrawArraysInstanced = this->DrawArraysInstanced;
+            __glewGetUniformLocation = this->GetUniformLocation;
+            __glewUniform1i = this->Uniform1i;
+            __glewUniform1f = this->Uniform1f;
+            __glewUniform3f = this->Uniform3f;
+            __glewUniform3fv = this->Uniform3fv;
+            __glewUniformMatrix4fv = this->UniformMatrix4fv;
+            __glewGenBuffers = this->GenBuffers;
+            __glewGenVertexArrays = this->GenVertexArrays;
+            __glewGenFramebuffers = this->GenFramebuffers;
+            __glewDeleteBuffers = this->DeleteBuffers;
+            __glewDeleteVertexArrays = this->DeleteVertexArrays;
+            __glewCreateProgram = this->CreateProgram;
+            __glewCreateShader = this->CreateShader;
+            __glewShaderSource = this->ShaderSource;
+            __glewCompileShader = this->CompileShader;
+            __glewAttachShader = this->AttachShader;
+            __glewLinkProgram = this->LinkProgram;
+            __glewDeleteShader = this->DeleteShader;
+            __glewDeleteProgram = this->DeleteProgram;
+            __glewProgramParameteri = this->ProgramParameteri;
+            __glewProgramBinary = this->ProgramBinary;
+            __glewBufferData = this->BufferData;
+            __glewVertexAttribPointer = this->VertexAttribPointer;
+            __glewEnableVertexAttribArray = this->EnableVertexAttribArray;
+            __glewVertexAttribDivisor = this->VertexAttribDivisor;
+            __glewTexBuffer = this->TexBuffer;
+            __glewTexImage3D = this->TexImage3D;
+            __glewTexSubImage3D = this->TexSubImage3D;
+            __glewCompressedTexImage2D = this->CompressedTexImage2D;
+            __glewCompressedTexImage3D = this->CompressedTexImage3D;
+            __glewCompressedTexSubImage3D = this->CompressedTexSubImage3D;
+            __glewFramebufferTexture2D = this->FramebufferTexture2D;
+        }
+    };
+
+    // What the wrappers forward to
+    static Saved &real()
+    {
+        static Saved s;
+        return s;
+    }
+
+    // The wrappers: log, then forward
+    static void GLAPIENTRY BindTexture(GLenum target, GLuint texture) { stream().op(BIND_TEXTURE).u(target).u(texture); real().core.BindTexture(target, texture); }
+    static void GLAPIENTRY Clear(GLbitfield mask) { stream().op(CLEAR).u(mask); real().core.Clear(mask); }
+    static void GLAPIENTRY ClearColor(GLfloat r, GLfloat g, GLfloat b, GLfloat a) { stream().op(CLEAR_COLOR).f(r).f(g).f(b).f(a); real().core.ClearColor(r, g, b, a); }
+    static void GLAPIENTRY DeleteTextures(GLsizei n, const GLuint *names) { stream().op(DELETE_TEXTURES).bytes(names, n * sizeof(GLuint)); real().core.DeleteTextures(n, names); }
+    static void GLAPIENTRY DepthFunc(GLenum func) { stream().op(DEPTH_FUNC).u(func); real().core.DepthFunc(func); }
+    static void GLAPIENTRY DrawArrays(GLenum mode, GLint first, GLsizei count) { stream().op(DRAW_ARRAYS).u(mode).u(first).u(count); real().core.DrawArrays(mode, first, count); }
+    static void GLAPIENTRY DrawBuffer(GLenum mode) { stream().op(DRAW_BUFFER).u(mode); real().core.DrawBuffer(mode); }
+    static void GLAPIENTRY Enable(GLenum cap) { stream().op(ENABLE).u(cap); real().core.Enable(cap); }
+    static void GLAPIENTRY GenTextures(GLsizei n, GLuint *names) { real().core.GenTextures(n, names); stream().op(GEN_TEXTURES).bytes(names, n * sizeof(GLuint)); }
+    static void GLAPIENTRY PixelStorei(GLenum pname, GLint param)
+    {
+        if (pname == GL_UNPACK_ALIGNMENT)
+            stream().unpackAlignment = param;
+        stream().op(PIXEL_STOREI).u(pname).u(param);
+        real().core.PixelStorei(pname, param);
+    }
+    static void GLAPIENTRY ReadBuffer(GLenum mode) { stream().op(READ_BUFFER).u(mode); real().core.ReadBuffer(mode); }
+    static void GLAPIENTRY TexImage2D(GLenum target, GLint level, GLint internalFormat, GLsizei w, GLsizei h, GLint border, GLenum format, GLenum type, const void *pixels)
+    {
+        stream().op(TEX_IMAGE_2D).u(target).u(level).u(internalFormat).u(w).u(h).u(border).u(format).u(type).bytes(pixels, imageSize(w, h, 1, format, type));
+        real().core.TexImage2D(target, level, internalFormat, w, h, border, format, type, pixels);
+    }
+    static void GLAPIENTRY TexParameterfv(GLenum target, GLenum pname, const GLfloat *params)
+    {
+        stream().op(TEX_PARAMETERFV).u(target).u(pname).bytes(params, (pname == GL_TEXTURE_BORDER_COLOR ? 4 : 1) * sizeof(GLfloat));
+        real().core.TexParameterfv(target, pname, params);
+    }
+    static void GLAPIENTRY TexParameteri(GLenum target, GLenum pname, GLint param) { stream().op(TEX_PARAMETERI).u(target).u(pname).u(param); real().core.TexParameteri(target, pname, param); }
+    static void GLAPIENTRY Viewport(GLint x, GLint y, GLsizei w, GLsizei h) { stream().op(VIEWPORT).u(x).u(y).u(w).u(h); real().core.Viewport(x, y, w, h); }
+
+    static void GLAPIENTRY UseProgram(GLuint program) { stream().op(USE_PROGRAM).u(program); real().UseProgram(program); }
+    static void GLAPIENTRY BindVertexArray(GLuint array) { stream().op(BIND_VERTEX_ARRAY).u(array); real().BindVertexArray(array); }
+    static void GLAPIENTRY BindFramebuffer(GLenum target, GLuint framebuffer) { stream().op(BIND_FRAMEBUFFER).u(target).u(framebuffer); real().BindFramebuffer(target, framebuffer); }
+    static void GLAPIENTRY ActiveTexture(GLenum unit) { stream().op(ACTIVE_TEXTURE).u(unit); real().ActiveTexture(unit); }
+    static void GLAPIENTRY BindBuffer(GLenum target, GLuint buffer) { stream().op(BIND_BUFFER).u(target).u(buffer); real().BindBuffer(target, buffer); }
+    static void GLAPIENTRY DrawArraysInstanced(GLenum mode, GLint first, GLsizei count, GLsizei instances)
+    {
+        stream().op(DRAW_ARRAYS_INSTANCED).u(mode).u(first).u(count).u(instances);
+        real().DrawArraysInstanced(mode, first, count, instances);
+    }
+    static GLint GLAPIENTRY GetUniformLocation(GLuint program, const GLchar *name)
+    {
+        GLint location = real().GetUniformLocation(program, name);
+        stream().op(GET_UNIFORM_LOCATION).u(program).u(location).bytes(name, strlen(name));
+        return location;
+    }
+    static void GLAPIENTRY Uniform1i(GLint location, GLint v) { stream().op(UNIFORM_1I).u(location).u(v); real().Uniform1i(location, v); }
+    static void GLAPIENTRY Uniform1f(GLint location, GLfloat v) { stream().op(UNIFORM_1F).u(location).f(v); real().Uniform1f(location, v); }
+    static void GLAPIENTRY Uniform3f(GLint location, GLfloat x, GLfloat y, GLfloat z) { stream().op(UNIFORM_3F).u(location).f(x).f(y).f(z); real().Uniform3f(location, x, y, z); }
+    static void GLAPIENTRY Uniform3fv(GLint location, GLsizei count, const GLfloat *v)
+    {
+        stream().op(UNIFORM_3FV).u(location).u(count).bytes(v, count * 3 * sizeof(GLfloat));
+        real().Uniform3fv(location, count, v);
+    }
+    static void GLAPIENTRY UniformMatrix4fv(GLint location, GLsizei count, GLboolean transpose, const GLfloat *v)
+    {
+        stream().op(UNIFORM_MATRIX_4FV).u(location).u(count).u(transpose).bytes(v, count * 16 * sizeof(GLfloat));
+        real().UniformMatrix4fv(location, count, transpose, v);
+    }
+    static void GLAPIENTRY GenBuffers(GLsizei n, GLuint *names) { real().GenBuffers(n, names); stream().op(GEN_BUFFERS).bytes(names, n * sizeof(GLuint)); }
+    static void GLAPIENTRY GenVertexArrays(GLsizei n, GLuint *names) { real().GenVertexArrays(n, names); stream().op(GEN_VERTEX_ARRAYS).bytes(names, n * sizeof(GLuint)); }
+    static void GLAPIENTRY GenFramebuffers(GLsizei n, GLuint *names) { real().GenFramebuffers(n, names); stream().op(GEN_FRAMEBUFFERS).bytes(names, n * sizeof(GLuint)); }
+    static void GLAPIENTRY DeleteBuffers(GLsizei n, const GLuint *names) { stream().op(DELETE_BUFFERS).bytes(names, n * sizeof(GLuint)); real().DeleteBuffers(n, names); }
+    static void GLAPIENTRY DeleteVertexArrays(GLsizei n, const GLuint *names) { stream().op(DELETE_VERTEX_ARRAYS).bytes(names, n * sizeof(GLuint)); real().DeleteVertexArrays(n, names); }
+    static GLuint GLAPIENTRY CreateProgram() { GLuint program = real().CreateProgram(); stream().op(CREATE_PROGRAM).u(program); return program; }
+    static GLuint GLAPIENTRY CreateShader(GLenum type) { GLuint shader = real().CreateShader(type); stream().op(CREATE_SHADER).u(type).u(shader); return shader; }
+    static void GLAPIENTRY ShaderSource(GLuint shader, GLsizei count, const GLchar *const *strings, const GLint *lengths)
+    {
+        stream().op(SHADER_SOURCE).u(shader).u(count);
+        for (GLsizei i = 0; i < count; i++)
+            stream().bytes(strings[i], lengths && lengths[i] >= 0 ? lengths[i] : strlen(strings[i]));
+        real().ShaderSource(shader, count, strings, lengths);
+    }
+    static void GLAPIENTRY CompileShader(GLuint shader) { stream().op(COMPILE_SHADER).u(shader); real().CompileShader(shader); }
+    static void GLAPIENTRY AttachShader(GLuint program, GLuint shader) { stream().op(ATTACH_SHADER).u(program).u(shader); real().AttachShader(program, shader); }
+    static void GLAPIENTRY LinkProgram(GLuint program) { stream().op(LINK_PROGRAM).u(program); real().LinkProgram(program); }
+    static void GLAPIENTRY DeleteShader(GLuint shader) { stream().op(DELETE_SHADER).u(shader); real().DeleteShader(shader); }
+    static void GLAPIENTRY DeleteProgram(GLuint program) { stream().op(DELETE_PROGRAM).u(program); real().DeleteProgram(program); }
+    static void GLAPIENTRY ProgramParameteri(GLuint program, GLenum pname, GLint value) { stream().op(PROGRAM_PARAMETERI).u(program).u(pname).u(value); real().ProgramParameteri(program, pname, value); }
+    static void GLAPIENTRY ProgramBinary(GLuint program, GLenum format, const void *binary, GLsizei length)
+    {
+        stream().op(PROGRAM_BINARY).u(program).u(format).bytes(binary, length);
+        real().ProgramBinary(program, format, binary, length);
+    }
+    static void GLAPIENTRY BufferData(GLenum target, GLsizeiptr size, const void *data, GLenum usage)
+    {
+        stream().op(BUFFER_DATA).u(target).u((GLuint)size).bytes(data, size).u(usage);
+        real().BufferData(target, size, data, usage);
+    }
+    static void GLAPIENTRY VertexAttribPointer(GLuint index, GLint size, GLenum type, GLboolean normalized, GLsizei stride, const void *offset)
+    {
+        stream().op(VERTEX_ATTRIB_POINTER).u(index).u(size).u(type).u(normalized).u(stride).u((GLuint)(size_t)offset);
+        real().VertexAttribPointer(index, size, type, normalized, stride, offset);
+    }
+    static void GLAPIENTRY EnableVertexAttribArray(GLuint index) { stream().op(ENABLE_VERTEX_ATTRIB_ARRAY).u(index); real().EnableVertexAttribArray(index); }
+    static void GLAPIENTRY VertexAttribDivisor(GLuint index, GLuint divisor) { stream().op(VERTEX_ATTRIB_DIVISOR).u(index).u(divisor); real().VertexAttribDivisor(index, divisor); }
+    static void GLAPIENTRY TexBuffer(GLenum target, GLenum internalFormat, GLuint buffer) { stream().op(TEX_BUFFER).u(target).u(internalFormat).u(buffer); real().TexBuffer(target, internalFormat, buffer); }
+    static void GLAPIENTRY TexImage3D(GLenum target, GLint level, GLint internalFormat, GLsizei w, GLsizei h, GLsizei d, GLint border, GLenum format, GLenum type, const void *pixels)
+    {
+        stream().op(TEX_IMAGE_3D).u(target).u(level).u(internalFormat).u(w).u(h).u(d).u(border).u(format).u(type).bytes(pixels, imageSize(w, h, d, format, type));
+        real().TexImage3D(target, level, internalFormat, w, h, d, border, format, type, pixels);
+    }
+    static void GLAPIENTRY TexSubImage3D(GLenum target, GLint level, GLint x, GLint y, GLint z, GLsizei w, GLsizei h, GLsizei d, GLenum format, GLenum type, const void *pixels)
+    {
+        stream().op(TEX_SUB_IMAGE_3D).u(target).u(level).u(x).u(y).u(z).u(w).u(h).u(d).u(format).u(type).bytes(pixels, imageSize(w, h, d, format, type));
+        real().TexSubImage3D(target, level, x, y, z, w, h, d, format, type, pixels);
+    }
+    static void GLAPIENTRY CompressedTexImage2D(GLenum target, GLint level, GLenum internalFormat, GLsizei w, GLsizei h, GLint border, GLsizei size, const void *data)
+    {
+        stream().op(COMPRESSED_TEX_IMAGE_2D).u(target).u(level).u(internalFormat).u(w).u(h).u(border).bytes(data, size);
+        real().CompressedTexImage2D(target, level, internalFormat, w, h, border, size, data);
+    }
+    static void GLAPIENTRY CompressedTexImage3D(GLenum target, GLint level, GLenum internalFormat, GLsizei w, GLsizei h, GLsizei d, GLint border, GLsizei size, const void *data)
+    {
+        stream().op(COMPRESSED_TEX_IMAGE_3D).u(target).u(level).u(internalFormat).u(w).u(h).u(d).u(border).bytes(data, size);
+        real().CompressedTexImage3D(target, level, internalFormat, w, h, d, border, size, data);
+    }
+    static void GLAPIENTRY CompressedTexSubImage3D(GLenum target, GLint level, GLint x, GLint y, GLint z, GLsizei w, GLsizei h, GLsizei d, GLenum format, GLsizei size, const void *data)
+    {
+        stream().op(COMPRESSED_TEX_SUB_IMAGE_3D).u(target).u(level).u(x).u(y).u(z).u(w).u(h).u(d).u(format).bytes(data, size);
+        real().CompressedTexSubImage3D(target, level, x, y, z, w, h, d, format, size, data);
+    }
+    static void GLAPIENTRY FramebufferTexture2D(GLenum target, GLenum attachment, GLenum textarget, GLuint texture, GLint level)
+    {
+        stream().op(FRAMEBUFFER_TEXTURE_2D).u(target).u(attachment).u(textarget).u(texture).u(level);
+        real().FramebufferTexture2D(target, attachment, textarget, texture, level);
+    }
+
+    static void hook()
+    {
+        Core &core = Dispatch();
+        core.BindTexture = BindTexture;
+        core.Clear = Clear;
+        core.ClearColor = ClearColor;
+        core.DeleteTextures = DeleteTextures;
+        core.DepthFunc = DepthFunc;
+        core.DrawArrays = DrawArrays;
+        core.DrawBuffer = DrawBuffer;
+        core.Enable = Enable;
+        core.GenTextures = GenTextures;
+        core.PixelStorei = PixelStorei;
+        core.ReadBuffer = ReadBuffer;
+        core.TexImage2D = TexImage2D;
+        core.TexParameterfv = TexParameterfv;
+        core.TexParameteri = TexParameteri;
+        core.Viewport = Viewport;
+        __glewUseProgram = UseProgram;
+        __glewBindVertexArray = BindVertexArray;
+        __glewBindFramebuffer = BindFramebuffer;
+        __glewActiveTexture = ActiveTexture;
+        __glewBindBuffer = BindBuffer;
+        __glewDrawArraysInstanced = DrawArraysInstanced;
+        __glewGetUniformLocation = GetUniformLocation;
+        __glewUniform1i = Uniform1i;
+        __glewUniform1f = Uniform1f;
+        __glewUniform3f = Uniform3f;
+        __glewUniform3fv = Uniform3fv;
+        __glewUniformMatrix4fv = UniformMatrix4fv;
+        __glewGenBuffers = GenBuffers;
+        __glewGenVertexArrays = GenVertexArrays;
+        __glewGenFramebuffers = GenFramebuffers;
+        __glewDeleteBuffers = DeleteBuffers;
+        __glewDeleteVertexArrays = DeleteVertexArrays;
+        __glewCreateProgram = CreateProgram;
+        __glewCreateShader = CreateShader;
+        __glewShaderSource = ShaderSource;
+        __glewCompileShader = CompileShader;
+        __glewAttachShader = AttachShader;
+        __glewLinkProgram = LinkProgram;
+        __glewDeleteShader = DeleteShader;
+        __glewDeleteProgram = DeleteProgram;
+        __glewProgramParameteri = ProgramParameteri;
+        __glewProgramBinary = ProgramBinary;
+        __glewBufferData = BufferData;
+        __glewVertexAttribPointer = VertexAttribPointer;
+        __glewEnableVertexAttribArray = EnableVertexAttribArray;
+        __glewVertexAttribDivisor = VertexAttribDivisor;
+        __glewTexBuffer = TexBuffer;
+        __glewTexImage3D = TexImage3D;
+        __glewTexSubImage3D = TexSubImage3D;
+        __glewCompressedTexImage2D = CompressedTexImage2D;
+        __glewCompressedTexImage3D = CompressedTexImage3D;
+        __glewCompressedTexSubImage3D = CompressedTexSubImage3D;
+        __glewFramebufferTexture2D = FramebufferTexture2D;
+    }
+
+    // Recorded object names and uniform locations, and what they are now
+    struct Names
+    {
+        std::map<GLuint, GLuint> textures, buffers, arrays, framebuffers, programs; // programs holds shaders too
+        std::map<std::pair<GLuint, GLint>, GLint> locations; // (recorded program, recorded location)
+        GLuint program; // recorded name of the program in use
+
+        Names() : program(0)
+        {
+        }
+        static GLuint map(std::map<GLuint, GLuint> &names, GLuint name)
+        {
+            std::map<GLuint, GLuint>::iterator it = names.find(name);
+            return it == names.end() ? name : it->second;
+        }
+        GLint location(GLint recorded)
+        {
+            std::map<std::pair<GLuint, GLint>, GLint>::iterator it = this->locations.find(std::make_pair(this->program, recorded));
+            return it == this->locations.end() ? -1 : it->second;
+        }
+    };
+
+    // Generated names come in as the recorded list; makes as many fresh ones
+    static void generate(Reader &r, std::map<GLuint, GLuint> &names, void (GLAPIENTRY *gen)(GLsizei, GLuint *))
+    {
+        GLuint size;
+        const GLuint *recorded = (const GLuint *)r.bytes(&size);
+        GLsizei n = size / sizeof(GLuint);
+        std::vector<GLuint> fresh(n);
+        if (n > 0)
+            gen(n, &fresh[0]);
+        for (GLsizei i = 0; i < n; i++) {
+            GLuint name;
+            memcpy(&name, recorded + i, sizeof(name));
+            names[name] = fresh[i];
+        }
+    }
+
+    static std::vector<GLuint> mapped(Reader &r, std::map<GLuint, GLuint> &names)
+    {
+        GLuint size;
+        const unsigned char *recorded = (const unsigned char *)r.bytes(&size);
+        std::vector<GLuint> list(size / sizeof(GLuint));
+        for (size_t i = 0; i < list.size(); i++) {
+            memcpy(&list[i], recorded + i * sizeof(GLuint), sizeof(GLuint));
+            list[i] = Names::map(names, list[i]);
+        }
+        return list;
+    }
+
+    // Copies a float payload out, since the stream has no alignment
+    static std::vector<GLfloat> floats(Reader &r)
+    {
+        GLuint size;
+        const void *data = r.bytes(&size);
+        std::vector<GLfloat> v(size / sizeof(GLfloat) + 1);
+        if (data)
+            memcpy(&v[0], data, size);
+        return v;
+    }
+
+    static bool replay(Reader &r, GLubyte op, Names &n)
+    {
+        switch (op) {
+            case USE_PROGRAM: n.program = r.u(); glUseProgram(Names::map(n.programs, n.program)); break;
+            case BIND_VERTEX_ARRAY: glBindVertexArray(Names::map(n.arrays, r.u())); break;
+            case BIND_FRAMEBUFFER: { GLenum target = r.u(); glBindFramebuffer(target, Names::map(n.framebuffers, r.u())); } break;
+            case ACTIVE_TEXTURE: glActiveTexture(r.u()); break;
+            case BIND_TEXTURE: { GLenum target = r.u(); glBindTexture(target, Names::map(n.textures, r.u())); } break;
+            case BIND_BUFFER: { GLenum target = r.u(); glBindBuffer(target, Names::map(n.buffers, r.u())); } break;
+            case ENABLE: glEnable(r.u()); break;
+            case DEPTH_FUNC: glDepthFunc(r.u()); break;
+            case VIEWPORT: { GLint x = r.u(), y = r.u(), w = r.u(), h = r.u(); glViewport(x, y, w, h); } break;
+            case CLEAR: glClear(r.u()); break;
+            case CLEAR_COLOR: { GLfloat c[4]; for (int i = 0; i < 4; i++) c[i] = r.f(); glClearColor(c[0], c[1], c[2], c[3]); } break;
+            case DRAW_BUFFER: glDrawBuffer(r.u()); break;
+            case READ_BUFFER: glReadBuffer(r.u()); break;
+            case DRAW_ARRAYS: { GLenum mode = r.u(); GLint first = r.u(); GLsizei count = r.u(); glDrawArrays(mode, first, count); } break;
+            case DRAW_ARRAYS_INSTANCED: { GLenum mode = r.u(); GLint first = r.u(); GLsizei count = r.u(), instances = r.u(); glDrawArraysInstanced(mode, first, count, instances); } break;
+            case GET_UNIFORM_LOCATION:
+                {
+                    GLuint program = r.u();
+                    GLint recorded = r.u();
+                    GLuint size;
+                    const char *name = (const char *)r.bytes(&size);
+                    std::string s(name ? name : "", size);
+                    n.locations[std::make_pair(program, recorded)] = glGetUniformLocation(Names::map(n.programs, program), s.c_str());
+                }
+                break;
+            case UNIFORM_1I: { GLint loc = n.location(r.u()); glUniform1i(loc, r.u()); } break;
+            case UNIFORM_1F: { GLint loc = n.location(r.u()); glUniform1f(loc, r.f()); } break;
+            case UNIFORM_3F: { GLint loc = n.location(r.u()); GLfloat x = r.f(), y = r.f(), z = r.f(); glUniform3f(loc, x, y, z); } break;
+            case UNIFORM_3FV: { GLint loc = n.location(r.u()); GLsizei count = r.u(); std::vector<GLfloat> v = floats(r); glUniform3fv(loc, count, &v[0]); } break;
+            case UNIFORM_MATRIX_4FV: { GLint loc = n.location(r.u()); GLsizei count = r.u(); GLboolean t = (GLboolean)r.u(); std::vector<GLfloat> v = floats(r); glUniformMatrix4fv(loc, count, t, &v[0]); } break;
+            case GEN_TEXTURES: generate(r, n.textures, Dispatch().GenTextures); break;
+            case GEN_BUFFERS: generate(r, n.buffers, __glewGenBuffers); break;
+            case GEN_VERTEX_ARRAYS: generate(r, n.arrays, __glewGenVertexArrays); break;
+            case GEN_FRAMEBUFFERS: generate(r, n.framebuffers, __glewGenFramebuffers); break;
+            case DELETE_TEXTURES: { std::vector<GLuint> v = mapped(r, n.textures); if (!v.empty()) glDeleteTextures((GLsizei)v.size(), &v[0]); } break;
+            case DELETE_BUFFERS: { std::vector<GLuint> v = mapped(r, n.buffers); if (!v.empty()) glDeleteBuffers((GLsizei)v.size(), &v[0]); } break;
+            case DELETE_VERTEX_ARRAYS: { std::vector<GLuint> v = mapped(r, n.arrays); if (!v.empty()) glDeleteVertexArrays((GLsizei)v.size(), &v[0]); } break;
+            case CREATE_PROGRAM: n.programs[r.u()] = glCreateProgram(); break;
+            case CREATE_SHADER: { GLenum type = r.u(); n.programs[r.u()] = glCreateShader(type); } break;
+            case SHADER_SOURCE:
+                {
+                    GLuint shader = Names::map(n.programs, r.u());
+                    GLsizei count = r.u();
+                    std::vector<std::string> strings(count);
+                    std::vector<const GLchar *> pointers(count);
+                    for (GLsizei i = 0; i < count && r.ok; i++) {
+                        GLuint size;
+                        const char *s = (const char *)r.bytes(&size);
+                        strings[i].assign(s ? s : "", size);
+                        pointers[i] = strings[i].c_str();
+                    }
+                    if (count > 0 && r.ok)
+                        glShaderSource(shader, count, &pointers[0], NULL);
+                }
+                break;
+            case COMPILE_SHADER: glCompileShader(Names::map(n.programs, r.u())); break;
+            case ATTACH_SHADER: { GLuint program = Names::map(n.programs, r.u()); glAttachShader(program, Names::map(n.programs, r.u())); } break;
+            case LINK_PROGRAM: glLinkProgram(Names::map(n.programs, r.u())); break;
+            case DELETE_SHADER: glDeleteShader(Names::map(n.programs, r.u())); break;
+            case DELETE_PROGRAM: glDeleteProgram(Names::map(n.programs, r.u())); break;
+            case PROGRAM_PARAMETERI: { GLuint program = Names::map(n.programs, r.u()); GLenum pname = r.u(); glProgramParameteri(program, pname, r.u()); } break;
+            case PROGRAM_BINARY: { GLuint program = Names::map(n.programs, r.u()); GLenum format = r.u(); GLuint size; const void *data = r.bytes(&size); glProgramBinary(program, format, data, size); } break;
+            case BUFFER_DATA: { GLenum target = r.u(); GLuint size = r.u(); const void *data = r.bytes(); glBufferData(target, size, data, r.u()); } break;
+            case VERTEX_ATTRIB_POINTER:
+                {
+                    GLuint index = r.u();
+                    GLint size = r.u();
+                    GLenum type = r.u();
+                    GLboolean normalized = (GLboolean)r.u();
+                    GLsizei stride = r.u();
+                    glVertexAttribPointer(index, size, type, normalized, stride, (const GLvoid *)(size_t)r.u());
+                }
+                break;
+            case ENABLE_VERTEX_ATTRIB_ARRAY: glEnableVertexAttribArray(r.u()); break;
+            case VERTEX_ATTRIB_DIVISOR: { GLuint index = r.u(); glVertexAttribDivisor(index, r.u()); } break;
+            case TEX_BUFFER: { GLenum target = r.u(), internalFormat = r.u(); glTexBuffer(target, internalFormat, Names::map(n.buffers, r.u())); } break;
+            case TEX_PARAMETERI: { GLenum target = r.u(), pname = r.u(); glTexParameteri(target, pname, r.u()); } break;
+            case TEX_PARAMETERFV: { GLenum target = r.u(), pname = r.u(); std::vector<GLfloat> v = floats(r); glTexParameterfv(target, pname, &v[0]); } break;
+            case PIXEL_STOREI: { GLenum pname = r.u(); glPixelStorei(pname, r.u()); } break;
+            default:
+                return replayImage(r, op, n);
+        }
+        return r.ok;
+    }
+
+    static bool replayImage(Reader &r, GLubyte op, Names &n)
+    {
+        GLuint w[10];
+        GLuint words = imageWords(op);
+        if (op < TEX_IMAGE_2D || op > FRAMEBUFFER_TEXTURE_2D)
+            return false;
+        if (op == FRAMEBUFFER_TEXTURE_2D) {
+            GLenum target = r.u(), attachment = r.u(), textarget = r.u();
+            GLuint texture = Names::map(n.textures, r.u());
+            glFramebufferTexture2D(target, attachment, textarget, texture, r.u());
+            return r.ok;
+        }
+        for (GLuint i = 0; i < words; i++)
+            w[i] = r.u();
+        GLuint size;
+        const void *data = r.bytes(&size);
+        if (!r.ok)
+            return false;
+        switch (op) {
+            case TEX_IMAGE_2D: glTexImage2D(w[0], w[1], w[2], w[3], w[4], w[5], w[6], w[7], data); break;
+            case TEX_IMAGE_3D: glTexImage3D(w[0], w[1], w[2], w[3], w[4], w[5], w[6], w[7], w[8], data); break;
+            case TEX_SUB_IMAGE_3D: glTexSubImage3D(w[0], w[1], w[2], w[3], w[4], w[5], w[6], w[7], w[8], w[9], data); break;
+            case COMPRESSED_TEX_IMAGE_2D: glCompressedTexImage2D(w[0], w[1], w[2], w[3], w[4], w[5], size, data); break;
+            case COMPRESSED_TEX_IMAGE_3D: glCompressedTexImage3D(w[0], w[1], w[2], w[3], w[4], w[5], w[6], size, data); break;
+            case COMPRESSED_TEX_SUB_IMAGE_3D: glCompressedTexSubImage3D(w[0], w[1], w[2], w[3], w[4], w[5], w[6], w[7], w[8], size, data); break;
+        }
+        return true;
+    }
+
+    // Steps over a record Summarize() doesn't count
+    static bool skip(Reader &r, GLubyte op)
+    {
+        int words;
+        bool payload = false;
+        switch (op) {
+            case GEN_TEXTURES: case GEN_BUFFERS: case GEN_VERTEX_ARRAYS: case GEN_FRAMEBUFFERS:
+            case DELETE_TEXTURES: case DELETE_BUFFERS: case DELETE_VERTEX_ARRAYS:
+                words = 0; payload = true; break;
+            case CLEAR: case CREATE_PROGRAM: case COMPILE_SHADER: case LINK_PROGRAM: case DELETE_SHADER: case DELETE_PROGRAM: case ENABLE_VERTEX_ATTRIB_ARRAY:
+                words = 1; break;
+            case CREATE_SHADER: case ATTACH_SHADER: case PIXEL_STOREI: case VERTEX_ATTRIB_DIVISOR:
+                words = 2; break;
+            case GET_UNIFORM_LOCATION: case PROGRAM_BINARY: case TEX_PARAMETERFV:
+                words = 2; payload = true; break;
+            case PROGRAM_PARAMETERI: case TEX_PARAMETERI: case TEX_BUFFER:
+                words = 3; break;
+            case CLEAR_COLOR:
+                words = 4; break;
+            case FRAMEBUFFER_TEXTURE_2D:
+                words = 5; break;
+            case VERTEX_ATTRIB_POINTER:
+                words = 6; break;
+            case SHADER_SOURCE:
+                {
+                    r.u();
+                    GLuint count = r.u();
+                    for (GLuint i = 0; i < count && r.ok; i++)
+                        r.bytes();
+                    return r.ok;
+                }
+            default:
+                return false;
+        }
+        for (int i = 0; i < words; i++)
+            r.u();
+        if (payload)
+            r.bytes();
+        return r.ok;
+    }
+};
+
+// GL 1.1 calls go through the table so recording can swap them too
+#define glBindTexture GLRecorder::Dispatch().BindTexture
+#define glClear GLRecorder::Dispatch().Clear
+#define glClearColor GLRecorder::Dispatch().ClearColor
+#define glDeleteTextures GLRecorder::Dispatch().DeleteTextures
+#define glDepthFunc GLRecorder::Dispatch().DepthFunc
+#define glDrawArrays GLRecorder::Dispatch().DrawArrays
+#define glDrawBuffer GLRecorder::Dispatch().DrawBuffer
+#define glEnable GLRecorder::Dispatch().Enable
+#define glGenTextures GLRecorder::Dispatch().GenTextures
+#define glPixelStorei GLRecorder::Dispatch().PixelStorei
+#define glReadBuffer GLRecorder::Dispatch().ReadBuffer
+#define glTexImage2D GLRecorder::Dispatch().TexImage2D
+#define glTexParameterfv GLRecorder::Dispatch().TexParameterfv
+#define glTexParameteri GLRecorder::Dispatch().TexParameteri
+#define glViewport GLRecorder::Dispatch().Viewport
+
+#endif
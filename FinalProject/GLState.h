@@ -0,0 +1,149 @@
+#ifndef GL_STATE_H
+#define GL_STATE_H
+
+#include <cstring>
+#include <iostream>
+
+#include <GL/glew.h>
+
+// Shadows the binding state the frame loop touches and drops calls that
+// would set what is already set. Every call is counted as issued or elided,
+// per frame, as a baseline for driver overhead. Anything that binds through
+// GL directly must be followed by Invalidate(), which makes the next call of
+// each kind go through.
+class GLState
+{
+public:
+    enum Call { USE_PROGRAM, BIND_VERTEX_ARRAY, BIND_FRAMEBUFFER, ACTIVE_TEXTURE, BIND_TEXTURE, CALLS };
+
+    struct Counters
+    {
+        GLuint Issued[CALLS], Elided[CALLS];
+    };
+
+    GLState()
+    {
+        memset(&this->frame, 0, sizeof(this->frame));
+        memset(&this->last, 0, sizeof(this->last));
+        this->Invalidate();
+    }
+
+    // Forgets what is bound, after GL was called behind our back
+    void Invalidate()
+    {
+        this->program = this->vertexArray = this->drawFramebuffer = this->readFramebuffer = UNKNOWN;
+        this->unit = UNKNOWN;
+        for (GLuint i = 0; i < UNITS; i++)
+            for (int j = 0; j < TARGETS; j++)
+                this->textures[i][j] = UNKNOWN;
+    }
+
+    void UseProgram(GLuint program)
+    {
+        if (this->elide(USE_PROGRAM, this->program == program))
+            return;
+        this->program = program;
+        glUseProgram(program);
+    }
+
+    void BindVertexArray(GLuint vertexArray)
+    {
+        if (this->elide(BIND_VERTEX_ARRAY, this->vertexArray == vertexArray))
+            return;
+        this->vertexArray = vertexArray;
+        glBindVertexArray(vertexArray);
+    }
+
+    // target is GL_FRAMEBUFFER, GL_DRAW_FRAMEBUFFER or GL_READ_FRAMEBUFFER
+    void BindFramebuffer(GLenum target, GLuint framebuffer)
+    {
+        bool draw = target != GL_READ_FRAMEBUFFER, read = target != GL_DRAW_FRAMEBUFFER;
+        if (this->elide(BIND_FRAMEBUFFER, (!draw || this->drawFramebuffer == framebuffer) && (!read || this->readFramebuffer == framebuffer)))
+            return;
+        if (draw)
+            this->drawFramebuffer = framebuffer;
+        if (read)
+            this->readFramebuffer = framebuffer;
+        glBindFramebuffer(target, framebuffer);
+    }
+
+    // unit is an index, not GL_TEXTUREi
+    void ActiveTexture(GLuint unit)
+    {
+        if (this->elide(ACTIVE_TEXTURE, this->unit == unit))
+            return;
+        this->unit = unit;
+        glActiveTexture(GL_TEXTURE0 + unit);
+    }
+
+    // Binds texture to target on unit, switching units only if it has to
+    void BindTexture(GLuint unit, GLenum target, GLuint texture)
+    {
+        int t = targetIndex(target);
+        if (unit < UNITS && t >= 0 && this->elide(BIND_TEXTURE, this->textures[unit][t] == texture))
+            return;
+        this->ActiveTexture(unit);
+        if (unit < UNITS && t >= 0)
+            this->textures[unit][t] = texture;
+        else
+            this->frame.Issued[BIND_TEXTURE]++;
+        glBindTexture(target, texture);
+    }
+
+    // Closes the frame: its counters become LastFrame() and new ones start
+    void EndFrame()
+    {
+        this->last = this->frame;
+        memset(&this->frame, 0, sizeof(this->frame));
+    }
+
+    const Counters &LastFrame() const
+    {
+        return this->last;
+    }
+
+    void PrintStats(std::ostream &out) const
+    {
+        static const char *names[CALLS] = { "glUseProgram", "glBindVertexArray", "glBindFramebuffer", "glActiveTexture", "glBindTexture" };
+        GLuint issued = 0, elided = 0;
+        out << "GL state:";
+        for (int i = 0; i < CALLS; i++) {
+            out << " " << names[i] << " " << this->last.Issued[i] << "/" << this->last.Issued[i] + this->last.Elided[i];
+            issued += this->last.Issued[i];
+            elided += this->last.Elided[i];
+        }
+        out << ", " << issued << " issued, " << elided << " elided" << std::endl;
+    }
+
+private:
+    static const GLuint UNKNOWN = 0xFFFFFFFFu;
+    static const GLuint UNITS = 16;
+    static const int TARGETS = 3;
+
+    GLuint program, vertexArray, drawFramebuffer, readFramebuffer;
+    GLuint unit;
+    GLuint textures[UNITS][TARGETS];
+    Counters frame, last;
+
+    // Counts the call one way or the other; true if it can be skipped
+    bool elide(Call call, bool same)
+    {
+        if (same)
+            this->frame.Elided[call]++;
+        else
+            this->frame.Issued[call]++;
+        return same;
+    }
+
+    static int targetIndex(GLenum target)
+    {
+        switch (target) {
+            case GL_TEXTURE_2D: return 0;
+            case GL_TEXTURE_2D_ARRAY: return 1;
+            case GL_TEXTURE_BUFFER: return 2;
+            default: return -1;
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,124 @@
+#ifndef HEIGHT_MAP_H
+#define HEIGHT_MAP_H
+
+#include <cmath>
+#include <cfloat>
+#include <vector>
+#include <algorithm>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "BoxGrid.h"
+
+// The level seen from above: for each cell, the top of the highest box
+// underfoot and the bottom of the lowest box overhead. Box heights are split
+// by the value passed to Build(): a box starting below it is something to
+// stand on, one starting above it is a ceiling. Boxes are grown by the
+// player's reach as they are drawn in, so every query is one lookup at the
+// player's position, however many boxes there are. Call Build() again
+// whenever the boxes change.
+class HeightMap
+{
+public:
+    explicit HeightMap(GLfloat cellSize = 0.05f) : cellSize(cellSize), x0(0.0f), z0(0.0f), width(0), depth(0)
+    {
+    }
+
+    // Draws in every box, grown by reach on x and z; a cell takes a box when
+    // its center is inside it
+    void Build(const BoxGrid &boxes, GLfloat reach, GLfloat split)
+    {
+        this->floors.clear();
+        this->ceilings.clear();
+        this->width = this->depth = 0;
+        if (boxes.Count() == 0)
+            return;
+        glm::vec2 lo(FLT_MAX), hi(-FLT_MAX);
+        for (GLuint id = 0; id < boxes.Count(); id++) {
+            glm::vec3 c = boxes.Center(id), e = boxes.HalfExtent(id);
+            lo = glm::min(lo, glm::vec2(c.x - e.x - reach, c.z - e.z - reach));
+            hi = glm::max(hi, glm::vec2(c.x + e.x + reach, c.z + e.z + reach));
+        }
+        this->x0 = lo.x;
+        this->z0 = lo.y;
+        this->width = (GLint)std::ceil((hi.x - lo.x) / this->cellSize) + 1;
+        this->depth = (GLint)std::ceil((hi.y - lo.y) / this->cellSize) + 1;
+        this->floors.assign((size_t)this->width * this->depth, -FLT_MAX);
+        this->ceilings.assign((size_t)this->width * this->depth, FLT_MAX);
+        for (GLuint id = 0; id < boxes.Count(); id++) {
+            glm::vec3 c = boxes.Center(id), e = boxes.HalfExtent(id);
+            GLfloat bottom = c.y - e.y, top = c.y + e.y;
+            GLint i0, i1, k0, k1;
+            this->span(c.x - e.x - reach - this->x0, c.x + e.x + reach - this->x0, i0, i1);
+            this->span(c.z - e.z - reach - this->z0, c.z + e.z + reach - this->z0, k0, k1);
+            for (GLint k = std::max(k0, 0); k <= std::min(k1, this->depth - 1); k++) {
+                for (GLint i = std::max(i0, 0); i <= std::min(i1, this->width - 1); i++) {
+                    size_t cell = (size_t)k * this->width + i;
+                    if (bottom < split)
+                        this->floors[cell] = std::max(this->floors[cell], top);
+                    else
+                        this->ceilings[cell] = std::min(this->ceilings[cell], bottom);
+                }
+            }
+        }
+    }
+
+    // Top of the highest box underfoot, or -FLT_MAX for bare ground
+    GLfloat Floor(GLfloat x, GLfloat z) const
+    {
+        GLint cell = this->cell(x, z);
+        return cell < 0 ? -FLT_MAX : this->floors[cell];
+    }
+
+    // Bottom of the lowest box overhead, or FLT_MAX for open sky
+    GLfloat Ceiling(GLfloat x, GLfloat z) const
+    {
+        GLint cell = this->cell(x, z);
+        return cell < 0 ? FLT_MAX : this->ceilings[cell];
+    }
+
+    // How far up the floor at x, z is from feet, into step; at most a step
+    // to walk on. False on bare ground, leaving step alone
+    bool StepUp(GLfloat x, GLfloat z, GLfloat feet, GLfloat &step) const
+    {
+        GLfloat floor = this->Floor(x, z);
+        if (floor == -FLT_MAX)
+            return false;
+        step = floor - feet;
+        return true;
+    }
+
+    // Room between head and the ceiling at x, z, into room. False under
+    // open sky, leaving room alone
+    bool Headroom(GLfloat x, GLfloat z, GLfloat head, GLfloat &room) const
+    {
+        GLfloat ceiling = this->Ceiling(x, z);
+        if (ceiling == FLT_MAX)
+            return false;
+        room = ceiling - head;
+        return true;
+    }
+
+private:
+    GLfloat cellSize, x0, z0;
+    GLint width, depth;
+    std::vector<GLfloat> floors, ceilings;
+
+    // Cells whose centers are strictly inside (lo, hi), relative to the origin
+    void span(GLfloat lo, GLfloat hi, GLint &first, GLint &last) const
+    {
+        first = (GLint)std::floor(lo / this->cellSize - 0.5f) + 1;
+        last = (GLint)std::ceil(hi / this->cellSize - 0.5f) - 1;
+    }
+
+    GLint cell(GLfloat x, GLfloat z) const
+    {
+        GLfloat i = std::floor((x - this->x0) / this->cellSize), k = std::floor((z - this->z0) / this->cellSize);
+        if (!(i >= 0.0f && i < this->width && k >= 0.0f && k < this->depth))
+            return -1;
+        return (GLint)k * this->width + (GLint)i;
+    }
+};
+
+#endif
@@ -0,0 +1,250 @@
+#ifndef IMA_ADPCM_H
+#define IMA_ADPCM_H
+
+#include <cmath>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#include <xmmintrin.h>
+#define IMA_ADPCM_SSE2 1
+#endif
+
+// IMA ADPCM as WAV files keep it (format tag 0x11), a quarter the size of
+// 16-bit PCM. Sound is cut into blocks of a fixed number of bytes; each
+// starts with, per channel, its first sample and step index, then holds
+// 4-bit codes in 4-byte words of eight, the channels' words taking turns.
+// Within a channel every sample depends on the one before, but blocks and
+// channels decode on their own, so the SSE2 decoder gives each of four
+// lanes a channel of a block: four mono blocks or two stereo ones at once.
+class ImaAdpcm
+{
+public:
+    // Block size for channels, and the frames a block of blockAlign bytes
+    // holds
+    static unsigned BlockAlign(int channels)
+    {
+        return 256 * channels;
+    }
+
+    static unsigned BlockFrames(unsigned blockAlign, int channels)
+    {
+        return (blockAlign - 4 * channels) * 2 / channels + 1;
+    }
+
+    // frames frames of interleaved 16-bit samples to whole blocks, the last
+    // one padded with silence
+    static std::vector<unsigned char> Encode(const short *pcm, unsigned frames, int channels, unsigned blockAlign)
+    {
+        unsigned perBlock = BlockFrames(blockAlign, channels), blocks = (frames + perBlock - 1) / perBlock;
+        std::vector<unsigned char> data((size_t)blocks * blockAlign, 0);
+        int index[2] = { 0, 0 };
+        for (unsigned b = 0; b < blocks; b++) {
+            unsigned char *block = &data[(size_t)b * blockAlign];
+            unsigned first = b * perBlock;
+            for (int c = 0; c < channels; c++) {
+                int predictor = pcm[(size_t)first * channels + c];
+                block[4 * c] = (unsigned char)predictor;
+                block[4 * c + 1] = (unsigned char)(predictor >> 8);
+                block[4 * c + 2] = (unsigned char)index[c];
+                for (unsigned s = 1; s < perBlock; s++) {
+                    unsigned frame = first + s;
+                    int code = encode(frame < frames ? pcm[(size_t)frame * channels + c] : 0, predictor, index[c]);
+                    unsigned char *word = block + 4 * channels + ((s - 1) / 8 * channels + c) * 4;
+                    word[(s - 1) % 8 / 2] |= (unsigned char)(code << ((s - 1) % 2 * 4));
+                }
+            }
+        }
+        return data;
+    }
+
+    // count whole blocks to interleaved floats in [-1, 1), BlockFrames() of
+    // them a block. simd picks the SSE2 decoder where there is one.
+    static void Decode(const unsigned char *blocks, unsigned count, unsigned blockAlign, int channels, float *out, bool simd = true)
+    {
+        unsigned perBlock = BlockFrames(blockAlign, channels), b = 0;
+#ifdef IMA_ADPCM_SSE2
+        unsigned group = 4 / channels;
+        if (simd)
+            for (; b + group <= count; b += group)
+                decodeLanes(blocks + (size_t)b * blockAlign, blockAlign, channels, perBlock, out + (size_t)b * perBlock * channels);
+#endif
+        for (; b < count; b++)
+            for (int c = 0; c < channels; c++)
+                decodeChannel(blocks + (size_t)b * blockAlign, channels, c, perBlock, out + (size_t)b * perBlock * channels);
+    }
+
+    // The first sample of a block's channel, which needs no decoding
+    static float First(const unsigned char *block, int channel)
+    {
+        return (short)(block[4 * channel] | block[4 * channel + 1] << 8) / 32768.0f;
+    }
+
+    // Times decoding ten seconds of mono and stereo noise with SSE2 and with
+    // plain code, against copying the same sound out of 16-bit PCM
+    static void Benchmark(std::ostream &out)
+    {
+        std::mt19937 random(48);
+        std::uniform_int_distribution<int> noise(-12000, 12000);
+        for (int channels = 1; channels <= 2; channels++) {
+            unsigned frames = 441000, blockAlign = BlockAlign(channels), perBlock = BlockFrames(blockAlign, channels);
+            std::vector<short> pcm((size_t)frames * channels);
+            int walk = 0;
+            for (size_t i = 0; i < pcm.size(); i++)
+                pcm[i] = (short)(walk = std::max(-32000, std::min(32000, walk / 2 + noise(random))));
+            std::vector<unsigned char> data = Encode(&pcm[0], frames, channels, blockAlign);
+            unsigned blocks = (unsigned)(data.size() / blockAlign);
+            std::vector<float> decoded[2], copied(pcm.size());
+            double times[3];
+            for (int run = 0; run < 3; run++) {
+                decoded[run & 1].resize((size_t)blocks * perBlock * channels);
+                std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                for (int r = 0; r < 10; r++)
+                    if (run < 2)
+                        Decode(&data[0], blocks, blockAlign, channels, &decoded[run][0], run == 1);
+                    else
+                        for (size_t i = 0; i < pcm.size(); i++)
+                            copied[i] = pcm[i] / 32768.0f;
+                times[run] = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / 10;
+            }
+            bool same = decoded[0] == decoded[1];
+            double error = 0.0;
+            for (size_t i = 0; i < pcm.size(); i++)
+                error += std::fabs(decoded[1][i] - copied[i]);
+            out << (channels == 1 ? "Mono" : "Stereo") << " IMA ADPCM, " << data.size() / 1024 << " KB for " << pcm.size() * 2 / 1024
+                << " KB of PCM: " << times[1] * 100.0 << " ms per second of sound"
+#ifdef IMA_ADPCM_SSE2
+                << " with SSE2"
+#endif
+                << ", " << times[0] * 100.0 << " ms plain, " << times[2] * 100.0 << " ms from 16-bit PCM; mean error "
+                << error / pcm.size() << (same ? "" : ", MISMATCH") << std::endl;
+        }
+    }
+
+private:
+    static const int *steps()
+    {
+        static const int table[89] = {
+            7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45, 50, 55, 60, 66, 73, 80, 88, 97, 107, 118,
+            130, 143, 157, 173, 190, 209, 230, 253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963, 1060,
+            1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358, 5894, 6484,
+            7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+        };
+        return table;
+    }
+
+    // How far the step index moves for a code, by its lower three bits
+    static int adjust(int code)
+    {
+        return code & 4 ? ((code & 3) + 1) * 2 : -1;
+    }
+
+    // The code closest to sample, moving predictor and index as the decoder
+    // will
+    static int encode(int sample, int &predictor, int &index)
+    {
+        int step = steps()[index], difference = sample - predictor, code = 0, delta = step >> 3;
+        if (difference < 0) {
+            code = 8;
+            difference = -difference;
+        }
+        for (int bit = 4; bit > 0; bit >>= 1, step >>= 1)
+            if (difference >= step) {
+                code |= bit;
+                difference -= step;
+                delta += step;
+            }
+        predictor = std::max(-32768, std::min(32767, code & 8 ? predictor - delta : predictor + delta));
+        index = std::max(0, std::min(88, index + adjust(code)));
+        return code;
+    }
+
+    static void decodeChannel(const unsigned char *block, int channels, int channel, unsigned perBlock, float *out)
+    {
+        int predictor = (short)(block[4 * channel] | block[4 * channel + 1] << 8), index = std::min(88, (int)block[4 * channel + 2]);
+        out[channel] = predictor / 32768.0f;
+        for (unsigned s = 1; s < perBlock; s++) {
+            const unsigned char *word = block + 4 * channels + ((s - 1) / 8 * channels + channel) * 4;
+            int code = word[(s - 1) % 8 / 2] >> ((s - 1) % 2 * 4) & 15, step = steps()[index];
+            int delta = (step >> 3) + (code & 4 ? step : 0) + (code & 2 ? step >> 1 : 0) + (code & 1 ? step >> 2 : 0);
+            predictor = std::max(-32768, std::min(32767, code & 8 ? predictor - delta : predictor + delta));
+            index = std::max(0, std::min(88, index + adjust(code)));
+            out[(size_t)s * channels + channel] = predictor / 32768.0f;
+        }
+    }
+
+#ifdef IMA_ADPCM_SSE2
+    // 4 / channels blocks, lane l being channel l % channels of block
+    // l / channels. Four codes of every lane are decoded, then turned around
+    // so each lane's four samples store together.
+    static void decodeLanes(const unsigned char *blocks, unsigned blockAlign, int channels, unsigned perBlock, float *out)
+    {
+        const unsigned char *lane[4];
+        int start[4], first[4];
+        for (int l = 0; l < 4; l++) {
+            lane[l] = blocks + (size_t)(l / channels) * blockAlign;
+            int c = l % channels;
+            start[l] = (short)(lane[l][4 * c] | lane[l][4 * c + 1] << 8);
+            first[l] = std::min(88, (int)lane[l][4 * c + 2]);
+            out[(size_t)(l / channels) * perBlock * channels + c] = start[l] / 32768.0f;
+            lane[l] += 4 * channels + 4 * c;
+        }
+        __m128i predictor = _mm_loadu_si128((const __m128i*)start), index = _mm_loadu_si128((const __m128i*)first);
+        const __m128i zero = _mm_setzero_si128(), three = _mm_set1_epi32(3), fifteen = _mm_set1_epi32(15), most = _mm_set1_epi32(88);
+        const __m128i bit1 = _mm_set1_epi32(1), bit2 = _mm_set1_epi32(2), bit4 = _mm_set1_epi32(4), bit8 = _mm_set1_epi32(8);
+        const __m128 scale = _mm_set1_ps(1.0f / 32768.0f);
+        const int *table = steps();
+        for (unsigned s = 1; s < perBlock; s += 8) {
+            unsigned w[4];
+            for (int l = 0; l < 4; l++) {
+                std::memcpy(&w[l], lane[l], 4);
+                lane[l] += 4 * channels;
+            }
+            __m128i words = _mm_setr_epi32((int)w[0], (int)w[1], (int)w[2], (int)w[3]);
+            for (int half = 0; half < 2; half++) {
+                __m128 sample[4];
+                for (int k = 0; k < 4; k++) {
+                    __m128i code = _mm_and_si128(words, fifteen);
+                    words = _mm_srli_epi32(words, 4);
+                    __m128i step = _mm_setr_epi32(table[_mm_extract_epi16(index, 0)], table[_mm_extract_epi16(index, 2)],
+                                                  table[_mm_extract_epi16(index, 4)], table[_mm_extract_epi16(index, 6)]);
+                    __m128i has4 = _mm_cmpeq_epi32(_mm_and_si128(code, bit4), bit4);
+                    __m128i delta = _mm_srai_epi32(step, 3);
+                    delta = _mm_add_epi32(delta, _mm_and_si128(has4, step));
+                    delta = _mm_add_epi32(delta, _mm_and_si128(_mm_cmpeq_epi32(_mm_and_si128(code, bit2), bit2), _mm_srai_epi32(step, 1)));
+                    delta = _mm_add_epi32(delta, _mm_and_si128(_mm_cmpeq_epi32(_mm_and_si128(code, bit1), bit1), _mm_srai_epi32(step, 2)));
+                    __m128i negative = _mm_cmpeq_epi32(_mm_and_si128(code, bit8), bit8);
+                    predictor = _mm_add_epi32(predictor, _mm_sub_epi32(_mm_xor_si128(delta, negative), negative));
+                    // saturated to 16 bits and widened back
+                    __m128i packed = _mm_packs_epi32(predictor, predictor);
+                    predictor = _mm_srai_epi32(_mm_unpacklo_epi16(packed, packed), 16);
+                    __m128i up = _mm_slli_epi32(_mm_add_epi32(_mm_and_si128(code, three), bit1), 1);
+                    index = _mm_add_epi32(index, _mm_or_si128(_mm_and_si128(has4, up), _mm_andnot_si128(has4, _mm_set1_epi32(-1))));
+                    index = _mm_andnot_si128(_mm_cmplt_epi32(index, zero), index);
+                    __m128i over = _mm_cmpgt_epi32(index, most);
+                    index = _mm_or_si128(_mm_and_si128(over, most), _mm_andnot_si128(over, index));
+                    sample[k] = _mm_mul_ps(_mm_cvtepi32_ps(predictor), scale);
+                }
+                _MM_TRANSPOSE4_PS(sample[0], sample[1], sample[2], sample[3]);
+                unsigned frame = s + 4 * half;
+                if (channels == 1)
+                    for (int l = 0; l < 4; l++)
+                        _mm_storeu_ps(out + (size_t)l * perBlock + frame, sample[l]);
+                else
+                    for (int b = 0; b < 2; b++) {
+                        float *at = out + ((size_t)b * perBlock + frame) * 2;
+                        _mm_storeu_ps(at, _mm_unpacklo_ps(sample[2 * b], sample[2 * b + 1]));
+                        _mm_storeu_ps(at + 4, _mm_unpackhi_ps(sample[2 * b], sample[2 * b + 1]));
+                    }
+            }
+        }
+    }
+#endif
+};
+
+#endif
@@ -0,0 +1,370 @@
+#ifndef LIGHT_CLUSTERS_H
+#define LIGHT_CLUSTERS_H
+
+#include <cmath>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <thread>
+#include <iostream>
+#include <algorithm>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define LIGHT_CLUSTERS_SSE 1
+#endif
+
+// A light that fades out with distance and reaches nothing past Radius
+struct PointLight
+{
+    glm::vec3 Position;
+    GLfloat Radius;
+    glm::vec3 Color;
+};
+
+// Point lights sorted by the part of the view they reach, for clustered
+// forward shading. The view frustum is cut into COLUMNS x ROWS tiles across
+// the screen and SLICES slices in depth, each deeper one longer by the same
+// ratio, and each cluster's view-space box is kept. Assign() tests every
+// light's sphere against the boxes of the slices its depth overlaps, four
+// lights at a time with SSE, the slices shared among threads. The lists go
+// to three texture buffers: each cluster's offset and count into the light
+// indices, the indices, and the lights as two texels each, where and how far
+// then what color. A fragment finds its cluster from its window position
+// and depth and shades only the lights in it.
+class LightClusters
+{
+public:
+    static const GLuint COLUMNS = 16, ROWS = 9, SLICES = 24;
+    static const GLuint CLUSTERS = COLUMNS * ROWS * SLICES;
+
+    bool Simd;      // false tests with plain code, for comparing
+    GLuint Threads; // at most, and no more than there are cores; few lights stay on the calling thread
+    // Cluster ranges, light indices and lights, each a buffer with a
+    // texture on it
+    GLuint Buffers[3], Textures[3];
+
+    LightClusters()
+        : Simd(true), Threads(std::max(1u, std::thread::hardware_concurrency())), up(0.0f), across(0.0f), closest(0.0f), farthest(0.0f),
+          ranges(2 * CLUSTERS, 0), counts(CLUSTERS), found(SLICES), lightCount(0)
+    {
+        for (int i = 0; i < 3; i++)
+            this->Buffers[i] = this->Textures[i] = 0;
+    }
+
+    // Makes the texture buffers; needs a current context
+    void Create()
+    {
+        const GLenum formats[3] = { GL_RG32UI, GL_R32UI, GL_RGBA32F };
+        glGenBuffers(3, this->Buffers);
+        glGenTextures(3, this->Textures);
+        for (int i = 0; i < 3; i++) {
+            glBindBuffer(GL_TEXTURE_BUFFER, this->Buffers[i]);
+            glBufferData(GL_TEXTURE_BUFFER, 16, NULL, GL_STREAM_DRAW);
+            glBindTexture(GL_TEXTURE_BUFFER, this->Textures[i]);
+            glTexBuffer(GL_TEXTURE_BUFFER, formats[i], this->Buffers[i]);
+        }
+        glBindTexture(GL_TEXTURE_BUFFER, 0);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    }
+
+    void Destroy()
+    {
+        glDeleteTextures(3, this->Textures);
+        glDeleteBuffers(3, this->Buffers);
+    }
+
+    // The frustum to cut up: the perspective projection the scene is drawn
+    // with and its near and far planes. The half field of view comes from
+    // the matrix, whatever units glm::perspective took it in. The boxes are
+    // only rebuilt when it changes.
+    void SetProjection(const glm::mat4 &projection, GLfloat closest, GLfloat farthest)
+    {
+        GLfloat up = 1.0f / projection[1][1], across = 1.0f / projection[0][0];
+        if (up == this->up && across == this->across && closest == this->closest && farthest == this->farthest)
+            return;
+        this->up = up;
+        this->across = across;
+        this->closest = closest;
+        this->farthest = farthest;
+        for (int k = 0; k < 6; k++)
+            this->bounds[k].resize(CLUSTERS);
+        for (GLuint z = 0; z < SLICES; z++) {
+            GLfloat front = this->depth(z), back = this->depth(z + 1);
+            for (GLuint y = 0; y < ROWS; y++)
+                for (GLuint x = 0; x < COLUMNS; x++) {
+                    GLuint c = (z * ROWS + y) * COLUMNS + x;
+                    GLfloat left = -1.0f + 2.0f * x / COLUMNS, right = -1.0f + 2.0f * (x + 1) / COLUMNS;
+                    GLfloat bottom = -1.0f + 2.0f * y / ROWS, top = -1.0f + 2.0f * (y + 1) / ROWS;
+                    // the tile's edges at the slice's near and far depths
+                    this->bounds[0][c] = std::min(left * front, left * back) * across;
+                    this->bounds[3][c] = std::max(right * front, right * back) * across;
+                    this->bounds[1][c] = std::min(bottom * front, bottom * back) * up;
+                    this->bounds[4][c] = std::max(top * front, top * back) * up;
+                    this->bounds[2][c] = -back;
+                    this->bounds[5][c] = -front;
+                }
+        }
+    }
+
+    // Which lights reach which clusters, seen through view
+    void Assign(const std::vector<PointLight> &lights, const glm::mat4 &view)
+    {
+        GLuint count = (GLuint)lights.size();
+        this->x.resize(count);
+        this->y.resize(count);
+        this->z.resize(count);
+        this->radius.resize(count);
+        for (GLuint i = 0; i < count; i++) {
+            glm::vec4 center = view * glm::vec4(lights[i].Position, 1.0f);
+            this->x[i] = center.x;
+            this->y[i] = center.y;
+            this->z[i] = center.z;
+            this->radius[i] = lights[i].Radius;
+        }
+        GLuint threads = this->threads(count);
+        std::vector<std::thread> workers;
+        for (GLuint t = 1; t < threads; t++)
+            workers.push_back(std::thread(&LightClusters::slices, this, t, threads));
+        this->slices(0, threads);
+        for (size_t i = 0; i < workers.size(); i++)
+            workers[i].join();
+        this->indices.clear();
+        for (GLuint s = 0; s < SLICES; s++)
+            this->indices.insert(this->indices.end(), this->found[s].Indices.begin(), this->found[s].Indices.end());
+        GLuint offset = 0;
+        for (GLuint c = 0; c < CLUSTERS; c++) {
+            this->ranges[2 * c] = offset;
+            this->ranges[2 * c + 1] = this->counts[c];
+            offset += this->counts[c];
+        }
+    }
+
+    // Sends what Assign() found and the lights themselves to the buffers
+    void Upload(const std::vector<PointLight> &lights)
+    {
+        std::vector<GLfloat> texels(8 * std::max((size_t)1, lights.size()), 0.0f);
+        for (size_t i = 0; i < lights.size(); i++) {
+            GLfloat *t = &texels[8 * i];
+            t[0] = lights[i].Position.x;
+            t[1] = lights[i].Position.y;
+            t[2] = lights[i].Position.z;
+            t[3] = lights[i].Radius;
+            t[4] = lights[i].Color.r;
+            t[5] = lights[i].Color.g;
+            t[6] = lights[i].Color.b;
+        }
+        GLuint none = 0;
+        glBindBuffer(GL_TEXTURE_BUFFER, this->Buffers[0]);
+        glBufferData(GL_TEXTURE_BUFFER, this->ranges.size() * sizeof(GLuint), &this->ranges[0], GL_STREAM_DRAW);
+        glBindBuffer(GL_TEXTURE_BUFFER, this->Buffers[1]);
+        glBufferData(GL_TEXTURE_BUFFER, std::max((size_t)1, this->indices.size()) * sizeof(GLuint), this->indices.empty() ? &none : &this->indices[0], GL_STREAM_DRAW);
+        glBindBuffer(GL_TEXTURE_BUFFER, this->Buffers[2]);
+        glBufferData(GL_TEXTURE_BUFFER, texels.size() * sizeof(GLfloat), &texels[0], GL_STREAM_DRAW);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+        this->lightCount = (GLint)lights.size();
+    }
+
+    // The uniforms a shader finds its cluster with, for a framebuffer of
+    // width x height; the textures go on units unit to unit + 2
+    void SetUniforms(GLuint program, GLint unit, GLsizei width, GLsizei height) const
+    {
+        glUniform1i(glGetUniformLocation(program, "clusterRanges"), unit);
+        glUniform1i(glGetUniformLocation(program, "clusterLights"), unit + 1);
+        glUniform1i(glGetUniformLocation(program, "pointLights"), unit + 2);
+        glUniform1i(glGetUniformLocation(program, "pointLightCount"), this->lightCount);
+        glUniform1i(glGetUniformLocation(program, "clusterColumns"), COLUMNS);
+        glUniform1i(glGetUniformLocation(program, "clusterRows"), ROWS);
+        glUniform1i(glGetUniformLocation(program, "clusterSlices"), SLICES);
+        glUniform3f(glGetUniformLocation(program, "clusterScale"), (GLfloat)COLUMNS / width, (GLfloat)ROWS / height,
+                    SLICES / std::log(this->farthest / this->closest));
+        glUniform1f(glGetUniformLocation(program, "clusterNear"), this->closest);
+    }
+
+    // Each cluster's offset and count into Indices()
+    const std::vector<GLuint> &Ranges() const
+    {
+        return this->ranges;
+    }
+
+    const std::vector<GLuint> &Indices() const
+    {
+        return this->indices;
+    }
+
+    // Times assigning 64 to 4096 lights scattered through the view with
+    // SSE on every thread, SSE on one and plain code on one, through the
+    // game's projection, and checks every light whose center is in view is
+    // in the list of the cluster its center falls in
+    static void Benchmark(std::ostream &out)
+    {
+        const GLuint counts[] = { 64, 256, 1024, 4096 }, repeats = 20;
+        const GLfloat closest = 0.1f, farthest = 100.0f;
+        std::mt19937 random(49);
+        glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 1.5f, 3.0f), glm::vec3(0.0f, 1.5f, 2.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+        // as main.cpp asks for it, with the camera's starting zoom; glm
+        // 0.9.5 takes degrees, so this is a field of view of 78.5 degrees
+        glm::mat4 projection = glm::perspective(glm::radians(4500.0f), 800.0f / 600.0f, closest, farthest);
+        for (int n = 0; n < 4; n++) {
+            std::uniform_real_distribution<GLfloat> across(-30.0f, 30.0f), height(0.0f, 3.0f), reach(1.0f, 4.0f);
+            std::vector<PointLight> lights(counts[n]);
+            for (GLuint i = 0; i < counts[n]; i++) {
+                lights[i].Position = glm::vec3(across(random), height(random), across(random) - 30.0f);
+                lights[i].Radius = reach(random);
+                lights[i].Color = glm::vec3(1.0f);
+            }
+            double times[3];
+            std::vector<GLuint> lists[3];
+            for (int run = 0; run < 3; run++) {
+                LightClusters clusters;
+                clusters.Simd = run < 2;
+                if (run > 0)
+                    clusters.Threads = 1;
+                clusters.SetProjection(projection, closest, farthest);
+                clusters.Assign(lights, view); // warm up the allocations
+                std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                for (GLuint r = 0; r < repeats; r++)
+                    clusters.Assign(lights, view);
+                times[run] = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / repeats;
+                lists[run] = clusters.ranges;
+                lists[run].insert(lists[run].end(), clusters.indices.begin(), clusters.indices.end());
+            }
+            GLuint used = 0, most = 0;
+            for (GLuint c = 0; c < CLUSTERS; c++) {
+                used += lists[0][2 * c + 1] > 0;
+                most = std::max(most, lists[0][2 * c + 1]);
+            }
+            GLuint assigned = (GLuint)lists[0].size() - 2 * CLUSTERS, seen = 0, missing = 0;
+            for (GLuint i = 0; i < counts[n]; i++) {
+                glm::vec4 center = view * glm::vec4(lights[i].Position, 1.0f), clip = projection * center;
+                if (-center.z <= closest || -center.z >= farthest || std::abs(clip.x) >= clip.w || std::abs(clip.y) >= clip.w)
+                    continue;
+                GLuint x = std::min(COLUMNS - 1, (GLuint)((clip.x / clip.w + 1.0f) * 0.5f * COLUMNS));
+                GLuint y = std::min(ROWS - 1, (GLuint)((clip.y / clip.w + 1.0f) * 0.5f * ROWS));
+                GLuint z = std::min(SLICES - 1, (GLuint)(std::log(-center.z / closest) / std::log(farthest / closest) * SLICES));
+                GLuint c = (z * ROWS + y) * COLUMNS + x;
+                const GLuint *list = &lists[0][2 * CLUSTERS + lists[0][2 * c]];
+                seen++;
+                missing += std::find(list, list + lists[0][2 * c + 1], i) == list + lists[0][2 * c + 1];
+            }
+            out << counts[n] << " lights: " << times[0] * 1000.0 << " ms on " << LightClusters().threads(counts[n]) << " threads"
+#ifdef LIGHT_CLUSTERS_SSE
+                << " with SSE, " << times[1] * 1000.0 << " ms on one"
+#endif
+                << ", " << times[2] * 1000.0 << " ms plain; " << (GLfloat)assigned / std::max(1u, used) << " lights per lit cluster, "
+                << most << " at most, " << missing << " of " << seen << " lights in view missing from their own cluster"
+                << (lists[0] == lists[1] && lists[0] == lists[2] ? "" : ", MISMATCH") << std::endl;
+        }
+    }
+
+private:
+    static const GLuint PARALLEL_MIN = 64;
+
+    // One slice's lists, its clusters' in order
+    struct Slice
+    {
+        std::vector<GLuint> Indices;
+        std::vector<GLfloat> X, Y, Z, Reach; // the lights it may hold, padded to fours
+        std::vector<GLuint> Lights;
+    };
+
+    GLfloat up, across, closest, farthest; // tangents of the half field of view, then the planes
+    std::vector<GLfloat> bounds[6];         // every cluster's box: min x, y, z then max
+    std::vector<GLfloat> x, y, z, radius;   // the lights in view space
+    std::vector<GLuint> ranges, counts, indices;
+    std::vector<Slice> found;
+    GLint lightCount;
+
+    // How many threads Assign() shares count lights among: one per
+    // PARALLEL_MIN lights, one per slice at most and never more than cores,
+    // since they are started anew every frame
+    GLuint threads(GLuint count) const
+    {
+        GLuint slices = SLICES; // std::min takes references, SLICES has no definition
+        GLuint cores = std::max(1u, std::thread::hardware_concurrency());
+        return std::max(1u, std::min(std::min(this->Threads, cores), std::min(slices, count / PARALLEL_MIN)));
+    }
+
+    // Where slice s starts, s from 0 to SLICES
+    GLfloat depth(GLuint s) const
+    {
+        return this->closest * std::pow(this->farthest / this->closest, (GLfloat)s / SLICES);
+    }
+
+    // Slices first, first + step, ...
+    void slices(GLuint first, GLuint step)
+    {
+        for (GLuint s = first; s < SLICES; s += step)
+            this->slice(s);
+    }
+
+    void slice(GLuint s)
+    {
+        Slice &slice = this->found[s];
+        slice.Indices.clear();
+        slice.Lights.clear();
+        slice.X.clear();
+        slice.Y.clear();
+        slice.Z.clear();
+        slice.Reach.clear();
+        // only the lights whose depth overlaps the slice's
+        GLfloat front = this->depth(s), back = this->depth(s + 1);
+        for (GLuint i = 0; i < (GLuint)this->x.size(); i++)
+            if (-this->z[i] + this->radius[i] >= front && -this->z[i] - this->radius[i] <= back) {
+                slice.Lights.push_back(i);
+                slice.X.push_back(this->x[i]);
+                slice.Y.push_back(this->y[i]);
+                slice.Z.push_back(this->z[i]);
+                slice.Reach.push_back(this->radius[i] * this->radius[i]);
+            }
+        GLuint candidates = (GLuint)slice.Lights.size();
+        while (slice.X.size() % 4) {
+            slice.X.push_back(0.0f);
+            slice.Y.push_back(0.0f);
+            slice.Z.push_back(0.0f);
+            slice.Reach.push_back(-1.0f); // never reached
+        }
+        for (GLuint c = s * ROWS * COLUMNS; c < (s + 1) * ROWS * COLUMNS; c++) {
+            size_t before = slice.Indices.size();
+            GLuint i = 0;
+#ifdef LIGHT_CLUSTERS_SSE
+            if (this->Simd) {
+                const __m128 zero = _mm_setzero_ps();
+                __m128 lowX = _mm_set1_ps(this->bounds[0][c]), lowY = _mm_set1_ps(this->bounds[1][c]), lowZ = _mm_set1_ps(this->bounds[2][c]);
+                __m128 highX = _mm_set1_ps(this->bounds[3][c]), highY = _mm_set1_ps(this->bounds[4][c]), highZ = _mm_set1_ps(this->bounds[5][c]);
+                for (; i < candidates; i += 4) {
+                    // how far each center is outside the box, per axis
+                    __m128 cx = _mm_loadu_ps(&slice.X[i]), cy = _mm_loadu_ps(&slice.Y[i]), cz = _mm_loadu_ps(&slice.Z[i]);
+                    __m128 dx = _mm_max_ps(_mm_max_ps(_mm_sub_ps(lowX, cx), _mm_sub_ps(cx, highX)), zero);
+                    __m128 dy = _mm_max_ps(_mm_max_ps(_mm_sub_ps(lowY, cy), _mm_sub_ps(cy, highY)), zero);
+                    __m128 dz = _mm_max_ps(_mm_max_ps(_mm_sub_ps(lowZ, cz), _mm_sub_ps(cz, highZ)), zero);
+                    __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+                    int hits = _mm_movemask_ps(_mm_cmple_ps(distance, _mm_loadu_ps(&slice.Reach[i])));
+                    for (; hits; hits &= hits - 1)
+                        slice.Indices.push_back(slice.Lights[i + lowest(hits)]);
+                }
+            }
+#endif
+            for (; i < candidates; i++) {
+                GLfloat dx = std::max(std::max(this->bounds[0][c] - slice.X[i], slice.X[i] - this->bounds[3][c]), 0.0f);
+                GLfloat dy = std::max(std::max(this->bounds[1][c] - slice.Y[i], slice.Y[i] - this->bounds[4][c]), 0.0f);
+                GLfloat dz = std::max(std::max(this->bounds[2][c] - slice.Z[i], slice.Z[i] - this->bounds[5][c]), 0.0f);
+                if (dx * dx + dy * dy + dz * dz <= slice.Reach[i])
+                    slice.Indices.push_back(slice.Lights[i]);
+            }
+            this->counts[c] = (GLuint)(slice.Indices.size() - before);
+        }
+    }
+
+    // The lowest set bit of a 4-bit mask
+    static GLuint lowest(int mask)
+    {
+        return mask & 1 ? 0 : mask & 2 ? 1 : mask & 4 ? 2 : 3;
+    }
+};
+
+#endif
@@ -0,0 +1,118 @@
+#ifndef PASS_TIMER_H
+#define PASS_TIMER_H
+
+#include <string>
+#include <vector>
+#include <iostream>
+
+#include <GL/glew.h>
+
+// GPU time of each pass of a frame, from GL_TIME_ELAPSED queries. Every
+// pass has LATENCY queries used in turn, one per frame, and a query is
+// read only when its turn comes round again, by which time the GPU is
+// long done with it, so timing never stalls the pipeline. Times add up
+// until Reset(), and PrintStats() gives each pass's average per frame.
+class PassTimer
+{
+public:
+    static const GLuint LATENCY = 3;
+
+    PassTimer() : frame(0), active(false)
+    {
+    }
+
+    // Makes the queries for one pass per name; call once GL is up
+    void Create(const std::vector<std::string> &names)
+    {
+        this->names = names;
+        this->queries.assign(names.size() * LATENCY, 0);
+        this->issued.assign(this->queries.size(), false);
+        glGenQueries((GLsizei)this->queries.size(), &this->queries[0]);
+        this->Reset();
+    }
+
+    void Destroy()
+    {
+        if (!this->queries.empty())
+            glDeleteQueries((GLsizei)this->queries.size(), &this->queries[0]);
+        this->queries.clear();
+    }
+
+    // Times everything until End() as pass; passes can not nest
+    void Begin(GLuint pass)
+    {
+        GLuint q = this->slot(pass);
+        glBeginQuery(GL_TIME_ELAPSED, this->queries[q]);
+        this->issued[q] = true;
+        this->active = true;
+    }
+
+    void End()
+    {
+        if (this->active)
+            glEndQuery(GL_TIME_ELAPSED);
+        this->active = false;
+    }
+
+    // Closes the frame and collects the queries the next one will reuse
+    void EndFrame()
+    {
+        this->frame++;
+        for (GLuint pass = 0; pass < this->names.size(); pass++) {
+            GLuint q = this->slot(pass);
+            if (!this->issued[q])
+                continue;
+            GLint available = 0;
+            glGetQueryObjectiv(this->queries[q], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (available) {
+                GLuint64 nanoseconds = 0;
+                glGetQueryObjectui64v(this->queries[q], GL_QUERY_RESULT, &nanoseconds);
+                this->nanoseconds[pass] += nanoseconds;
+                this->samples[pass]++;
+            }
+            this->issued[q] = false;
+        }
+    }
+
+    // Starts the averages over, as when the passes a frame runs change
+    void Reset()
+    {
+        this->nanoseconds.assign(this->names.size(), 0);
+        this->samples.assign(this->names.size(), 0);
+    }
+
+    // Average milliseconds of pass per frame it ran in, 0 if it never did
+    double Milliseconds(GLuint pass) const
+    {
+        return this->samples[pass] ? this->nanoseconds[pass] / 1e6 / this->samples[pass] : 0.0;
+    }
+
+    void PrintStats(std::ostream &out) const
+    {
+        out << "GPU passes:";
+        double total = 0.0;
+        for (GLuint pass = 0; pass < this->names.size(); pass++) {
+            if (this->samples[pass] == 0)
+                continue;
+            out << " " << this->names[pass] << " " << this->Milliseconds(pass) << " ms (" << this->samples[pass] << " frames),";
+            total += this->Milliseconds(pass);
+        }
+        out << " " << total << " ms a frame" << std::endl;
+    }
+
+private:
+    std::vector<std::string> names;
+    std::vector<GLuint> queries; // LATENCY per pass, the pass's turns in a row
+    std::vector<bool> issued;
+    std::vector<GLuint64> nanoseconds;
+    std::vector<GLuint> samples;
+    GLuint frame;
+    bool active;
+
+    GLuint slot(GLuint pass) const
+    {
+        return pass * LATENCY + this->frame % LATENCY;
+    }
+};
+
+#endif
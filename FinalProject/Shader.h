@@ -2,18 +2,43 @@
 #define SHADER_H
 
 #include <string>
+#include <cstring>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <chrono>
 
 #include <GL/glew.h>
 
+#include "ShaderCache.h"
+
+// GL_KHR_parallel_shader_compile (and its ARB twin); newer than our GLEW
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
 class Shader
 {
 public:
     GLuint Program;
-    // Constructor generates the shader on the fly
-    Shader(const GLchar* vertexPath, const GLchar* fragmentPath)
+    // An empty shader; Compile() gives it a program
+    Shader() : Program(0), vertex(0), fragment(0), pending(false), linked(false), cache(NULL), seconds(0.0)
+    {
+    }
+    // Constructor generates the shader on the fly, or takes the linked
+    // program from cache when its sources and the driver haven't changed.
+    // defines ("#define NAME value" lines) go right after each #version, and
+    // the GLSL in the file at sharedPath, if any, after the vertex shader's.
+    Shader(const GLchar* vertexPath, const GLchar* fragmentPath, ShaderCache* cache = NULL, const std::string& defines = "", const std::string& sharedPath = "")
+        : Program(0), vertex(0), fragment(0), pending(false), linked(false), cache(NULL), seconds(0.0)
+    {
+        this->Compile(vertexPath, fragmentPath, cache, defines, sharedPath);
+        this->Finish();
+    }
+    // Issues the compile and link like the constructor, but returns without
+    // asking for their status, which would make the driver wait for them.
+    // Program isn't usable until Finish() has returned true.
+    void Compile(const GLchar* vertexPath, const GLchar* fragmentPath, ShaderCache* cache = NULL, const std::string& defines = "", const std::string& sharedPath = "")
     {
         // 1. Retrieve the vertex/fragment source code from filePath
         std::string vertexCode;
@@ -35,47 +60,87 @@ public:
             // close file handlers
             vShaderFile.close();
             fShaderFile.close();
+            // Code both vertex shaders of a pair use goes in after the defines
+            std::string shared;
+            if (!sharedPath.empty()) {
+                std::ifstream sharedFile;
+                sharedFile.exceptions(std::ifstream::badbit);
+                sharedFile.open(sharedPath.c_str());
+                std::stringstream sharedStream;
+                sharedStream << sharedFile.rdbuf();
+                shared = sharedStream.str() + '\n';
+            }
             // Convert stream into string
-            vertexCode = vShaderStream.str();
-            fragmentCode = fShaderStream.str();
+            vertexCode = AddDefines(vShaderStream.str(), defines + shared);
+            fragmentCode = AddDefines(fShaderStream.str(), defines);
         }
         catch (std::ifstream::failure e)
         {
             std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
         }
+        // 2. Try the program binary cache
+        this->Program = glCreateProgram();
+        this->cache = cache;
+        this->name = std::string(vertexPath) + '\n' + fragmentPath + '\n' + sharedPath + '\n' + defines;
+        this->source = vertexCode + '\0' + fragmentCode;
+        if (cache && cache->Load(this->Program, this->name, this->source)) {
+            this->linked = true;
+            return;
+        }
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
         const GLchar* vShaderCode = vertexCode.c_str();
         const GLchar * fShaderCode = fragmentCode.c_str();
-        // 2. Compile shaders
-        GLuint vertex, fragment;
+        // 3. Compile shaders
+        // Vertex Shader
+        this->vertex = glCreateShader(GL_VERTEX_SHADER);
+        glShaderSource(this->vertex, 1, &vShaderCode, NULL);
+        glCompileShader(this->vertex);
+        // Fragment Shader
+        this->fragment = glCreateShader(GL_FRAGMENT_SHADER);
+        glShaderSource(this->fragment, 1, &fShaderCode, NULL);
+        glCompileShader(this->fragment);
+        // Shader Program
+        glAttachShader(this->Program, this->vertex);
+        glAttachShader(this->Program, this->fragment);
+        if (cache)
+            cache->Prepare(this->Program);
+        glLinkProgram(this->Program);
+        this->seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        this->pending = true;
+    }
+    // True once Finish() won't block. Without parallel compile support there
+    // is no way to ask, so it is always true and Finish() may wait.
+    bool Ready() const
+    {
+        if (!this->pending || !ParallelCompile())
+            return true;
+        GLint done = GL_FALSE;
+        glGetProgramiv(this->Program, GL_COMPLETION_STATUS_KHR, &done);
+        return done == GL_TRUE;
+    }
+    // Waits for the compile and link if they're still running, prints their
+    // errors and returns whether Program linked
+    bool Finish()
+    {
+        if (!this->pending)
+            return this->linked;
+        this->pending = false;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
         GLint success;
         GLchar infoLog[512];
-        // Vertex Shader
-        vertex = glCreateShader(GL_VERTEX_SHADER);
-        glShaderSource(vertex, 1, &vShaderCode, NULL);
-        glCompileShader(vertex);
         // Print compile errors if any
-        glGetShaderiv(vertex, GL_COMPILE_STATUS, &success);
+        glGetShaderiv(this->vertex, GL_COMPILE_STATUS, &success);
         if (!success)
         {
-            glGetShaderInfoLog(vertex, 512, NULL, infoLog);
+            glGetShaderInfoLog(this->vertex, 512, NULL, infoLog);
             std::cout << "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n" << infoLog << std::endl;
         }
-        // Fragment Shader
-        fragment = glCreateShader(GL_FRAGMENT_SHADER);
-        glShaderSource(fragment, 1, &fShaderCode, NULL);
-        glCompileShader(fragment);
-        // Print compile errors if any
-        glGetShaderiv(fragment, GL_COMPILE_STATUS, &success);
+        glGetShaderiv(this->fragment, GL_COMPILE_STATUS, &success);
         if (!success)
         {
-            glGetShaderInfoLog(fragment, 512, NULL, infoLog);
+            glGetShaderInfoLog(this->fragment, 512, NULL, infoLog);
             std::cout << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n" << infoLog << std::endl;
         }
-        // Shader Program
-        this->Program = glCreateProgram();
-        glAttachShader(this->Program, vertex);
-        glAttachShader(this->Program, fragment);
-        glLinkProgram(this->Program);
         // Print linking errors if any
         glGetProgramiv(this->Program, GL_LINK_STATUS, &success);
         if (!success)
@@ -83,16 +148,70 @@ public:
             glGetProgramInfoLog(this->Program, 512, NULL, infoLog);
             std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
         }
+        else if (this->cache)
+            this->cache->Store(this->Program, this->name, this->source, this->seconds + std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
         // Delete the shaders as they're linked into our program now and no longer necessery
-        glDeleteShader(vertex);
-        glDeleteShader(fragment);
-        
+        glDeleteShader(this->vertex);
+        glDeleteShader(this->fragment);
+        this->vertex = this->fragment = 0;
+        this->source.clear();
+        this->linked = success == GL_TRUE;
+        return this->linked;
+    }
+    // Deletes the program, and the shaders of a compile still pending
+    void Delete()
+    {
+        if (this->pending)
+        {
+            glDeleteShader(this->vertex);
+            glDeleteShader(this->fragment);
+        }
+        glDeleteProgram(this->Program);
+        *this = Shader();
     }
     // Uses the current shader
     void Use()
     {
         glUseProgram(this->Program);
     }
+    // Inserts defines (or any other text) after the #version line, which
+    // has to stay first
+    static std::string AddDefines(const std::string& code, const std::string& defines)
+    {
+        if (defines.empty())
+            return code;
+        size_t start = code.find("#version");
+        size_t end = start == std::string::npos ? std::string::npos : code.find('\n', start);
+        if (end == std::string::npos)
+            return defines + code;
+        return code.substr(0, end + 1) + defines + code.substr(end + 1);
+    }
+    // Whether the driver compiles on its own threads and answers
+    // GL_COMPLETION_STATUS_KHR; the default thread count is left to it
+    static bool ParallelCompile()
+    {
+        static int supported = -1;
+        if (supported < 0) {
+            supported = 0;
+            GLint count = 0;
+            glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+            for (GLint i = 0; i < count; i++) {
+                const char* ext = (const char*)glGetStringi(GL_EXTENSIONS, i);
+                if (ext && (strcmp(ext, "GL_KHR_parallel_shader_compile") == 0 || strcmp(ext, "GL_ARB_parallel_shader_compile") == 0))
+                    supported = 1;
+            }
+        }
+        return supported == 1;
+    }
+
+private:
+    // While a compile is pending
+    GLuint vertex, fragment;
+    bool pending, linked;
+    ShaderCache* cache;
+    std::string name, source;
+    // Spent in Compile() and waiting in Finish(), not the frames between
+    double seconds;
 };
 
-#endif
\ No newline at end of file
+#endif
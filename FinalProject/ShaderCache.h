@@ -0,0 +1,170 @@
+#ifndef SHADER_CACHE_H
+#define SHADER_CACHE_H
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+#include <sys/stat.h>
+
+#include <GL/glew.h>
+
+#include "CacheFile.h"
+
+// On-disk cache of linked program binaries (glGetProgramBinary). There is one
+// entry per program, named after a hash of its shader paths; the entry
+// records a key hashed from the shader sources plus the driver's vendor,
+// renderer and version strings. Loading a program whose key doesn't match, or
+// whose binary the driver refuses, falls back to compiling from source, after
+// which the entry is rewritten. Drivers without any binary formats disable the
+// cache, and every program is compiled as before.
+class ShaderCache
+{
+public:
+    struct Stats
+    {
+        GLuint Hits, Misses, Rejected; // Rejected: key matched but the driver refused the binary
+        double LoadSeconds;    // time spent in glProgramBinary on hits
+        double CompileSeconds; // time spent compiling and linking on misses
+        double SavedSeconds;   // what the hits took to compile last time, less LoadSeconds
+    };
+
+    bool Enabled; // false if the driver offers no binary formats
+
+    // Needs a current context: the driver strings become part of every key
+    ShaderCache(const std::string &directory) : directory(directory)
+    {
+        memset(&this->stats, 0, sizeof(this->stats));
+        GLint formats = 0;
+        if (glGetProgramBinary && glProgramBinary)
+            glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+        this->Enabled = formats > 0;
+        if (this->Enabled)
+            mkdir(directory.c_str(), 0755);
+        const GLenum names[] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+        for (int i = 0; i < 3; i++) {
+            const GLubyte *s = glGetString(names[i]);
+            this->driver += s ? (const char *)s : "";
+            this->driver += '\n';
+        }
+    }
+
+    // Links program from the entry for name if it was built from source by
+    // this driver; false means the caller has to compile it
+    bool Load(GLuint program, const std::string &name, const std::string &source)
+    {
+        if (!this->Enabled)
+            return false;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        Header header;
+        std::vector<char> binary;
+        if (!this->read(name, header, binary) || header.Key != this->key(source)) {
+            this->stats.Misses++;
+            return false;
+        }
+        glProgramBinary(program, header.Format, &binary[0], (GLsizei)binary.size());
+        GLint success;
+        glGetProgramiv(program, GL_LINK_STATUS, &success);
+        if (!success) {
+            // Usually a driver update that kept its version string
+            this->stats.Rejected++;
+            this->stats.Misses++;
+            return false;
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        this->stats.Hits++;
+        this->stats.LoadSeconds += seconds;
+        this->stats.SavedSeconds += header.CompileSeconds - seconds;
+        return true;
+    }
+
+    // Called before linking so the driver keeps a retrievable binary around
+    void Prepare(GLuint program)
+    {
+        if (this->Enabled)
+            glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+
+    // Stores a freshly linked program; compileSeconds is what Load() will
+    // count as saved next time
+    void Store(GLuint program, const std::string &name, const std::string &source, double compileSeconds)
+    {
+        this->stats.CompileSeconds += compileSeconds;
+        if (!this->Enabled)
+            return;
+        GLint length = 0;
+        glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+        if (length <= 0)
+            return;
+        Header header;
+        memcpy(header.Magic, "PBC1", 4);
+        header.Key = this->key(source);
+        header.CompileSeconds = compileSeconds;
+        std::vector<char> binary(length);
+        GLsizei written = 0;
+        glGetProgramBinary(program, length, &written, &header.Format, &binary[0]);
+        if (written <= 0)
+            return;
+        header.Length = (GLuint)written;
+        CacheFile::Write(this->entryPath(name), &header, sizeof(header), &binary[0], header.Length);
+    }
+
+    const Stats &GetStats() const
+    {
+        return this->stats;
+    }
+
+    void PrintStats(std::ostream &out) const
+    {
+        GLuint total = this->stats.Hits + this->stats.Misses;
+        out << "Shader cache: " << (this->Enabled ? "" : "disabled, ") << this->stats.Hits << "/" << total << " hits, "
+            << this->stats.Rejected << " rejected, " << this->stats.LoadSeconds * 1000.0 << " ms loading, "
+            << this->stats.CompileSeconds * 1000.0 << " ms compiling, " << this->stats.SavedSeconds * 1000.0 << " ms saved" << std::endl;
+    }
+
+private:
+    // Entry layout: Header, then Length bytes of program binary
+    struct Header
+    {
+        char Magic[4];
+        GLenum Format;
+        unsigned long long Key;
+        double CompileSeconds;
+        GLuint Length;
+    };
+
+    std::string directory;
+    std::string driver;
+    Stats stats;
+
+    unsigned long long key(const std::string &source) const
+    {
+        return CacheFile::Hash(source, CacheFile::Hash(this->driver));
+    }
+
+    std::string entryPath(const std::string &name) const
+    {
+        char file[32];
+        snprintf(file, sizeof(file), "/%016llx.pbc", CacheFile::Hash(name));
+        return this->directory + file;
+    }
+
+    bool read(const std::string &name, Header &header, std::vector<char> &binary) const
+    {
+        FILE *f = fopen(this->entryPath(name).c_str(), "rb");
+        if (!f)
+            return false;
+        bool ok = fread(&header, sizeof(header), 1, f) == 1 && memcmp(header.Magic, "PBC1", 4) == 0 && header.Length > 0;
+        if (ok) {
+            binary.resize(header.Length);
+            ok = fread(&binary[0], 1, header.Length, f) == header.Length;
+        }
+        fclose(f);
+        return ok;
+    }
+};
+
+#endif
@@ -0,0 +1,154 @@
+#ifndef SHADER_VARIANTS_H
+#define SHADER_VARIANTS_H
+
+#include <map>
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <iostream>
+
+#include <GL/glew.h>
+
+#include "Shader.h"
+#include "ShaderCache.h"
+#include "FileWatcher.h"
+
+// What a variant of a shader is specialized on. Each option becomes a
+// #define, so a variant carries no branches or uniforms for the others.
+struct ShaderOptions
+{
+    bool Shadows;
+    GLint PcfRadius; // shadow taps are (2 * PcfRadius + 1)^2 texels
+    GLint Lights;
+    bool Clustered; // point lights from their cluster's list, or all of them
+
+    ShaderOptions(bool shadows = true, GLint pcfRadius = 1, GLint lights = 1, bool clustered = true) : Shadows(shadows), PcfRadius(pcfRadius), Lights(lights), Clustered(clustered)
+    {
+    }
+
+    // Also the variant's key: equal options give equal strings
+    std::string Defines() const
+    {
+        char defines[128];
+        snprintf(defines, sizeof(defines), "#define SHADOWS %d\n#define PCF_RADIUS %d\n#define LIGHT_COUNT %d\n#define CLUSTERED %d\n",
+                 this->Shadows ? 1 : 0, this->PcfRadius, this->Lights, this->Clustered ? 1 : 0);
+        return defines;
+    }
+};
+
+// Every variant of one vertex/fragment pair. A variant is compiled the first
+// time it is asked for (or loaded from the ShaderCache) and kept after that.
+// Compiles started by Request() or by an edit to either file are issued
+// without waiting, and Update() swaps each one in once it has linked, never
+// in the frame that started it; a variant that fails to build keeps its old
+// program. Only drivers with KHR_parallel_shader_compile link in the
+// background. Without it (every macOS driver) there's no asking whether a
+// link is done, so Update() finishes one variant a frame and that frame
+// stalls for whatever of the link the driver has left.
+class ShaderVariants
+{
+public:
+    // sharedPath, if given, is GLSL put into the vertex shader after the
+    // defines; it is watched like the pair itself
+    ShaderVariants(const std::string &vertexPath, const std::string &fragmentPath, ShaderCache *cache = NULL, const std::string &sharedPath = "")
+        : vertexPath(vertexPath), fragmentPath(fragmentPath), sharedPath(sharedPath), cache(cache), frame(0)
+    {
+        this->watcher.Watch(vertexPath);
+        this->watcher.Watch(fragmentPath);
+        if (!sharedPath.empty())
+            this->watcher.Watch(sharedPath);
+    }
+
+    // Starts compiling a variant without waiting for it
+    void Request(const ShaderOptions &options)
+    {
+        std::string defines = options.Defines();
+        if (this->variants.count(defines) == 0 && this->pending.count(defines) == 0) {
+            this->pending[defines].Compile(this->vertexPath.c_str(), this->fragmentPath.c_str(), this->cache, defines, this->sharedPath);
+            this->started[defines] = this->frame;
+        }
+    }
+
+    // The variant's program; waits only for a variant that has never linked
+    Shader &Get(const ShaderOptions &options)
+    {
+        std::string defines = options.Defines();
+        std::map<std::string, Shader>::iterator it = this->variants.find(defines);
+        if (it != this->variants.end())
+            return it->second;
+        this->Request(options);
+        this->pending[defines].Finish();
+        it = this->variants.insert(std::make_pair(defines, this->pending[defines])).first;
+        this->pending.erase(defines);
+        this->started.erase(defines);
+        return it->second;
+    }
+
+    // Once a frame: recompiles every variant when a source file changed and
+    // swaps in those that are done; returns how many were swapped
+    GLuint Update()
+    {
+        this->frame++;
+        if (!this->watcher.Poll().empty()) {
+            std::vector<std::string> keys;
+            for (std::map<std::string, Shader>::iterator it = this->variants.begin(); it != this->variants.end(); ++it)
+                keys.push_back(it->first);
+            for (std::map<std::string, Shader>::iterator it = this->pending.begin(); it != this->pending.end(); ++it)
+                if (this->variants.count(it->first) == 0)
+                    keys.push_back(it->first);
+            for (size_t i = 0; i < keys.size(); i++) {
+                Shader &next = this->pending[keys[i]];
+                next.Delete(); // superseded by this edit, if it was compiling
+                next.Compile(this->vertexPath.c_str(), this->fragmentPath.c_str(), this->cache, keys[i], this->sharedPath);
+                this->started[keys[i]] = this->frame;
+            }
+        }
+        GLuint swapped = 0, finished = 0;
+        bool parallel = Shader::ParallelCompile();
+        std::map<std::string, Shader>::iterator it = this->pending.begin();
+        while (it != this->pending.end()) {
+            // Without parallel compile Ready() can't tell, and asking for
+            // the status right after the compile would wait for it; so
+            // would a second Finish() in the same frame
+            if (this->started[it->first] == this->frame || !it->second.Ready() || (!parallel && finished > 0)) {
+                ++it;
+                continue;
+            }
+            finished++;
+            std::map<std::string, Shader>::iterator current = this->variants.find(it->first);
+            if (it->second.Finish()) {
+                if (current != this->variants.end()) {
+                    current->second.Delete();
+                    current->second = it->second;
+                    std::cout << "Reloaded " << this->fragmentPath << std::endl;
+                } else {
+                    this->variants.insert(*it);
+                }
+                swapped++;
+            } else if (current != this->variants.end()) {
+                it->second.Delete(); // keep drawing with the old one
+            } else {
+                this->variants.insert(*it);
+            }
+            this->started.erase(it->first);
+            this->pending.erase(it++);
+        }
+        return swapped;
+    }
+
+    GLuint Count() const
+    {
+        return (GLuint)this->variants.size();
+    }
+
+private:
+    std::string vertexPath, fragmentPath, sharedPath;
+    ShaderCache *cache;
+    std::map<std::string, Shader> variants;
+    std::map<std::string, Shader> pending; // compiling, not yet swapped in
+    std::map<std::string, GLuint> started;  // the frame each pending compile began in
+    GLuint frame;                           // counts Update() calls
+    FileWatcher watcher;
+};
+
+#endif
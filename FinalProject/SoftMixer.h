@@ -0,0 +1,1357 @@
+#ifndef SOFT_MIXER_H
+#define SOFT_MIXER_H
+
+#include <cmath>
+#include <cstring>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <algorithm>
+#include <functional>
+
+#include "irrKlang/irrKlang.h"
+#include "ImaAdpcm.h"
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define SOFT_MIXER_SSE 1
+#endif
+
+// Where a SoftMixer's output goes, a block at a time, as interleaved stereo
+// floats in [-1, 1]
+class SoftMixerSink
+{
+public:
+    virtual ~SoftMixerSink()
+    {
+    }
+
+    virtual void Write(const float *frames, unsigned count, unsigned rate) = 0;
+};
+
+// Throws the mix away, counting it; for running without a sound card
+class NullSink : public SoftMixerSink
+{
+public:
+    NullSink() : Frames(0)
+    {
+    }
+
+    unsigned long long Frames;
+
+    void Write(const float * /*frames*/, unsigned count, unsigned /*rate*/)
+    {
+        this->Frames += count;
+    }
+};
+
+// Writes the mix to a 16-bit stereo WAV file, which is complete once the sink
+// is destroyed
+class WavSink : public SoftMixerSink
+{
+public:
+    explicit WavSink(const char *path) : file(path, std::ios::binary), frames(0), rate(44100)
+    {
+        if (!this->file)
+            throw std::runtime_error(std::string("Can not write ") + path);
+        this->header();
+    }
+
+    ~WavSink()
+    {
+        this->file.seekp(0);
+        this->header();
+    }
+
+    void Write(const float *frames, unsigned count, unsigned rate)
+    {
+        this->rate = rate;
+        this->samples.resize(2 * count);
+        for (unsigned i = 0; i < 2 * count; i++)
+            this->samples[i] = (short)(std::max(-1.0f, std::min(1.0f, frames[i])) * 32767.0f);
+        this->file.write((const char*)&this->samples[0], 4 * count);
+        this->frames += count;
+    }
+
+private:
+    std::ofstream file;
+    unsigned frames, rate;
+    std::vector<short> samples;
+
+    void put(unsigned value, int bytes)
+    {
+        for (int i = 0; i < bytes; i++)
+            this->file.put((char)(value >> (8 * i)));
+    }
+
+    void header()
+    {
+        this->file.write("RIFF", 4);
+        this->put(36 + 4 * this->frames, 4);
+        this->file.write("WAVEfmt ", 8);
+        this->put(16, 4);
+        this->put(1, 2); // PCM
+        this->put(2, 2);
+        this->put(this->rate, 4);
+        this->put(4 * this->rate, 4);
+        this->put(4, 2);
+        this->put(16, 2);
+        this->file.write("data", 4);
+        this->put(4 * this->frames, 4);
+    }
+};
+
+// A sound decoded whole into 16 bit samples, interleaved when stereo, or
+// kept as IMA ADPCM blocks that its voices decode as they play
+class SoftSoundSource : public irrklang::ISoundSource
+{
+public:
+    std::string Name;
+    irrklang::SAudioStreamFormat Format;
+    std::vector<short> Samples; // 8 bit sounds widened
+    std::atomic<int> Voices; // playing now, kept by the mixing thread
+    // IMA ADPCM in place of Samples, when BlockAlign is not 0
+    std::vector<unsigned char> Blocks;
+    unsigned BlockAlign, BlockFrames;
+    // A streamed source keeps where its data is instead
+    bool Streamed;
+    std::string Path;
+    std::streamoff DataOffset;
+
+    SoftSoundSource(const char *name)
+        : Name(name), Voices(0), BlockAlign(0), BlockFrames(0), Streamed(false), DataOffset(0), volume(1.0f), minDistance(1.0f), maxDistance(1000000000.0f)
+    {
+        this->Format.ChannelCount = 0;
+        this->Format.FrameCount = 0;
+        this->Format.SampleRate = 0;
+        this->Format.SampleFormat = irrklang::ESF_S16;
+    }
+
+    // Takes 8 or 16 bit PCM, mono or stereo
+    bool Decode(const void *data, irrklang::ik_s32 bytes, const irrklang::SAudioStreamFormat &format)
+    {
+        if (format.ChannelCount < 1 || format.ChannelCount > 2 || format.SampleRate <= 0)
+            return false;
+        this->Format = format;
+        this->Format.FrameCount = bytes / format.getFrameSize();
+        this->Samples.resize((size_t)this->Format.FrameCount * format.ChannelCount);
+        if (!this->Samples.empty())
+            Widen(data, this->Samples.size(), format.SampleFormat, &this->Samples[0]);
+        return this->Format.FrameCount > 0;
+    }
+
+    // Keeps IMA ADPCM blocks of blockAlign bytes as they are; frames is the
+    // count a fact chunk gave, or 0
+    bool DecodeAdpcm(const void *data, irrklang::ik_s32 bytes, const irrklang::SAudioStreamFormat &format, unsigned blockAlign, unsigned frames)
+    {
+        if (format.ChannelCount < 1 || format.ChannelCount > 2 || format.SampleRate <= 0 || bytes <= 0)
+            return false;
+        this->Format = format;
+        this->setBlocks(blockAlign, bytes, frames);
+        this->Blocks.assign((const unsigned char*)data, (const unsigned char*)data + bytes);
+        this->Blocks.resize((this->Blocks.size() + blockAlign - 1) / blockAlign * blockAlign, 0); // a cut short last block
+        return this->Format.FrameCount > 0;
+    }
+
+    // Swaps Samples for IMA ADPCM, an eighth of their size
+    void Compress()
+    {
+        if (this->BlockAlign || this->Samples.empty())
+            return;
+        this->BlockAlign = ImaAdpcm::BlockAlign(this->Format.ChannelCount);
+        this->BlockFrames = ImaAdpcm::BlockFrames(this->BlockAlign, this->Format.ChannelCount);
+        this->Blocks = ImaAdpcm::Encode(&this->Samples[0], (unsigned)this->Format.FrameCount, this->Format.ChannelCount, this->BlockAlign);
+        std::vector<short>().swap(this->Samples);
+    }
+
+    // Bytes the sound takes in memory
+    size_t Size() const
+    {
+        return this->Samples.size() * sizeof(short) + this->Blocks.size();
+    }
+
+    // count PCM samples at data to 16 bit samples at out
+    static void Widen(const void *data, size_t count, irrklang::ESampleFormat format, short *out)
+    {
+        if (format == irrklang::ESF_U8)
+            for (size_t i = 0; i < count; i++)
+                out[i] = (short)((((const unsigned char*)data)[i] - 128) * 256);
+        else
+            for (size_t i = 0; i < count; i++) {
+                const unsigned char *p = (const unsigned char*)data + 2 * i;
+                out[i] = (short)(p[0] | p[1] << 8);
+            }
+    }
+
+    // count PCM samples at data to floats at out
+    static void Convert(const void *data, size_t count, irrklang::ESampleFormat format, float *out)
+    {
+        if (format == irrklang::ESF_U8)
+            for (size_t i = 0; i < count; i++)
+                out[i] = (((const unsigned char*)data)[i] - 128) / 128.0f;
+        else
+            for (size_t i = 0; i < count; i++) {
+                const unsigned char *p = (const unsigned char*)data + 2 * i;
+                out[i] = (short)(p[0] | p[1] << 8) / 32768.0f;
+            }
+    }
+
+    // Reads only path's chunk headers, to stream its data later
+    bool OpenWav(const char *path)
+    {
+        std::ifstream file(path, std::ios::binary);
+        unsigned char header[12], chunk[8], body[16];
+        if (!file.read((char*)header, 12) || std::memcmp(header, "RIFF", 4) != 0 || std::memcmp(header + 8, "WAVE", 4) != 0)
+            return false;
+        bool haveFormat = false;
+        unsigned blockAlign = 0, frames = 0;
+        while (file.read((char*)chunk, 8)) {
+            irrklang::ik_s32 size = (irrklang::ik_s32)(chunk[4] | chunk[5] << 8 | chunk[6] << 16 | (unsigned)chunk[7] << 24);
+            std::streamoff next = (std::streamoff)file.tellg() + size + (size & 1);
+            if (std::memcmp(chunk, "fmt ", 4) == 0 && size >= 16) {
+                if (!file.read((char*)body, 16) || !readFormat(body, this->Format, blockAlign))
+                    return false;
+                haveFormat = true;
+            } else if (std::memcmp(chunk, "fact", 4) == 0 && size >= 4) {
+                if (!file.read((char*)body, 4))
+                    return false;
+                frames = body[0] | body[1] << 8 | body[2] << 16 | (unsigned)body[3] << 24;
+            } else if (std::memcmp(chunk, "data", 4) == 0 && haveFormat) {
+                if (this->Format.ChannelCount < 1 || this->Format.ChannelCount > 2 || this->Format.SampleRate <= 0)
+                    return false;
+                this->Path = path;
+                this->DataOffset = file.tellg();
+                file.seekg(0, std::ios::end);
+                size = (irrklang::ik_s32)std::min((std::streamoff)size, (std::streamoff)file.tellg() - this->DataOffset);
+                if (blockAlign)
+                    this->setBlocks(blockAlign, size, frames);
+                else
+                    this->Format.FrameCount = size / this->Format.getFrameSize();
+                this->Streamed = true;
+                return this->Format.FrameCount > 0;
+            }
+            file.seekg(next);
+        }
+        return false;
+    }
+
+    // Takes a RIFF WAV file's bytes
+    bool DecodeWav(const unsigned char *file, irrklang::ik_s32 bytes)
+    {
+        if (bytes < 12 || std::memcmp(file, "RIFF", 4) != 0 || std::memcmp(file + 8, "WAVE", 4) != 0)
+            return false;
+        irrklang::SAudioStreamFormat format;
+        bool haveFormat = false;
+        unsigned blockAlign = 0, frames = 0;
+        for (irrklang::ik_s32 at = 12; at + 8 <= bytes;) {
+            irrklang::ik_s32 size = (irrklang::ik_s32)(file[at + 4] | file[at + 5] << 8 | file[at + 6] << 16 | (unsigned)file[at + 7] << 24);
+            const unsigned char *body = file + at + 8;
+            size = std::min(size, bytes - at - 8);
+            if (std::memcmp(file + at, "fmt ", 4) == 0 && size >= 16) {
+                if (!readFormat(body, format, blockAlign))
+                    return false;
+                haveFormat = true;
+            } else if (std::memcmp(file + at, "fact", 4) == 0 && size >= 4)
+                frames = body[0] | body[1] << 8 | body[2] << 16 | (unsigned)body[3] << 24;
+            else if (std::memcmp(file + at, "data", 4) == 0 && haveFormat)
+                return blockAlign ? this->DecodeAdpcm(body, size, format, blockAlign, frames) : this->Decode(body, size, format);
+            at += 8 + size + (size & 1);
+        }
+        return false;
+    }
+
+    const irrklang::ik_c8* getName() { return this->Name.c_str(); }
+    void setStreamMode(irrklang::E_STREAM_MODE /*mode*/) {}
+    irrklang::E_STREAM_MODE getStreamMode() { return this->Streamed ? irrklang::ESM_STREAMING : irrklang::ESM_NO_STREAMING; }
+    irrklang::ik_u32 getPlayLength() { return (irrklang::ik_u32)(1000.0 * this->Format.FrameCount / this->Format.SampleRate); }
+    irrklang::SAudioStreamFormat getAudioFormat() { return this->Format; }
+    bool getIsSeekingSupported() { return true; }
+    void setDefaultVolume(irrklang::ik_f32 volume) { this->volume = volume; }
+    irrklang::ik_f32 getDefaultVolume() { return this->volume; }
+    void setDefaultMinDistance(irrklang::ik_f32 minDistance) { this->minDistance = minDistance; }
+    irrklang::ik_f32 getDefaultMinDistance() { return this->minDistance; }
+    void setDefaultMaxDistance(irrklang::ik_f32 maxDistance) { this->maxDistance = maxDistance; }
+    irrklang::ik_f32 getDefaultMaxDistance() { return this->maxDistance; }
+    void forceReloadAtNextUse() {}
+    void setForcedStreamingThreshold(irrklang::ik_s32 /*thresholdBytes*/) {}
+    irrklang::ik_s32 getForcedStreamingThreshold() { return -1; }
+    void* getSampleData() { return NULL; } // kept widened or as ADPCM, not in Format
+    // The mixer owns its sources, as irrKlang does
+    void grab() {}
+    bool drop() { return false; }
+
+private:
+    irrklang::ik_f32 volume, minDistance, maxDistance;
+
+    // The first 16 bytes of a fmt chunk; blockAlign is left 0 for PCM
+    static bool readFormat(const unsigned char *body, irrklang::SAudioStreamFormat &format, unsigned &blockAlign)
+    {
+        int tag = body[0] | body[1] << 8, bits = body[14] | body[15] << 8;
+        format.ChannelCount = body[2] | body[3] << 8;
+        format.SampleRate = (irrklang::ik_s32)(body[4] | body[5] << 8 | body[6] << 16 | (unsigned)body[7] << 24);
+        format.SampleFormat = bits == 8 ? irrklang::ESF_U8 : irrklang::ESF_S16;
+        blockAlign = 0;
+        if (tag == 0x11 && bits == 4 && format.ChannelCount >= 1 && format.ChannelCount <= 2) {
+            // IMA ADPCM, decoded to 16 bits
+            blockAlign = body[12] | body[13] << 8;
+            unsigned header = 4 * format.ChannelCount;
+            return blockAlign > header && (blockAlign - header) % header == 0;
+        }
+        return tag == 1 && (bits == 8 || bits == 16); // not compressed another way, nor a depth we do not mix
+    }
+
+    // Frames in bytes of IMA ADPCM, the last block perhaps cut short, or as
+    // many as a fact chunk says if that is fewer
+    void setBlocks(unsigned blockAlign, irrklang::ik_s32 bytes, unsigned frames)
+    {
+        int channels = this->Format.ChannelCount;
+        unsigned rest = bytes % blockAlign, count = bytes / blockAlign * ImaAdpcm::BlockFrames(blockAlign, channels);
+        if (rest > 4u * channels)
+            count += ImaAdpcm::BlockFrames(rest / (4 * channels) * (4 * channels), channels);
+        this->BlockAlign = blockAlign;
+        this->BlockFrames = ImaAdpcm::BlockFrames(blockAlign, channels);
+        this->Format.FrameCount = frames && frames < count ? frames : count;
+    }
+};
+
+// One playing of a streamed source. The I/O thread decodes its file a chunk
+// at a time into a ring of float frames, at most the power of two past a
+// quarter second, and the mixing thread reads them out; each side owns one
+// counter. A mixer that is not real time has no I/O thread and fills the
+// ring itself before reading, so it never runs dry. A looping stream seeks back to the start of the data as it reads,
+// so the loop point is just two neighbouring frames in the ring. IMA ADPCM
+// is read and decoded a whole block at a time.
+class SoftStream
+{
+public:
+    std::atomic<bool> Finished; // the mixer is done with it
+    std::atomic<bool> Ended;    // every frame is in the ring
+
+    SoftStream(const SoftSoundSource &source, bool loop)
+        : Finished(false), Ended(false), source(source), loop(loop), file(source.Path.c_str(), std::ios::binary), left(0), write(0), read(0)
+    {
+        this->capacity = 1;
+        while (this->capacity < (unsigned)source.Format.SampleRate / 4)
+            this->capacity *= 2;
+        this->ring.resize((size_t)this->capacity * source.Format.ChannelCount);
+        this->rewind();
+    }
+
+    // I/O thread, or the mixing thread when not real time: tops the ring up
+    void Fill()
+    {
+        const irrklang::SAudioStreamFormat &format = this->source.Format;
+        unsigned chunk = this->capacity / 4;
+        while (!this->Ended) {
+            if (this->left == 0) {
+                if (!this->loop || !this->rewind()) {
+                    this->Ended = true;
+                    return;
+                }
+            }
+            unsigned w = this->write.load(std::memory_order_relaxed);
+            unsigned space = this->capacity - (w - this->read.load(std::memory_order_acquire));
+            unsigned frames = std::min(this->left, std::min(space, chunk));
+            if (this->source.BlockAlign) {
+                unsigned most = std::min(space, std::max(chunk, this->source.BlockFrames));
+                frames = this->left <= most ? this->left : most / this->source.BlockFrames * this->source.BlockFrames;
+            }
+            if (frames == 0)
+                return; // full
+            unsigned at = w & (this->capacity - 1), first = std::min(frames, this->capacity - at);
+            if (this->source.BlockAlign) {
+                if (!this->readBlocks(frames, at, first)) {
+                    this->Ended = true;
+                    return;
+                }
+            } else {
+                this->bytes.resize((size_t)frames * format.getFrameSize());
+                if (!this->file.read(&this->bytes[0], this->bytes.size())) {
+                    this->Ended = true; // cut short
+                    return;
+                }
+                SoftSoundSource::Convert(&this->bytes[0], (size_t)first * format.ChannelCount, format.SampleFormat, &this->ring[(size_t)at * format.ChannelCount]);
+                SoftSoundSource::Convert(&this->bytes[(size_t)first * format.getFrameSize()], (size_t)(frames - first) * format.ChannelCount, format.SampleFormat, &this->ring[0]);
+            }
+            this->left -= frames;
+            this->write.store(w + frames, std::memory_order_release);
+        }
+    }
+
+    // Mixing thread: frames in the ring, from the read position on
+    unsigned Available() const
+    {
+        return this->write.load(std::memory_order_acquire) - this->read.load(std::memory_order_relaxed);
+    }
+
+    float Sample(unsigned frame, int channel) const
+    {
+        unsigned at = (this->read.load(std::memory_order_relaxed) + frame) & (this->capacity - 1);
+        return this->ring[(size_t)at * this->source.Format.ChannelCount + channel];
+    }
+
+    void Consume(unsigned frames)
+    {
+        this->read.store(this->read.load(std::memory_order_relaxed) + frames, std::memory_order_release);
+    }
+
+private:
+    const SoftSoundSource &source;
+    bool loop;
+    std::ifstream file;
+    unsigned left, capacity;     // frames still to read before the end
+    std::vector<char> bytes;
+    std::vector<float> ring, decoded;
+    std::atomic<unsigned> write; // by the I/O thread
+    std::atomic<unsigned> read;  // by the mixing thread
+
+    // The blocks holding the next frames frames, into the ring at at, first
+    // of them before it wraps
+    bool readBlocks(unsigned frames, unsigned at, unsigned first)
+    {
+        int channels = this->source.Format.ChannelCount;
+        unsigned blocks = (frames + this->source.BlockFrames - 1) / this->source.BlockFrames;
+        this->bytes.resize((size_t)blocks * this->source.BlockAlign);
+        this->file.read(&this->bytes[0], this->bytes.size());
+        if (this->file.gcount() == 0)
+            return false; // cut short
+        std::fill(this->bytes.begin() + (size_t)this->file.gcount(), this->bytes.end(), 0);
+        this->decoded.resize((size_t)blocks * this->source.BlockFrames * channels);
+        ImaAdpcm::Decode((const unsigned char*)&this->bytes[0], blocks, this->source.BlockAlign, channels, &this->decoded[0]);
+        std::memcpy(&this->ring[(size_t)at * channels], &this->decoded[0], (size_t)first * channels * sizeof(float));
+        std::memcpy(&this->ring[0], &this->decoded[(size_t)first * channels], (size_t)(frames - first) * channels * sizeof(float));
+        return true;
+    }
+
+    bool rewind()
+    {
+        this->file.clear();
+        this->file.seekg(this->source.DataOffset);
+        this->left = (unsigned)this->source.Format.FrameCount;
+        return this->file && this->left > 0;
+    }
+};
+
+// An irrKlang engine that mixes in software, for machines without the irrKlang
+// library. The game thread's calls become commands in a single-producer,
+// single-consumer ring; whoever calls Mix() drains it and renders the playing
+// voices into one stereo block, resampled linearly to the output rate and
+// summed with SSE. With a sink, a thread of the mixer's own calls Mix() at the
+// pace of the sound card, or as fast as it can when realTime is false; without
+// one, a device callback calls Mix() itself. Sounds are decoded whole when
+// they are added, unless they are streamed: asked for with ESM_STREAMING, or
+// files past STREAM_BYTES with ESM_AUTO_DETECT. Each playing of a streamed
+// sound gets a SoftStream, which an I/O thread keeps filled, or Mix() itself
+// when realTime is false. Sounds decoded
+// whole keep 16 bit samples, or IMA ADPCM instead, a file's own or compressed
+// when added with Compress set, decoded a few blocks at a time as they play.
+// Past RealVoices sounds at once, only the loudest are mixed. The rest are
+// virtual, moving through their sound unheard until they are loud enough
+// again. Tracked sounds, effects, plugins, stream loaders, file factories and
+// the doppler effect are not supported: play calls return 0, startPaused
+// sounds never start and the rest are accepted and ignored.
+class SoftMixer : public irrklang::ISoundEngine
+{
+public:
+    explicit SoftMixer(SoftMixerSink *sink = NULL, bool realTime = true, unsigned rate = 44100)
+        : Simd(true), RealVoices(32), Compress(false), sink(sink), realTime(realTime), rate(rate), head(0), tail(0), running(false), dropped(0), volume(1.0f),
+          minDistance(1.0f), maxDistance(1000000000.0f), rolloff(1.0f), receiver(NULL), paused(false), masterVolume(1.0f), rolloffNow(1.0f),
+          listener(0, 0, 0), right(1, 0, 0), underruns(0), realNow(0), virtualNow(0), realMost(0), virtualMost(0), mixSeconds(0.0), mixBlocks(0),
+          mixFrames(0), streaming(false)
+    {
+        std::memset(&this->internal, 0, sizeof(this->internal));
+        if (this->sink) {
+            this->running = true;
+            this->pump = std::thread(&SoftMixer::run, this);
+        }
+    }
+
+    ~SoftMixer()
+    {
+        this->Stop();
+        if (this->streaming) {
+            this->streaming = false;
+            this->io.join();
+        }
+        for (size_t i = 0; i < this->streams.size(); i++)
+            delete this->streams[i];
+        for (size_t i = 0; i < this->sources.size(); i++)
+            delete this->sources[i];
+        for (size_t i = 0; i < this->retired.size(); i++)
+            delete this->retired[i];
+    }
+
+    // Stops the thread feeding the sink; nothing is mixed after
+    void Stop()
+    {
+        if (this->running) {
+            this->running = false;
+            this->pump.join();
+        }
+    }
+
+    bool Simd;           // false mixes with plain loops, for comparing
+    unsigned RealVoices; // mixed at most at once; set before playing
+    bool Compress;       // keep sounds added from now on as IMA ADPCM
+
+    // Renders the next frames stereo frames into out, interleaved
+    void Mix(float *out, unsigned frames)
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        Command c;
+        while (this->pop(c))
+            this->apply(c);
+        std::memset(out, 0, 2 * frames * sizeof(float));
+        this->scratch.resize(2 * frames);
+        if (!this->paused)
+            this->prioritize();
+        unsigned real = 0;
+        for (size_t v = 0; v < this->voices.size() && !this->paused;) {
+            Voice &voice = this->voices[v];
+            // Each block ramps from the gains the voice was last mixed with
+            // to its new ones, which are 0 once it is virtual, so neither a
+            // change of place nor of status clicks. A voice that is real from
+            // its first block starts at its gains straight away.
+            float left = 0.0f, right = 0.0f;
+            if (voice.Real)
+                this->gains(voice, left, right);
+            if (voice.Fresh && voice.Real) {
+                voice.Left = left;
+                voice.Right = right;
+            }
+            voice.Fresh = false;
+            unsigned rendered;
+            if (voice.Left == 0.0f && voice.Right == 0.0f && left == 0.0f && right == 0.0f)
+                rendered = this->advance(voice, frames);
+            else {
+                rendered = this->render(voice, &this->scratch[0], frames);
+                this->accumulate(out, &this->scratch[0], rendered, voice.Left, voice.Right, (left - voice.Left) / frames, (right - voice.Right) / frames);
+            }
+            voice.Left = left;
+            voice.Right = right;
+            if (rendered < frames) {
+                this->release(voice);
+                voice = std::move(this->voices.back());
+                this->voices.pop_back();
+            } else {
+                // Only voices still playing after the block are counted
+                real += voice.Left > 0.0f || voice.Right > 0.0f;
+                v++;
+            }
+        }
+        this->finish(out, frames);
+        this->realNow = real;
+        this->virtualNow = (unsigned)this->voices.size() - real;
+        this->realMost = std::max(this->realMost, real);
+        this->virtualMost = std::max(this->virtualMost, (unsigned)this->voices.size() - real);
+        this->mixSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        this->mixBlocks++;
+        this->mixFrames += frames;
+        if (this->receiver) {
+            this->receiverSamples.resize(2 * frames);
+            for (unsigned i = 0; i < 2 * frames; i++)
+                this->receiverSamples[i] = (short)(out[i] * 32767.0f);
+            this->receiver->OnAudioDataReady(&this->receiverSamples[0], 4 * frames, this->rate);
+        }
+    }
+
+    // Commands lost to a full ring
+    unsigned Dropped() const
+    {
+        return this->dropped;
+    }
+
+    // Blocks in which a stream had not been read far enough
+    unsigned Underruns() const
+    {
+        return this->underruns;
+    }
+
+    // Voices heard and voices only followed, after the last block
+    unsigned RealCount() const
+    {
+        return this->realNow;
+    }
+
+    unsigned VirtualCount() const
+    {
+        return this->virtualNow;
+    }
+
+    // The mixing thread's counters; call Stop() first if a sink is fed
+    void PrintStats(std::ostream &out) const
+    {
+        out << "Mixer: " << this->mixBlocks << " blocks";
+        if (this->mixBlocks > 0)
+            out << ", " << this->mixSeconds / this->mixBlocks * 1e6 << " us each, " << this->mixSeconds * this->rate / this->mixFrames * 100.0
+                << "% of real time";
+        out << ", at most " << this->realMost << " real and " << this->virtualMost << " virtual voices, " << this->underruns << " underruns, "
+            << this->dropped << " commands dropped, " << this->SoundBytes() / 1024 << " KB of sound in memory" << std::endl;
+    }
+
+    // What the sounds decoded whole take, not counting streams
+    size_t SoundBytes() const
+    {
+        size_t bytes = 0;
+        for (size_t i = 0; i < this->sources.size(); i++)
+            bytes += this->sources[i]->Size();
+        return bytes;
+    }
+
+    const char* getDriverName() { return "SoftMixer"; }
+
+    irrklang::ISound* play2D(const char *soundFileName, bool playLooped = false, bool startPaused = false, bool track = false,
+                             irrklang::E_STREAM_MODE streamMode = irrklang::ESM_AUTO_DETECT, bool enableSoundEffects = false)
+    {
+        return this->play2D(this->sourceFor(soundFileName, streamMode), playLooped, startPaused, track, enableSoundEffects);
+    }
+
+    irrklang::ISound* play2D(irrklang::ISoundSource *source, bool playLooped = false, bool startPaused = false, bool /*track*/ = false,
+                             bool /*enableSoundEffects*/ = false)
+    {
+        this->play(source, false, irrklang::vec3df(0, 0, 0), playLooped, startPaused);
+        return NULL;
+    }
+
+    irrklang::ISound* play3D(const char *soundFileName, irrklang::vec3df pos, bool playLooped = false, bool startPaused = false, bool track = false,
+                             irrklang::E_STREAM_MODE streamMode = irrklang::ESM_AUTO_DETECT, bool enableSoundEffects = false)
+    {
+        return this->play3D(this->sourceFor(soundFileName, streamMode), pos, playLooped, startPaused, track, enableSoundEffects);
+    }
+
+    irrklang::ISound* play3D(irrklang::ISoundSource *source, irrklang::vec3df pos, bool playLooped = false, bool startPaused = false,
+                             bool /*track*/ = false, bool /*enableSoundEffects*/ = false)
+    {
+        this->play(source, true, pos, playLooped, startPaused);
+        return NULL;
+    }
+
+    void stopAllSounds()
+    {
+        Command c(Command::STOP_ALL);
+        this->push(c);
+    }
+
+    void setAllSoundsPaused(bool bPaused = true)
+    {
+        Command c(Command::PAUSE_ALL);
+        c.Flag = bPaused;
+        this->push(c);
+    }
+
+    irrklang::ISoundSource* getSoundSource(const irrklang::ik_c8 *soundName, bool addIfNotFound = true)
+    {
+        for (size_t i = 0; i < this->sources.size(); i++)
+            if (this->sources[i]->Name == soundName)
+                return this->sources[i];
+        return addIfNotFound ? this->addSoundSourceFromFile(soundName) : NULL;
+    }
+
+    irrklang::ISoundSource* getSoundSource(irrklang::ik_s32 index)
+    {
+        return index >= 0 && index < (irrklang::ik_s32)this->sources.size() ? this->sources[index] : NULL;
+    }
+
+    irrklang::ik_s32 getSoundSourceCount()
+    {
+        return (irrklang::ik_s32)this->sources.size();
+    }
+
+    irrklang::ISoundSource* addSoundSourceFromFile(const irrklang::ik_c8 *fileName, irrklang::E_STREAM_MODE mode = irrklang::ESM_AUTO_DETECT,
+                                                   bool /*preload*/ = false)
+    {
+        if (this->getSoundSource(fileName, false))
+            return NULL;
+        std::ifstream file(fileName, std::ios::binary | std::ios::ate);
+        if (mode == irrklang::ESM_STREAMING || (mode == irrklang::ESM_AUTO_DETECT && file.tellg() > (std::streamoff)STREAM_BYTES)) {
+            SoftSoundSource *source = new SoftSoundSource(fileName);
+            if (!source->OpenWav(fileName)) {
+                delete source;
+                return NULL;
+            }
+            this->sources.push_back(source);
+            return source;
+        }
+        file.seekg(0);
+        std::vector<char> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        if (bytes.empty())
+            return NULL;
+        return this->addSoundSourceFromMemory(&bytes[0], (irrklang::ik_s32)bytes.size(), fileName);
+    }
+
+    irrklang::ISoundSource* addSoundSourceFromMemory(void *memory, irrklang::ik_s32 sizeInBytes, const irrklang::ik_c8 *soundName,
+                                                     bool /*copyMemory*/ = true)
+    {
+        if (this->getSoundSource(soundName, false))
+            return NULL;
+        SoftSoundSource *source = new SoftSoundSource(soundName);
+        if (!source->DecodeWav((const unsigned char*)memory, sizeInBytes)) {
+            delete source;
+            return NULL;
+        }
+        if (this->Compress)
+            source->Compress();
+        this->sources.push_back(source);
+        return source;
+    }
+
+    irrklang::ISoundSource* addSoundSourceFromPCMData(void *memory, irrklang::ik_s32 sizeInBytes, const irrklang::ik_c8 *soundName,
+                                                      irrklang::SAudioStreamFormat format, bool /*copyMemory*/ = true)
+    {
+        if (this->getSoundSource(soundName, false))
+            return NULL;
+        SoftSoundSource *source = new SoftSoundSource(soundName);
+        if (!source->Decode(memory, sizeInBytes, format)) {
+            delete source;
+            return NULL;
+        }
+        if (this->Compress)
+            source->Compress();
+        this->sources.push_back(source);
+        return source;
+    }
+
+    irrklang::ISoundSource* addSoundSourceAlias(irrklang::ISoundSource *baseSource, const irrklang::ik_c8 *soundName)
+    {
+        SoftSoundSource *base = static_cast<SoftSoundSource*>(baseSource);
+        if (!base || this->getSoundSource(soundName, false))
+            return NULL;
+        SoftSoundSource *source = new SoftSoundSource(soundName);
+        source->Format = base->Format;
+        source->Samples = base->Samples;
+        source->Blocks = base->Blocks;
+        source->BlockAlign = base->BlockAlign;
+        source->BlockFrames = base->BlockFrames;
+        source->Streamed = base->Streamed;
+        source->Path = base->Path;
+        source->DataOffset = base->DataOffset;
+        this->sources.push_back(source);
+        return source;
+    }
+
+    // A removed source may still be playing, so it is only freed with the
+    // mixer
+    void removeSoundSource(irrklang::ISoundSource *source)
+    {
+        std::vector<SoftSoundSource*>::iterator found = std::find(this->sources.begin(), this->sources.end(), source);
+        if (found == this->sources.end())
+            return;
+        this->retired.push_back(*found);
+        this->sources.erase(found);
+    }
+
+    void removeSoundSource(const irrklang::ik_c8 *name)
+    {
+        this->removeSoundSource(this->getSoundSource(name, false));
+    }
+
+    void removeAllSoundSources()
+    {
+        this->retired.insert(this->retired.end(), this->sources.begin(), this->sources.end());
+        this->sources.clear();
+    }
+
+    void setSoundVolume(irrklang::ik_f32 volume)
+    {
+        this->volume = volume;
+        Command c(Command::VOLUME);
+        c.Value = volume;
+        this->push(c);
+    }
+
+    irrklang::ik_f32 getSoundVolume()
+    {
+        return this->volume;
+    }
+
+    void setListenerPosition(const irrklang::vec3df &pos, const irrklang::vec3df &lookdir, const irrklang::vec3df &/*velPerSecond*/ = irrklang::vec3df(0, 0, 0),
+                             const irrklang::vec3df &upVector = irrklang::vec3df(0, 1, 0))
+    {
+        Command c(Command::LISTENER);
+        c.Position = pos;
+        c.Direction = lookdir.crossProduct(upVector);
+        if (c.Direction.getLengthSQ() > 0.0f)
+            c.Direction.normalize();
+        this->push(c);
+    }
+
+    void update() {}
+    bool isCurrentlyPlaying(const char *soundName) { return this->isCurrentlyPlaying(this->getSoundSource(soundName, false)); }
+    bool isCurrentlyPlaying(irrklang::ISoundSource *source) { return source && static_cast<SoftSoundSource*>(source)->Voices > 0; }
+    void registerAudioStreamLoader(irrklang::IAudioStreamLoader */*loader*/) {}
+    bool isMultiThreaded() const { return this->sink != NULL; }
+    void addFileFactory(irrklang::IFileFactory */*fileFactory*/) {}
+    void setDefault3DSoundMinDistance(irrklang::ik_f32 minDistance) { this->minDistance = minDistance; }
+    irrklang::ik_f32 getDefault3DSoundMinDistance() { return this->minDistance; }
+    void setDefault3DSoundMaxDistance(irrklang::ik_f32 maxDistance) { this->maxDistance = maxDistance; }
+    irrklang::ik_f32 getDefault3DSoundMaxDistance() { return this->maxDistance; }
+
+    void setRolloffFactor(irrklang::ik_f32 rolloff)
+    {
+        this->rolloff = rolloff;
+        Command c(Command::ROLLOFF);
+        c.Value = rolloff;
+        this->push(c);
+    }
+
+    void setDopplerEffectParameters(irrklang::ik_f32 /*dopplerFactor*/ = 1.0f, irrklang::ik_f32 /*distanceFactor*/ = 1.0f) {}
+    bool loadPlugins(const irrklang::ik_c8 */*path*/) { return false; }
+    const irrklang::SInternalAudioInterface& getInternalAudioInterface() { return this->internal; }
+
+    // Called on the mixing thread with each block as 16-bit stereo
+    bool setMixedDataOutputReceiver(irrklang::ISoundMixedOutputReceiver *receiver)
+    {
+        this->receiver = receiver;
+        return true;
+    }
+
+    // Times ten seconds of 8 to 256 looping voices, half of them placed
+    // around the listener: every voice mixed with SSE and with plain loops,
+    // then with the default real voice limit; then 64 voices playing IMA
+    // ADPCM against the same from 16 bit samples, and the decoder alone
+    static void Benchmark(std::ostream &out)
+    {
+        const unsigned counts[] = { 8, 64, 256 }, seconds = 10;
+        for (int n = 0; n < 3; n++) {
+            double times[3];
+            std::vector<float> last[3];
+            unsigned virtuals = 0;
+            for (int run = 0; run < 3; run++) {
+                SoftMixer mixer;
+                mixer.Simd = run != 0;
+                if (run < 2)
+                    mixer.RealVoices = counts[n];
+                times[run] = time(mixer, counts[n], seconds, last[run]);
+                virtuals = mixer.VirtualCount();
+            }
+            float worst = 0.0f;
+            for (size_t i = 0; i < last[0].size(); i++)
+                worst = std::max(worst, std::fabs(last[0][i] - last[1][i]));
+            out << counts[n] << " voices: " << times[1] * 1000.0 / seconds << " ms per second of sound"
+#ifdef SOFT_MIXER_SSE
+                << " with SSE"
+#endif
+                << ", " << times[0] * 1000.0 / seconds << " ms with plain loops, " << seconds / times[1] << "x real time; "
+                << times[2] * 1000.0 / seconds << " ms with " << virtuals << " of them virtual" << (worst < 1e-4f ? "" : ", MISMATCH") << std::endl;
+        }
+        double times[3];
+        size_t bytes[3];
+        std::vector<float> last[3];
+        for (int run = 0; run < 3; run++) {
+            SoftMixer mixer;
+            mixer.Simd = run != 1;
+            mixer.Compress = run != 0;
+            mixer.RealVoices = 64;
+            times[run] = time(mixer, 64, seconds, last[run]);
+            bytes[run] = mixer.SoundBytes();
+        }
+        float worst = 0.0f;
+        for (size_t i = 0; i < last[1].size(); i++)
+            worst = std::max(worst, std::fabs(last[1][i] - last[2][i]));
+        out << "64 voices from IMA ADPCM: " << times[2] * 1000.0 / seconds << " ms per second of sound, " << times[1] * 1000.0 / seconds
+            << " ms with plain loops, " << bytes[2] / 1024 << " KB of sound; from 16 bit samples " << times[0] * 1000.0 / seconds << " ms, "
+            << bytes[0] / 1024 << " KB" << (worst < 1e-4f ? "" : ", MISMATCH") << std::endl;
+        ImaAdpcm::Benchmark(out);
+    }
+
+private:
+    static const unsigned CAPACITY = 256; // commands, a power of two
+    static const unsigned BLOCK = 512;    // frames the mixing thread renders at a time
+    static const unsigned STREAM_BYTES = 256 * 1024; // files streamed by ESM_AUTO_DETECT
+
+    struct Command
+    {
+        enum Kind { PLAY, STOP_ALL, PAUSE_ALL, VOLUME, ROLLOFF, LISTENER };
+
+        Kind What;
+        SoftSoundSource *Source;
+        SoftStream *Stream;
+        irrklang::vec3df Position, Direction;
+        bool Loop, Positional, Flag;
+        float Value;
+
+        Command(Kind what = PLAY) : What(what), Source(NULL), Stream(NULL), Loop(false), Positional(false), Flag(false), Value(0.0f)
+        {
+        }
+    };
+
+    struct Voice
+    {
+        SoftSoundSource *Source;
+        SoftStream *Stream;    // or NULL when Source is decoded whole
+        double Position, Step; // in source frames, from the stream's read position
+        bool Loop, Positional;
+        irrklang::vec3df Where;
+        bool Real, Fresh;      // chosen to be mixed this block; not mixed yet
+        float Left, Right;     // gains it was last mixed with, 0 while virtual
+        float Priority;
+        // frames Window on of an IMA ADPCM source, decoded
+        unsigned Window;
+        std::vector<float> Decoded;
+    };
+
+    // Control side, the thread making engine calls
+    SoftMixerSink *sink;
+    bool realTime;
+    unsigned rate;
+    Command ring[CAPACITY];
+    std::atomic<unsigned> head, tail;
+    std::atomic<bool> running;
+    std::thread pump;
+    unsigned dropped;
+    std::vector<SoftSoundSource*> sources, retired;
+    irrklang::ik_f32 volume, minDistance, maxDistance, rolloff;
+    irrklang::SInternalAudioInterface internal;
+    irrklang::ISoundMixedOutputReceiver *receiver;
+    // Mixing side, the thread calling Mix()
+    std::vector<Voice> voices;
+    std::vector<float> scratch;
+    std::vector<short> receiverSamples;
+    bool paused;
+    float masterVolume, rolloffNow;
+    irrklang::vec3df listener, right;
+    unsigned underruns;
+    std::vector<float> priorities;
+    std::atomic<unsigned> realNow, virtualNow;
+    unsigned realMost, virtualMost;
+    double mixSeconds;
+    unsigned long long mixBlocks, mixFrames;
+    // Streams being played, shared by the control side and the I/O thread
+    std::mutex streamsLock;
+    std::vector<SoftStream*> streams;
+    std::atomic<bool> streaming;
+    std::thread io;
+
+    bool push(const Command &c)
+    {
+        unsigned h = this->head.load(std::memory_order_relaxed);
+        if (h - this->tail.load(std::memory_order_acquire) == CAPACITY) {
+            this->dropped++;
+            return false;
+        }
+        this->ring[h & (CAPACITY - 1)] = c;
+        this->head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(Command &c)
+    {
+        unsigned t = this->tail.load(std::memory_order_relaxed);
+        if (t == this->head.load(std::memory_order_acquire))
+            return false;
+        c = this->ring[t & (CAPACITY - 1)];
+        this->tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    void play(irrklang::ISoundSource *source, bool positional, const irrklang::vec3df &where, bool loop, bool startPaused)
+    {
+        if (!source || startPaused)
+            return;
+        Command c(Command::PLAY);
+        c.Source = static_cast<SoftSoundSource*>(source);
+        c.Positional = positional;
+        c.Position = where;
+        c.Loop = loop;
+        if (c.Source->Streamed) {
+            // filled once here so it starts at once, then by the I/O thread
+            // or, when not real time, by Mix()
+            c.Stream = new SoftStream(*c.Source, loop);
+            c.Stream->Fill();
+            std::lock_guard<std::mutex> lock(this->streamsLock);
+            this->collect();
+            this->streams.push_back(c.Stream);
+            if (this->realTime && !this->streaming) {
+                this->streaming = true;
+                this->io = std::thread(&SoftMixer::feed, this);
+            }
+        }
+        if (!this->push(c) && c.Stream)
+            c.Stream->Finished = true;
+    }
+
+    irrklang::ISoundSource* sourceFor(const char *soundFileName, irrklang::E_STREAM_MODE streamMode)
+    {
+        irrklang::ISoundSource *source = this->getSoundSource(soundFileName, false);
+        return source ? source : this->addSoundSourceFromFile(soundFileName, streamMode);
+    }
+
+    // The mixing thread is done with voice
+    void release(Voice &voice)
+    {
+        voice.Source->Voices--;
+        if (voice.Stream)
+            voice.Stream->Finished = true;
+    }
+
+    // Frees the streams the mixer is done with; streamsLock must be held
+    void collect()
+    {
+        for (size_t i = 0; i < this->streams.size();) {
+            if (this->streams[i]->Finished) {
+                delete this->streams[i];
+                this->streams[i] = this->streams.back();
+                this->streams.pop_back();
+            } else
+                i++;
+        }
+    }
+
+    // The I/O thread: tops up every stream and frees the finished ones
+    void feed()
+    {
+        while (this->streaming) {
+            {
+                std::lock_guard<std::mutex> lock(this->streamsLock);
+                this->collect();
+                for (size_t i = 0; i < this->streams.size(); i++)
+                    this->streams[i]->Fill();
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+    }
+
+    void apply(const Command &c)
+    {
+        switch (c.What) {
+            case Command::PLAY: {
+                Voice voice;
+                voice.Source = c.Source;
+                voice.Stream = c.Stream;
+                voice.Position = 0.0;
+                voice.Step = (double)c.Source->Format.SampleRate / this->rate;
+                voice.Loop = c.Loop;
+                voice.Positional = c.Positional;
+                voice.Where = c.Position;
+                voice.Real = false;
+                voice.Fresh = true;
+                voice.Left = voice.Right = 0.0f;
+                voice.Window = 0;
+                c.Source->Voices++;
+                this->voices.push_back(voice);
+            } break;
+            case Command::STOP_ALL:
+                for (size_t v = 0; v < this->voices.size(); v++)
+                    this->release(this->voices[v]);
+                this->voices.clear();
+                break;
+            case Command::PAUSE_ALL: this->paused = c.Flag; break;
+            case Command::VOLUME: this->masterVolume = c.Value; break;
+            case Command::ROLLOFF: this->rolloffNow = c.Value; break;
+            case Command::LISTENER:
+                this->listener = c.Position;
+                this->right = c.Direction;
+                break;
+        }
+    }
+
+    // A 3D voice fades with distance past its source's min distance and
+    // stops fading at the max, and pans by which side of the listener it
+    // is on, keeping its power
+    void gains(const Voice &voice, float &left, float &right) const
+    {
+        float gain = voice.Source->getDefaultVolume(), pan = 0.0f;
+        if (voice.Positional) {
+            irrklang::vec3df to = voice.Where - this->listener;
+            float distance = (float)to.getLength();
+            float closest = voice.Source->getDefaultMinDistance(), farthest = voice.Source->getDefaultMaxDistance();
+            float clamped = std::max(closest, std::min(farthest, distance));
+            gain *= closest / (closest + this->rolloffNow * (clamped - closest));
+            if (distance > 0.0f)
+                pan = to.dotProduct(this->right) / distance;
+        }
+        float angle = (pan + 1.0f) * 0.78539816f;
+        left = gain * std::cos(angle) * 1.41421356f;
+        right = gain * std::sin(angle) * 1.41421356f;
+    }
+
+    // Resamples voice into frames stereo frames at out and moves it on;
+    // returns fewer than frames when a sound that does not loop ran out
+    unsigned render(Voice &voice, float *out, unsigned frames)
+    {
+        if (voice.Stream)
+            return this->renderStream(voice, out, frames);
+        if (voice.Source->BlockAlign)
+            return this->renderBlocks(voice, out, frames);
+        const SoftSoundSource &source = *voice.Source;
+        const short *samples = &source.Samples[0];
+        const float scale = 1.0f / 32768.0f;
+        double length = source.Format.FrameCount;
+        bool stereo = source.Format.ChannelCount == 2;
+        unsigned i = 0;
+        for (; i < frames; i++) {
+            if (voice.Position >= length) {
+                if (!voice.Loop)
+                    break;
+                voice.Position -= length;
+            }
+            size_t at = (size_t)voice.Position, next = at + 1;
+            if (next >= (size_t)length)
+                next = voice.Loop ? 0 : at;
+            float t = (float)(voice.Position - at);
+            if (stereo) {
+                float left = samples[2 * at] * scale, right = samples[2 * at + 1] * scale;
+                out[2 * i] = left + t * (samples[2 * next] * scale - left);
+                out[2 * i + 1] = right + t * (samples[2 * next + 1] * scale - right);
+            } else {
+                float now = samples[at] * scale;
+                out[2 * i] = out[2 * i + 1] = now + t * (samples[next] * scale - now);
+            }
+            voice.Position += voice.Step;
+        }
+        return i;
+    }
+
+    // The same from IMA ADPCM, through a window of as many blocks as the
+    // decoder takes at once and the first frame of the block after
+    unsigned renderBlocks(Voice &voice, float *out, unsigned frames)
+    {
+        const SoftSoundSource &source = *voice.Source;
+        int channels = source.Format.ChannelCount;
+        unsigned span = source.BlockFrames * (4u / channels);
+        double length = source.Format.FrameCount;
+        float start[2] = { ImaAdpcm::First(&source.Blocks[0], 0), ImaAdpcm::First(&source.Blocks[0], channels - 1) };
+        unsigned i = 0;
+        for (; i < frames; i++) {
+            if (voice.Position >= length) {
+                if (!voice.Loop)
+                    break;
+                voice.Position -= length;
+            }
+            size_t at = (size_t)voice.Position;
+            if (voice.Decoded.empty() || at < voice.Window || at >= voice.Window + span)
+                this->decode(voice, (unsigned)(at / span * span), span);
+            const float *now = &voice.Decoded[(at - voice.Window) * channels], *next = now + channels;
+            if (at + 1 >= (size_t)length)
+                next = voice.Loop ? start : now;
+            float t = (float)(voice.Position - at);
+            if (channels == 2) {
+                out[2 * i] = now[0] + t * (next[0] - now[0]);
+                out[2 * i + 1] = now[1] + t * (next[1] - now[1]);
+            } else
+                out[2 * i] = out[2 * i + 1] = now[0] + t * (next[0] - now[0]);
+            voice.Position += voice.Step;
+        }
+        return i;
+    }
+
+    // Decodes the span frames of voice's source from frame window on
+    void decode(Voice &voice, unsigned window, unsigned span)
+    {
+        const SoftSoundSource &source = *voice.Source;
+        int channels = source.Format.ChannelCount;
+        unsigned block = window / source.BlockFrames, total = (unsigned)(source.Blocks.size() / source.BlockAlign);
+        unsigned blocks = std::min(4u / channels, total - block);
+        voice.Decoded.resize((size_t)(span + 1) * channels);
+        ImaAdpcm::Decode(&source.Blocks[(size_t)block * source.BlockAlign], blocks, source.BlockAlign, channels, &voice.Decoded[0], this->Simd);
+        if (block + blocks < total)
+            for (int c = 0; c < channels; c++)
+                voice.Decoded[(size_t)span * channels + c] = ImaAdpcm::First(&source.Blocks[(size_t)(block + blocks) * source.BlockAlign], c);
+        voice.Window = window;
+    }
+
+    // The same from a stream's ring, handing back the frames it has passed.
+    // When the I/O thread has fallen behind, the rest of the block is silent
+    // and the voice carries on.
+    unsigned renderStream(Voice &voice, float *out, unsigned frames)
+    {
+        SoftStream &stream = *voice.Stream;
+        if (!this->realTime)
+            stream.Fill(); // nobody else will, and nothing is waiting on the block
+        bool ended = stream.Ended, stereo = voice.Source->Format.ChannelCount == 2;
+        unsigned available = stream.Available(), i = 0;
+        for (; i < frames; i++) {
+            unsigned at = (unsigned)voice.Position;
+            if (at >= available || (at + 1 >= available && !ended))
+                break;
+            unsigned next = at + 1 < available ? at + 1 : at;
+            float t = (float)(voice.Position - at);
+            if (stereo) {
+                out[2 * i] = stream.Sample(at, 0) + t * (stream.Sample(next, 0) - stream.Sample(at, 0));
+                out[2 * i + 1] = stream.Sample(at, 1) + t * (stream.Sample(next, 1) - stream.Sample(at, 1));
+            } else
+                out[2 * i] = out[2 * i + 1] = stream.Sample(at, 0) + t * (stream.Sample(next, 0) - stream.Sample(at, 0));
+            voice.Position += voice.Step;
+        }
+        unsigned passed = std::min((unsigned)voice.Position, available);
+        stream.Consume(passed);
+        voice.Position -= passed;
+        if (i == frames || ended)
+            return i;
+        this->underruns++;
+        std::memset(out + 2 * i, 0, 2 * (frames - i) * sizeof(float));
+        return frames;
+    }
+
+    // out += voice * (left, right), the gains moving on by (leftStep,
+    // rightStep) a frame; two frames to a register
+    void accumulate(float *out, const float *voice, unsigned frames, float left, float right, float leftStep, float rightStep) const
+    {
+        unsigned i = 0, count = 2 * frames;
+#ifdef SOFT_MIXER_SSE
+        if (this->Simd) {
+            __m128 gain = _mm_setr_ps(left, right, left + leftStep, right + rightStep);
+            __m128 step = _mm_setr_ps(2.0f * leftStep, 2.0f * rightStep, 2.0f * leftStep, 2.0f * rightStep);
+            for (; i + 4 <= count; i += 4) {
+                _mm_storeu_ps(out + i, _mm_add_ps(_mm_loadu_ps(out + i), _mm_mul_ps(_mm_loadu_ps(voice + i), gain)));
+                gain = _mm_add_ps(gain, step);
+            }
+        }
+#endif
+        for (; i < count; i += 2) {
+            out[i] += voice[i] * (left + leftStep * (i / 2));
+            out[i + 1] += voice[i + 1] * (right + rightStep * (i / 2));
+        }
+    }
+
+    // Marks the RealVoices loudest voices real. A voice that is real already
+    // counts a quarter louder, so two about as loud do not trade places
+    // every block.
+    void prioritize()
+    {
+        size_t count = this->voices.size();
+        for (size_t v = 0; v < count; v++) {
+            Voice &voice = this->voices[v];
+            float left, right;
+            this->gains(voice, left, right);
+            voice.Priority = std::max(left, right) * (voice.Left > 0.0f || voice.Right > 0.0f ? 1.25f : 1.0f);
+            voice.Real = true;
+        }
+        if (count <= this->RealVoices)
+            return;
+        this->priorities.resize(count);
+        for (size_t v = 0; v < count; v++)
+            this->priorities[v] = this->voices[v].Priority;
+        std::nth_element(this->priorities.begin(), this->priorities.begin() + this->RealVoices, this->priorities.end(), std::greater<float>());
+        float quietest = this->priorities[this->RealVoices];
+        // strictly louder than the first voice left out, then ties in order
+        unsigned real = 0;
+        for (size_t v = 0; v < count; v++) {
+            this->voices[v].Real = this->voices[v].Priority > quietest;
+            real += this->voices[v].Real;
+        }
+        for (size_t v = 0; v < count && real < this->RealVoices; v++)
+            if (!this->voices[v].Real && this->voices[v].Priority == quietest) {
+                this->voices[v].Real = true;
+                real++;
+            }
+        // A voice left out is still mixed for the block it fades over, so
+        // the quietest of those coming in wait until it is gone
+        for (size_t v = 0; v < count; v++)
+            real += !this->voices[v].Real && (this->voices[v].Left > 0.0f || this->voices[v].Right > 0.0f);
+        for (; real > this->RealVoices; real--) {
+            Voice *waiting = NULL;
+            for (size_t v = 0; v < count; v++) {
+                Voice &voice = this->voices[v];
+                if (voice.Real && voice.Left == 0.0f && voice.Right == 0.0f && (!waiting || voice.Priority < waiting->Priority))
+                    waiting = &voice;
+            }
+            if (!waiting)
+                break;
+            waiting->Real = false;
+        }
+    }
+
+    // Moves a virtual voice on as if it had been mixed; returns fewer than
+    // frames when it ran out
+    unsigned advance(Voice &voice, unsigned frames)
+    {
+        double to = voice.Position + voice.Step * frames;
+        if (voice.Stream) {
+            if (!this->realTime)
+                voice.Stream->Fill();
+            unsigned available = voice.Stream->Available();
+            bool ended = voice.Stream->Ended;
+            unsigned passed = std::min((unsigned)to, available);
+            voice.Stream->Consume(passed);
+            voice.Position = to - passed;
+            return ended && to >= available ? 0 : frames;
+        }
+        double length = voice.Source->Format.FrameCount;
+        if (to < length) {
+            voice.Position = to;
+            return frames;
+        }
+        if (!voice.Loop)
+            return std::min((unsigned)((length - voice.Position) / voice.Step), frames - 1);
+        voice.Position = std::fmod(to, length);
+        return frames;
+    }
+
+    // Master volume, then clipped to [-1, 1]
+    void finish(float *out, unsigned frames) const
+    {
+        unsigned i = 0, count = 2 * frames;
+#ifdef SOFT_MIXER_SSE
+        if (this->Simd) {
+            __m128 gain = _mm_set1_ps(this->masterVolume), lo = _mm_set1_ps(-1.0f), hi = _mm_set1_ps(1.0f);
+            for (; i + 4 <= count; i += 4)
+                _mm_storeu_ps(out + i, _mm_max_ps(lo, _mm_min_ps(hi, _mm_mul_ps(_mm_loadu_ps(out + i), gain))));
+        }
+#endif
+        for (; i < count; i++)
+            out[i] = std::max(-1.0f, std::min(1.0f, out[i] * this->masterVolume));
+    }
+
+    // The mixing thread: a block at a time into the sink, each when the
+    // last one would have finished playing
+    void run()
+    {
+        std::vector<float> block(2 * BLOCK);
+        std::chrono::steady_clock::time_point next = std::chrono::steady_clock::now();
+        while (this->running) {
+            this->Mix(&block[0], BLOCK);
+            this->sink->Write(&block[0], BLOCK, this->rate);
+            if (this->realTime) {
+                next += std::chrono::microseconds(1000000ull * BLOCK / this->rate);
+                std::this_thread::sleep_until(next);
+            }
+        }
+    }
+
+    // Seconds of voices looping the benchmark's tones, half of them 3D; the
+    // last block mixed goes in last
+    static double time(SoftMixer &mixer, unsigned voices, unsigned seconds, std::vector<float> &last)
+    {
+        const unsigned block = 512;
+        mixer.tone("mono", 1, 44100, 440.0f);
+        mixer.tone("stereo", 2, 22050, 330.0f);
+        mixer.setListenerPosition(irrklang::vec3df(0, 0, 0), irrklang::vec3df(0, 0, 1));
+        for (unsigned v = 0; v < voices; v++) {
+            irrklang::ISoundSource *source = mixer.getSoundSource(v % 3 ? "mono" : "stereo", false);
+            if (v % 2)
+                mixer.play3D(source, irrklang::vec3df((float)(v % 7) - 3.0f, 0.0f, (float)(v % 5)), true);
+            else
+                mixer.play2D(source, true);
+        }
+        last.resize(2 * block);
+        unsigned blocks = seconds * mixer.rate / block;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (unsigned b = 0; b < blocks; b++)
+            mixer.Mix(&last[0], block);
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // A second of sine wave, as 16-bit PCM, for the benchmark
+    void tone(const char *name, int channels, int rate, float pitch)
+    {
+        std::vector<short> samples((size_t)rate * channels);
+        for (int i = 0; i < rate; i++)
+            for (int c = 0; c < channels; c++)
+                samples[(size_t)i * channels + c] = (short)(8000.0f * std::sin(6.2831853f * pitch * i / rate + c));
+        irrklang::SAudioStreamFormat format;
+        format.ChannelCount = channels;
+        format.FrameCount = rate;
+        format.SampleRate = rate;
+        format.SampleFormat = irrklang::ESF_S16;
+        this->addSoundSourceFromPCMData(&samples[0], (irrklang::ik_s32)(samples.size() * 2), name, format);
+    }
+};
+
+#endif
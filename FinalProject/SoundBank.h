@@ -0,0 +1,131 @@
+#ifndef SOUND_BANK_H
+#define SOUND_BANK_H
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <string>
+#include <iostream>
+#include <stdexcept>
+#include <algorithm>
+
+#include "irrKlang/irrKlang.h"
+
+// Sound effects loaded whole into the engine before the game starts, played
+// by handle. Trigger() only writes the handle into a ring that a dispatch
+// thread drains, so the game thread neither looks up a file name nor waits
+// on the engine. There is one producer, the game thread, and one consumer,
+// so the ring needs no lock: each side owns one index and publishes it with
+// release/acquire. The dispatch thread also keeps how long each trigger
+// waited until the engine had started it.
+class SoundBank
+{
+public:
+    SoundBank() : engine(NULL), head(0), tail(0), running(false), dropped(0), played(0), totalWait(0.0), longestWait(0.0)
+    {
+    }
+
+    ~SoundBank()
+    {
+        this->Stop();
+    }
+
+    void Open(irrklang::ISoundEngine *engine)
+    {
+        this->engine = engine;
+    }
+
+    // Decodes path into memory now; returns the handle to Trigger() it with
+    unsigned Load(const char *path)
+    {
+        irrklang::ISoundSource *source = this->engine->addSoundSourceFromFile(path, irrklang::ESM_NO_STREAMING, true);
+        if (!source)
+            source = this->engine->getSoundSource(path, false); // loaded already
+        if (!source)
+            throw std::runtime_error(std::string("Can not load sound ") + path);
+        this->sources.push_back(source);
+        return (unsigned)this->sources.size() - 1;
+    }
+
+    // Starts the dispatch thread; Load() every sound first
+    void Start()
+    {
+        if (this->running)
+            return;
+        this->running = true;
+        this->dispatcher = std::thread(&SoundBank::dispatch, this);
+    }
+
+    // Plays what was triggered so far and stops the dispatch thread
+    void Stop()
+    {
+        if (!this->running)
+            return;
+        this->running = false;
+        this->dispatcher.join();
+    }
+
+    // Game thread only. A full ring drops the sound rather than wait.
+    void Trigger(unsigned sound)
+    {
+        unsigned h = this->head.load(std::memory_order_relaxed);
+        if (h - this->tail.load(std::memory_order_acquire) == CAPACITY) {
+            this->dropped++;
+            return;
+        }
+        this->ring[h & (CAPACITY - 1)].Sound = sound;
+        this->ring[h & (CAPACITY - 1)].Queued = std::chrono::steady_clock::now();
+        this->head.store(h + 1, std::memory_order_release);
+    }
+
+    // Trigger to playback start, once the bank is stopped
+    void PrintLatency(std::ostream &out) const
+    {
+        out << "Sounds: " << this->played << " played";
+        if (this->played > 0)
+            out << ", trigger to playback " << this->totalWait / this->played * 1e6 << " us average, " << this->longestWait * 1e6 << " us longest";
+        out << ", " << this->dropped << " dropped" << std::endl;
+    }
+
+private:
+    static const unsigned CAPACITY = 64; // a power of two
+
+    struct Request
+    {
+        unsigned Sound;
+        std::chrono::steady_clock::time_point Queued;
+    };
+
+    irrklang::ISoundEngine *engine;
+    std::vector<irrklang::ISoundSource*> sources;
+    Request ring[CAPACITY];
+    std::atomic<unsigned> head, tail; // written by Trigger() and dispatch()
+    std::atomic<bool> running;
+    std::thread dispatcher;
+    unsigned dropped;                 // by the game thread
+    unsigned played;                  // the rest by the dispatch thread
+    double totalWait, longestWait;
+
+    void dispatch()
+    {
+        for (;;) {
+            bool last = !this->running;
+            unsigned t = this->tail.load(std::memory_order_relaxed);
+            while (t != this->head.load(std::memory_order_acquire)) {
+                Request request = this->ring[t & (CAPACITY - 1)];
+                this->tail.store(++t, std::memory_order_release);
+                this->engine->play2D(this->sources[request.Sound]);
+                double wait = std::chrono::duration<double>(std::chrono::steady_clock::now() - request.Queued).count();
+                this->played++;
+                this->totalWait += wait;
+                this->longestWait = std::max(this->longestWait, wait);
+            }
+            if (last)
+                return;
+            std::this_thread::sleep_for(std::chrono::microseconds(500));
+        }
+    }
+};
+
+#endif
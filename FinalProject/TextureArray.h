@@ -0,0 +1,56 @@
+#ifndef TEXTURE_ARRAY_H
+#define TEXTURE_ARRAY_H
+
+#include <vector>
+
+#include <GL/glew.h>
+
+#include "TextureCache.h"
+
+// Packs several images into one GL_TEXTURE_2D_ARRAY so every material can be
+// sampled through a single binding; a draw picks its material with a layer
+// index instead of a texture bind. Each image is decoded at 1/scale and
+// cooked through the TextureCache at Size x Size, so sources of different
+// sizes can share it.
+class TextureArray
+{
+public:
+    GLuint Texture;
+    GLint Size;
+    GLint Layers;
+
+    // Builds the array from images, in order: layer i holds images[i]
+    TextureArray(TextureCache &cache, GLint size, const std::vector<const char*> &images, int scale, bool compress) : Size(size), Layers((GLint)images.size())
+    {
+        GLint levels = 1;
+        while ((size >> levels) > 0)
+            levels++;
+        glGenTextures(1, &this->Texture);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, this->Texture);
+        // Allocate every level up front, then fill it in layer by layer
+        for (GLint i = 0; i < levels; i++) {
+            GLint s = size >> i;
+            if (compress)
+                glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, i, GL_COMPRESSED_RGB_S3TC_DXT1_EXT, s, s, this->Layers, 0, ((s + 3) / 4) * ((s + 3) / 4) * 8 * this->Layers, NULL);
+            else
+                glTexImage3D(GL_TEXTURE_2D_ARRAY, i, GL_RGB, s, s, this->Layers, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+        }
+        for (GLint layer = 0; layer < this->Layers; layer++)
+            cache.LoadLayer(layer, images[layer], scale, size, compress);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, levels - 1);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    }
+
+    // Binds the array to texture unit GL_TEXTURE0 + unit
+    void Bind(GLuint unit) const
+    {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, this->Texture);
+    }
+};
+
+#endif
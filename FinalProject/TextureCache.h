@@ -0,0 +1,302 @@
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include <GL/glew.h>
+#include <SOIL.h>
+#include "SOIL/src/image_helper.h"
+extern "C" {
+#include "SOIL/src/image_DXT.h"
+}
+
+#include "CacheFile.h"
+
+// On-disk cache of GPU-ready textures. An entry holds a texture's whole mip
+// chain, optionally DXT1-compressed, and is named after a hash of the source
+// file's bytes plus the load options. A hit maps the entry and uploads every
+// level straight out of the mapping; a miss decodes the source with SOIL,
+// builds the chain and writes the entry for next time. Once the directory
+// grows past its budget, the least recently used entries are deleted.
+// Entries can also be cooked to a fixed square size and uploaded as one layer
+// of a GL_TEXTURE_2D_ARRAY (see TextureArray.h).
+class TextureCache
+{
+public:
+    struct Stats
+    {
+        GLuint Hits, Misses, Evictions;
+        size_t BytesRead, BytesWritten;
+        double Seconds; // time spent inside Load() and LoadLayer()
+    };
+
+    // Creates the cache directory if it isn't there yet
+    TextureCache(const std::string &directory, size_t maxBytes) : directory(directory), maxBytes(maxBytes)
+    {
+        memset(&this->stats, 0, sizeof(this->stats));
+        mkdir(directory.c_str(), 0755);
+    }
+
+    // Fills texture with the image at imageName, decoded at 1/scale (1, 2, 4
+    // or 8) and, if compress is set, stored as DXT1
+    void Load(GLuint texture, const char *imageName, int scale, bool compress)
+    {
+        glBindTexture(GL_TEXTURE_2D, texture);
+        this->fetch(imageName, scale, 0, compress, -1);
+    }
+
+    // Fills one layer of the bound GL_TEXTURE_2D_ARRAY, whose levels must
+    // already be allocated, with the image decoded at 1/scale and resampled
+    // to size x size
+    void LoadLayer(GLint layer, const char *imageName, int scale, GLint size, bool compress)
+    {
+        this->fetch(imageName, scale, size, compress, layer);
+    }
+
+    const Stats &GetStats() const
+    {
+        return this->stats;
+    }
+
+    void PrintStats(std::ostream &out) const
+    {
+        out << "Texture cache: " << this->stats.Hits << " hits, " << this->stats.Misses << " misses, "
+            << this->stats.Evictions << " evicted, " << this->stats.BytesRead << " bytes mapped, "
+            << this->stats.BytesWritten << " bytes written, " << this->stats.Seconds * 1000.0 << " ms" << std::endl;
+    }
+
+private:
+    // Entry layout: Header, then per level a GLuint byte count and the texels
+    struct Header
+    {
+        char Magic[4];
+        GLuint Version;
+        GLenum InternalFormat;
+        GLint Width, Height;
+        GLuint Levels;
+    };
+    static const GLuint VERSION = 1;
+
+    std::string directory;
+    size_t maxBytes;
+    Stats stats;
+
+    static unsigned char *mapFile(const char *path, size_t *size)
+    {
+        int fd = open(path, O_RDONLY);
+        if (fd < 0)
+            return NULL;
+        struct stat st;
+        void *data = MAP_FAILED;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            *size = (size_t)st.st_size;
+            data = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        close(fd);
+        return data == MAP_FAILED ? NULL : (unsigned char *)data;
+    }
+
+    std::string entryPath(unsigned long long key, int scale, GLint size, bool compress) const
+    {
+        char name[64];
+        snprintf(name, sizeof(name), "/%016llx-s%d-%d%s.txc", key, scale, size, compress ? "-dxt1" : "");
+        return this->directory + name;
+    }
+
+    void fetch(const char *imageName, int scale, GLint size, bool compress, GLint layer)
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        size_t sourceSize;
+        unsigned char *source = mapFile(imageName, &sourceSize);
+        if (!source)
+            throw std::runtime_error(std::string("Can not open texture ") + imageName);
+        std::string path = this->entryPath(CacheFile::Hash(source, sourceSize), scale, size, compress);
+        size_t entrySize;
+        unsigned char *entry = mapFile(path.c_str(), &entrySize);
+        if (entry && upload(entry, entrySize, layer)) {
+            this->stats.Hits++;
+            this->stats.BytesRead += entrySize;
+            utimes(path.c_str(), NULL); // bump it in the LRU order
+            munmap(entry, entrySize);
+            munmap(source, sourceSize);
+        } else {
+            if (entry)
+                munmap(entry, entrySize);
+            std::vector<unsigned char> built = build(source, sourceSize, scale, size, compress);
+            munmap(source, sourceSize);
+            if (built.empty())
+                throw std::runtime_error(SOIL_last_result());
+            upload(&built[0], built.size(), layer);
+            if (CacheFile::Write(path, NULL, 0, &built[0], built.size()))
+                this->stats.BytesWritten += built.size();
+            this->stats.Misses++;
+            this->evict(path);
+        }
+        this->stats.Seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // Uploads every level of an entry to the bound texture, or to one layer of
+    // the bound array; false if the entry is truncated or from another version
+    static bool upload(const unsigned char *entry, size_t size, GLint layer)
+    {
+        Header header;
+        if (size < sizeof(header))
+            return false;
+        memcpy(&header, entry, sizeof(header));
+        if (memcmp(header.Magic, "TXC1", 4) != 0 || header.Version != VERSION || header.Levels == 0)
+            return false;
+        // Check the whole chain is there before touching the texture
+        size_t offset = sizeof(header);
+        for (GLuint i = 0; i < header.Levels; i++) {
+            GLuint levelSize;
+            if (offset + sizeof(levelSize) > size)
+                return false;
+            memcpy(&levelSize, entry + offset, sizeof(levelSize));
+            offset += sizeof(levelSize) + levelSize;
+            if (offset > size)
+                return false;
+        }
+        GLint alignment;
+        glGetIntegerv(GL_UNPACK_ALIGNMENT, &alignment);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        offset = sizeof(header);
+        for (GLuint i = 0; i < header.Levels; i++) {
+            GLuint levelSize;
+            memcpy(&levelSize, entry + offset, sizeof(levelSize));
+            offset += sizeof(levelSize);
+            GLint width = std::max(1, header.Width >> i), height = std::max(1, header.Height >> i);
+            if (layer >= 0 && header.InternalFormat == GL_RGB)
+                glTexSubImage3D(GL_TEXTURE_2D_ARRAY, i, 0, 0, layer, width, height, 1, GL_RGB, GL_UNSIGNED_BYTE, entry + offset);
+            else if (layer >= 0)
+                glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, i, 0, 0, layer, width, height, 1, header.InternalFormat, levelSize, entry + offset);
+            else if (header.InternalFormat == GL_RGB)
+                glTexImage2D(GL_TEXTURE_2D, i, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, entry + offset);
+            else
+                glCompressedTexImage2D(GL_TEXTURE_2D, i, header.InternalFormat, width, height, 0, levelSize, entry + offset);
+            offset += levelSize;
+        }
+        glPixelStorei(GL_UNPACK_ALIGNMENT, alignment);
+        if (layer < 0)
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, header.Levels - 1);
+        return true;
+    }
+
+    // Decodes the source, resamples it to size x size unless size is 0, and
+    // lays out a complete entry in memory; empty on failure
+    static std::vector<unsigned char> build(const unsigned char *source, size_t sourceSize, int scale, GLint size, bool compress)
+    {
+        std::vector<unsigned char> entry;
+        int width, height, channels;
+        unsigned char *image = SOIL_load_image_from_memory_scaled(source, (int)sourceSize, scale, &width, &height, &channels, SOIL_LOAD_RGB);
+        if (!image)
+            return entry;
+        std::vector<unsigned char> level(image, image + width * height * 3), next;
+        SOIL_free_image_data(image);
+        if (size > 0) {
+            // Halve while it's at least twice too big, then stretch the rest
+            while (width >= 2 * size && height >= 2 * size) {
+                next.resize((width / 2) * (height / 2) * 3);
+                mipmap_image(&level[0], width, height, 3, &next[0], 2, 2);
+                level.swap(next);
+                width /= 2;
+                height /= 2;
+            }
+            if (width != size || height != size) {
+                next.resize(size * size * 3);
+                up_scale_image(&level[0], width, height, 3, &next[0], size, size);
+                level.swap(next);
+                width = height = size;
+            }
+        }
+        Header header;
+        memcpy(header.Magic, "TXC1", 4);
+        header.Version = VERSION;
+        header.InternalFormat = compress ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT : GL_RGB;
+        header.Width = width;
+        header.Height = height;
+        header.Levels = 1;
+        while ((width >> header.Levels) > 0 || (height >> header.Levels) > 0)
+            header.Levels++;
+        entry.insert(entry.end(), (unsigned char *)&header, (unsigned char *)(&header + 1));
+        // Each level is box-filtered from the one above it
+        for (GLuint i = 0; i < header.Levels; i++) {
+            GLint w = std::max(1, width >> i), h = std::max(1, height >> i);
+            unsigned char *texels = &level[0];
+            int levelSize = w * h * 3;
+            unsigned char *dxt = NULL;
+            if (compress) {
+                dxt = convert_image_to_DXT1(texels, w, h, 3, &levelSize);
+                if (!dxt)
+                    return std::vector<unsigned char>();
+                texels = dxt;
+            }
+            GLuint stored = (GLuint)levelSize;
+            entry.insert(entry.end(), (unsigned char *)&stored, (unsigned char *)(&stored + 1));
+            entry.insert(entry.end(), texels, texels + levelSize);
+            if (dxt)
+                SOIL_free_image_data(dxt);
+            if (i + 1 < header.Levels) {
+                next.resize(std::max(1, w / 2) * std::max(1, h / 2) * 3);
+                mipmap_image(&level[0], w, h, 3, &next[0], 2, 2);
+                level.swap(next);
+            }
+        }
+        return entry;
+    }
+
+    struct Entry
+    {
+        std::string Path;
+        size_t Size;
+        time_t Used;
+        bool operator<(const Entry &other) const { return this->Used < other.Used; }
+    };
+
+    // Deletes least recently used entries, never keep, until the directory
+    // fits the budget
+    void evict(const std::string &keep)
+    {
+        DIR *dir = opendir(this->directory.c_str());
+        if (!dir)
+            return;
+        std::vector<Entry> entries;
+        size_t total = 0;
+        while (struct dirent *d = readdir(dir)) {
+            size_t len = strlen(d->d_name);
+            if (len < 4 || strcmp(d->d_name + len - 4, ".txc") != 0)
+                continue;
+            Entry e;
+            e.Path = this->directory + "/" + d->d_name;
+            struct stat st;
+            if (stat(e.Path.c_str(), &st) != 0)
+                continue;
+            e.Size = (size_t)st.st_size;
+            e.Used = st.st_mtime;
+            total += e.Size;
+            entries.push_back(e);
+        }
+        closedir(dir);
+        std::sort(entries.begin(), entries.end());
+        for (size_t i = 0; i < entries.size() && total > this->maxBytes; i++) {
+            if (entries[i].Path != keep && unlink(entries[i].Path.c_str()) == 0) {
+                total -= entries[i].Size;
+                this->stats.Evictions++;
+            }
+        }
+    }
+};
+
+#endif
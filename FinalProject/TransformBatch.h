@@ -0,0 +1,115 @@
+#ifndef TRANSFORM_BATCH_H
+#define TRANSFORM_BATCH_H
+
+#include <cmath>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <iostream>
+#include <algorithm>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/matrix_inverse.hpp>
+
+#if (GLM_ARCH & GLM_ARCH_SSE2)
+#include <glm/gtx/simd_mat4.hpp>
+#include <glm/gtx/simd_quat.hpp>
+#define TRANSFORM_BATCH_SIMD 1
+#endif
+
+// Model matrices for many objects at once, from parallel arrays of position,
+// rotation and scale: model = T(position) * R(rotation) * S(scale), built
+// column by column instead of through a chain of 4x4 products. Each also
+// gets its normal matrix, the inverse transpose of the model's 3x3, which for
+// this shape is the rotation with each column divided by its scale rather
+// than multiplied. Both come out as whole mat4s for glUniformMatrix4fv; a
+// shader takes the mat3() of the normal matrix.
+class TransformBatch
+{
+public:
+    static void Compose(GLuint count, const glm::vec3 *position, const glm::quat *rotation, const glm::vec3 *scale, glm::mat4 *models, glm::mat4 *normals)
+    {
+#ifdef TRANSFORM_BATCH_SIMD
+        const __m128 one = _mm_set1_ps(1.0f), unitW = _mm_setr_ps(0.0f, 0.0f, 0.0f, 1.0f);
+        for (GLuint i = 0; i < count; i++) {
+            glm::simdMat4 r = glm::mat4SIMD_cast(glm::simdQuat(rotation[i]));
+            __m128 s = _mm_setr_ps(scale[i].x, scale[i].y, scale[i].z, 1.0f), inverse = _mm_div_ps(one, s);
+            GLfloat *m = &models[i][0][0], *n = &normals[i][0][0];
+            _mm_storeu_ps(m, _mm_mul_ps(r[0].Data, _mm_shuffle_ps(s, s, _MM_SHUFFLE(0, 0, 0, 0))));
+            _mm_storeu_ps(m + 4, _mm_mul_ps(r[1].Data, _mm_shuffle_ps(s, s, _MM_SHUFFLE(1, 1, 1, 1))));
+            _mm_storeu_ps(m + 8, _mm_mul_ps(r[2].Data, _mm_shuffle_ps(s, s, _MM_SHUFFLE(2, 2, 2, 2))));
+            _mm_storeu_ps(m + 12, _mm_setr_ps(position[i].x, position[i].y, position[i].z, 1.0f));
+            _mm_storeu_ps(n, _mm_mul_ps(r[0].Data, _mm_shuffle_ps(inverse, inverse, _MM_SHUFFLE(0, 0, 0, 0))));
+            _mm_storeu_ps(n + 4, _mm_mul_ps(r[1].Data, _mm_shuffle_ps(inverse, inverse, _MM_SHUFFLE(1, 1, 1, 1))));
+            _mm_storeu_ps(n + 8, _mm_mul_ps(r[2].Data, _mm_shuffle_ps(inverse, inverse, _MM_SHUFFLE(2, 2, 2, 2))));
+            _mm_storeu_ps(n + 12, unitW);
+        }
+#else
+        for (GLuint i = 0; i < count; i++) {
+            glm::mat3 r = glm::mat3_cast(rotation[i]);
+            for (int c = 0; c < 3; c++) {
+                models[i][c] = glm::vec4(r[c] * scale[i][c], 0.0f);
+                normals[i][c] = glm::vec4(r[c] / scale[i][c], 0.0f);
+            }
+            models[i][3] = glm::vec4(position[i], 1.0f);
+            normals[i][3] = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+        }
+#endif
+    }
+
+    // Times 1k to 1M transforms through Compose() against the usual
+    // translate, rotate, scale chain and an inverse transpose for the normal
+    static void Benchmark(std::ostream &out)
+    {
+        const GLuint counts[] = { 1000, 100000, 1000000 };
+        std::mt19937 random(43);
+        std::uniform_real_distribution<GLfloat> place(-100.0f, 100.0f), turn(-180.0f, 180.0f), axis(-1.0f, 1.0f), size(0.5f, 2.0f);
+        for (int c = 0; c < 3; c++) {
+            GLuint count = counts[c], repeats = 10000000 / count;
+            std::vector<glm::vec3> position(count), scale(count);
+            std::vector<glm::quat> rotation(count);
+            for (GLuint i = 0; i < count; i++) {
+                position[i] = glm::vec3(place(random), place(random), place(random));
+                glm::vec3 around(axis(random), axis(random), axis(random));
+                rotation[i] = glm::angleAxis(turn(random), glm::length(around) > 0.001f ? glm::normalize(around) : glm::vec3(0.0f, 1.0f, 0.0f));
+                scale[i] = glm::vec3(size(random), size(random), size(random));
+            }
+            std::vector<glm::mat4> chainModels(count), chainNormals(count), models(count), normals(count);
+
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            for (GLuint r = 0; r < repeats; r++)
+                for (GLuint i = 0; i < count; i++) {
+                    glm::mat4 model;
+                    model = glm::translate(model, position[i]);
+                    model = model * glm::mat4_cast(rotation[i]);
+                    model = glm::scale(model, scale[i]);
+                    chainModels[i] = model;
+                    chainNormals[i] = glm::mat4(glm::inverseTranspose(glm::mat3(model)));
+                }
+            double chainTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / repeats;
+
+            start = std::chrono::steady_clock::now();
+            for (GLuint r = 0; r < repeats; r++)
+                Compose(count, &position[0], &rotation[0], &scale[0], &models[0], &normals[0]);
+            double batchTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / repeats;
+
+            GLfloat worst = 0.0f;
+            for (GLuint i = 0; i < count; i++)
+                for (int k = 0; k < 4; k++) {
+                    glm::vec4 dm = glm::abs(models[i][k] - chainModels[i][k]), dn = glm::abs(normals[i][k] - chainNormals[i][k]);
+                    worst = std::max(worst, std::max(std::max(std::max(dm.x, dm.y), std::max(dm.z, dm.w)), std::max(std::max(dn.x, dn.y), std::max(dn.z, dn.w))));
+                }
+
+            out << count << " transforms: chain " << chainTime * 1e9 / count << " ns each, batch " << batchTime * 1e9 / count << " ns each"
+#ifdef TRANSFORM_BATCH_SIMD
+                << " (SSE)"
+#endif
+                << (worst < 1e-3f ? "" : ", MISMATCH") << std::endl;
+        }
+    }
+};
+
+#endif
@@ -1,4 +1,5 @@
 #include <iostream>
+#include <random>
 
 // GLEW 1.13
 #define GLEW_STATIC
@@ -15,12 +16,29 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
-// audio
+// audio: irrKlang, or built with SOFT_MIXER defined, the software mixer in
+// SoftMixer.h, for machines without the irrKlang library
 #include "irrKlang/irrKlang.h"
 
 // Other includes
+#include "GLRecorder.h" // first, so the headers below call GL through it
 #include "Shader.h"
+#include "ShaderVariants.h"
 #include "Camera.h"
+#include "TextureCache.h"
+#include "TextureArray.h"
+#include "GLState.h"
+#include "BoxGrid.h"
+#include "HeightMap.h"
+#include "EntityStore.h"
+#include "AgentHash.h"
+#include "TransformBatch.h"
+#include "SoundBank.h"
+#ifdef SOFT_MIXER
+#include "SoftMixer.h"
+#endif
+#include "LightClusters.h"
+#include "PassTimer.h"
 
 using std::cout;
 using std::endl;
@@ -31,11 +49,16 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
 void mouse_callback(GLFWwindow* window, double xpos, double ypos);
 void do_movement(GLdouble);
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset);
-void loadOurTexture(GLuint textureNum, char* imageName);
 void getJumpHeight(GLdouble deltaTime);
-void renderRobot(Shader &ourShader, GLuint* VAO, glm::vec3* robotPositions, GLfloat rotateAngle, glm::vec3* robotScale);
+void followCamera();
+void animateRobots();
+GLsizei uploadRobots(GLuint buffer);
+void renderRobot(Shader &ourShader, GLuint robotVAO, GLsizei robots, GLfloat time);
+void composeEntities();
 void renderFloor(Shader &ourShader, GLuint* VAO);
-void renderBoxes(Shader &ourShader, GLuint* VAO);
+void renderBoxes(Shader &ourShader, GLuint* VAO, GLint layerLoc);
+void placeLights(GLuint count);
+void moveLights(GLfloat time);
 void OnError(int errorCode, const char* msg) {
     throw std::runtime_error(msg);
 }
@@ -60,20 +83,143 @@ GLfloat turnAngle = 0.0f;
 GLfloat jumpMax = 0.8f;
 GLfloat jumpMin = 0.0f;
 
-//box positions
-glm::vec3 boxPos[3] =
+//box positions the level starts with
+const glm::vec3 boxPos[3] =
     {glm::vec3(0.0f, 0.0f, 0.0f),glm::vec3(5.0f, -0.5f, 0.0f), glm::vec3(0.0f, 2.0f, 2.0f)};
+//every robot and box in the world
+EntityStore entities;
+//the robot the camera follows
+Entity player;
+//each entity's model and normal matrix this frame, by entity index
+std::vector<glm::mat4> entityModels, entityNormals;
+//the boxes the robot collides with, from the BOX entities
+BoxGrid boxGrid;
+
+//half the width of the robot's footprint
+const GLfloat robotRadius = 0.2f;
+//every entity by where it stands, rebuilt each tick, for robots meeting robots
+AgentHash crowd(4.0f * robotRadius);
+//boxes starting below this are stood on, those above it are ceilings
+const GLfloat headHeight = 1.1f;
+//floor and ceiling under every point of the level, from boxGrid
+HeightMap heightMap;
 
 //sound
 ISoundEngine* engine;
+//sound effects, loaded before the game starts and played by handle
+SoundBank sounds;
+unsigned walkSound, jumpSound;
+
+//skips binds that change nothing and counts them
+GLState glState;
+//GPU time of the shadow, depth pre-pass and lit passes
+PassTimer passTimer;
+enum { SHADOW_PASS, DEPTH_PREPASS, LIT_PASS };
+
+//point lights drifting around the level, --lights sets how many
+std::vector<PointLight> pointLights;
+//where each point light drifts around
+std::vector<glm::vec3> lightHomes;
+//which point lights reach each part of the view, rebuilt every frame
+LightClusters lightClusters;
 
 //controls
 bool shadowOn = true;
+//shadow map taps are (2 * pcfRadius + 1)^2 texels
+const GLint pcfRadius = 1;
 bool collisionOn = true;
+//point lights from their cluster's list, or every light on every fragment
+bool clusteredOn = true;
+//lay down depth first so the lit pass shades each pixel once
+bool prepassOn = false;
+
+//textures decode at 1/textureScale size (1, 2, 4 or 8) in low-memory mode
+const int textureScale = 1;
+//all materials share one texture array with materialSize x materialSize layers
+const GLint materialSize = 512 / textureScale;
+//decoded textures and their mipmaps are kept on disk between runs, DXT1-compressed if set
+const char textureCacheDir[] = "/Users/wei/Documents/CSE167FinalProject/FinalProject2/FinalProject/texcache";
+const size_t textureCacheBytes = 64 * 1024 * 1024;
+//linked shader programs are kept on disk between runs, keyed by source and driver
+const char shaderCacheDir[] = "/Users/wei/Documents/CSE167FinalProject/FinalProject2/FinalProject/shadercache";
+const bool textureCompress = false;
+//frames --record captures before it exits; --frames changes it
+GLuint recordFrames = 300;
 
 // The MAIN function, from here we start the application and run the game loop
-int main()
+int main(int argc, char* argv[])
 {
+    // GL streams: --record <file> [--frames N] captures the calls of N frames,
+    // --replay <file> times them, --summary <file> counts them and
+    // --check <file> <baseline> fails if they draw or change state more.
+    // --collision-bench times box queries from 3 to 100k boxes,
+    // --crowd-bench neighbor queries from 1k to 100k robots,
+    // --transform-bench model matrices for 1k to 1M objects and
+    // --light-bench sorting 64 to 4096 point lights into clusters.
+    // --lights <n> scatters n point lights around the level and
+    // --prepass starts with the depth pre-pass on.
+    // With SOFT_MIXER, --mixer-bench times software mixing of 8 to 256
+    // voices and IMA ADPCM, --audio-wav <file> writes the sound to a file
+    // and --compress-audio keeps the sounds as IMA ADPCM.
+    std::string recordPath, replayPath;
+#ifdef SOFT_MIXER
+    std::string audioPath;
+    bool compressAudio = false;
+#endif
+    GLuint lightCount = 0;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--summary" && i + 1 < argc) {
+            GLRecorder::Summary summary;
+            if (!GLRecorder::Summarize(argv[i + 1], summary)) {
+                cout << "Can not read GL stream " << argv[i + 1] << endl;
+                return 1;
+            }
+            GLRecorder::PrintSummary(summary, cout);
+            return 0;
+        }
+        if (arg == "--check" && i + 2 < argc)
+            return GLRecorder::Check(argv[i + 1], argv[i + 2], cout) ? 0 : 1;
+        if (arg == "--collision-bench") {
+            BoxGrid::Benchmark(cout);
+            return 0;
+        }
+        if (arg == "--crowd-bench") {
+            AgentHash::Benchmark(cout);
+            return 0;
+        }
+        if (arg == "--transform-bench") {
+            TransformBatch::Benchmark(cout);
+            return 0;
+        }
+#ifdef SOFT_MIXER
+        if (arg == "--mixer-bench") {
+            SoftMixer::Benchmark(cout);
+            return 0;
+        }
+#endif
+        if (arg == "--light-bench") {
+            LightClusters::Benchmark(cout);
+            return 0;
+        }
+        if (arg == "--record" && i + 1 < argc)
+            recordPath = argv[++i];
+        else if (arg == "--frames" && i + 1 < argc)
+            recordFrames = atoi(argv[++i]);
+        else if (arg == "--replay" && i + 1 < argc)
+            replayPath = argv[++i];
+#ifdef SOFT_MIXER
+        else if (arg == "--audio-wav" && i + 1 < argc)
+            audioPath = argv[++i];
+        else if (arg == "--compress-audio")
+            compressAudio = true;
+#endif
+        else if (arg == "--lights" && i + 1 < argc)
+            lightCount = atoi(argv[++i]);
+        else if (arg == "--prepass")
+            prepassOn = true;
+    }
+    
     // initialise GLFW
     glfwSetErrorCallback(OnError);
     if(!glfwInit())
@@ -116,10 +262,26 @@ int main()
     if(!GLEW_VERSION_3_2)
         throw std::runtime_error("OpenGL 3.2 API is not available.");
     
+    if (!replayPath.empty()) {
+        bool replayed = GLRecorder::Replay(replayPath, cout);
+        glfwTerminate();
+        return replayed ? 0 : 1;
+    }
+    if (!recordPath.empty() && !GLRecorder::Start(recordPath))
+        throw std::runtime_error("Can not record to " + recordPath);
+    
     // Define the viewport dimensions
     //glViewport(0, 0, WIDTH, HEIGHT);
     
+#ifdef SOFT_MIXER
+    NullSink nullSink;
+    SoftMixerSink* mixSink = audioPath.empty() ? (SoftMixerSink*)&nullSink : new WavSink(audioPath.c_str());
+    SoftMixer* softMixer = new SoftMixer(mixSink);
+    softMixer->Compress = compressAudio;
+    engine = softMixer;
+#else
     engine = createIrrKlangDevice();
+#endif
     
     if (!engine)
     {
@@ -127,12 +289,28 @@ int main()
         return 0; // error starting up the engine
     }
     
-    engine->play2D("/Users/wei/Documents/CSE167FinalProject/FinalProject2/FinalProject/bgm.wav", true);
+    // the music is read from disk as it plays rather than loaded whole
+    engine->play2D("/Users/wei/Documents/CSE167FinalProject/FinalProject2/FinalProject/bgm.wav", true, false, false, ESM_STREAMING);
     engine->setSoundVolume(0.1);
+    sounds.Open(engine);
+    walkSound = sounds.Load("/Users/wei/Documents/CSE167FinalProject/FinalProject2/FinalProject/walk2.wav");
+    jumpSound = sounds.Load("/Users/wei/Documents/CSE167FinalProject/FinalProject2/FinalProject/jump.wav");
+    sounds.Start();
 
         // Build and compile our shader program
-    Shader ourShader("/Users/wei/Documents/CSE167FinalProject/FinalProject2/FinalProject/shader.vs", "/Users/wei/Documents/CSE167FinalProject/FinalProject2/FinalProject/shader.frag");
-    Shader simpleDepthShader("/Users/wei/Documents/CSE167FinalProject/FinalProject2/FinalProject/simpleDepthShader.vs", "/Users/wei/Documents/CSE167FinalProject/FinalProject2/FinalProject/simpleDepthShader.frag");
+    ShaderCache shaderCache(shaderCacheDir);
+    // A recorded stream has to build its programs from source to replay
+    ShaderCache* programCache = GLRecorder::Recording() ? NULL : &shaderCache;
+    // robot.glsl: the robots' instancing, which both vertex shaders share
+    ShaderVariants ourShaders("/Users/wei/Documents/CSE167FinalProject/FinalProject2/FinalProject/shader.vs", "/Users/wei/Documents/CSE167FinalProject/FinalProject2/FinalProject/shader.frag", programCache, "/Users/wei/Documents/CSE167FinalProject/FinalProject2/FinalProject/robot.glsl");
+    ShaderVariants depthShaders("/Users/wei/Documents/CSE167FinalProject/FinalProject2/FinalProject/simpleDepthShader.vs", "/Users/wei/Documents/CSE167FinalProject/FinalProject2/FinalProject/simpleDepthShader.frag", programCache, "/Users/wei/Documents/CSE167FinalProject/FinalProject2/FinalProject/robot.glsl");
+    // Start every shadow and clustering variant now, so toggling either
+    // finds it built; they compile while the geometry and textures load.
+    // Without parallel compile each of the first frames may still wait on
+    // one of their links
+    for (int i = 0; i < 4; i++)
+        ourShaders.Request(ShaderOptions(i & 1, pcfRadius, 1, i & 2));
+    depthShaders.Request(ShaderOptions());
     
     // Set up vertex data (and buffer(s)) and attribute pointers
     GLfloat planeVertices[] = {
@@ -191,24 +369,6 @@ int main()
         -0.5f, 0.5f, 0.5f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f // bottom-left
     };
     
-    glm::vec3 robotPositions[] = {
-        glm::vec3(0.0f, 0.9f, 0.0f),//body
-        glm::vec3(0.0f, 1.4f, 0.0f),//head
-        glm::vec3(0.1f, 0.3f, 0.0f),//leg1
-        glm::vec3(-0.1f, 0.3f, 0.0f),//leg2
-        glm::vec3(0.3f, 0.9f, 0.0f),//arm1
-        glm::vec3(-0.3f, 0.9f, 0.0f)//arm2
-    };
-    
-    glm::vec3 robotScale[] = {
-        glm::vec3(0.4f, 0.6f, 0.2f),//body
-        glm::vec3(0.4f, 0.4f, 0.4f),//head
-        glm::vec3(0.2f, 0.6f, 0.2f),//leg1
-        glm::vec3(0.2f, 0.6f, 0.2f),//leg2
-        glm::vec3(0.2f, 0.6f, 0.2f),//arm1
-        glm::vec3(0.2f, 0.6f, 0.2f)//arm2
-    };
-    
     // Generate VAO, VBO, EBO
     GLuint VAO[3], VBO[3];
     glGenVertexArrays(3, VAO);
@@ -244,17 +404,41 @@ int main()
     
     glBindVertexArray(0); // Unbind VAO
     
+    // robots: the cube, plus where each robot stands, its turn and its walk
+    // from VBO[2], which moves on to the next robot every six instances
+    glBindVertexArray(VAO[2]);
+    glBindBuffer(GL_ARRAY_BUFFER, VBO[0]);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(GLfloat), (GLvoid*)0);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(GLfloat), (GLvoid*)(3 * sizeof(GLfloat)));
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(GLfloat), (GLvoid*)(6 * sizeof(GLfloat)));
+    glEnableVertexAttribArray(2);
+    glBindBuffer(GL_ARRAY_BUFFER, VBO[2]);
+    glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, 6 * sizeof(GLfloat), (GLvoid*)0);
+    glEnableVertexAttribArray(3);
+    glVertexAttribDivisor(3, 6);
+    glVertexAttribPointer(4, 2, GL_FLOAT, GL_FALSE, 6 * sizeof(GLfloat), (GLvoid*)(4 * sizeof(GLfloat)));
+    glEnableVertexAttribArray(4);
+    glVertexAttribDivisor(4, 6);
+    glBindVertexArray(0); // Unbind VAO
+    
     
-    // Load and create a texture
-    GLuint texture[3];
-    glGenTextures(3, texture);
-    char textureName0[]="/Users/wei/Documents/CSE167FinalProject/FinalProject2/FinalProject/woodFloor.jpg";
-    char textureName1[] ="/Users/wei/Documents/CSE167FinalProject/FinalProject2/FinalProject/blue.jpg";
-    char textureName2[] ="/Users/wei/Documents/CSE167FinalProject/FinalProject2/FinalProject/container.jpg";
-    loadOurTexture(texture[0], textureName0);
-    loadOurTexture(texture[1], textureName1);
-    loadOurTexture(texture[2], textureName2);
-    glBindTexture(GL_TEXTURE_2D, 0); // Unbind texture when done, so we won't accidentily mess up our texture.
+    // Load the materials into one texture array, a layer each
+    std::vector<const char*> materialNames;
+    materialNames.push_back("/Users/wei/Documents/CSE167FinalProject/FinalProject2/FinalProject/woodFloor.jpg");
+    materialNames.push_back("/Users/wei/Documents/CSE167FinalProject/FinalProject2/FinalProject/blue.jpg");
+    materialNames.push_back("/Users/wei/Documents/CSE167FinalProject/FinalProject2/FinalProject/container.jpg");
+    const GLint floorLayer = 0, robotLayer = 1, boxLayer = 2;
+    TextureCache textureCache(textureCacheDir, textureCacheBytes);
+    SOIL_reset_allocation_count();
+    TextureArray materials(textureCache, materialSize, materialNames, textureScale, textureCompress);
+    textureCache.PrintStats(cout);
+    for (int i = 0; i < 4; i++)
+        ourShaders.Get(ShaderOptions(i & 1, pcfRadius, 1, i & 2));
+    depthShaders.Get(ShaderOptions());
+    shaderCache.PrintStats(cout);
+    cout << "Texture decode allocations: " << SOIL_allocation_count() << " for 3 images" << endl;
     
     glEnable(GL_DEPTH_TEST);
     
@@ -299,16 +483,30 @@ int main()
     view = glm::translate(view, glm::vec3(0.0f, 0.0f, -3.0f));
     glm::mat4 projection;
     projection = glm::perspective(glm::radians(camera.Zoom), (GLfloat)WIDTH / (GLfloat)HEIGHT, 0.1f, 100.0f);
-    // rotation control for robot's arms and legs
-    glm::vec3 lastCameraPosition = camera.Position;
-    GLfloat rotateAngle = 0.0f;
-    GLfloat coef = 57.0f;
     // used to calculate FPS
     GLdouble currTime, lastFrameTime = 0.0;
     // jump
    
     
     glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
+    // the robot stands 1.8 tall
+    player = entities.Create(EntityStore::ROBOT, robotLayer, camera.Position, glm::vec3(robotRadius, 0.9f, robotRadius));
+    for (int i = 0; i < 3; i++)
+        entities.Create(EntityStore::BOX, boxLayer, boxPos[i], glm::vec3(0.5f));
+    for (GLuint i = 0; i < entities.Count(); i++)
+        if (entities.Model[i] == EntityStore::BOX)
+            boxGrid.Add(entities.Position[i], entities.Extent[i]);
+    heightMap.Build(boxGrid, robotRadius, headHeight);
+    placeLights(lightCount);
+    lightClusters.Create();
+    std::vector<std::string> passNames;
+    passNames.push_back("shadow");
+    passNames.push_back("depth pre-pass");
+    passNames.push_back("lit");
+    passTimer.Create(passNames);
+    // Setup bound things behind glState's back
+    glState.Invalidate();
+    GLRecorder::EndFrame(); // everything so far is setup
 
     
     // run while the window is open
@@ -320,28 +518,44 @@ int main()
         currTime = glfwGetTime();
         if (keys[GLFW_KEY_F]) {
             cout << "FPS: " << 1.0 / (currTime - lastFrameTime) << endl;
+            glState.PrintStats(cout);
+            passTimer.PrintStats(cout);
         }
         // Move
+        crowd.Build(entities.Position);
         do_movement(currTime - lastFrameTime);
         getJumpHeight(currTime - lastFrameTime);
         lastFrameTime = currTime;
+        camera.Position.y = 1.5f + jumpHeight;
+        followCamera();
+        animateRobots();
+        GLsizei robots = uploadRobots(VBO[2]);
+        composeEntities();
+        
+        // Swap in shaders edited on disk once they have linked; a swap
+        // deletes the program glState may think is bound
+        if (ourShaders.Update() + depthShaders.Update() > 0)
+            glState.Invalidate();
         
         // Shadow part
-        simpleDepthShader.Use();
+        passTimer.Begin(SHADOW_PASS);
+        Shader &simpleDepthShader = depthShaders.Get(ShaderOptions());
+        glState.UseProgram(simpleDepthShader.Program);
         glUniformMatrix4fv(glGetUniformLocation(simpleDepthShader.Program, "lightSpaceMatrix"), 1, GL_FALSE, glm::value_ptr(lightSpaceMatrix));
         
         glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
-        glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO);
+        glState.BindFramebuffer(GL_FRAMEBUFFER, depthMapFBO);
         glClear(GL_DEPTH_BUFFER_BIT);
         //RenderScene(simpleDepthShader);
         // shadow
         // floor
         renderFloor(simpleDepthShader, VAO);
         // boxes
-        renderBoxes(simpleDepthShader, VAO);
+        renderBoxes(simpleDepthShader, VAO, -1);
         //robot
-        renderRobot(simpleDepthShader, VAO, robotPositions, rotateAngle, robotScale);
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        renderRobot(simpleDepthShader, VAO[2], robots, (GLfloat)currTime);
+        glState.BindFramebuffer(GL_FRAMEBUFFER, 0);
+        passTimer.End();
         
         // Normal part
         // Define the viewport dimensions
@@ -350,66 +564,99 @@ int main()
         // Clear the colorbuffer
         //glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        
-        // Activate shader
-        ourShader.Use();
-        
-        // General Uniform
         view = glm::lookAt(camera.Position, camera.Position + camera.Front, camera.Up);
         projection = glm::perspective(glm::radians(camera.Zoom), (GLfloat)WIDTH / (GLfloat)HEIGHT, 0.1f, 100.0f);
-        glUniformMatrix4fv(glGetUniformLocation(ourShader.Program, "view"), 1, GL_FALSE, glm::value_ptr(view));
-        glUniformMatrix4fv(glGetUniformLocation(ourShader.Program, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
-        glUniform1i(glGetUniformLocation(ourShader.Program, "shadowOn"), shadowOn);
+        glm::mat4 viewProjection = projection * view;
         
-        // Robot
-        // calculate some parameters
-        GLfloat distDiff = glm::distance(glm::vec3(camera.Position.x, 0.0, camera.Position.z), glm::vec3(lastCameraPosition.x, 0.0, lastCameraPosition.z));
-        if (rotateAngle > 57 || rotateAngle < -57) {
-            rotateAngle = coef;
-            coef = -coef;
-            engine->play2D("/Users/wei/Documents/CSE167FinalProject/FinalProject2/FinalProject/walk2.wav");
+        // Depth pre-pass: depth only, with the position-only shadow shader
+        // from the camera, so the lit pass below runs once per pixel
+        if (prepassOn) {
+            passTimer.Begin(DEPTH_PREPASS);
+            glState.UseProgram(simpleDepthShader.Program);
+            glUniformMatrix4fv(glGetUniformLocation(simpleDepthShader.Program, "lightSpaceMatrix"), 1, GL_FALSE, glm::value_ptr(viewProjection));
+            glDrawBuffer(GL_NONE);
+            renderFloor(simpleDepthShader, VAO);
+            renderBoxes(simpleDepthShader, VAO, -1);
+            renderRobot(simpleDepthShader, VAO[2], robots, (GLfloat)currTime);
+            glDrawBuffer(GL_BACK);
+            glDepthFunc(GL_EQUAL);
+            passTimer.End();
         }
-        rotateAngle += distDiff * coef;
-        lastCameraPosition = camera.Position;
-        camera.Position.y = 1.5f + jumpHeight;
+        
+        // Activate shader: the variant compiled for the current settings
+        passTimer.Begin(LIT_PASS);
+        Shader &ourShader = ourShaders.Get(ShaderOptions(shadowOn, pcfRadius, 1, clusteredOn));
+        glState.UseProgram(ourShader.Program);
+        
+        // General Uniform
+        glUniformMatrix4fv(glGetUniformLocation(ourShader.Program, "view"), 1, GL_FALSE, glm::value_ptr(view));
+        glUniformMatrix4fv(glGetUniformLocation(ourShader.Program, "viewProjection"), 1, GL_FALSE, glm::value_ptr(viewProjection));
         
         // Set light uniforms
         glUniform3fv(glGetUniformLocation(ourShader.Program, "lightPos"), 1, &lightPos[0]);
         glUniform3fv(glGetUniformLocation(ourShader.Program, "viewPos"), 1, &camera.Position[0]);
         glUniformMatrix4fv(glGetUniformLocation(ourShader.Program, "lightSpaceMatrix"), 1, GL_FALSE, glm::value_ptr(lightSpaceMatrix));
-        glActiveTexture(GL_TEXTURE3);
-        glBindTexture(GL_TEXTURE_2D, depthMap);
+        glState.BindTexture(3, GL_TEXTURE_2D, depthMap);
         glUniform1i(glGetUniformLocation(ourShader.Program, "shadowMap"), 3);
         
-        // Bind Texture
-        glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_2D, texture[1]);
-        glUniform1i(glGetUniformLocation(ourShader.Program, "ourTexture1"), 1);
-        renderRobot(ourShader, VAO, robotPositions, rotateAngle, robotScale);
+        // Point lights: sorted into the clusters of this frame's view
+        moveLights((GLfloat)currTime);
+        lightClusters.SetProjection(projection, 0.1f, 100.0f);
+        lightClusters.Assign(pointLights, view);
+        lightClusters.Upload(pointLights);
+        for (GLuint i = 0; i < 3; i++)
+            glState.BindTexture(4 + i, GL_TEXTURE_BUFFER, lightClusters.Textures[i]);
+        lightClusters.SetUniforms(ourShader.Program, 4, WIDTH * 2, HEIGHT * 2);
+        
+        // Bind Texture: one array for every material, draws only switch layers
+        glState.BindTexture(0, GL_TEXTURE_2D_ARRAY, materials.Texture);
+        glUniform1i(glGetUniformLocation(ourShader.Program, "materials"), 0);
+        GLint layerLoc = glGetUniformLocation(ourShader.Program, "layer");
+        // Robots all wear one material in their instanced draw
+        glUniform1i(layerLoc, robotLayer);
+        renderRobot(ourShader, VAO[2], robots, (GLfloat)currTime);
         
         // floor
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, texture[0]);
-        glUniform1i(glGetUniformLocation(ourShader.Program, "ourTexture1"), 0);
+        glUniform1i(layerLoc, floorLayer);
         renderFloor(ourShader, VAO);
         //glDrawArraysInstanced(GL_TRIANGLES, 0, 6, 10000); // 100 triangles of 6 vertices each
         
         // Box
-        glActiveTexture(GL_TEXTURE2);
-        glBindTexture(GL_TEXTURE_2D, texture[2]);
-        glUniform1i(glGetUniformLocation(ourShader.Program, "ourTexture1"), 2);
-        renderBoxes(ourShader, VAO);
+        renderBoxes(ourShader, VAO, layerLoc);
         // Others
-        
-        // Unbind
-        glBindVertexArray(0);
+        if (prepassOn)
+            glDepthFunc(GL_LESS);
+        passTimer.End();
         
         // Swap the screen buffers
         glfwSwapBuffers(gWindow);
+        glState.EndFrame();
+        passTimer.EndFrame();
+        if (GLRecorder::Recording()) {
+            GLRecorder::EndFrame();
+            if (--recordFrames == 0)
+                glfwSetWindowShouldClose(gWindow, GL_TRUE);
+        }
     }
     // Properly de-allocate all resources once they've outlived their purpose
-    glDeleteVertexArrays(2, VAO);
-    glDeleteBuffers(2, VBO);
+    glDeleteVertexArrays(3, VAO);
+    glDeleteBuffers(3, VBO);
+    glDeleteTextures(1, &materials.Texture);
+    lightClusters.Destroy();
+    passTimer.PrintStats(cout);
+    passTimer.Destroy();
+    GLRecorder::Stop();
+    sounds.Stop();
+    sounds.PrintLatency(cout);
+#ifdef SOFT_MIXER
+    softMixer->Stop();
+    softMixer->PrintStats(cout);
+#endif
+    engine->drop();
+#ifdef SOFT_MIXER
+    if (mixSink != &nullSink)
+        delete mixSink; // finishes the file
+#endif
     // clean up and exit
     glfwTerminate();
     return 0;
@@ -479,7 +726,7 @@ void do_movement(GLdouble deltaTime)
     if (keys[GLFW_KEY_SPACE])
         if (jumpStatus == 0) {
             jumpStatus = 1;
-            engine->play2D("/Users/wei/Documents/CSE167FinalProject/FinalProject2/FinalProject/jump.wav");
+            sounds.Trigger(jumpSound);
         }
 
     jumpMax = 0.8f;
@@ -487,22 +734,30 @@ void do_movement(GLdouble deltaTime)
     
     //bool collided = false;
     // Colision Detection
-    if(collisionOn)
-    for (int i = 0; i < 3; i++) {
-        glm::vec3 cubePos = boxPos[i] + 3.0f * camera.Front;
-        glm::vec3 robotPos = camera.Position + 3.0f * camera.Front;
-        if ( glm::abs(cubePos.x-robotPos.x)<0.7 && glm::abs(cubePos.z-robotPos.z)<0.7 ) {
-            // change jumpmax and jumpmin
-            if(boxPos[i].y > 1.6)
-                jumpMax = boxPos[i].y - 1.6;
-            else if(jumpHeight > 0 && boxPos[i].y < 0.8)
-                jumpMin = boxPos[i].y + 1.0;
+    if(collisionOn) {
+        // The highest box under the robot's footprint and the lowest one
+        // over it, one lookup each
+        GLfloat headroom, step;
+        // change jumpmax and jumpmin
+        if(heightMap.Headroom(camera.Position.x, camera.Position.z, headHeight, headroom))
+            jumpMax = headroom;
+        if(heightMap.StepUp(camera.Position.x, camera.Position.z, 0.0f, step)) {
+            if(jumpHeight > 0 && step < 1.3)
+                jumpMin = step + 0.5;
             // collision
-            if(jumpHeight < boxPos[i].y + 1.0 && boxPos[i].y < 1.6) {
+            if(jumpHeight < step + 0.5) {
                 //collided = true;
                 camera.Position = currentPos;
-                if (jumpMax < boxPos[i].y + 1.0)
+                if (jumpMax < step + 0.5)
                     jumpMin = 0.0;
+            }
+        }
+        // Other robots closer than two footprints
+        static std::vector<GLuint> near;
+        crowd.Neighbors(camera.Position, 2.0f * robotRadius, near);
+        for (size_t i = 0; i < near.size(); i++) {
+            if (entities.Model[near[i]] == EntityStore::ROBOT && near[i] != entities.Index(player)) {
+                camera.Position = currentPos;
                 break;
             }
         }
@@ -514,6 +769,13 @@ void do_movement(GLdouble deltaTime)
     if (keys[GLFW_KEY_2]) {
         collisionOn = !collisionOn;
     }
+    if (keys[GLFW_KEY_3]) {
+        clusteredOn = !clusteredOn;
+    }
+    if (keys[GLFW_KEY_4]) {
+        prepassOn = !prepassOn;
+        passTimer.Reset(); // the averages are of one way or the other
+    }
 //    if(collided) {
 //        camera.Position = currentPos;
 //    }
@@ -528,25 +790,6 @@ void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
     camera.ProcessMouseScroll(yoffset);
 }
 
-void loadOurTexture(GLuint textureNum, char* imageName)
-{
-    glBindTexture(GL_TEXTURE_2D, textureNum); // All upcoming GL_TEXTURE_2D operations now have effect on this texture object
-    // Set the texture wrapping parameters
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);	// Set texture wrapping to GL_REPEAT (usually basic wrapping method)
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    // Set texture filtering parameters
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    // Load image, create texture and generate mipmaps
-    int width, height;
-    unsigned char* image = SOIL_load_image(imageName, &width, &height, 0, SOIL_LOAD_RGB);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
-    glGenerateMipmap(GL_TEXTURE_2D);
-    SOIL_free_image_data(image);
-    glBindTexture(GL_TEXTURE_2D, 0); // Unbind texture when done, so we won't accidentily mess up our texture.
-    
-}
-
 void getJumpHeight(GLdouble deltaTime)
 {
     //GLfloat heightLimit = 0.8f;
@@ -571,31 +814,65 @@ void getJumpHeight(GLdouble deltaTime)
     }
 }
 
-void renderRobot(Shader &ourShader, GLuint* VAO, glm::vec3* robotPositions, GLfloat rotateAngle, glm::vec3* robotScale)
+// The player's robot stands where the camera is, turned the way it walks
+void followCamera()
 {
-    glm::vec3 tempVec = camera.Position + 3.0f * camera.Front;
-    tempVec.y = camera.Position.y;
-    glUniform3f(glGetUniformLocation(ourShader.Program, "cameraPosition"), 0,0,0);
-    //glUniform3f(glGetUniformLocation(ourShader.Program, "cameraPosition"), tempVec.x, camera.Position.y, tempVec.z);
-    // Draw robot
-    glBindVertexArray(VAO[0]);
-    for (GLuint i = 0; i < 6; i++) {
-        glm::mat4 robotModel;
-        robotModel = glm::translate(robotModel, tempVec);
-        robotModel = glm::rotate(robotModel, -(camera.Yaw + 90.f + turnAngle), glm::vec3(0.0f, 1.0f, 0.0f));
-        robotModel = glm::translate(robotModel, robotPositions[i]);
-        robotModel = glm::translate(robotModel, glm::vec3(0.0f, -1.8f, 0.0f));
-        if (i == 3 || i == 4) { //arm1 and leg2
-            robotModel = glm::rotate(robotModel, rotateAngle, glm::vec3(1.0f, 0.0f, 0.0f));
-        }
-        else if (i == 2 || i == 5) { //arm2 and leg1
-            robotModel = glm::rotate(robotModel, -rotateAngle, glm::vec3(1.0f, 0.0f, 0.0f));
+    GLuint i = entities.Index(player);
+    entities.Position[i] = camera.Position;
+    entities.Yaw[i] = -(camera.Yaw + 90.f + turnAngle);
+}
+
+// Moves every robot's walk on by how far it walked since last time
+void animateRobots()
+{
+    GLfloat playerPhase = entities.Phase[entities.Index(player)];
+    EntityStore::ParallelFor(entities.Count(), [](GLuint begin, GLuint end) {
+        for (GLuint i = begin; i < end; i++) {
+            if (entities.Model[i] != EntityStore::ROBOT)
+                continue;
+            entities.Phase[i] += glm::distance(glm::vec2(entities.Position[i].x, entities.Position[i].z), glm::vec2(entities.Previous[i].x, entities.Previous[i].z));
+            entities.Previous[i] = entities.Position[i];
         }
-        robotModel = glm::translate(robotModel, glm::vec3(0.0f, -0.2f, 0.0f));
-        robotModel = glm::scale(robotModel, robotScale[i]);
-        glUniformMatrix4fv(glGetUniformLocation(ourShader.Program, "model"), 1, GL_FALSE, glm::value_ptr(robotModel));
-        glDrawArrays(GL_TRIANGLES, 0, 36);
+    });
+    // a foot comes down where the swing turns around, at every odd phase
+    if (std::floor((entities.Phase[entities.Index(player)] + 1.0f) / 2.0f) != std::floor((playerPhase + 1.0f) / 2.0f))
+        sounds.Trigger(walkSound);
+}
+
+// Fills buffer with the instance attributes of every robot, where the
+// camera's offset puts it; returns how many robots there are
+GLsizei uploadRobots(GLuint buffer)
+{
+    static std::vector<GLfloat> instances;
+    glm::vec3 tempVec = 3.0f * camera.Front;
+    tempVec.y = 0.0f;
+    instances.clear();
+    for (GLuint e = 0; e < entities.Count(); e++) {
+        if (entities.Model[e] != EntityStore::ROBOT)
+            continue;
+        glm::vec3 p = entities.Position[e] + tempVec;
+        GLfloat instance[6] = { p.x, p.y, p.z, entities.Yaw[e], entities.Phase[e], entities.Speed[e] };
+        instances.insert(instances.end(), instance, instance + 6);
     }
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(GLfloat), instances.empty() ? NULL : &instances[0], GL_STREAM_DRAW);
+    return (GLsizei)(instances.size() / 6);
+}
+
+// Draws every robot in one call, six instances each: the vertex shader
+// places and swings each part
+void renderRobot(Shader &ourShader, GLuint robotVAO, GLsizei robots, GLfloat time)
+{
+    glUniform3f(glGetUniformLocation(ourShader.Program, "cameraPosition"), 0,0,0);
+    //glUniform3f(glGetUniformLocation(ourShader.Program, "cameraPosition"), tempVec.x, camera.Position.y, tempVec.z);
+    if (robots == 0)
+        return;
+    GLint robotsLoc = glGetUniformLocation(ourShader.Program, "robots");
+    glUniform1f(glGetUniformLocation(ourShader.Program, "time"), time);
+    glUniform1i(robotsLoc, 1);
+    glState.BindVertexArray(robotVAO);
+    glDrawArraysInstanced(GL_TRIANGLES, 0, 36, robots * 6);
+    glUniform1i(robotsLoc, 0);
 }
 
 void renderFloor(Shader &ourShader, GLuint* VAO)
@@ -605,23 +882,75 @@ void renderFloor(Shader &ourShader, GLuint* VAO)
     tempVec.y = 0.0f;
     staticModel = glm::translate(staticModel, tempVec);
     glUniformMatrix4fv(glGetUniformLocation(ourShader.Program, "model"), 1, GL_FALSE, glm::value_ptr(staticModel));
+    glUniformMatrix4fv(glGetUniformLocation(ourShader.Program, "normalModel"), 1, GL_FALSE, glm::value_ptr(glm::mat4()));
     //glUniform3f(glGetUniformLocation(ourShader.Program, "cameraPosition"), 3.0f * camera.Front.x, 0.0, 3.0f * camera.Front.z);
     // Draw floor
-    glBindVertexArray(VAO[1]); // First VAO
+    glState.BindVertexArray(VAO[1]); // First VAO
     glDrawArrays(GL_TRIANGLES, 0, 6);
 }
 
-void renderBoxes(Shader &ourShader, GLuint* VAO)
+// Every entity's model and normal matrix, where the camera's offset puts it,
+// for this frame's passes to share
+void composeEntities()
 {
-    
+    static std::vector<glm::vec3> positions, scales;
+    static std::vector<glm::quat> rotations;
+    GLuint count = entities.Count();
     glm::vec3 tempVec = 3.0f * camera.Front;
     tempVec.y = 0.0f;
-    for (GLuint i = 0; i < 3; i++) {
-        glm::mat4 boxModel;
-        boxModel = glm::translate(boxModel, tempVec);
-        boxModel = glm::translate(boxModel, boxPos[i]);
-        glUniformMatrix4fv(glGetUniformLocation(ourShader.Program, "model"), 1, GL_FALSE, glm::value_ptr(boxModel));
-        glBindVertexArray(VAO[0]);
+    positions.resize(count);
+    rotations.resize(count);
+    scales.resize(count);
+    entityModels.resize(count);
+    entityNormals.resize(count);
+    for (GLuint i = 0; i < count; i++) {
+        positions[i] = entities.Position[i] + tempVec;
+        rotations[i] = glm::angleAxis(entities.Yaw[i], glm::vec3(0.0f, 1.0f, 0.0f));
+        scales[i] = 2.0f * entities.Extent[i];
+    }
+    if (count > 0)
+        TransformBatch::Compose(count, &positions[0], &rotations[0], &scales[0], &entityModels[0], &entityNormals[0]);
+}
+
+// layerLoc is the material layer uniform, or -1 when the shader has none
+void renderBoxes(Shader &ourShader, GLuint* VAO, GLint layerLoc)
+{
+    GLint modelLoc = glGetUniformLocation(ourShader.Program, "model"), normalLoc = glGetUniformLocation(ourShader.Program, "normalModel");
+    GLint layer = -1;
+    for (GLuint i = 0; i < entities.Count(); i++) {
+        if (entities.Model[i] != EntityStore::BOX)
+            continue;
+        if (layerLoc >= 0 && entities.Layer[i] != layer) {
+            layer = entities.Layer[i];
+            glUniform1i(layerLoc, layer);
+        }
+        glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(entityModels[i]));
+        glUniformMatrix4fv(normalLoc, 1, GL_FALSE, glm::value_ptr(entityNormals[i]));
+        glState.BindVertexArray(VAO[0]);
         glDrawArrays(GL_TRIANGLES, 0, 36);
     }
-}
\ No newline at end of file
+}
+
+// Scatters count point lights of random colors over the floor, each with a
+// spot it drifts around
+void placeLights(GLuint count)
+{
+    std::mt19937 random(49);
+    std::uniform_real_distribution<GLfloat> across(-20.0f, 20.0f), height(0.0f, 2.5f), hue(0.2f, 1.0f), reach(1.5f, 4.0f);
+    pointLights.resize(count);
+    lightHomes.resize(count);
+    for (GLuint i = 0; i < count; i++) {
+        lightHomes[i] = glm::vec3(across(random), height(random), across(random));
+        pointLights[i].Radius = reach(random);
+        pointLights[i].Color = glm::vec3(hue(random), hue(random), hue(random));
+    }
+}
+
+// Moves every point light around its spot
+void moveLights(GLfloat time)
+{
+    for (GLuint i = 0; i < pointLights.size(); i++) {
+        GLfloat phase = time * 0.5f + i;
+        pointLights[i].Position = lightHomes[i] + glm::vec3(std::cos(phase), 0.25f * std::sin(2.0f * phase), std::sin(phase));
+    }
+}
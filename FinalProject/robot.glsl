@@ -0,0 +1,46 @@
+// Shared by shader.vs and simpleDepthShader.vs, which get it right after
+// their #version line and defines.
+
+// Both place every vertex with place() below, so the depth pre-pass lays
+// down bit for bit the depths the lit pass tests with GL_EQUAL
+invariant gl_Position;
+
+// Robots are drawn instanced, six instances to a robot, one per part; the
+// robot's own attributes advance once every six instances
+uniform bool robots;
+uniform float time;
+layout (location = 3) in vec4 robot; // where it stands, and its turn in degrees
+layout (location = 4) in vec2 walk;  // phase, and phase added per second
+const vec3 partOffset[6] = vec3[6](vec3(0.0, 0.9, 0.0), vec3(0.0, 1.4, 0.0), vec3(0.1, 0.3, 0.0), vec3(-0.1, 0.3, 0.0), vec3(0.3, 0.9, 0.0), vec3(-0.3, 0.9, 0.0)); // body, head, legs, arms
+const vec3 partScale[6] = vec3[6](vec3(0.4, 0.6, 0.2), vec3(0.4, 0.4, 0.4), vec3(0.2, 0.6, 0.2), vec3(0.2, 0.6, 0.2), vec3(0.2, 0.6, 0.2), vec3(0.2, 0.6, 0.2));
+const float partSwing[6] = float[6](0.0, 0.0, -1.0, 1.0, 1.0, -1.0); // each leg with the opposite arm
+
+mat4 translation(vec3 t)
+{
+    return mat4(1.0, 0.0, 0.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0, 0.0, 1.0, 0.0, t.x, t.y, t.z, 1.0);
+}
+
+// The model matrix of this instance's part: limbs swing 57 degrees each
+// way, a full stride every 4 units of phase
+mat4 robotModel()
+{
+    int part = gl_InstanceID % 6;
+    float phase = walk.x + walk.y * time;
+    float swing = radians(57.0 * partSwing[part] * (1.0 - abs(mod(phase + 1.0, 4.0) - 2.0)));
+    float turn = radians(robot.w);
+    mat4 yaw = mat4(cos(turn), 0.0, -sin(turn), 0.0, 0.0, 1.0, 0.0, 0.0, sin(turn), 0.0, cos(turn), 0.0, 0.0, 0.0, 0.0, 1.0);
+    mat4 pitch = mat4(1.0, 0.0, 0.0, 0.0, 0.0, cos(swing), sin(swing), 0.0, 0.0, -sin(swing), cos(swing), 0.0, 0.0, 0.0, 0.0, 1.0);
+    mat4 scale = mat4(partScale[part].x, 0.0, 0.0, 0.0, 0.0, partScale[part].y, 0.0, 0.0, 0.0, 0.0, partScale[part].z, 0.0, 0.0, 0.0, 0.0, 1.0);
+    return translation(robot.xyz) * yaw * translation(partOffset[part] + vec3(0.0, -1.8, 0.0)) * pitch * translation(vec3(0.0, -0.2, 0.0)) * scale;
+}
+
+// The model matrix of this vertex: its robot part's, or model
+mat4 worldMatrix(mat4 model)
+{
+    return robots ? robotModel() : model;
+}
+
+vec4 place(mat4 viewProjection, mat4 world, vec3 position)
+{
+    return viewProjection * world * vec4(position, 1.0);
+}
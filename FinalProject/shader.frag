@@ -1,4 +1,20 @@
 #version 330 core
+// Variant options, #defined by ShaderVariants; the defaults match the game
+#ifndef SHADOWS
+#define SHADOWS 1
+#endif
+#ifndef PCF_RADIUS
+#define PCF_RADIUS 1
+#endif
+#ifndef LIGHT_COUNT
+#define LIGHT_COUNT 1
+#endif
+#ifndef SHININESS
+#define SHININESS 64.0
+#endif
+#ifndef CLUSTERED
+#define CLUSTERED 1
+#endif
 in VS_OUT {
     vec3 FragPos;
     vec3 Normal;
@@ -10,16 +26,64 @@ in vec2 TexCoord;
 
 out vec4 FragColor;
 
-uniform sampler2D ourTexture1;
+// every material is a layer of one array; layer picks it per draw
+uniform sampler2DArray materials;
+uniform int layer;
 uniform sampler2D ourTexture2;
 uniform sampler2D shadowMap;
 
-uniform vec3 lightPos;
+// the shadow map is rendered from lightPos[0]
+uniform vec3 lightPos[LIGHT_COUNT];
 uniform vec3 viewPos;
-uniform int shadowOn;
+
+// point lights from LightClusters: each cluster's offset and count into
+// clusterLights, the light indices, and two texels per light
+uniform usamplerBuffer clusterRanges;
+uniform usamplerBuffer clusterLights;
+uniform samplerBuffer pointLights;
+uniform int pointLightCount;
+uniform int clusterColumns;
+uniform int clusterRows;
+uniform int clusterSlices;
+uniform vec3 clusterScale; // tiles per pixel, slices per log of depth
+uniform float clusterNear;
+uniform mat4 view;
+
+vec3 PointLightCalculation(int index, vec3 normal, vec3 viewDir)
+{
+    vec4 where = texelFetch(pointLights, 2 * index);
+    vec3 toLight = where.xyz - fs_in.FragPos;
+    float distance2 = dot(toLight, toLight);
+    if(distance2 >= where.w * where.w)
+        return vec3(0.0);
+    float fade = 1.0 - distance2 / (where.w * where.w);
+    vec3 lightDir = toLight * inversesqrt(distance2);
+    float diff = max(dot(lightDir, normal), 0.0);
+    float spec = pow(max(dot(normal, normalize(lightDir + viewDir)), 0.0), SHININESS);
+    return fade * fade * (diff + spec) * texelFetch(pointLights, 2 * index + 1).rgb;
+}
+
+vec3 PointLighting(vec3 normal, vec3 viewDir)
+{
+    vec3 lighting = vec3(0.0);
+#if CLUSTERED
+    float depth = -(view * vec4(fs_in.FragPos, 1.0)).z;
+    ivec3 cluster = ivec3(gl_FragCoord.xy * clusterScale.xy, log(max(depth, clusterNear) / clusterNear) * clusterScale.z);
+    cluster = clamp(cluster, ivec3(0), ivec3(clusterColumns, clusterRows, clusterSlices) - 1);
+    uvec2 range = texelFetch(clusterRanges, (cluster.z * clusterRows + cluster.y) * clusterColumns + cluster.x).xy;
+    for(uint i = 0u; i < range.y; ++i)
+        lighting += PointLightCalculation(int(texelFetch(clusterLights, int(range.x + i)).r), normal, viewDir);
+#else
+    // every light for every fragment, to compare against
+    for(int i = 0; i < pointLightCount; ++i)
+        lighting += PointLightCalculation(i, normal, viewDir);
+#endif
+    return lighting;
+}
 
 float ShadowCalculation(vec4 fragPosLightSpace)
 {
+#if SHADOWS
     // perform perspective divide
     vec3 projCoords = fragPosLightSpace.xyz / fragPosLightSpace.w;
     // Transform to [0,1] range
@@ -30,53 +94,61 @@ float ShadowCalculation(vec4 fragPosLightSpace)
     float currentDepth = projCoords.z;
     // Calculate bias (based on depth map resolution and slope)
     vec3 normal = normalize(fs_in.Normal);
-    vec3 lightDir = normalize(lightPos - fs_in.FragPos);
+    vec3 lightDir = normalize(lightPos[0] - fs_in.FragPos);
     float bias = max(0.05 * (1.0 - dot(normal, lightDir)), 0.005);
     // Check whether current frag pos is in shadow
     // float shadow = currentDepth - bias > closestDepth  ? 1.0 : 0.0;
     // PCF
     float shadow = 0.0;
     vec2 texelSize = 1.0 / textureSize(shadowMap, 0);
-    for(int x = -1; x <= 1; ++x)
+    for(int x = -PCF_RADIUS; x <= PCF_RADIUS; ++x)
     {
-        for(int y = -1; y <= 1; ++y)
+        for(int y = -PCF_RADIUS; y <= PCF_RADIUS; ++y)
         {
             float pcfDepth = texture(shadowMap, projCoords.xy + vec2(x, y) * texelSize).r;
             shadow += currentDepth - bias > pcfDepth  ? 1.0 : 0.0;
         }
     }
-    shadow /= 9.0;
+    shadow /= float((2 * PCF_RADIUS + 1) * (2 * PCF_RADIUS + 1));
     
     // Keep the shadow at 0.0 when outside the far_plane region of the light's frustum.
     if(projCoords.z > 1.0)
         shadow = 0.0;
     
-    if(shadowOn == 0)
-        shadow = 0.0;
     return shadow;
+#else
+    return 0.0;
+#endif
 }
 
 void main()
 {
-    vec3 color = texture(ourTexture1, fs_in.TexCoords).rgb;
+    vec3 color = texture(materials, vec3(fs_in.TexCoords, layer)).rgb;
     vec3 normal = normalize(fs_in.Normal);
     vec3 lightColor = vec3(0.6);
     // Ambient
     vec3 ambient = 0.5 * color;
-    // Diffuse
-    vec3 lightDir = normalize(lightPos - fs_in.FragPos);
-    float diff = max(dot(lightDir, normal), 0.0);
-    vec3 diffuse = diff * lightColor;
-    // Specular
     vec3 viewDir = normalize(viewPos - fs_in.FragPos);
-    //vec3 reflectDir = reflect(-lightDir, normal);
-    float spec = 0.0;
-    vec3 halfwayDir = normalize(lightDir + viewDir);
-    spec = pow(max(dot(normal, halfwayDir), 0.0), 64.0);
-    vec3 specular = spec * lightColor;
     // º∆À„“ı”∞
     float shadow = ShadowCalculation(fs_in.FragPosLightSpace);
-    vec3 lighting = (ambient + (1.0 - shadow) * (diffuse + specular)) * color;
+    vec3 lighting = ambient;
+    for(int i = 0; i < LIGHT_COUNT; ++i)
+    {
+        // Diffuse
+        vec3 lightDir = normalize(lightPos[i] - fs_in.FragPos);
+        float diff = max(dot(lightDir, normal), 0.0);
+        vec3 diffuse = diff * lightColor;
+        // Specular
+        //vec3 reflectDir = reflect(-lightDir, normal);
+        float spec = 0.0;
+        vec3 halfwayDir = normalize(lightDir + viewDir);
+        spec = pow(max(dot(normal, halfwayDir), 0.0), SHININESS);
+        vec3 specular = spec * lightColor;
+        // only the first light casts shadows
+        lighting += (i == 0 ? 1.0 - shadow : 1.0) * (diffuse + specular);
+    }
+    lighting += PointLighting(normal, viewDir);
+    lighting *= color;
     
     FragColor = vec4(lighting, 1.0f);
 }
\ No newline at end of file
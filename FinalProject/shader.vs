@@ -15,16 +15,20 @@ out VS_OUT {
 } vs_out;
 
 uniform mat4 model;
+uniform mat4 normalModel; // inverse transpose of model, set with it
 uniform mat4 view;
-uniform mat4 projection;
+uniform mat4 viewProjection; // projection * view, so the depth pre-pass can match it
 uniform mat4 lightSpaceMatrix;
 
 uniform vec3 cameraPosition;
+
+// robots, worldMatrix() and place() come from robot.glsl, put in after #version
 void main()
 {
-    gl_Position = projection * view * model * vec4(position, 1.0f);
-    vs_out.FragPos = vec3(model * vec4(position, 1.0));
-    vs_out.Normal = transpose(inverse(mat3(model))) * normal;
+    mat4 world = worldMatrix(model);
+    gl_Position = place(viewProjection, world, position);
+    vs_out.FragPos = vec3(world * vec4(position, 1.0));
+    vs_out.Normal = (robots ? transpose(inverse(mat3(world))) : mat3(normalModel)) * normal;
     vs_out.TexCoords = texCoords;
     vs_out.FragPosLightSpace = lightSpaceMatrix * vec4(vs_out.FragPos, 1.0);
     //ourColor = color;
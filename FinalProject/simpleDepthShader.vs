@@ -1,10 +1,13 @@
 #version 330 core
 layout (location = 0) in vec3 position;
 
+// the light's view and projection, or the camera's for the depth pre-pass
 uniform mat4 lightSpaceMatrix;
 uniform mat4 model;
 
+// worldMatrix() and place() come from robot.glsl, put in after #version
 void main()
 {
-    gl_Position = lightSpaceMatrix * model * vec4(position, 1.0f);
+    mat4 world = worldMatrix(model);
+    gl_Position = place(lightSpaceMatrix, world, position);
 }
\ No newline at end of file
@@ -40,6 +40,8 @@
 #ifndef HEADER_SIMPLE_OPENGL_IMAGE_LIBRARY
 #define HEADER_SIMPLE_OPENGL_IMAGE_LIBRARY
 
+#include <stddef.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -88,6 +90,9 @@ enum
 	SOIL_FLAG_INVERT_Y: flip the image vertically
 	SOIL_FLAG_COMPRESS_TO_DXT: if the card can display them, will convert RGB to DXT1, RGBA to DXT5
 	SOIL_FLAG_DDS_LOAD_DIRECT: will load DDS files directly without _ANY_ additional processing
+		(the file is memory mapped and every MIPmap is uploaded straight from the mapping;
+		DXT1/3/5, BC4/BC5 (ATI1/ATI2) and BGR(A) files are understood, and so is the DX10
+		header with its sRGB variants; a DX10 array is returned as a GL_TEXTURE_2D_ARRAY)
 	SOIL_FLAG_NTSC_SAFE_RGB: clamps RGB components to the range [16,235]
 	SOIL_FLAG_CoCg_Y: Google YCoCg; RGB=>CoYCg, RGBA=>CoCgAY
 	SOIL_FLAG_TEXTURE_RECTANGE: uses ARB_texture_rectangle ; pixel indexed & no repeat or MIPmaps or cubemaps
@@ -390,6 +395,86 @@ unsigned char*
 		int force_channels
 	);
 
+/**
+	Loads an image from disk at 1/scale_denominator of its size (1, 2, 4
+	or 8), e.g. for low MIPmap levels, thumbnails or a low-memory mode.
+	JPEGs are reduced while decoding, which saves most of the decode time
+	and memory, and their size is rounded up; other formats are decoded
+	in full, box filtered, and their size is rounded down.
+	\return 0 if failed, otherwise returns a pointer to the image data
+**/
+unsigned char*
+	SOIL_load_image_scaled
+	(
+		const char *filename,
+		int scale_denominator,
+		int *width, int *height, int *channels,
+		int force_channels
+	);
+
+/**
+	Loads an image from memory at 1/scale_denominator of its size, see
+	SOIL_load_image_scaled.
+	\return 0 if failed, otherwise returns a pointer to the image data
+**/
+unsigned char*
+	SOIL_load_image_from_memory_scaled
+	(
+		const unsigned char *const buffer,
+		int buffer_length,
+		int scale_denominator,
+		int *width, int *height, int *channels,
+		int force_channels
+	);
+
+/**
+	Reads an image's width, height and channel count without decoding
+	the pixels (for JPEG and PNG), e.g. to size a buffer for
+	SOIL_load_image_into.  *channels matches what SOIL_load_image
+	would report.
+	\return 0 if failed, otherwise returns 1
+**/
+int
+	SOIL_query_image_info
+	(
+		const char *filename,
+		int *width, int *height, int *channels
+	);
+
+/**
+	Loads an image from disk into a caller-owned buffer (e.g. a mapped
+	pixel buffer object) instead of allocating one.  buffer_length must
+	hold width*height*N bytes, N being force_channels, or the image's own
+	channel count for SOIL_LOAD_AUTO.  JPEG and PNG decode their final
+	pass straight into the buffer.
+	\return 0 if failed, otherwise returns 1
+**/
+int
+	SOIL_load_image_into
+	(
+		const char *filename,
+		unsigned char *buffer,
+		int buffer_length,
+		int *width, int *height, int *channels,
+		int force_channels
+	);
+
+/**
+	Loads an image from memory into a caller-owned buffer, see
+	SOIL_load_image_into.
+	\return 0 if failed, otherwise returns 1
+**/
+int
+	SOIL_load_image_from_memory_into
+	(
+		const unsigned char *const buffer,
+		int buffer_length,
+		unsigned char *out_buffer,
+		int out_buffer_length,
+		int *width, int *height, int *channels,
+		int force_channels
+	);
+
 /**
 	Saves an image from an array of unsigned chars (RGBA) to disk
 	\return 0 if failed, otherwise returns 1
@@ -404,7 +489,8 @@ int
 	);
 
 /**
-	Frees the image data (note, this is just C's "free()"...this function is
+	Frees the image data through the allocator installed with
+	SOIL_set_allocator (C's "free()" by default)...this function is
 	present mostly so C++ programmers don't forget to use "free()" and call
 	"delete []" instead [8^)
 **/
@@ -414,10 +500,44 @@ void
 		unsigned char *img_data
 	);
 
+/**
+	Routes every buffer SOIL and the image decoders allocate, including
+	the temporaries used while decoding, through the given functions.
+	Pass NULL for all three to go back to malloc/realloc/free.  Not
+	thread safe; install it before loading anything, and free images
+	through the same allocator that created them.
+**/
+void
+	SOIL_set_allocator
+	(
+		void *(*alloc_func)( void *user_data, size_t size ),
+		void *(*realloc_func)( void *user_data, void *ptr, size_t size ),
+		void (*free_func)( void *user_data, void *ptr ),
+		void *user_data
+	);
+
+/**
+	The number of allocations the image decoders made on the calling
+	thread since its last call to SOIL_reset_allocation_count.  Decoding a JPEG or PNG into a
+	caller-owned buffer should cost about one.
+**/
+int
+	SOIL_allocation_count
+	(
+		void
+	);
+
+void
+	SOIL_reset_allocation_count
+	(
+		void
+	);
+
 /**
 	This function resturn a pointer to a string describing the last thing
-	that happened inside SOIL.  It can be used to determine why an image
-	failed to load.
+	that happened inside SOIL on the calling thread.  It can be used to
+	determine why an image failed to load, even while other threads are
+	loading images of their own.
 **/
 const char*
 	SOIL_last_result
@@ -37,9 +37,32 @@
 
 #include <stdlib.h>
 #include <string.h>
+#ifndef WIN32
+	#include <pthread.h>
+	#include <fcntl.h>
+	#include <unistd.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+#endif
 
-/*	error reporting	*/
-char *result_string_pointer = "SOIL initialized";
+/*	error reporting, kept per thread so parallel loads each see their own	*/
+#if defined(_MSC_VER)
+	#define SOIL_THREAD_LOCAL __declspec(thread)
+#else
+	#define SOIL_THREAD_LOCAL __thread
+#endif
+SOIL_THREAD_LOCAL char *result_string_pointer = "SOIL initialized";
+
+/*	the capability queries run once, under a lock, for all threads	*/
+#ifdef WIN32
+	static SRWLOCK capability_lock = SRWLOCK_INIT;
+	#define SOIL_LOCK_CAPABILITIES()	AcquireSRWLockExclusive( &capability_lock )
+	#define SOIL_UNLOCK_CAPABILITIES()	ReleaseSRWLockExclusive( &capability_lock )
+#else
+	static pthread_mutex_t capability_lock = PTHREAD_MUTEX_INITIALIZER;
+	#define SOIL_LOCK_CAPABILITIES()	pthread_mutex_lock( &capability_lock )
+	#define SOIL_UNLOCK_CAPABILITIES()	pthread_mutex_unlock( &capability_lock )
+#endif
 
 /*	for loading cube maps	*/
 enum{
@@ -80,6 +103,36 @@ int query_DXT_capability( void );
 #define SOIL_RGBA_S3TC_DXT5		0x83F3
 typedef void (APIENTRY * P_SOIL_GLCOMPRESSEDTEXIMAGE2DPROC) (GLenum target, GLint level, GLenum internalformat, GLsizei width, GLsizei height, GLint border, GLsizei imageSize, const GLvoid * data);
 P_SOIL_GLCOMPRESSEDTEXIMAGE2DPROC soilGlCompressedTexImage2D = NULL;
+/*	for BC4/BC5 (RGTC) compression	*/
+static int has_RGTC_capability = SOIL_CAPABILITY_UNKNOWN;
+int query_RGTC_capability( void );
+#define SOIL_RED_RGTC1			0x8DBB
+#define SOIL_SIGNED_RED_RGTC1	0x8DBC
+#define SOIL_RG_RGTC2			0x8DBD
+#define SOIL_SIGNED_RG_RGTC2	0x8DBE
+/*	for sRGB textures	*/
+static int has_sRGB_capability = SOIL_CAPABILITY_UNKNOWN;
+int query_sRGB_capability( void );
+#define SOIL_SRGB8_ALPHA8				0x8C43
+#define SOIL_SRGB_ALPHA_S3TC_DXT1		0x8C4D
+#define SOIL_SRGB_ALPHA_S3TC_DXT3		0x8C4E
+#define SOIL_SRGB_ALPHA_S3TC_DXT5		0x8C4F
+/*	for uploading BGR(A) data without swizzling it first	*/
+#define SOIL_BGR				0x80E0
+#define SOIL_BGRA				0x80E1
+/*	for texture arrays	*/
+static int has_texture_array_capability = SOIL_CAPABILITY_UNKNOWN;
+int query_texture_array_capability( void );
+#define SOIL_TEXTURE_2D_ARRAY	0x8C1A
+typedef void (APIENTRY * P_SOIL_GLTEXIMAGE3DPROC) (GLenum target, GLint level, GLint internalformat, GLsizei width, GLsizei height, GLsizei depth, GLint border, GLenum format, GLenum type, const GLvoid * data);
+typedef void (APIENTRY * P_SOIL_GLTEXSUBIMAGE3DPROC) (GLenum target, GLint level, GLint xoffset, GLint yoffset, GLint zoffset, GLsizei width, GLsizei height, GLsizei depth, GLenum format, GLenum type, const GLvoid * data);
+typedef void (APIENTRY * P_SOIL_GLCOMPRESSEDTEXIMAGE3DPROC) (GLenum target, GLint level, GLenum internalformat, GLsizei width, GLsizei height, GLsizei depth, GLint border, GLsizei imageSize, const GLvoid * data);
+typedef void (APIENTRY * P_SOIL_GLCOMPRESSEDTEXSUBIMAGE3DPROC) (GLenum target, GLint level, GLint xoffset, GLint yoffset, GLint zoffset, GLsizei width, GLsizei height, GLsizei depth, GLenum format, GLsizei imageSize, const GLvoid * data);
+P_SOIL_GLTEXIMAGE3DPROC soilGlTexImage3D = NULL;
+P_SOIL_GLTEXSUBIMAGE3DPROC soilGlTexSubImage3D = NULL;
+P_SOIL_GLCOMPRESSEDTEXIMAGE3DPROC soilGlCompressedTexImage3D = NULL;
+P_SOIL_GLCOMPRESSEDTEXSUBIMAGE3DPROC soilGlCompressedTexSubImage3D = NULL;
+static void *SOIL_get_proc_address( const char *name );
 unsigned int SOIL_direct_load_DDS(
 		const char *filename,
 		unsigned int reuse_texture_ID,
@@ -889,7 +942,7 @@ unsigned int
 		dh = width;
 	}
 	sz = dw+dh;
-	sub_img = (unsigned char *)malloc( sz*sz*channels );
+	sub_img = (unsigned char *)stbi_image_malloc( sz*sz*channels );
 	/*	do the splitting and uploading	*/
 	tex_id = reuse_texture_ID;
 	for( i = 0; i < 6; ++i )
@@ -1026,7 +1079,7 @@ unsigned int
 		}
 	}
 	/*	create a copy the image data	*/
-	img = (unsigned char*)malloc( width*height*channels );
+	img = (unsigned char*)stbi_image_malloc( width*height*channels );
 	memcpy( img, data, width*height*channels );
 	/*	does the user want me to invert the image?	*/
 	if( flags & SOIL_FLAG_INVERT_Y )
@@ -1108,7 +1161,7 @@ unsigned int
 		if( (new_width != width) || (new_height != height) )
 		{
 			/*	yep, resize	*/
-			unsigned char *resampled = (unsigned char*)malloc( channels*new_width*new_height );
+			unsigned char *resampled = (unsigned char*)stbi_image_malloc( channels*new_width*new_height );
 			up_scale_image(
 					img, width, height, channels,
 					resampled, new_width, new_height );
@@ -1143,7 +1196,7 @@ unsigned int
 		}
 		new_width = width / reduce_block_x;
 		new_height = height / reduce_block_y;
-		resampled = (unsigned char*)malloc( channels*new_width*new_height );
+		resampled = (unsigned char*)stbi_image_malloc( channels*new_width*new_height );
 		/*	perform the actual reduction	*/
 		mipmap_image(	img, width, height, channels,
 						resampled, reduce_block_x, reduce_block_y );
@@ -1261,7 +1314,7 @@ unsigned int
 			int MIPlevel = 1;
 			int MIPwidth = (width+1) / 2;
 			int MIPheight = (height+1) / 2;
-			unsigned char *resampled = (unsigned char*)malloc( channels*MIPwidth*MIPheight );
+			unsigned char *resampled = (unsigned char*)stbi_image_malloc( channels*MIPwidth*MIPheight );
 			while( ((1<<MIPlevel) <= width) || ((1<<MIPlevel) <= height) )
 			{
 				/*	do this MIPmap level	*/
@@ -1395,7 +1448,7 @@ int
 	}
 
     /*  Get the data from OpenGL	*/
-    pixel_data = (unsigned char*)malloc( 3*width*height );
+    pixel_data = (unsigned char*)stbi_image_malloc( 3*width*height );
     glReadPixels (x, y, width, height, GL_RGB, GL_UNSIGNED_BYTE, pixel_data);
 
     /*	invert the image	*/
@@ -1464,6 +1517,232 @@ unsigned char*
 	return result;
 }
 
+/*	box filters a fully decoded image down by scale, for the formats that
+	can't be reduced while decoding; takes ownership of img	*/
+unsigned char*
+	downscale_decoded_image
+	(
+		unsigned char *img,
+		int scale,
+		int *width, int *height, int channels
+	)
+{
+	int new_width, new_height;
+	int i, j, c, u, v;
+	unsigned char *reduced;
+	if( (img == NULL) || (scale == 1) )
+	{
+		return img;
+	}
+	/*	round up, as the JPEG decoder does, so both agree on the size	*/
+	new_width = (*width + scale - 1) / scale;
+	new_height = (*height + scale - 1) / scale;
+	reduced = (unsigned char*)stbi_image_malloc( new_width*new_height*channels );
+	if( NULL == reduced )
+	{
+		SOIL_free_image_data( img );
+		return NULL;
+	}
+	for( j = 0; j < new_height; ++j )
+	{
+		for( i = 0; i < new_width; ++i )
+		{
+			/*	the last block of a row or column holds what is left	*/
+			int u_block = *width - i*scale;
+			int v_block = *height - j*scale;
+			int block_area;
+			if( u_block > scale )
+			{
+				u_block = scale;
+			}
+			if( v_block > scale )
+			{
+				v_block = scale;
+			}
+			block_area = u_block*v_block;
+			for( c = 0; c < channels; ++c )
+			{
+				int sum_value = block_area >> 1;
+				for( v = 0; v < v_block; ++v )
+				{
+					for( u = 0; u < u_block; ++u )
+					{
+						sum_value += img[((j*scale + v)*(*width) + i*scale + u)*channels + c];
+					}
+				}
+				reduced[(j*new_width + i)*channels + c] = (unsigned char)(sum_value / block_area);
+			}
+		}
+	}
+	SOIL_free_image_data( img );
+	*width = new_width;
+	*height = new_height;
+	return reduced;
+}
+
+unsigned char*
+	SOIL_load_image_scaled
+	(
+		const char *filename,
+		int scale_denominator,
+		int *width, int *height, int *channels,
+		int force_channels
+	)
+{
+	FILE *f;
+	int orig_channels = 0;
+	unsigned char *result = NULL;
+	/*	error check	*/
+	if( (scale_denominator != 1) && (scale_denominator != 2) &&
+		(scale_denominator != 4) && (scale_denominator != 8) )
+	{
+		result_string_pointer = "Scale must be 1, 2, 4 or 8";
+		return NULL;
+	}
+	f = fopen( filename, "rb" );
+	if( NULL == f )
+	{
+		result_string_pointer = "Unable to open file";
+		return NULL;
+	}
+	if( stbi_jpeg_test_file( f ) )
+	{
+		/*	JPEGs shrink inside the IDCT, skipping most of the work	*/
+		result = stbi_jpeg_load_scaled_from_file( f, scale_denominator,
+				width, height, &orig_channels, force_channels );
+	} else
+	{
+		result = stbi_load_from_file( f, width, height, &orig_channels, force_channels );
+		result = downscale_decoded_image( result, scale_denominator, width, height,
+				force_channels ? force_channels : orig_channels );
+	}
+	fclose( f );
+	if( channels )
+	{
+		*channels = orig_channels;
+	}
+	if( result == NULL )
+	{
+		result_string_pointer = stbi_failure_reason();
+	} else
+	{
+		result_string_pointer = "Image loaded at reduced scale";
+	}
+	return result;
+}
+
+unsigned char*
+	SOIL_load_image_from_memory_scaled
+	(
+		const unsigned char *const buffer,
+		int buffer_length,
+		int scale_denominator,
+		int *width, int *height, int *channels,
+		int force_channels
+	)
+{
+	int orig_channels = 0;
+	unsigned char *result = NULL;
+	/*	error check	*/
+	if( (scale_denominator != 1) && (scale_denominator != 2) &&
+		(scale_denominator != 4) && (scale_denominator != 8) )
+	{
+		result_string_pointer = "Scale must be 1, 2, 4 or 8";
+		return NULL;
+	}
+	if( stbi_jpeg_test_memory( buffer, buffer_length ) )
+	{
+		result = stbi_jpeg_load_scaled_from_memory( buffer, buffer_length,
+				scale_denominator, width, height, &orig_channels, force_channels );
+	} else
+	{
+		result = stbi_load_from_memory( buffer, buffer_length,
+				width, height, &orig_channels, force_channels );
+		result = downscale_decoded_image( result, scale_denominator, width, height,
+				force_channels ? force_channels : orig_channels );
+	}
+	if( channels )
+	{
+		*channels = orig_channels;
+	}
+	if( result == NULL )
+	{
+		result_string_pointer = stbi_failure_reason();
+	} else
+	{
+		result_string_pointer = "Image loaded from memory at reduced scale";
+	}
+	return result;
+}
+
+int
+	SOIL_query_image_info
+	(
+		const char *filename,
+		int *width, int *height, int *channels
+	)
+{
+	int result = stbi_info( filename, width, height, channels );
+	if( result == 0 )
+	{
+		result_string_pointer = stbi_failure_reason();
+	} else
+	{
+		result_string_pointer = "Image info read";
+	}
+	return result;
+}
+
+int
+	SOIL_load_image_into
+	(
+		const char *filename,
+		unsigned char *buffer,
+		int buffer_length,
+		int *width, int *height, int *channels,
+		int force_channels
+	)
+{
+	int result = stbi_load_into( filename,
+				buffer, buffer_length,
+				width, height, channels,
+				force_channels );
+	if( result == 0 )
+	{
+		result_string_pointer = stbi_failure_reason();
+	} else
+	{
+		result_string_pointer = "Image loaded into buffer";
+	}
+	return result;
+}
+
+int
+	SOIL_load_image_from_memory_into
+	(
+		const unsigned char *const buffer,
+		int buffer_length,
+		unsigned char *out_buffer,
+		int out_buffer_length,
+		int *width, int *height, int *channels,
+		int force_channels
+	)
+{
+	int result = stbi_load_from_memory_into(
+				buffer, buffer_length,
+				out_buffer, out_buffer_length,
+				width, height, channels,
+				force_channels );
+	if( result == 0 )
+	{
+		result_string_pointer = stbi_failure_reason();
+	} else
+	{
+		result_string_pointer = "Image loaded from memory into buffer";
+	}
+	return result;
+}
+
 int
 	SOIL_save_image
 	(
@@ -1517,7 +1796,50 @@ void
 		unsigned char *img_data
 	)
 {
-	free( (void*)img_data );
+	stbi_image_free( (void*)img_data );
+}
+
+void
+	SOIL_set_allocator
+	(
+		void *(*alloc_func)( void *user_data, size_t size ),
+		void *(*realloc_func)( void *user_data, void *ptr, size_t size ),
+		void (*free_func)( void *user_data, void *ptr ),
+		void *user_data
+	)
+{
+	stbi_allocator allocator;
+	if( (alloc_func == NULL) || (realloc_func == NULL) || (free_func == NULL) )
+	{
+		/*	back to the C runtime	*/
+		stbi_set_allocator( NULL );
+		result_string_pointer = "Default allocator restored";
+		return;
+	}
+	allocator.malloc_fn = alloc_func;
+	allocator.realloc_fn = realloc_func;
+	allocator.free_fn = free_func;
+	allocator.user = user_data;
+	stbi_set_allocator( &allocator );
+	result_string_pointer = "Allocator installed";
+}
+
+int
+	SOIL_allocation_count
+	(
+		void
+	)
+{
+	return stbi_allocation_count();
+}
+
+void
+	SOIL_reset_allocation_count
+	(
+		void
+	)
+{
+	stbi_reset_allocation_count();
 }
 
 const char*
@@ -1529,6 +1851,18 @@ const char*
 	return result_string_pointer;
 }
 
+/*	size in bytes of one DDS surface at the given MIPmap dimensions	*/
+static unsigned int DDS_surface_size(
+		unsigned int w, unsigned int h,
+		int uncompressed, int block_size )
+{
+	if( uncompressed )
+	{
+		return w * h * block_size;
+	}
+	return ((w+3)>>2) * ((h+3)>>2) * block_size;
+}
+
 unsigned int SOIL_direct_load_DDS_from_memory(
 		const unsigned char *const buffer,
 		int buffer_length,
@@ -1538,16 +1872,17 @@ unsigned int SOIL_direct_load_DDS_from_memory(
 {
 	/*	variables	*/
 	DDS_header header;
+	DDS_header_DXT10 header10;
 	unsigned int buffer_index = 0;
 	unsigned int tex_ID = 0;
 	/*	file reading variables	*/
 	unsigned int S3TC_type = 0;
-	unsigned char *DDS_data;
-	unsigned int DDS_main_size;
+	unsigned int pixel_format = 0;
 	unsigned int DDS_full_size;
-	unsigned int width, height;
+	unsigned int width, height, layers = 1, layer;
 	int mipmaps, cubemap, uncompressed, block_size = 16;
-	unsigned int flag;
+	int rgtc = 0, srgb = 0, unpack_alignment = 4;
+	unsigned int flag, fourcc;
 	unsigned int cf_target, ogl_target_start, ogl_target_end;
 	unsigned int opengl_texture_type;
 	int i;
@@ -1585,58 +1920,157 @@ unsigned int SOIL_direct_load_DDS_from_memory(
 	if( (header.sPixelFormat.dwFlags & flag) == 0 ) {goto quick_exit;}
 	if( header.sPixelFormat.dwSize != 32 ) {goto quick_exit;}
 	if( (header.sCaps.dwCaps1 & DDSCAPS_TEXTURE) == 0 ) {goto quick_exit;}
-	/*	make sure it is a type we can upload	*/
-	if( (header.sPixelFormat.dwFlags & DDPF_FOURCC) &&
-		!(
-		(header.sPixelFormat.dwFourCC == (('D'<<0)|('X'<<8)|('T'<<16)|('1'<<24))) ||
-		(header.sPixelFormat.dwFourCC == (('D'<<0)|('X'<<8)|('T'<<16)|('3'<<24))) ||
-		(header.sPixelFormat.dwFourCC == (('D'<<0)|('X'<<8)|('T'<<16)|('5'<<24)))
-		) )
-	{
-		goto quick_exit;
-	}
-	/*	OK, validated the header, let's load the image data	*/
-	result_string_pointer = "DDS header loaded and validated";
+	/*	OK, validated the header, work out what the data is	*/
 	width = header.dwWidth;
 	height = header.dwHeight;
 	uncompressed = 1 - (header.sPixelFormat.dwFlags & DDPF_FOURCC) / DDPF_FOURCC;
 	cubemap = (header.sCaps.dwCaps2 & DDSCAPS2_CUBEMAP) / DDSCAPS2_CUBEMAP;
+	fourcc = header.sPixelFormat.dwFourCC;
 	if( uncompressed )
 	{
+		/*	and remember, DDS uncompressed uses BGR(A), so
+			let OpenGL do the swizzle during the upload	*/
 		S3TC_type = GL_RGB;
+		pixel_format = SOIL_BGR;
 		block_size = 3;
 		if( header.sPixelFormat.dwFlags & DDPF_ALPHAPIXELS )
 		{
 			S3TC_type = GL_RGBA;
+			pixel_format = SOIL_BGRA;
 			block_size = 4;
 		}
-		DDS_main_size = width * height * block_size;
-	} else
+	} else if( fourcc == (('D'<<0)|('X'<<8)|('1'<<16)|('0'<<24)) )
 	{
-		/*	can we even handle direct uploading to OpenGL DXT compressed images?	*/
-		if( query_DXT_capability() != SOIL_CAPABILITY_PRESENT )
+		/*	the DX10 extended header carries a DXGI format,
+			an array size, and the cubemap flag	*/
+		if( buffer_length < sizeof( DDS_header ) + sizeof( DDS_header_DXT10 ) )
 		{
-			/*	we can't do it!	*/
-			result_string_pointer = "Direct upload of S3TC images not supported by the OpenGL driver";
+			result_string_pointer = "DDS file was too small to contain the DX10 header";
 			return 0;
 		}
-		/*	well, we know it is DXT1/3/5, because we checked above	*/
-		switch( (header.sPixelFormat.dwFourCC >> 24) - '0' )
+		memcpy( (void*)(&header10), (const void *)(&buffer[buffer_index]), sizeof( DDS_header_DXT10 ) );
+		buffer_index += sizeof( DDS_header_DXT10 );
+		if( header10.resourceDimension != DDS_DIMENSION_TEXTURE2D ) {goto quick_exit;}
+		if( header10.arraySize > 1 )
 		{
-		case 1:
-			S3TC_type = SOIL_RGBA_S3TC_DXT1;
+			layers = header10.arraySize;
+		}
+		cubemap = (header10.miscFlag & DDS_RESOURCE_MISC_TEXTURECUBE) != 0;
+		switch( header10.dxgiFormat )
+		{
+		case DXGI_FORMAT_BC1_UNORM_SRGB:
+			srgb = 1;
+			/*	fall through	*/
+		case DXGI_FORMAT_BC1_UNORM:
+			S3TC_type = srgb ? SOIL_SRGB_ALPHA_S3TC_DXT1 : SOIL_RGBA_S3TC_DXT1;
 			block_size = 8;
 			break;
-		case 3:
-			S3TC_type = SOIL_RGBA_S3TC_DXT3;
-			block_size = 16;
+		case DXGI_FORMAT_BC2_UNORM_SRGB:
+			srgb = 1;
+			/*	fall through	*/
+		case DXGI_FORMAT_BC2_UNORM:
+			S3TC_type = srgb ? SOIL_SRGB_ALPHA_S3TC_DXT3 : SOIL_RGBA_S3TC_DXT3;
+			break;
+		case DXGI_FORMAT_BC3_UNORM_SRGB:
+			srgb = 1;
+			/*	fall through	*/
+		case DXGI_FORMAT_BC3_UNORM:
+			S3TC_type = srgb ? SOIL_SRGB_ALPHA_S3TC_DXT5 : SOIL_RGBA_S3TC_DXT5;
+			break;
+		case DXGI_FORMAT_BC4_UNORM:
+			S3TC_type = SOIL_RED_RGTC1;
+			block_size = 8;
+			rgtc = 1;
+			break;
+		case DXGI_FORMAT_BC4_SNORM:
+			S3TC_type = SOIL_SIGNED_RED_RGTC1;
+			block_size = 8;
+			rgtc = 1;
+			break;
+		case DXGI_FORMAT_BC5_UNORM:
+			S3TC_type = SOIL_RG_RGTC2;
+			rgtc = 1;
+			break;
+		case DXGI_FORMAT_BC5_SNORM:
+			S3TC_type = SOIL_SIGNED_RG_RGTC2;
+			rgtc = 1;
 			break;
-		case 5:
-			S3TC_type = SOIL_RGBA_S3TC_DXT5;
-			block_size = 16;
+		case DXGI_FORMAT_R8G8B8A8_UNORM_SRGB:
+			srgb = 1;
+			/*	fall through	*/
+		case DXGI_FORMAT_R8G8B8A8_UNORM:
+			S3TC_type = srgb ? SOIL_SRGB8_ALPHA8 : GL_RGBA;
+			pixel_format = GL_RGBA;
+			block_size = 4;
+			uncompressed = 1;
+			break;
+		case DXGI_FORMAT_B8G8R8A8_UNORM_SRGB:
+			srgb = 1;
+			/*	fall through	*/
+		case DXGI_FORMAT_B8G8R8A8_UNORM:
+			S3TC_type = srgb ? SOIL_SRGB8_ALPHA8 : GL_RGBA;
+			pixel_format = SOIL_BGRA;
+			block_size = 4;
+			uncompressed = 1;
 			break;
+		default:
+			result_string_pointer = "DDS DXGI format is not supported";
+			return 0;
 		}
-		DDS_main_size = ((width+3)>>2)*((height+3)>>2)*block_size;
+	} else if( fourcc == (('D'<<0)|('X'<<8)|('T'<<16)|('1'<<24)) )
+	{
+		S3TC_type = SOIL_RGBA_S3TC_DXT1;
+		block_size = 8;
+	} else if( fourcc == (('D'<<0)|('X'<<8)|('T'<<16)|('3'<<24)) )
+	{
+		S3TC_type = SOIL_RGBA_S3TC_DXT3;
+	} else if( fourcc == (('D'<<0)|('X'<<8)|('T'<<16)|('5'<<24)) )
+	{
+		S3TC_type = SOIL_RGBA_S3TC_DXT5;
+	} else if(
+		(fourcc == (('A'<<0)|('T'<<8)|('I'<<16)|('1'<<24))) ||
+		(fourcc == (('B'<<0)|('C'<<8)|('4'<<16)|('U'<<24))) )
+	{
+		S3TC_type = SOIL_RED_RGTC1;
+		block_size = 8;
+		rgtc = 1;
+	} else if( fourcc == (('B'<<0)|('C'<<8)|('4'<<16)|('S'<<24)) )
+	{
+		S3TC_type = SOIL_SIGNED_RED_RGTC1;
+		block_size = 8;
+		rgtc = 1;
+	} else if(
+		(fourcc == (('A'<<0)|('T'<<8)|('I'<<16)|('2'<<24))) ||
+		(fourcc == (('B'<<0)|('C'<<8)|('5'<<16)|('U'<<24))) )
+	{
+		S3TC_type = SOIL_RG_RGTC2;
+		rgtc = 1;
+	} else if( fourcc == (('B'<<0)|('C'<<8)|('5'<<16)|('S'<<24)) )
+	{
+		S3TC_type = SOIL_SIGNED_RG_RGTC2;
+		rgtc = 1;
+	} else
+	{
+		/*	not a type we can upload	*/
+		goto quick_exit;
+	}
+	result_string_pointer = "DDS header loaded and validated";
+	/*	can we even handle direct uploading of these formats?	*/
+	if( !uncompressed && (query_DXT_capability() != SOIL_CAPABILITY_PRESENT) )
+	{
+		/*	we can't do it!	*/
+		result_string_pointer = "Direct upload of S3TC images not supported by the OpenGL driver";
+		return 0;
+	}
+	if( rgtc && (query_RGTC_capability() != SOIL_CAPABILITY_PRESENT) )
+	{
+		result_string_pointer = "Direct upload of BC4/BC5 images not supported by the OpenGL driver";
+		return 0;
+	}
+	if( srgb && (query_sRGB_capability() != SOIL_CAPABILITY_PRESENT) )
+	{
+		result_string_pointer = "Direct upload of sRGB images not supported by the OpenGL driver";
+		return 0;
 	}
 	if( cubemap )
 	{
@@ -1647,6 +2081,11 @@ unsigned int SOIL_direct_load_DDS_from_memory(
 			result_string_pointer = "DDS image was a cubemap";
 			return 0;
 		}
+		if( layers > 1 )
+		{
+			result_string_pointer = "DDS cubemap arrays are not supported";
+			return 0;
+		}
 		/*	can we even handle cubemaps with the OpenGL driver?	*/
 		if( query_cubemap_capability() != SOIL_CAPABILITY_PRESENT )
 		{
@@ -1666,46 +2105,45 @@ unsigned int SOIL_direct_load_DDS_from_memory(
 			result_string_pointer = "DDS image was not a cubemap";
 			return 0;
 		}
-		ogl_target_start = GL_TEXTURE_2D;
-		ogl_target_end =   GL_TEXTURE_2D;
-		opengl_texture_type = GL_TEXTURE_2D;
-	}
-	if( (header.sCaps.dwCaps1 & DDSCAPS_MIPMAP) && (header.dwMipMapCount > 1) )
-	{
-		int shift_offset;
-		mipmaps = header.dwMipMapCount - 1;
-		DDS_full_size = DDS_main_size;
-		if( uncompressed )
-		{
-			/*	uncompressed DDS, simple MIPmap size calculation	*/
-			shift_offset = 0;
-		} else
-		{
-			/*	compressed DDS, MIPmap size calculation is block based	*/
-			shift_offset = 2;
-		}
-		for( i = 1; i <= mipmaps; ++ i )
+		if( layers > 1 )
 		{
-			int w, h;
-			w = width >> (shift_offset + i);
-			h = height >> (shift_offset + i);
-			if( w < 1 )
-			{
-				w = 1;
-			}
-			if( h < 1 )
+			/*	arrays go in one GL_TEXTURE_2D_ARRAY, a layer per element	*/
+			if( query_texture_array_capability() != SOIL_CAPABILITY_PRESENT )
 			{
-				h = 1;
+				result_string_pointer = "Direct upload of texture arrays not supported by the OpenGL driver";
+				return 0;
 			}
-			DDS_full_size += w*h*block_size;
+			opengl_texture_type = SOIL_TEXTURE_2D_ARRAY;
+		} else
+		{
+			opengl_texture_type = GL_TEXTURE_2D;
 		}
+		ogl_target_start = opengl_texture_type;
+		ogl_target_end =   opengl_texture_type;
+	}
+	if( (header.sCaps.dwCaps1 & DDSCAPS_MIPMAP) && (header.dwMipMapCount > 1) )
+	{
+		mipmaps = header.dwMipMapCount - 1;
 	} else
 	{
 		mipmaps = 0;
-		DDS_full_size = DDS_main_size;
 	}
-	DDS_data = (unsigned char*)malloc( DDS_full_size );
-	/*	got the image data RAM, create or use an existing OpenGL texture handle	*/
+	/*	each face or array element holds its full MIPmap chain	*/
+	DDS_full_size = 0;
+	for( i = 0; i <= mipmaps; ++i )
+	{
+		unsigned int w = width >> i, h = height >> i;
+		DDS_full_size += DDS_surface_size( w ? w : 1, h ? h : 1, uncompressed, block_size );
+	}
+	/*	make sure it's all there before touching any GL state	*/
+	if( DDS_full_size == 0 ||
+		(buffer_length - buffer_index) / DDS_full_size <
+			layers * (ogl_target_end - ogl_target_start + 1) )
+	{
+		result_string_pointer = "DDS file was too small for expected image data";
+		return 0;
+	}
+	/*	create or use an existing OpenGL texture handle	*/
 	tex_ID = reuse_texture_ID;
 	if( tex_ID == 0 )
 	{
@@ -1713,80 +2151,95 @@ unsigned int SOIL_direct_load_DDS_from_memory(
 	}
 	/*  bind an OpenGL texture ID	*/
 	glBindTexture( opengl_texture_type, tex_ID );
-	/*	do this for each face of the cubemap!	*/
-	for( cf_target = ogl_target_start; cf_target <= ogl_target_end; ++cf_target )
+	/*	uncompressed rows are tightly packed, whatever their width	*/
+	if( uncompressed )
+	{
+		glGetIntegerv( GL_UNPACK_ALIGNMENT, &unpack_alignment );
+		glPixelStorei( GL_UNPACK_ALIGNMENT, 1 );
+	}
+	/*	everything is uploaded straight out of the caller's buffer	*/
+	if( layers > 1 )
 	{
-		if( buffer_index + DDS_full_size <= buffer_length )
+		/*	the file stores each element's MIPmap chain in turn, so
+			size every level first, then fill it in layer by layer	*/
+		for( i = 0; i <= mipmaps; ++i )
 		{
-			unsigned int byte_offset = DDS_main_size;
-			memcpy( (void*)DDS_data, (const void*)(&buffer[buffer_index]), DDS_full_size );
-			buffer_index += DDS_full_size;
-			/*	upload the main chunk	*/
+			unsigned int w = width >> i, h = height >> i;
+			w = w ? w : 1;
+			h = h ? h : 1;
 			if( uncompressed )
 			{
-				/*	and remember, DXT uncompressed uses BGR(A),
-					so swap to RGB(A) for ALL MIPmap levels	*/
-				for( i = 0; i < DDS_full_size; i += block_size )
-				{
-					unsigned char temp = DDS_data[i];
-					DDS_data[i] = DDS_data[i+2];
-					DDS_data[i+2] = temp;
-				}
-				glTexImage2D(
-					cf_target, 0,
-					S3TC_type, width, height, 0,
-					S3TC_type, GL_UNSIGNED_BYTE, DDS_data );
+				soilGlTexImage3D(
+					opengl_texture_type, i,
+					S3TC_type, w, h, layers, 0,
+					pixel_format, GL_UNSIGNED_BYTE, NULL );
 			} else
 			{
-				soilGlCompressedTexImage2D(
-					cf_target, 0,
-					S3TC_type, width, height, 0,
-					DDS_main_size, DDS_data );
+				soilGlCompressedTexImage3D(
+					opengl_texture_type, i,
+					S3TC_type, w, h, layers, 0,
+					DDS_surface_size( w, h, 0, block_size ) * layers, NULL );
 			}
-			/*	upload the mipmaps, if we have them	*/
-			for( i = 1; i <= mipmaps; ++i )
+		}
+		for( layer = 0; layer < layers; ++layer )
+		{
+			for( i = 0; i <= mipmaps; ++i )
 			{
-				int w, h, mip_size;
-				w = width >> i;
-				h = height >> i;
-				if( w < 1 )
+				unsigned int w = width >> i, h = height >> i, mip_size;
+				w = w ? w : 1;
+				h = h ? h : 1;
+				mip_size = DDS_surface_size( w, h, uncompressed, block_size );
+				if( uncompressed )
 				{
-					w = 1;
-				}
-				if( h < 1 )
+					soilGlTexSubImage3D(
+						opengl_texture_type, i,
+						0, 0, layer, w, h, 1,
+						pixel_format, GL_UNSIGNED_BYTE, &buffer[buffer_index] );
+				} else
 				{
-					h = 1;
+					soilGlCompressedTexSubImage3D(
+						opengl_texture_type, i,
+						0, 0, layer, w, h, 1,
+						S3TC_type, mip_size, &buffer[buffer_index] );
 				}
-				/*	upload this mipmap	*/
+				buffer_index += mip_size;
+			}
+		}
+	} else
+	{
+		/*	do this for each face of the cubemap!	*/
+		for( cf_target = ogl_target_start; cf_target <= ogl_target_end; ++cf_target )
+		{
+			for( i = 0; i <= mipmaps; ++i )
+			{
+				unsigned int w = width >> i, h = height >> i, mip_size;
+				w = w ? w : 1;
+				h = h ? h : 1;
+				mip_size = DDS_surface_size( w, h, uncompressed, block_size );
 				if( uncompressed )
 				{
-					mip_size = w*h*block_size;
 					glTexImage2D(
 						cf_target, i,
 						S3TC_type, w, h, 0,
-						S3TC_type, GL_UNSIGNED_BYTE, &DDS_data[byte_offset] );
+						pixel_format, GL_UNSIGNED_BYTE, &buffer[buffer_index] );
 				} else
 				{
-					mip_size = ((w+3)/4)*((h+3)/4)*block_size;
 					soilGlCompressedTexImage2D(
 						cf_target, i,
 						S3TC_type, w, h, 0,
-						mip_size, &DDS_data[byte_offset] );
+						mip_size, &buffer[buffer_index] );
 				}
 				/*	and move to the next mipmap	*/
-				byte_offset += mip_size;
+				buffer_index += mip_size;
 			}
-			/*	it worked!	*/
-			result_string_pointer = "DDS file loaded";
-		} else
-		{
-			glDeleteTextures( 1, & tex_ID );
-			tex_ID = 0;
-			cf_target = ogl_target_end + 1;
-			result_string_pointer = "DDS file was too small for expected image data";
-		}
-	}/* end reading each face */
-	SOIL_free_image_data( DDS_data );
+		}/* end reading each face */
+	}
+	if( uncompressed )
+	{
+		glPixelStorei( GL_UNPACK_ALIGNMENT, unpack_alignment );
+	}
+	/*	it worked!	*/
+	result_string_pointer = "DDS file loaded";
 	if( tex_ID )
 	{
 		/*	did I have MIPmaps?	*/
@@ -1822,15 +2275,78 @@ quick_exit:
 	return tex_ID;
 }
 
+/*	map a whole file read-only; NULL if it can't be opened or is empty	*/
+static const unsigned char *SOIL_map_file(
+		const char *filename,
+		size_t *length )
+{
+	void *view = NULL;
+#ifdef WIN32
+	HANDLE file, mapping;
+	LARGE_INTEGER size;
+	file = CreateFileA( filename, GENERIC_READ, FILE_SHARE_READ, NULL,
+			OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL );
+	if( file == INVALID_HANDLE_VALUE )
+	{
+		return NULL;
+	}
+	if( GetFileSizeEx( file, &size ) && (size.QuadPart > 0) )
+	{
+		mapping = CreateFileMappingA( file, NULL, PAGE_READONLY, 0, 0, NULL );
+		if( mapping != NULL )
+		{
+			/*	the view keeps the mapping alive	*/
+			view = MapViewOfFile( mapping, FILE_MAP_READ, 0, 0, 0 );
+			CloseHandle( mapping );
+		}
+		*length = (size_t)size.QuadPart;
+	}
+	CloseHandle( file );
+#else
+	struct stat st;
+	int fd = open( filename, O_RDONLY );
+	if( fd < 0 )
+	{
+		return NULL;
+	}
+	if( (fstat( fd, &st ) == 0) && (st.st_size > 0) )
+	{
+		view = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+		if( view == MAP_FAILED )
+		{
+			view = NULL;
+		} else
+		{
+			/*	the uploads walk the file front to back once	*/
+			madvise( view, st.st_size, MADV_SEQUENTIAL );
+		}
+		*length = (size_t)st.st_size;
+	}
+	/*	the mapping stays valid after the descriptor is closed	*/
+	close( fd );
+#endif
+	return (const unsigned char *)view;
+}
+
+static void SOIL_unmap_file(
+		const unsigned char *view,
+		size_t length )
+{
+#ifdef WIN32
+	UnmapViewOfFile( view );
+#else
+	munmap( (void *)view, length );
+#endif
+}
+
 unsigned int SOIL_direct_load_DDS(
 		const char *filename,
 		unsigned int reuse_texture_ID,
 		int flags,
 		int loading_as_cubemap )
 {
-	FILE *f;
-	unsigned char *buffer;
-	size_t buffer_length, bytes_read;
+	const unsigned char *buffer;
+	size_t buffer_length = 0;
 	unsigned int tex_ID = 0;
 	/*	error checks	*/
 	if( NULL == filename )
@@ -1838,41 +2354,33 @@ unsigned int SOIL_direct_load_DDS(
 		result_string_pointer = "NULL filename";
 		return 0;
 	}
-	f = fopen( filename, "rb" );
-	if( NULL == f )
+	/*	map the file, the GL driver reads the texels out of the page cache	*/
+	buffer = SOIL_map_file( filename, &buffer_length );
+	if( NULL == buffer )
 	{
 		/*	the file doesn't seem to exist (or be open-able)	*/
 		result_string_pointer = "Can not find DDS file";
 		return 0;
 	}
-	fseek( f, 0, SEEK_END );
-	buffer_length = ftell( f );
-	fseek( f, 0, SEEK_SET );
-	buffer = (unsigned char *) malloc( buffer_length );
-	if( NULL == buffer )
+	if( buffer_length > 0x7FFFFFFF )
 	{
-		result_string_pointer = "malloc failed";
-		fclose( f );
+		result_string_pointer = "DDS file is too large";
+		SOIL_unmap_file( buffer, buffer_length );
 		return 0;
 	}
-	bytes_read = fread( (void*)buffer, 1, buffer_length, f );
-	fclose( f );
-	if( bytes_read < buffer_length )
-	{
-		/*	huh?	*/
-		buffer_length = bytes_read;
-	}
 	/*	now try to do the loading	*/
 	tex_ID = SOIL_direct_load_DDS_from_memory(
-		(const unsigned char *const)buffer, buffer_length,
+		buffer, (int)buffer_length,
 		reuse_texture_ID, flags, loading_as_cubemap );
-	SOIL_free_image_data( buffer );
+	SOIL_unmap_file( buffer, buffer_length );
 	return tex_ID;
 }
 
 int query_NPOT_capability( void )
 {
+	int result;
 	/*	check for the capability	*/
+	SOIL_LOCK_CAPABILITIES();
 	if( has_NPOT_capability == SOIL_CAPABILITY_UNKNOWN )
 	{
 		/*	we haven't yet checked for the capability, do so	*/
@@ -1890,12 +2398,16 @@ int query_NPOT_capability( void )
 		}
 	}
 	/*	let the user know if we can do non-power-of-two textures or not	*/
-	return has_NPOT_capability;
+	result = has_NPOT_capability;
+	SOIL_UNLOCK_CAPABILITIES();
+	return result;
 }
 
 int query_tex_rectangle_capability( void )
 {
+	int result;
 	/*	check for the capability	*/
+	SOIL_LOCK_CAPABILITIES();
 	if( has_tex_rectangle_capability == SOIL_CAPABILITY_UNKNOWN )
 	{
 		/*	we haven't yet checked for the capability, do so	*/
@@ -1919,12 +2431,16 @@ int query_tex_rectangle_capability( void )
 		}
 	}
 	/*	let the user know if we can do texture rectangles or not	*/
-	return has_tex_rectangle_capability;
+	result = has_tex_rectangle_capability;
+	SOIL_UNLOCK_CAPABILITIES();
+	return result;
 }
 
 int query_cubemap_capability( void )
 {
+	int result;
 	/*	check for the capability	*/
+	SOIL_LOCK_CAPABILITIES();
 	if( has_cubemap_capability == SOIL_CAPABILITY_UNKNOWN )
 	{
 		/*	we haven't yet checked for the capability, do so	*/
@@ -1945,12 +2461,16 @@ int query_cubemap_capability( void )
 		}
 	}
 	/*	let the user know if we can do cubemaps or not	*/
-	return has_cubemap_capability;
+	result = has_cubemap_capability;
+	SOIL_UNLOCK_CAPABILITIES();
+	return result;
 }
 
 int query_DXT_capability( void )
 {
+	int result;
 	/*	check for the capability	*/
+	SOIL_LOCK_CAPABILITIES();
 	if( has_DXT_capability == SOIL_CAPABILITY_UNKNOWN )
 	{
 		/*	we haven't yet checked for the capability, do so	*/
@@ -2020,5 +2540,134 @@ int query_DXT_capability( void )
 		}
 	}
 	/*	let the user know if we can do DXT or not	*/
-	return has_DXT_capability;
+	result = has_DXT_capability;
+	SOIL_UNLOCK_CAPABILITIES();
+	return result;
+}
+
+static void *SOIL_get_proc_address( const char *name )
+{
+	void *addr = NULL;
+	#ifdef WIN32
+		addr = (void *)wglGetProcAddress( name );
+	#elif defined(__APPLE__) || defined(__APPLE_CC__)
+		CFBundleRef bundle;
+		CFURLRef bundleURL =
+			CFURLCreateWithFileSystemPath(
+				kCFAllocatorDefault,
+				CFSTR("/System/Library/Frameworks/OpenGL.framework"),
+				kCFURLPOSIXPathStyle,
+				true );
+		CFStringRef functionName =
+			CFStringCreateWithCString(
+				kCFAllocatorDefault,
+				name,
+				kCFStringEncodingASCII );
+		bundle = CFBundleCreate( kCFAllocatorDefault, bundleURL );
+		assert( bundle != NULL );
+		addr = CFBundleGetFunctionPointerForName( bundle, functionName );
+		CFRelease( bundleURL );
+		CFRelease( functionName );
+		CFRelease( bundle );
+	#else
+		addr = (void *)glXGetProcAddressARB( (const GLubyte *)name );
+	#endif
+	return addr;
+}
+
+int query_RGTC_capability( void )
+{
+	int result;
+	/*	check for the capability	*/
+	SOIL_LOCK_CAPABILITIES();
+	if( has_RGTC_capability == SOIL_CAPABILITY_UNKNOWN )
+	{
+		/*	we haven't yet checked for the capability, do so	*/
+		if(
+			(NULL == strstr( (char const*)glGetString( GL_EXTENSIONS ),
+				"GL_ARB_texture_compression_rgtc" ) )
+		&&
+			(NULL == strstr( (char const*)glGetString( GL_EXTENSIONS ),
+				"GL_EXT_texture_compression_rgtc" ) )
+			)
+		{
+			/*	not there, flag the failure	*/
+			has_RGTC_capability = SOIL_CAPABILITY_NONE;
+		} else
+		{
+			/*	it's there!	*/
+			has_RGTC_capability = SOIL_CAPABILITY_PRESENT;
+		}
+	}
+	/*	let the user know if we can do BC4/BC5 or not	*/
+	result = has_RGTC_capability;
+	SOIL_UNLOCK_CAPABILITIES();
+	return result;
+}
+
+int query_sRGB_capability( void )
+{
+	int result;
+	/*	check for the capability	*/
+	SOIL_LOCK_CAPABILITIES();
+	if( has_sRGB_capability == SOIL_CAPABILITY_UNKNOWN )
+	{
+		/*	we haven't yet checked for the capability, do so	*/
+		if( NULL == strstr( (char const*)glGetString( GL_EXTENSIONS ),
+				"GL_EXT_texture_sRGB" ) )
+		{
+			/*	not there, flag the failure	*/
+			has_sRGB_capability = SOIL_CAPABILITY_NONE;
+		} else
+		{
+			/*	it's there!	*/
+			has_sRGB_capability = SOIL_CAPABILITY_PRESENT;
+		}
+	}
+	/*	let the user know if we can do sRGB textures or not	*/
+	result = has_sRGB_capability;
+	SOIL_UNLOCK_CAPABILITIES();
+	return result;
+}
+
+int query_texture_array_capability( void )
+{
+	int result;
+	/*	check for the capability	*/
+	SOIL_LOCK_CAPABILITIES();
+	if( has_texture_array_capability == SOIL_CAPABILITY_UNKNOWN )
+	{
+		/*	we haven't yet checked for the capability, do so	*/
+		if( NULL == strstr( (char const*)glGetString( GL_EXTENSIONS ),
+				"GL_EXT_texture_array" ) )
+		{
+			/*	not there, flag the failure	*/
+			has_texture_array_capability = SOIL_CAPABILITY_NONE;
+		} else
+		{
+			/*	the 3D upload entry points are not exported everywhere	*/
+			soilGlTexImage3D = (P_SOIL_GLTEXIMAGE3DPROC)
+					SOIL_get_proc_address( "glTexImage3D" );
+			soilGlTexSubImage3D = (P_SOIL_GLTEXSUBIMAGE3DPROC)
+					SOIL_get_proc_address( "glTexSubImage3D" );
+			soilGlCompressedTexImage3D = (P_SOIL_GLCOMPRESSEDTEXIMAGE3DPROC)
+					SOIL_get_proc_address( "glCompressedTexImage3DARB" );
+			soilGlCompressedTexSubImage3D = (P_SOIL_GLCOMPRESSEDTEXSUBIMAGE3DPROC)
+					SOIL_get_proc_address( "glCompressedTexSubImage3DARB" );
+			if( (NULL == soilGlTexImage3D) || (NULL == soilGlTexSubImage3D) ||
+				(NULL == soilGlCompressedTexImage3D) ||
+				(NULL == soilGlCompressedTexSubImage3D) )
+			{
+				has_texture_array_capability = SOIL_CAPABILITY_NONE;
+			} else
+			{
+				/*	all's well!	*/
+				has_texture_array_capability = SOIL_CAPABILITY_PRESENT;
+			}
+		}
+	}
+	/*	let the user know if we can do texture arrays or not	*/
+	result = has_texture_array_capability;
+	SOIL_UNLOCK_CAPABILITIES();
+	return result;
 }
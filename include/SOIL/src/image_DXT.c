@@ -8,6 +8,7 @@
 */
 
 #include "image_DXT.h"
+#include "stb_image_aug.h"
 #include <math.h>
 #include <stdlib.h>
 #include <string.h>
@@ -94,7 +95,7 @@ int
 	fwrite( DDS_data, 1, DDS_size, fout );
 	fclose( fout );
 	/*	done	*/
-	free( DDS_data );
+	stbi_image_free( DDS_data );
 	return 1;
 }
 
@@ -125,7 +126,7 @@ unsigned char* convert_image_to_DXT1(
 	/*	get the RAM for the compressed image
 		(8 bytes per 4x4 pixel block)	*/
 	*out_size = ((width+3) >> 2) * ((height+3) >> 2) * 8;
-	compressed = (unsigned char*)malloc( *out_size );
+	compressed = (unsigned char*)stbi_image_malloc( *out_size );
 	/*	go through each block	*/
 	for( j = 0; j < height; j += 4 )
 	{
@@ -208,7 +209,7 @@ unsigned char* convert_image_to_DXT5(
 	/*	get the RAM for the compressed image
 		(16 bytes per 4x4 pixel block)	*/
 	*out_size = ((width+3) >> 2) * ((height+3) >> 2) * 16;
-	compressed = (unsigned char*)malloc( *out_size );
+	compressed = (unsigned char*)stbi_image_malloc( *out_size );
 	/*	go through each block	*/
 	for( j = 0; j < height; j += 4 )
 	{
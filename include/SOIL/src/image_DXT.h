@@ -85,6 +85,17 @@ typedef struct
 }
 DDS_header ;
 
+/*	follows DDS_header when sPixelFormat.dwFourCC is "DX10"	*/
+typedef struct
+{
+    unsigned int    dxgiFormat;
+    unsigned int    resourceDimension;
+    unsigned int    miscFlag;
+    unsigned int    arraySize;
+    unsigned int    miscFlags2;
+}
+DDS_header_DXT10 ;
+
 /*	the following constants were copied directly off the MSDN website	*/
 
 /*	The dwFlags member of the original DDSURFACEDESC2 structure
@@ -120,4 +131,24 @@ DDS_header ;
 #define DDSCAPS2_CUBEMAP_NEGATIVEZ	0x00008000
 #define DDSCAPS2_VOLUME	0x00200000
 
+/*	DX10 extended header: resourceDimension and miscFlag values	*/
+#define DDS_DIMENSION_TEXTURE2D	3
+#define DDS_RESOURCE_MISC_TEXTURECUBE	0x00000004
+
+/*	the DXGI_FORMAT values SOIL can upload directly	*/
+#define DXGI_FORMAT_R8G8B8A8_UNORM	28
+#define DXGI_FORMAT_R8G8B8A8_UNORM_SRGB	29
+#define DXGI_FORMAT_BC1_UNORM	71
+#define DXGI_FORMAT_BC1_UNORM_SRGB	72
+#define DXGI_FORMAT_BC2_UNORM	74
+#define DXGI_FORMAT_BC2_UNORM_SRGB	75
+#define DXGI_FORMAT_BC3_UNORM	77
+#define DXGI_FORMAT_BC3_UNORM_SRGB	78
+#define DXGI_FORMAT_BC4_UNORM	80
+#define DXGI_FORMAT_BC4_SNORM	81
+#define DXGI_FORMAT_BC5_UNORM	83
+#define DXGI_FORMAT_BC5_SNORM	84
+#define DXGI_FORMAT_B8G8R8A8_UNORM	87
+#define DXGI_FORMAT_B8G8R8A8_UNORM_SRGB	91
+
 #endif /* HEADER_IMAGE_DXT	*/
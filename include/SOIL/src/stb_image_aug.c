@@ -15,10 +15,11 @@
       decoded from memory or through stdio FILE (define STBI_NO_STDIO to remove code)
       supports installable dequantizing-IDCT, YCbCr-to-RGB conversion (define STBI_SIMD)
 
-   TODO:
-      stbi_info_*
-
    history:
+      1.20   incremental zlib decoding (stbi_zstream); PNG unfilters rows as they inflate
+      1.19   reduced-size IDCT for 1/2, 1/4, 1/8 scale JPEG decoding
+      1.18   per-thread failure reason and HDR settings, static zlib tables
+      1.17   pluggable allocator, decode into caller memory, stbi_info_*
       1.16   major bugfix - convert_format converted one too many pixels
       1.15   initialize some fields for thread safety
       1.14   fix threadsafe conversion bug; header-file-only version (#define STBI_HEADER_FILE_ONLY before including)
@@ -109,13 +110,22 @@ typedef unsigned char validate_uint32[sizeof(uint32)==4];
 //	I (JLD) want full messages for SOIL
 #define STBI_FAILURE_USERMSG 1
 
+// the failure reason, allocation counter and HDR conversion overrides are
+// kept per thread so decodes on different threads don't trample each other
+#ifndef STBI_THREAD_LOCAL
+   #if defined(_MSC_VER)
+      #define STBI_THREAD_LOCAL  __declspec(thread)
+   #else
+      #define STBI_THREAD_LOCAL  __thread
+   #endif
+#endif
+
 //////////////////////////////////////////////////////////////////////////////
 //
 // Generic API that works on all image types
 //
 
-// this is not threadsafe
-static char *failure_reason;
+static STBI_THREAD_LOCAL char *failure_reason;
 
 char *stbi_failure_reason(void)
 {
@@ -139,9 +149,53 @@ static int e(char *str)
 #define epf(x,y)   ((float *) (e(x,y)?NULL:NULL))
 #define epuc(x,y)  ((unsigned char *) (e(x,y)?NULL:NULL))
 
+static void *default_malloc(void *user, size_t size)            { (void) user; return malloc(size); }
+static void *default_realloc(void *user, void *p, size_t size)  { (void) user; return realloc(p, size); }
+static void  default_free(void *user, void *p)                   { (void) user; free(p); }
+
+static stbi_allocator allocator = { default_malloc, default_realloc, default_free, NULL };
+static STBI_THREAD_LOCAL int allocation_count;
+
+void stbi_set_allocator(stbi_allocator const *a)
+{
+   if (a) {
+      allocator = *a;
+   } else {
+      allocator.malloc_fn  = default_malloc;
+      allocator.realloc_fn = default_realloc;
+      allocator.free_fn    = default_free;
+      allocator.user       = NULL;
+   }
+}
+
+int  stbi_allocation_count(void)       { return allocation_count; }
+void stbi_reset_allocation_count(void) { allocation_count = 0; }
+
+static void *stbi_malloc(size_t size)
+{
+   ++allocation_count;
+   return allocator.malloc_fn(allocator.user, size);
+}
+
+static void *stbi_realloc(void *p, size_t size)
+{
+   ++allocation_count;
+   return allocator.realloc_fn(allocator.user, p, size);
+}
+
+static void stbi_free(void *p)
+{
+   if (p) allocator.free_fn(allocator.user, p);
+}
+
+void *stbi_image_malloc(size_t size)
+{
+   return stbi_malloc(size);
+}
+
 void stbi_image_free(void *retval_from_stbi_load)
 {
-   free(retval_from_stbi_load);
+   stbi_free(retval_from_stbi_load);
 }
 
 #define MAX_LOADERS  32
@@ -320,12 +374,44 @@ extern int      stbi_is_hdr_from_file(FILE *f)
 
 #endif
 
-// @TODO: get image dimensions & components without fully decoding
+// get image dimensions & components; JPEG and PNG only parse their
+// headers, other formats are decoded and the pixels thrown away
 #ifndef STBI_NO_STDIO
-extern int      stbi_info            (char const *filename,           int *x, int *y, int *comp);
-extern int      stbi_info_from_file  (FILE *f,                  int *x, int *y, int *comp);
+extern int      stbi_info            (char const *filename,           int *x, int *y, int *comp)
+{
+   FILE *f = fopen(filename, "rb");
+   int result;
+   if (!f) return e("can't fopen", "Unable to open file");
+   result = stbi_info_from_file(f, x, y, comp);
+   fclose(f);
+   return result;
+}
+
+extern int      stbi_info_from_file  (FILE *f,                  int *x, int *y, int *comp)
+{
+   stbi_uc *data;
+   int n;
+   if (stbi_jpeg_info_from_file(f, x, y, comp)) return 1;
+   if (stbi_png_info_from_file(f, x, y, comp))  return 1;
+   n = ftell(f);
+   data = stbi_load_from_file(f, x, y, comp, 0);
+   fseek(f,n,SEEK_SET);
+   if (data == NULL) return 0;
+   stbi_image_free(data);
+   return 1;
+}
 #endif
-extern int      stbi_info_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *comp);
+
+extern int      stbi_info_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *comp)
+{
+   stbi_uc *data;
+   if (stbi_jpeg_info_from_memory(buffer, len, x, y, comp)) return 1;
+   if (stbi_png_info_from_memory(buffer, len, x, y, comp))  return 1;
+   data = stbi_load_from_memory(buffer, len, x, y, comp, 0);
+   if (data == NULL) return 0;
+   stbi_image_free(data);
+   return 1;
+}
 
 #ifndef STBI_NO_HDR
 static float h2l_gamma_i=1.0f/2.2f, h2l_scale_i=1.0f;
@@ -336,6 +422,20 @@ void   stbi_hdr_to_ldr_scale(float scale) { h2l_scale_i = 1/scale; }
 
 void   stbi_ldr_to_hdr_gamma(float gamma) { l2h_gamma = gamma; }
 void   stbi_ldr_to_hdr_scale(float scale) { l2h_scale = scale; }
+
+// the calling thread's overrides, each used once its bit is set
+enum { H2L_GAMMA = 1, H2L_SCALE = 2, L2H_GAMMA = 4, L2H_SCALE = 8 };
+static STBI_THREAD_LOCAL float h2l_gamma_i_thread, h2l_scale_i_thread;
+static STBI_THREAD_LOCAL float l2h_gamma_thread, l2h_scale_thread;
+static STBI_THREAD_LOCAL int overridden;
+
+void   stbi_hdr_to_ldr_gamma_thread(float gamma) { h2l_gamma_i_thread = 1/gamma; overridden |= H2L_GAMMA; }
+void   stbi_hdr_to_ldr_scale_thread(float scale) { h2l_scale_i_thread = 1/scale; overridden |= H2L_SCALE; }
+
+void   stbi_ldr_to_hdr_gamma_thread(float gamma) { l2h_gamma_thread = gamma; overridden |= L2H_GAMMA; }
+void   stbi_ldr_to_hdr_scale_thread(float scale) { l2h_scale_thread = scale; overridden |= L2H_SCALE; }
+
+void   stbi_hdr_thread_defaults(void) { overridden = 0; }
 #endif
 
 
@@ -360,12 +460,18 @@ typedef struct
    FILE  *img_file;
    #endif
    uint8 *img_buffer, *img_buffer_end;
+
+   // caller-owned destination for the final image, if any
+   uint8 *dest;
+   uint32 dest_len;
 } stbi;
 
 #ifndef STBI_NO_STDIO
 static void start_file(stbi *s, FILE *f)
 {
    s->img_file = f;
+   s->dest = NULL;
+   s->dest_len = 0;
 }
 #endif
 
@@ -376,6 +482,27 @@ static void start_mem(stbi *s, uint8 const *buffer, int len)
 #endif
    s->img_buffer = (uint8 *) buffer;
    s->img_buffer_end = (uint8 *) buffer+len;
+   s->dest = NULL;
+   s->dest_len = 0;
+}
+
+// allocate the buffer for the last pass of a decode; this is the caller's
+// memory when loading "into", so it must only be used for the final output
+static uint8 *alloc_output(stbi *s, uint32 size)
+{
+   uint8 *p;
+   if (s && s->dest) {
+      if (size > s->dest_len) return epuc("buffer too small", "Output buffer too small for image");
+      return s->dest;
+   }
+   p = (uint8 *) stbi_malloc(size);
+   if (p == NULL) return epuc("outofmem", "Out of memory");
+   return p;
+}
+
+static void free_output(stbi *s, void *p)
+{
+   if (!s || p != s->dest) stbi_free(p);
 }
 
 __forceinline static int get8(stbi *s)
@@ -467,7 +594,8 @@ static uint8 compute_y(int r, int g, int b)
    return (uint8) (((r*77) + (g*150) +  (29*b)) >> 8);
 }
 
-static unsigned char *convert_format(unsigned char *data, int img_n, int req_comp, uint x, uint y)
+// 'dest' may supply the caller's output buffer; pass NULL to allocate one
+static unsigned char *convert_format_to(stbi *dest, unsigned char *data, int img_n, int req_comp, uint x, uint y)
 {
    int i,j;
    unsigned char *good;
@@ -475,10 +603,10 @@ static unsigned char *convert_format(unsigned char *data, int img_n, int req_com
    if (req_comp == img_n) return data;
    assert(req_comp >= 1 && req_comp <= 4);
 
-   good = (unsigned char *) malloc(req_comp * x * y);
+   good = alloc_output(dest, req_comp * x * y);
    if (good == NULL) {
-      free(data);
-      return epuc("outofmem", "Out of memory");
+      stbi_free(data);
+      return NULL;
    }
 
    for (j=0; j < (int) y; ++j) {
@@ -507,25 +635,32 @@ static unsigned char *convert_format(unsigned char *data, int img_n, int req_com
       #undef CASE
    }
 
-   free(data);
+   stbi_free(data);
    return good;
 }
 
+static unsigned char *convert_format(unsigned char *data, int img_n, int req_comp, uint x, uint y)
+{
+   return convert_format_to(NULL, data, img_n, req_comp, x, y);
+}
+
 #ifndef STBI_NO_HDR
 static float   *ldr_to_hdr(stbi_uc *data, int x, int y, int comp)
 {
    int i,k,n;
-   float *output = (float *) malloc(x * y * comp * sizeof(float));
-   if (output == NULL) { free(data); return epf("outofmem", "Out of memory"); }
+   float gamma = (overridden & L2H_GAMMA) ? l2h_gamma_thread : l2h_gamma;
+   float scale = (overridden & L2H_SCALE) ? l2h_scale_thread : l2h_scale;
+   float *output = (float *) stbi_malloc(x * y * comp * sizeof(float));
+   if (output == NULL) { stbi_free(data); return epf("outofmem", "Out of memory"); }
    // compute number of non-alpha components
    if (comp & 1) n = comp; else n = comp-1;
    for (i=0; i < x*y; ++i) {
       for (k=0; k < n; ++k) {
-         output[i*comp + k] = (float) pow(data[i*comp+k]/255.0f, l2h_gamma) * l2h_scale;
+         output[i*comp + k] = (float) pow(data[i*comp+k]/255.0f, gamma) * scale;
       }
       if (k < comp) output[i*comp + k] = data[i*comp+k]/255.0f;
    }
-   free(data);
+   stbi_free(data);
    return output;
 }
 
@@ -533,13 +668,15 @@ static float   *ldr_to_hdr(stbi_uc *data, int x, int y, int comp)
 static stbi_uc *hdr_to_ldr(float   *data, int x, int y, int comp)
 {
    int i,k,n;
-   stbi_uc *output = (stbi_uc *) malloc(x * y * comp);
-   if (output == NULL) { free(data); return epuc("outofmem", "Out of memory"); }
+   float gamma_i = (overridden & H2L_GAMMA) ? h2l_gamma_i_thread : h2l_gamma_i;
+   float scale_i = (overridden & H2L_SCALE) ? h2l_scale_i_thread : h2l_scale_i;
+   stbi_uc *output = (stbi_uc *) stbi_malloc(x * y * comp);
+   if (output == NULL) { stbi_free(data); return epuc("outofmem", "Out of memory"); }
    // compute number of non-alpha components
    if (comp & 1) n = comp; else n = comp-1;
    for (i=0; i < x*y; ++i) {
       for (k=0; k < n; ++k) {
-         float z = (float) pow(data[i*comp+k]*h2l_scale_i, h2l_gamma_i) * 255 + 0.5f;
+         float z = (float) pow(data[i*comp+k]*scale_i, gamma_i) * 255 + 0.5f;
          if (z < 0) z = 0;
          if (z > 255) z = 255;
          output[i*comp + k] = float2int(z);
@@ -551,7 +688,7 @@ static stbi_uc *hdr_to_ldr(float   *data, int x, int y, int comp)
          output[i*comp + k] = float2int(z);
       }
    }
-   free(data);
+   stbi_free(data);
    return output;
 }
 #endif
@@ -623,10 +760,12 @@ typedef struct
 
       int x,y,w2,h2;
       uint8 *data;
-      void *raw_data;
       uint8 *linebuf;
    } img_comp[4];
 
+   // component planes and line buffers, carved out of one allocation
+   void *scratch;
+
    uint32         code_buffer; // jpeg entropy-coded buffer
    int            code_bits;   // number of valid bits
    unsigned char  marker;      // marker seen while filling entropy buffer
@@ -634,6 +773,8 @@ typedef struct
 
    int scan_n, order[4];
    int restart_interval, todo;
+
+   int scale_shift; // decode at 1/(1 << scale_shift) size, 0..3
 } jpeg;
 
 static int build_huffman(huffman *h, int *count)
@@ -870,6 +1011,46 @@ __forceinline static uint8 clamp(int x)
    t1 += p2+p4;                                \
    t0 += p1+p3;
 
+// reduced-size IDCTs for decode-time downscaling: an n-point IDCT over the
+// n x n lowest frequencies yields the block box-filtered down by 8/n, and
+// skips dequantizing and transforming everything else. tables hold
+// 0.5*C(u)*cos((2x+1)*u*pi/2n), scaled up by 1<<12
+static short idct_scale_1[1*1] = { 1448 };
+static short idct_scale_2[2*2] = { 1448, 1448,   1448,-1448 };
+static short idct_scale_4[4*4] =
+{
+   1448, 1892, 1448,  784,
+   1448,  784,-1448,-1892,
+   1448, -784,-1448, 1892,
+   1448,-1892, 1448, -784,
+};
+
+static void idct_reduced(uint8 *out, int out_stride, short data[64], uint8 *dequantize, int n)
+{
+   int i,j,k,sum,val[16];
+   short *t = n == 4 ? idct_scale_4 : n == 2 ? idct_scale_2 : idct_scale_1;
+
+   // rows; keep 4 extra bits of precision for the second pass
+   for (j=0; j < n; ++j) {
+      for (i=0; i < n; ++i) {
+         sum = 0;
+         for (k=0; k < n; ++k)
+            sum += data[j*8+k] * dequantize[j*8+k] * t[i*n+k];
+         val[j*n+i] = (sum + (1 << 7)) >> 8;
+      }
+   }
+
+   // columns; remove the 1<<12 table scale plus the 4 bits kept above
+   for (j=0; j < n; ++j, out += out_stride) {
+      for (i=0; i < n; ++i) {
+         sum = 0;
+         for (k=0; k < n; ++k)
+            sum += val[k*n+i] * t[j*n+k];
+         out[i] = clamp((sum + (1 << 15)) >> 16);
+      }
+   }
+}
+
 #if !STBI_SIMD
 // .344 seconds on 3*anemones.jpg
 static void idct_block(uint8 *out, int out_stride, short data[64], uint8 *dequantize)
@@ -1033,9 +1214,13 @@ static int parse_entropy_coded_data(jpeg *z)
       // component has, independent of interleaved MCU blocking and such
       int w = (z->img_comp[n].x+7) >> 3;
       int h = (z->img_comp[n].y+7) >> 3;
+      int bs = 8 >> z->scale_shift; // output pixels per block side
       for (j=0; j < h; ++j) {
          for (i=0; i < w; ++i) {
             if (!decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+z->img_comp[n].ha, n)) return 0;
+            if (z->scale_shift)
+               idct_reduced(z->img_comp[n].data+z->img_comp[n].w2*j*bs+i*bs, z->img_comp[n].w2, data, z->dequant[z->img_comp[n].tq], bs);
+            else
             #if STBI_SIMD
             stbi_idct_installed(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data, z->dequant2[z->img_comp[n].tq]);
             #else
@@ -1063,9 +1248,12 @@ static int parse_entropy_coded_data(jpeg *z)
                // by the basic H and V specified for the component
                for (y=0; y < z->img_comp[n].v; ++y) {
                   for (x=0; x < z->img_comp[n].h; ++x) {
-                     int x2 = (i*z->img_comp[n].h + x)*8;
-                     int y2 = (j*z->img_comp[n].v + y)*8;
+                     int x2 = (i*z->img_comp[n].h + x) * (8 >> z->scale_shift);
+                     int y2 = (j*z->img_comp[n].v + y) * (8 >> z->scale_shift);
                      if (!decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+z->img_comp[n].ha, n)) return 0;
+                     if (z->scale_shift)
+                        idct_reduced(z->img_comp[n].data+z->img_comp[n].w2*y2+x2, z->img_comp[n].w2, data, z->dequant[z->img_comp[n].tq], 8 >> z->scale_shift);
+                     else
                      #if STBI_SIMD
                      stbi_idct_installed(z->img_comp[n].data+z->img_comp[n].w2*y2+x2, z->img_comp[n].w2, data, z->dequant2[z->img_comp[n].tq]);
                      #else
@@ -1186,9 +1374,11 @@ static int process_scan_header(jpeg *z)
 static int process_frame_header(jpeg *z, int scan)
 {
    stbi *s = &z->s;
-   int Lf,p,i,q, h_max=1,v_max=1,c;
+   int Lf,i,q, h_max=1,v_max=1,c;
+   uint32 scratch_len;
+   uint8 *p;
    Lf = get16(s);         if (Lf < 11) return e("bad SOF len","Corrupt JPEG"); // JPEG
-   p  = get8(s);          if (p != 8) return e("only 8-bit","JPEG format not supported: 8-bit only"); // JPEG baseline
+   q  = get8(s);          if (q != 8) return e("only 8-bit","JPEG format not supported: 8-bit only"); // JPEG baseline
    s->img_y = get16(s);   if (s->img_y == 0) return e("no header height", "JPEG format not supported: delayed height"); // Legal, but we don't handle it--but neither does IJG
    s->img_x = get16(s);   if (s->img_x == 0) return e("0 width","Corrupt JPEG"); // JPEG requires
    c = get8(s);
@@ -1229,6 +1419,7 @@ static int process_frame_header(jpeg *z, int scan)
    z->img_mcu_x = (s->img_x + z->img_mcu_w-1) / z->img_mcu_w;
    z->img_mcu_y = (s->img_y + z->img_mcu_h-1) / z->img_mcu_h;
 
+   scratch_len = 15;
    for (i=0; i < s->img_n; ++i) {
       // number of effective pixels (e.g. for non-interleaved MCU)
       z->img_comp[i].x = (s->img_x * z->img_comp[i].h + h_max-1) / h_max;
@@ -1237,19 +1428,26 @@ static int process_frame_header(jpeg *z, int scan)
       // the bogus oversized data from using interleaved MCUs and their
       // big blocks (e.g. a 16x16 iMCU on an image of width 33); we won't
       // discard the extra data until colorspace conversion
-      z->img_comp[i].w2 = z->img_mcu_x * z->img_comp[i].h * 8;
-      z->img_comp[i].h2 = z->img_mcu_y * z->img_comp[i].v * 8;
-      z->img_comp[i].raw_data = malloc(z->img_comp[i].w2 * z->img_comp[i].h2+15);
-      if (z->img_comp[i].raw_data == NULL) {
-         for(--i; i >= 0; --i) {
-            free(z->img_comp[i].raw_data);
-            z->img_comp[i].data = NULL;
-         }
-         return e("outofmem", "Out of memory");
-      }
-      // align blocks for installable-idct using mmx/sse
-      z->img_comp[i].data = (uint8*) (((size_t) z->img_comp[i].raw_data + 15) & ~15);
-      z->img_comp[i].linebuf = NULL;
+      z->img_comp[i].w2 = z->img_mcu_x * z->img_comp[i].h * (8 >> z->scale_shift);
+      z->img_comp[i].h2 = z->img_mcu_y * z->img_comp[i].v * (8 >> z->scale_shift);
+      // keep every plane 16-byte aligned; each also gets a line buffer big
+      // enough for upsampling off the edges with upsample factor of 4
+      scratch_len += ((z->img_comp[i].w2 * z->img_comp[i].h2 + 15) & ~15);
+      scratch_len += ((s->img_x + 3 + 15) & ~15);
+   }
+
+   // one allocation for every plane of the image instead of one per plane
+   z->scratch = stbi_malloc(scratch_len);
+   if (z->scratch == NULL) return e("outofmem", "Out of memory");
+   // align blocks for installable-idct using mmx/sse
+   p = (uint8 *) (((size_t) z->scratch + 15) & ~15);
+   for (i=0; i < s->img_n; ++i) {
+      z->img_comp[i].data = p;
+      p += (z->img_comp[i].w2 * z->img_comp[i].h2 + 15) & ~15;
+   }
+   for (i=0; i < s->img_n; ++i) {
+      z->img_comp[i].linebuf = p;
+      p += (s->img_x + 3 + 15) & ~15;
    }
 
    return 1;
@@ -1402,7 +1600,7 @@ static void YCbCr_to_RGB_row(uint8 *out, uint8 *y, uint8 *pcb, uint8 *pcr, int c
       out[0] = (uint8)r;
       out[1] = (uint8)g;
       out[2] = (uint8)b;
-      out[3] = 255;
+      if (step == 4) out[3] = 255;
       out += step;
    }
 }
@@ -1422,15 +1620,11 @@ static void cleanup_jpeg(jpeg *j)
 {
    int i;
    for (i=0; i < j->s.img_n; ++i) {
-      if (j->img_comp[i].data) {
-         free(j->img_comp[i].raw_data);
-         j->img_comp[i].data = NULL;
-      }
-      if (j->img_comp[i].linebuf) {
-         free(j->img_comp[i].linebuf);
-         j->img_comp[i].linebuf = NULL;
-      }
+      j->img_comp[i].data = NULL;
+      j->img_comp[i].linebuf = NULL;
    }
+   stbi_free(j->scratch);
+   j->scratch = NULL;
 }
 
 typedef struct
@@ -1443,16 +1637,29 @@ typedef struct
    int ypos;    // which pre-expansion row we're on
 } stbi_resample;
 
-static uint8 *load_jpeg_image(jpeg *z, int *out_x, int *out_y, int *comp, int req_comp)
+// scale_shift picks a 1/1, 1/2, 1/4 or 1/8 size decode (0..3)
+static uint8 *load_jpeg_image_scaled(jpeg *z, int *out_x, int *out_y, int *comp, int req_comp, int scale_shift)
 {
    int n, decode_n;
    // validate req_comp
    if (req_comp < 0 || req_comp > 4) return epuc("bad req_comp", "Internal error");
    z->s.img_n = 0;
+   z->scratch = NULL;
+   z->scale_shift = scale_shift;
 
    // load a jpeg image from whichever source
    if (!decode_jpeg_image(z)) { cleanup_jpeg(z); return NULL; }
 
+   // the planes came out of the IDCT already reduced; everything from here
+   // on works in output pixels
+   if (scale_shift) {
+      int k, round = (1 << scale_shift) - 1;
+      z->s.img_x = (z->s.img_x + round) >> scale_shift;
+      z->s.img_y = (z->s.img_y + round) >> scale_shift;
+      for (k=0; k < z->s.img_n; ++k)
+         z->img_comp[k].y = (z->img_comp[k].y + round) >> scale_shift;
+   }
+
    // determine actual number of components to generate
    n = req_comp ? req_comp : z->s.img_n;
 
@@ -1473,11 +1680,6 @@ static uint8 *load_jpeg_image(jpeg *z, int *out_x, int *out_y, int *comp, int re
       for (k=0; k < decode_n; ++k) {
          stbi_resample *r = &res_comp[k];
 
-         // allocate line buffer big enough for upsampling off the edges
-         // with upsample factor of 4
-         z->img_comp[k].linebuf = (uint8 *) malloc(z->s.img_x + 3);
-         if (!z->img_comp[k].linebuf) { cleanup_jpeg(z); return epuc("outofmem", "Out of memory"); }
-
          r->hs      = z->img_h_max / z->img_comp[k].h;
          r->vs      = z->img_v_max / z->img_comp[k].v;
          r->ystep   = r->vs >> 1;
@@ -1493,8 +1695,8 @@ static uint8 *load_jpeg_image(jpeg *z, int *out_x, int *out_y, int *comp, int re
       }
 
       // can't error after this so, this is safe
-      output = (uint8 *) malloc(n * z->s.img_x * z->s.img_y + 1);
-      if (!output) { cleanup_jpeg(z); return epuc("outofmem", "Out of memory"); }
+      output = alloc_output(&z->s, n * z->s.img_x * z->s.img_y);
+      if (!output) { cleanup_jpeg(z); return NULL; }
 
       // now go ahead and resample
       for (j=0; j < z->s.img_y; ++j) {
@@ -1524,7 +1726,7 @@ static uint8 *load_jpeg_image(jpeg *z, int *out_x, int *out_y, int *comp, int re
             } else
                for (i=0; i < z->s.img_x; ++i) {
                   out[0] = out[1] = out[2] = y[i];
-                  out[3] = 255; // not used if n==3
+                  if (n == 4) out[3] = 255;
                   out += n;
                }
          } else {
@@ -1543,6 +1745,23 @@ static uint8 *load_jpeg_image(jpeg *z, int *out_x, int *out_y, int *comp, int re
    }
 }
 
+static uint8 *load_jpeg_image(jpeg *z, int *out_x, int *out_y, int *comp, int req_comp)
+{
+   return load_jpeg_image_scaled(z, out_x, out_y, comp, req_comp, 0);
+}
+
+static int jpeg_scale_shift(int scale_denom)
+{
+   switch (scale_denom) {
+      case 1: return 0;
+      case 2: return 1;
+      case 4: return 2;
+      case 8: return 3;
+   }
+   e("bad scale", "JPEG scale must be 1, 2, 4 or 8");
+   return -1;
+}
+
 #ifndef STBI_NO_STDIO
 unsigned char *stbi_jpeg_load_from_file(FILE *f, int *x, int *y, int *comp, int req_comp)
 {
@@ -1569,6 +1788,36 @@ unsigned char *stbi_jpeg_load_from_memory(stbi_uc const *buffer, int len, int *x
    return load_jpeg_image(&j, x,y,comp,req_comp);
 }
 
+#ifndef STBI_NO_STDIO
+unsigned char *stbi_jpeg_load_scaled_from_file(FILE *f, int scale_denom, int *x, int *y, int *comp, int req_comp)
+{
+   jpeg j;
+   int shift = jpeg_scale_shift(scale_denom);
+   if (shift < 0) return NULL;
+   start_file(&j.s, f);
+   return load_jpeg_image_scaled(&j, x,y,comp,req_comp, shift);
+}
+
+unsigned char *stbi_jpeg_load_scaled(char const *filename, int scale_denom, int *x, int *y, int *comp, int req_comp)
+{
+   unsigned char *data;
+   FILE *f = fopen(filename, "rb");
+   if (!f) return epuc("can't fopen", "Unable to open file");
+   data = stbi_jpeg_load_scaled_from_file(f,scale_denom,x,y,comp,req_comp);
+   fclose(f);
+   return data;
+}
+#endif
+
+unsigned char *stbi_jpeg_load_scaled_from_memory(stbi_uc const *buffer, int len, int scale_denom, int *x, int *y, int *comp, int req_comp)
+{
+   jpeg j;
+   int shift = jpeg_scale_shift(scale_denom);
+   if (shift < 0) return NULL;
+   start_mem(&j.s, buffer,len);
+   return load_jpeg_image_scaled(&j, x,y,comp,req_comp, shift);
+}
+
 #ifndef STBI_NO_STDIO
 int stbi_jpeg_test_file(FILE *f)
 {
@@ -1589,17 +1838,51 @@ int stbi_jpeg_test_memory(stbi_uc const *buffer, int len)
    return decode_jpeg_header(&j, SCAN_type);
 }
 
-// @TODO:
+static int jpeg_info(jpeg *j, int *x, int *y, int *comp)
+{
+   if (!decode_jpeg_header(j, SCAN_header)) return 0;
+   if (x) *x = j->s.img_x;
+   if (y) *y = j->s.img_y;
+   if (comp) *comp = j->s.img_n;
+   return 1;
+}
+
 #ifndef STBI_NO_STDIO
-extern int      stbi_jpeg_info            (char const *filename,           int *x, int *y, int *comp);
-extern int      stbi_jpeg_info_from_file  (FILE *f,                  int *x, int *y, int *comp);
+extern int      stbi_jpeg_info            (char const *filename,           int *x, int *y, int *comp)
+{
+   FILE *f = fopen(filename, "rb");
+   int result;
+   if (!f) return e("can't fopen", "Unable to open file");
+   result = stbi_jpeg_info_from_file(f, x, y, comp);
+   fclose(f);
+   return result;
+}
+
+extern int      stbi_jpeg_info_from_file  (FILE *f,                  int *x, int *y, int *comp)
+{
+   int n,r;
+   jpeg j;
+   n = ftell(f);
+   start_file(&j.s, f);
+   r = jpeg_info(&j, x, y, comp);
+   fseek(f,n,SEEK_SET);
+   return r;
+}
 #endif
-extern int      stbi_jpeg_info_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *comp);
+
+extern int      stbi_jpeg_info_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *comp)
+{
+   jpeg j;
+   start_mem(&j.s, buffer,len);
+   return jpeg_info(&j, x, y, comp);
+}
 
 // public domain zlib decode    v0.2  Sean Barrett 2006-11-18
 //    simple implementation
 //      - all input must be provided in an upfront buffer
 //      - all output is written to a single output buffer (can malloc/realloc)
+//      - or, through stbi_zstream, input arrives in chunks and output is
+//        drained through a 64K buffer that keeps a 32K sliding window
 //    performance
 //      - fast huffman
 
@@ -1648,7 +1931,8 @@ static int zbuild_huffman(zhuffman *z, uint8 *sizelist, int num)
       ++sizes[sizelist[i]];
    sizes[0] = 0;
    for (i=1; i < 16; ++i)
-      assert(sizes[i] <= (1 << i));
+      if (sizes[i] > (1 << i))
+         return e("bad sizes","Corrupt PNG");
    code = 0;
    for (i=1; i < 16; ++i) {
       next_code[i] = code;
@@ -1690,6 +1974,7 @@ static int zbuild_huffman(zhuffman *z, uint8 *sizelist, int num)
 typedef struct
 {
    uint8 *zbuffer, *zbuffer_end;
+   int zphantom; // bytes fetched past zbuffer_end (read as 0)
    int num_bits;
    uint32 code_buffer;
 
@@ -1703,7 +1988,7 @@ typedef struct
 
 __forceinline static int zget8(zbuf *z)
 {
-   if (z->zbuffer >= z->zbuffer_end) return 0;
+   if (z->zbuffer >= z->zbuffer_end) { ++z->zphantom; return 0; }
    return *z->zbuffer++;
 }
 
@@ -1762,7 +2047,7 @@ static int expand(zbuf *z, int n)  // need to make room for n bytes
    limit = (int) (z->zout_end - z->zout_start);
    while (cur + n > limit)
       limit *= 2;
-   q = (char *) realloc(z->zout_start, limit);
+   q = (char *) stbi_realloc(z->zout_start, limit);
    if (q == NULL) return e("outofmem", "Out of memory");
    z->zout_start = q;
    z->zout       = q + cur;
@@ -1784,38 +2069,47 @@ static int dist_base[32] = { 1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,
 static int dist_extra[32] =
 { 0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13};
 
-static int parse_huffman_block(zbuf *a)
+// decode one literal or match; returns 1, 2 at the end of the block, or
+// 0 on error. a match writes at most 258 bytes
+__forceinline static int parse_huffman_symbol(zbuf *a)
 {
-   for(;;) {
-      int z = zhuffman_decode(a, &a->z_length);
-      if (z < 256) {
-         if (z < 0) return e("bad huffman code","Corrupt PNG"); // error in huffman codes
-         if (a->zout >= a->zout_end) if (!expand(a, 1)) return 0;
-         *a->zout++ = (char) z;
-      } else {
-         uint8 *p;
-         int len,dist;
-         if (z == 256) return 1;
-         z -= 257;
-         len = length_base[z];
-         if (length_extra[z]) len += zreceive(a, length_extra[z]);
-         z = zhuffman_decode(a, &a->z_distance);
-         if (z < 0) return e("bad huffman code","Corrupt PNG");
-         dist = dist_base[z];
-         if (dist_extra[z]) dist += zreceive(a, dist_extra[z]);
-         if (a->zout - a->zout_start < dist) return e("bad dist","Corrupt PNG");
-         if (a->zout + len > a->zout_end) if (!expand(a, len)) return 0;
-         p = (uint8 *) (a->zout - dist);
-         while (len--)
-            *a->zout++ = *p++;
-      }
+   int z = zhuffman_decode(a, &a->z_length);
+   if (z < 256) {
+      if (z < 0) return e("bad huffman code","Corrupt PNG"); // error in huffman codes
+      if (a->zout >= a->zout_end) if (!expand(a, 1)) return 0;
+      *a->zout++ = (char) z;
+   } else {
+      uint8 *p;
+      int len,dist;
+      if (z == 256) return 2;
+      z -= 257;
+      len = length_base[z];
+      if (length_extra[z]) len += zreceive(a, length_extra[z]);
+      z = zhuffman_decode(a, &a->z_distance);
+      if (z < 0) return e("bad huffman code","Corrupt PNG");
+      dist = dist_base[z];
+      if (dist_extra[z]) dist += zreceive(a, dist_extra[z]);
+      if (a->zout - a->zout_start < dist) return e("bad dist","Corrupt PNG");
+      if (a->zout + len > a->zout_end) if (!expand(a, len)) return 0;
+      p = (uint8 *) (a->zout - dist);
+      while (len--)
+         *a->zout++ = *p++;
    }
+   return 1;
+}
+
+static int parse_huffman_block(zbuf *a)
+{
+   int r;
+   while ((r = parse_huffman_symbol(a)) == 1)
+      ;
+   return r == 2;
 }
 
 static int compute_huffman_codes(zbuf *a)
 {
    static uint8 length_dezigzag[19] = { 16,17,18,0,8,7,9,6,10,5,11,4,12,3,13,2,14,1,15 };
-   static zhuffman z_codelength; // static just to save stack space
+   zhuffman z_codelength;
    uint8 lencodes[286+32+137];//padding for maximum single op
    uint8 codelength_sizes[19];
    int i,n;
@@ -1834,10 +2128,11 @@ static int compute_huffman_codes(zbuf *a)
    n = 0;
    while (n < hlit + hdist) {
       int c = zhuffman_decode(a, &z_codelength);
-      assert(c >= 0 && c < 19);
+      if (c < 0 || c >= 19) return e("bad codelengths","Corrupt PNG");
       if (c < 16)
          lencodes[n++] = (uint8) c;
       else if (c == 16) {
+         if (n == 0) return e("bad codelengths","Corrupt PNG");
          c = zreceive(a,2)+3;
          memset(lencodes+n, lencodes[n-1], c);
          n += c;
@@ -1858,7 +2153,8 @@ static int compute_huffman_codes(zbuf *a)
    return 1;
 }
 
-static int parse_uncompressed_block(zbuf *a)
+// returns the stored block's length, or -1 on error
+static int parse_uncompressed_header(zbuf *a)
 {
    uint8 header[4];
    int len,nlen,k;
@@ -1877,7 +2173,14 @@ static int parse_uncompressed_block(zbuf *a)
       header[k++] = (uint8) zget8(a);
    len  = header[1] * 256 + header[0];
    nlen = header[3] * 256 + header[2];
-   if (nlen != (len ^ 0xffff)) return e("zlib corrupt","Corrupt PNG");
+   if (nlen != (len ^ 0xffff)) return e("zlib corrupt","Corrupt PNG") - 1;
+   return len;
+}
+
+static int parse_uncompressed_block(zbuf *a)
+{
+   int len = parse_uncompressed_header(a);
+   if (len < 0) return 0;
    if (a->zbuffer + len > a->zbuffer_end) return e("read past buffer","Corrupt PNG");
    if (a->zout + len > a->zout_end)
       if (!expand(a, len)) return 0;
@@ -1900,18 +2203,20 @@ static int parse_zlib_header(zbuf *a)
    return 1;
 }
 
-// @TODO: should statically initialize these for optimal thread safety
-static uint8 default_length[288], default_distance[32];
-static void init_defaults(void)
+// fixed huffman code lengths from the deflate spec, built at compile
+// time so concurrent decoders never race to fill them in
+#define Z8(x)   x,x,x,x,x,x,x,x
+#define Z16(x)  Z8(x),Z8(x)
+static uint8 default_length[288] =
 {
-   int i;   // use <= to match clearly with spec
-   for (i=0; i <= 143; ++i)     default_length[i]   = 8;
-   for (   ; i <= 255; ++i)     default_length[i]   = 9;
-   for (   ; i <= 279; ++i)     default_length[i]   = 7;
-   for (   ; i <= 287; ++i)     default_length[i]   = 8;
-
-   for (i=0; i <=  31; ++i)     default_distance[i] = 5;
-}
+   Z16(8),Z16(8),Z16(8),Z16(8),Z16(8),Z16(8),Z16(8),Z16(8),Z16(8), //   0..143
+   Z16(9),Z16(9),Z16(9),Z16(9),Z16(9),Z16(9),Z16(9),               // 144..255
+   Z8(7),Z8(7),Z8(7),                                              // 256..279
+   Z8(8),                                                          // 280..287
+};
+static uint8 default_distance[32] = { Z16(5),Z16(5) };
+#undef Z16
+#undef Z8
 
 static int parse_zlib(zbuf *a, int parse_header)
 {
@@ -1930,7 +2235,6 @@ static int parse_zlib(zbuf *a, int parse_header)
       } else {
          if (type == 1) {
             // use fixed code lengths
-            if (!default_distance[31]) init_defaults();
             if (!zbuild_huffman(&a->z_length  , default_length  , 288)) return 0;
             if (!zbuild_huffman(&a->z_distance, default_distance,  32)) return 0;
          } else {
@@ -1944,6 +2248,7 @@ static int parse_zlib(zbuf *a, int parse_header)
 
 static int do_zlib(zbuf *a, char *obuf, int olen, int exp, int parse_header)
 {
+   a->zphantom   = 0;
    a->zout_start = obuf;
    a->zout       = obuf;
    a->zout_end   = obuf + olen;
@@ -1955,7 +2260,7 @@ static int do_zlib(zbuf *a, char *obuf, int olen, int exp, int parse_header)
 char *stbi_zlib_decode_malloc_guesssize(const char *buffer, int len, int initial_size, int *outlen)
 {
    zbuf a;
-   char *p = (char *) malloc(initial_size);
+   char *p = (char *) stbi_malloc(initial_size);
    if (p == NULL) return NULL;
    a.zbuffer = (uint8 *) buffer;
    a.zbuffer_end = (uint8 *) buffer + len;
@@ -1963,7 +2268,7 @@ char *stbi_zlib_decode_malloc_guesssize(const char *buffer, int len, int initial
       if (outlen) *outlen = (int) (a.zout - a.zout_start);
       return a.zout_start;
    } else {
-      free(a.zout_start);
+      stbi_free(a.zout_start);
       return NULL;
    }
 }
@@ -1987,7 +2292,7 @@ int stbi_zlib_decode_buffer(char *obuffer, int olen, char const *ibuffer, int il
 char *stbi_zlib_decode_noheader_malloc(char const *buffer, int len, int *outlen)
 {
    zbuf a;
-   char *p = (char *) malloc(16384);
+   char *p = (char *) stbi_malloc(16384);
    if (p == NULL) return NULL;
    a.zbuffer = (uint8 *) buffer;
    a.zbuffer_end = (uint8 *) buffer+len;
@@ -1995,7 +2300,7 @@ char *stbi_zlib_decode_noheader_malloc(char const *buffer, int len, int *outlen)
       if (outlen) *outlen = (int) (a.zout - a.zout_start);
       return a.zout_start;
    } else {
-      free(a.zout_start);
+      stbi_free(a.zout_start);
       return NULL;
    }
 }
@@ -2011,13 +2316,222 @@ int stbi_zlib_decode_noheader_buffer(char *obuffer, int olen, const char *ibuffe
       return -1;
 }
 
+// incremental inflate
+//    the decoder runs in small resumable steps (zlib header, block header,
+//    one symbol, a run of stored bytes). a step that reads past the input
+//    fed so far is rolled back and retried once more input arrives, so a
+//    chunk boundary can fall anywhere. output goes into a 64K buffer
+//    (ZSTREAM_SPACE) that keeps the last 32K (ZSTREAM_WINDOW) for
+//    back-references and slides down once drained
+
+#define ZSTREAM_WINDOW  32768
+#define ZSTREAM_SPACE   (ZSTREAM_WINDOW * 2)
+#define ZSTREAM_MAXLEN  258   // longest match
+
+enum
+{
+   ZS_header, ZS_block, ZS_huffman, ZS_stored, ZS_done
+};
+
+struct stbi_zstream
+{
+   zbuf z;
+   int state;
+   int final;         // current block is the last one
+   int stored_left;   // bytes left in a stored block
+   int input_final;   // no more input will be fed
+   int failed;
+   uint8 *in;         // pending input; z.zbuffer..z.zbuffer_end lives in here
+   int in_cap;
+   char *drain;       // first decoded byte not yet handed to the caller
+   uint8 *extra;      // optional caller scratch allocated alongside
+   char window[ZSTREAM_SPACE];
+};
+
+static stbi_zstream *zstream_open(int parse_header, int extra)
+{
+   stbi_zstream *s = (stbi_zstream *) stbi_malloc(sizeof(*s) + extra);
+   if (s == NULL) return (stbi_zstream *) epuc("outofmem", "Out of memory");
+   memset(&s->z, 0, sizeof(s->z));
+   s->state = parse_header ? ZS_header : ZS_block;
+   s->final = s->stored_left = s->input_final = s->failed = 0;
+   s->in = NULL;
+   s->in_cap = 0;
+   s->z.zout_start = s->z.zout = s->drain = s->window;
+   s->z.zout_end = s->window + ZSTREAM_SPACE;
+   s->z.z_expandable = 0;
+   s->extra = extra ? (uint8 *) (s+1) : NULL;
+   return s;
+}
+
+stbi_zstream *stbi_zstream_open(int parse_header)
+{
+   return zstream_open(parse_header, 0);
+}
+
+void stbi_zstream_close(stbi_zstream *s)
+{
+   if (s == NULL) return;
+   stbi_free(s->in);
+   stbi_free(s);
+}
+
+// make room for len more input bytes and return where they go
+static uint8 *zstream_input_space(stbi_zstream *s, int len)
+{
+   int pending = (int) (s->z.zbuffer_end - s->z.zbuffer);
+   if (pending && s->z.zbuffer != s->in)
+      memmove(s->in, s->z.zbuffer, pending);
+   if (pending + len > s->in_cap) {
+      int cap = s->in_cap ? s->in_cap : 4096;
+      uint8 *p;
+      while (pending + len > cap)
+         cap *= 2;
+      p = (uint8 *) stbi_realloc(s->in, cap);
+      if (p == NULL) return epuc("outofmem", "Out of memory");
+      s->in = p;
+      s->in_cap = cap;
+   }
+   s->z.zbuffer = s->in;
+   s->z.zbuffer_end = s->in + pending + len;
+   return s->in + pending;
+}
+
+int stbi_zstream_feed(stbi_zstream *s, char const *buffer, int len, int final)
+{
+   if (len > 0) {
+      uint8 *p = zstream_input_space(s, len);
+      if (p == NULL) return 0;
+      memcpy(p, buffer, len);
+   }
+   if (final) s->input_final = 1;
+   return 1;
+}
+
+// run one step; returns 1 on progress, 0 if it needs more input, -1 on error
+static int zstream_step(stbi_zstream *s)
+{
+   zbuf *a = &s->z;
+   uint8 *in_save = a->zbuffer;
+   uint32 code_save = a->code_buffer;
+   int bits_save = a->num_bits;
+   char *out_save = a->zout;
+   int state_save = s->state, final_save = s->final;
+   int ok = 1, n;
+
+   a->zphantom = 0;
+   switch (s->state) {
+      case ZS_header:
+         ok = parse_zlib_header(a);
+         s->state = ZS_block;
+         break;
+      case ZS_block: {
+         int type;
+         s->final = zreceive(a,1);
+         type = zreceive(a,2);
+         if (type == 0) {
+            s->stored_left = parse_uncompressed_header(a);
+            ok = s->stored_left >= 0;
+            s->state = ZS_stored;
+         } else if (type == 3) {
+            ok = e("bad block type","Corrupt PNG");
+         } else {
+            if (type == 1) {
+               // use fixed code lengths
+               ok = zbuild_huffman(&a->z_length  , default_length  , 288)
+                 && zbuild_huffman(&a->z_distance, default_distance,  32);
+            } else {
+               ok = compute_huffman_codes(a);
+            }
+            s->state = ZS_huffman;
+         }
+         break;
+      }
+      case ZS_huffman:
+         n = parse_huffman_symbol(a);
+         ok = n != 0;
+         if (n == 2) s->state = s->final ? ZS_done : ZS_block;
+         break;
+      case ZS_stored:
+         // raw bytes: copy what we have, no rollback needed
+         n = (int) (a->zbuffer_end - a->zbuffer);
+         if (n > s->stored_left) n = s->stored_left;
+         if (n > a->zout_end - a->zout) n = (int) (a->zout_end - a->zout);
+         if (n == 0 && s->stored_left) {
+            if (s->input_final) { s->failed = 1; return e("read past buffer","Corrupt PNG") - 1; }
+            return 0;
+         }
+         memcpy(a->zout, a->zbuffer, n);
+         a->zbuffer += n;
+         a->zout += n;
+         s->stored_left -= n;
+         if (s->stored_left == 0) s->state = s->final ? ZS_done : ZS_block;
+         return 1;
+   }
+
+   // bits that came from past the end of the input were used: undo the
+   // step and wait for more, unless there is no more
+   if (a->zphantom * 8 > a->num_bits) {
+      if (s->input_final) { s->failed = 1; return e("truncated","Corrupt PNG") - 1; }
+      s->state = state_save;
+      s->final = final_save;
+      a->zbuffer = in_save;
+      a->code_buffer = code_save;
+      a->num_bits = bits_save;
+      a->zout = out_save;
+      return 0;
+   }
+   if (!ok) { s->failed = 1; return -1; }
+   // forget bytes prefetched from past the end, the next feed supplies them
+   if (a->zphantom) {
+      a->num_bits -= a->zphantom * 8;
+      a->code_buffer &= (1U << a->num_bits) - 1;
+   }
+   return 1;
+}
+
+int stbi_zstream_read(stbi_zstream *s, char *obuffer, int olen)
+{
+   int n = 0, r = 1;
+   if (s->failed) return -1;
+   while (n < olen) {
+      int k = (int) (s->z.zout - s->drain);
+      if (k > 0) {
+         if (k > olen - n) k = olen - n;
+         memcpy(obuffer + n, s->drain, k);
+         s->drain += k;
+         n += k;
+         continue;
+      }
+      if (s->state == ZS_done || r == 0) break;
+      // all decoded data has been handed out; once the window is nearly
+      // full, slide it down keeping 32K of history
+      if (s->z.zout_end - s->z.zout < ZSTREAM_MAXLEN) {
+         memmove(s->window, s->z.zout - ZSTREAM_WINDOW, ZSTREAM_WINDOW);
+         s->z.zout = s->drain = s->window + ZSTREAM_WINDOW;
+      }
+      // decode until there's enough to fill the request or the window
+      while (s->z.zout - s->drain < olen - n && s->z.zout_end - s->z.zout >= ZSTREAM_MAXLEN && s->state != ZS_done) {
+         r = zstream_step(s);
+         if (r < 0) return -1;
+         if (r == 0) break;
+      }
+   }
+   return n;
+}
+
+int stbi_zstream_done(stbi_zstream *s)
+{
+   return s->state == ZS_done && s->drain == s->z.zout;
+}
+
 // public domain "baseline" PNG decoder   v0.10  Sean Barrett 2006-11-18
 //    simple implementation
 //      - only 8-bit samples
 //      - no CRC checking
-//      - allocates lots of intermediate memory
-//        - avoids problem of streaming data between subsystems
-//        - avoids explicit window management
+//      - IDAT data is inflated incrementally and each scanline is
+//        unfiltered as soon as it is complete, so neither the compressed
+//        nor the filtered image is ever held in full
 //    performance
 //      - uses stb_zlib, a PD zlib implementation with fast huffman decoding
 
@@ -2050,9 +2564,14 @@ static int check_png_header(stbi *s)
 typedef struct
 {
    stbi s;
-   uint8 *idata, *expanded, *out;
+   stbi_zstream *zs;  // IDAT inflater; its extra space holds one filtered row
+   uint8 *out;
+   uint32 row_fill;   // bytes of the current filtered row received so far
+   uint32 row_y;      // rows unfiltered into out so far
 } png;
 
+#define PNG_IDAT_SLICE  16384  // IDAT bytes handed to the inflater at a time
+
 
 enum {
    F_none=0, F_sub=1, F_up=2, F_avg=3, F_paeth=4,
@@ -2075,73 +2594,105 @@ static int paeth(int a, int b, int c)
    return c;
 }
 
-// create the png data from post-deflated data
-static int create_png_image(png *a, uint8 *raw, uint32 raw_len, int out_n)
+// unfilter post-deflated row j into the output image; rows must arrive in
+// order since each one is predicted from the row above
+static int unfilter_png_row(png *a, uint8 *raw, uint32 j, int out_n)
 {
    stbi *s = &a->s;
-   uint32 i,j,stride = s->img_x*out_n;
+   uint32 i,stride = s->img_x*out_n;
    int k;
    int img_n = s->img_n; // copy it into a local for later
+   uint8 *cur = a->out + stride*j;
+   uint8 *prior = cur - stride;
+   int filter = *raw++;
    assert(out_n == s->img_n || out_n == s->img_n+1);
-   a->out = (uint8 *) malloc(s->img_x * s->img_y * out_n);
-   if (!a->out) return e("outofmem", "Out of memory");
-   if (raw_len != (img_n * s->img_x + 1) * s->img_y) return e("not enough pixels","Corrupt PNG");
-   for (j=0; j < s->img_y; ++j) {
-      uint8 *cur = a->out + stride*j;
-      uint8 *prior = cur - stride;
-      int filter = *raw++;
-      if (filter > 4) return e("invalid filter","Corrupt PNG");
-      // if first row, use special filter that doesn't sample previous row
-      if (j == 0) filter = first_row_filter[filter];
-      // handle first pixel explicitly
-      for (k=0; k < img_n; ++k) {
-         switch(filter) {
-            case F_none       : cur[k] = raw[k]; break;
-            case F_sub        : cur[k] = raw[k]; break;
-            case F_up         : cur[k] = raw[k] + prior[k]; break;
-            case F_avg        : cur[k] = raw[k] + (prior[k]>>1); break;
-            case F_paeth      : cur[k] = (uint8) (raw[k] + paeth(0,prior[k],0)); break;
-            case F_avg_first  : cur[k] = raw[k]; break;
-            case F_paeth_first: cur[k] = raw[k]; break;
-         }
+   if (filter > 4) return e("invalid filter","Corrupt PNG");
+   // if first row, use special filter that doesn't sample previous row
+   if (j == 0) filter = first_row_filter[filter];
+   // handle first pixel explicitly
+   for (k=0; k < img_n; ++k) {
+      switch(filter) {
+         case F_none       : cur[k] = raw[k]; break;
+         case F_sub        : cur[k] = raw[k]; break;
+         case F_up         : cur[k] = raw[k] + prior[k]; break;
+         case F_avg        : cur[k] = raw[k] + (prior[k]>>1); break;
+         case F_paeth      : cur[k] = (uint8) (raw[k] + paeth(0,prior[k],0)); break;
+         case F_avg_first  : cur[k] = raw[k]; break;
+         case F_paeth_first: cur[k] = raw[k]; break;
       }
-      if (img_n != out_n) cur[img_n] = 255;
-      raw += img_n;
-      cur += out_n;
-      prior += out_n;
-      // this is a little gross, so that we don't switch per-pixel or per-component
-      if (img_n == out_n) {
-         #define CASE(f) \
-             case f:     \
-                for (i=s->img_x-1; i >= 1; --i, raw+=img_n,cur+=img_n,prior+=img_n) \
-                   for (k=0; k < img_n; ++k)
-         switch(filter) {
-            CASE(F_none)  cur[k] = raw[k]; break;
-            CASE(F_sub)   cur[k] = raw[k] + cur[k-img_n]; break;
-            CASE(F_up)    cur[k] = raw[k] + prior[k]; break;
-            CASE(F_avg)   cur[k] = raw[k] + ((prior[k] + cur[k-img_n])>>1); break;
-            CASE(F_paeth)  cur[k] = (uint8) (raw[k] + paeth(cur[k-img_n],prior[k],prior[k-img_n])); break;
-            CASE(F_avg_first)    cur[k] = raw[k] + (cur[k-img_n] >> 1); break;
-            CASE(F_paeth_first)  cur[k] = (uint8) (raw[k] + paeth(cur[k-img_n],0,0)); break;
-         }
-         #undef CASE
-      } else {
-         assert(img_n+1 == out_n);
-         #define CASE(f) \
-             case f:     \
-                for (i=s->img_x-1; i >= 1; --i, cur[img_n]=255,raw+=img_n,cur+=out_n,prior+=out_n) \
-                   for (k=0; k < img_n; ++k)
-         switch(filter) {
-            CASE(F_none)  cur[k] = raw[k]; break;
-            CASE(F_sub)   cur[k] = raw[k] + cur[k-out_n]; break;
-            CASE(F_up)    cur[k] = raw[k] + prior[k]; break;
-            CASE(F_avg)   cur[k] = raw[k] + ((prior[k] + cur[k-out_n])>>1); break;
-            CASE(F_paeth)  cur[k] = (uint8) (raw[k] + paeth(cur[k-out_n],prior[k],prior[k-out_n])); break;
-            CASE(F_avg_first)    cur[k] = raw[k] + (cur[k-out_n] >> 1); break;
-            CASE(F_paeth_first)  cur[k] = (uint8) (raw[k] + paeth(cur[k-out_n],0,0)); break;
-         }
-         #undef CASE
+   }
+   if (img_n != out_n) cur[img_n] = 255;
+   raw += img_n;
+   cur += out_n;
+   prior += out_n;
+   // this is a little gross, so that we don't switch per-pixel or per-component
+   if (img_n == out_n) {
+      #define CASE(f) \
+          case f:     \
+             for (i=s->img_x-1; i >= 1; --i, raw+=img_n,cur+=img_n,prior+=img_n) \
+                for (k=0; k < img_n; ++k)
+      switch(filter) {
+         CASE(F_none)  cur[k] = raw[k]; break;
+         CASE(F_sub)   cur[k] = raw[k] + cur[k-img_n]; break;
+         CASE(F_up)    cur[k] = raw[k] + prior[k]; break;
+         CASE(F_avg)   cur[k] = raw[k] + ((prior[k] + cur[k-img_n])>>1); break;
+         CASE(F_paeth)  cur[k] = (uint8) (raw[k] + paeth(cur[k-img_n],prior[k],prior[k-img_n])); break;
+         CASE(F_avg_first)    cur[k] = raw[k] + (cur[k-img_n] >> 1); break;
+         CASE(F_paeth_first)  cur[k] = (uint8) (raw[k] + paeth(cur[k-img_n],0,0)); break;
+      }
+      #undef CASE
+   } else {
+      assert(img_n+1 == out_n);
+      #define CASE(f) \
+          case f:     \
+             for (i=s->img_x-1; i >= 1; --i, cur[img_n]=255,raw+=img_n,cur+=out_n,prior+=out_n) \
+                for (k=0; k < img_n; ++k)
+      switch(filter) {
+         CASE(F_none)  cur[k] = raw[k]; break;
+         CASE(F_sub)   cur[k] = raw[k] + cur[k-out_n]; break;
+         CASE(F_up)    cur[k] = raw[k] + prior[k]; break;
+         CASE(F_avg)   cur[k] = raw[k] + ((prior[k] + cur[k-out_n])>>1); break;
+         CASE(F_paeth)  cur[k] = (uint8) (raw[k] + paeth(cur[k-out_n],prior[k],prior[k-out_n])); break;
+         CASE(F_avg_first)    cur[k] = raw[k] + (cur[k-out_n] >> 1); break;
+         CASE(F_paeth_first)  cur[k] = (uint8) (raw[k] + paeth(cur[k-out_n],0,0)); break;
       }
+      #undef CASE
+   }
+   return 1;
+}
+
+// start inflating; 'final' means no later stage rewrites the pixels, so
+// they can go straight to the output buffer
+static int start_png_image(png *a, int out_n, int final)
+{
+   stbi *s = &a->s;
+   if (final) {
+      a->out = alloc_output(s, s->img_x * s->img_y * out_n);
+      if (!a->out) return 0;
+   } else {
+      a->out = (uint8 *) stbi_malloc(s->img_x * s->img_y * out_n);
+      if (!a->out) return e("outofmem", "Out of memory");
+   }
+   a->zs = zstream_open(1, s->img_n * s->img_x + 1);
+   if (a->zs == NULL) return 0;
+   a->row_fill = a->row_y = 0;
+   return 1;
+}
+
+// unfilter every row the input fed so far completes
+static int drain_png_rows(png *a, int out_n)
+{
+   stbi *s = &a->s;
+   uint32 raw_len = s->img_n * s->img_x + 1;
+   uint8 *raw = a->zs->extra;
+   while (a->row_y < s->img_y) {
+      int n = stbi_zstream_read(a->zs, (char *) raw + a->row_fill, raw_len - a->row_fill);
+      if (n < 0) return 0; // zlib should set error
+      a->row_fill += n;
+      if (a->row_fill < raw_len) break; // rest of the row is in a later IDAT
+      if (!unfilter_png_row(a, raw, a->row_y, out_n)) return 0;
+      a->row_fill = 0;
+      ++a->row_y;
    }
    return 1;
 }
@@ -2171,13 +2722,18 @@ static int compute_transparency(png *z, uint8 tc[3], int out_n)
    return 1;
 }
 
-static int expand_palette(png *a, uint8 *palette, int len, int pal_img_n)
+static int expand_palette(png *a, uint8 *palette, int len, int pal_img_n, int final)
 {
    uint32 i, pixel_count = a->s.img_x * a->s.img_y;
    uint8 *p, *temp_out, *orig = a->out;
 
-   p = (uint8 *) malloc(pixel_count * pal_img_n);
-   if (p == NULL) return e("outofmem", "Out of memory");
+   if (final) {
+      p = alloc_output(&a->s, pixel_count * pal_img_n);
+      if (p == NULL) return 0;
+   } else {
+      p = (uint8 *) stbi_malloc(pixel_count * pal_img_n);
+      if (p == NULL) return e("outofmem", "Out of memory");
+   }
 
    // between here and free(out) below, exitting would leak
    temp_out = p;
@@ -2200,7 +2756,7 @@ static int expand_palette(png *a, uint8 *palette, int len, int pal_img_n)
          p += 4;
       }
    }
-   free(a->out);
+   stbi_free(a->out);
    a->out = temp_out;
    return 1;
 }
@@ -2209,8 +2765,8 @@ static int parse_png_file(png *z, int scan, int req_comp)
 {
    uint8 palette[1024], pal_img_n=0;
    uint8 has_trans=0, tc[3];
-   uint32 ioff=0, idata_limit=0, i, pal_len=0;
-   int first=1,k;
+   uint32 i, pal_len=0;
+   int first=1,k,final;
    stbi *s = &z->s;
 
    if (!check_png_header(s)) return 0;
@@ -2263,7 +2819,7 @@ static int parse_png_file(png *z, int scan, int req_comp)
          }
 
          case PNG_TYPE('t','R','N','S'): {
-            if (z->idata) return e("tRNS after IDAT","Corrupt PNG");
+            if (z->zs) return e("tRNS after IDAT","Corrupt PNG");
             if (pal_img_n) {
                if (scan == SCAN_header) { s->img_n = 4; return 1; }
                if (pal_len == 0) return e("tRNS before PLTE","Corrupt PNG");
@@ -2282,43 +2838,53 @@ static int parse_png_file(png *z, int scan, int req_comp)
          }
 
          case PNG_TYPE('I','D','A','T'): {
+            uint32 left = c.length;
             if (pal_img_n && !pal_len) return e("no PLTE","Corrupt PNG");
             if (scan == SCAN_header) { s->img_n = pal_img_n; return 1; }
-            if (ioff + c.length > idata_limit) {
-               uint8 *p;
-               if (idata_limit == 0) idata_limit = c.length > 4096 ? c.length : 4096;
-               while (ioff + c.length > idata_limit)
-                  idata_limit *= 2;
-               p = (uint8 *) realloc(z->idata, idata_limit); if (p == NULL) return e("outofmem", "Out of memory");
-               z->idata = p;
+            if (z->zs == NULL) {
+               // everything that decides the output layout precedes IDAT
+               if ((req_comp == s->img_n+1 && req_comp != 3 && !pal_img_n) || has_trans)
+                  s->img_out_n = s->img_n+1;
+               else
+                  s->img_out_n = s->img_n;
+               final = !pal_img_n && (!req_comp || req_comp == s->img_out_n);
+               if (!start_png_image(z, s->img_out_n, final)) return 0;
             }
-            #ifndef STBI_NO_STDIO
-            if (s->img_file)
-            {
-               if (fread(z->idata+ioff,1,c.length,s->img_file) != c.length) return e("outofdata","Corrupt PNG");
-            }
-            else
-            #endif
-            {
-               memcpy(z->idata+ioff, s->img_buffer, c.length);
-               s->img_buffer += c.length;
+            // hand the chunk over in slices so the inflater's input
+            // buffer stays small however the encoder split its IDATs
+            while (left) {
+               uint32 n = left < PNG_IDAT_SLICE ? left : PNG_IDAT_SLICE;
+               uint8 *p = zstream_input_space(z->zs, n);
+               if (p == NULL) return 0;
+               #ifndef STBI_NO_STDIO
+               if (s->img_file)
+               {
+                  if (fread(p,1,n,s->img_file) != n) return e("outofdata","Corrupt PNG");
+               }
+               else
+               #endif
+               {
+                  if (s->img_buffer + n > s->img_buffer_end) return e("outofdata","Corrupt PNG");
+                  memcpy(p, s->img_buffer, n);
+                  s->img_buffer += n;
+               }
+               if (!drain_png_rows(z, s->img_out_n)) return 0;
+               left -= n;
             }
-            ioff += c.length;
             break;
          }
 
          case PNG_TYPE('I','E','N','D'): {
-            uint32 raw_len;
+            char extra;
             if (scan != SCAN_load) return 1;
-            if (z->idata == NULL) return e("no IDAT","Corrupt PNG");
-            z->expanded = (uint8 *) stbi_zlib_decode_malloc((char *) z->idata, ioff, (int *) &raw_len);
-            if (z->expanded == NULL) return 0; // zlib should set error
-            free(z->idata); z->idata = NULL;
-            if ((req_comp == s->img_n+1 && req_comp != 3 && !pal_img_n) || has_trans)
-               s->img_out_n = s->img_n+1;
-            else
-               s->img_out_n = s->img_n;
-            if (!create_png_image(z, z->expanded, raw_len, s->img_out_n)) return 0;
+            if (z->zs == NULL) return e("no IDAT","Corrupt PNG");
+            stbi_zstream_feed(z->zs, NULL, 0, 1);
+            if (!drain_png_rows(z, s->img_out_n)) return 0;
+            if (z->row_y != s->img_y) return e("not enough pixels","Corrupt PNG");
+            k = stbi_zstream_read(z->zs, &extra, 1);
+            if (k < 0) return 0;
+            if (k > 0) return e("too many pixels","Corrupt PNG");
+            stbi_zstream_close(z->zs); z->zs = NULL;
             if (has_trans)
                if (!compute_transparency(z, tc, s->img_out_n)) return 0;
             if (pal_img_n) {
@@ -2326,10 +2892,10 @@ static int parse_png_file(png *z, int scan, int req_comp)
                s->img_n = pal_img_n; // record the actual colors we had
                s->img_out_n = pal_img_n;
                if (req_comp >= 3) s->img_out_n = req_comp;
-               if (!expand_palette(z, palette, pal_len, s->img_out_n))
+               final = !req_comp || req_comp == s->img_out_n;
+               if (!expand_palette(z, palette, pal_len, s->img_out_n, final))
                   return 0;
             }
-            free(z->expanded); z->expanded = NULL;
             return 1;
          }
 
@@ -2337,8 +2903,7 @@ static int parse_png_file(png *z, int scan, int req_comp)
             // if critical, fail
             if ((c.type & (1 << 29)) == 0) {
                #ifndef STBI_NO_FAILURE_STRINGS
-               // not threadsafe
-               static char invalid_chunk[] = "XXXX chunk not known";
+               static STBI_THREAD_LOCAL char invalid_chunk[] = "XXXX chunk not known";
                invalid_chunk[0] = (uint8) (c.type >> 24);
                invalid_chunk[1] = (uint8) (c.type >> 16);
                invalid_chunk[2] = (uint8) (c.type >>  8);
@@ -2357,15 +2922,14 @@ static int parse_png_file(png *z, int scan, int req_comp)
 static unsigned char *do_png(png *p, int *x, int *y, int *n, int req_comp)
 {
    unsigned char *result=NULL;
-   p->expanded = NULL;
-   p->idata = NULL;
+   p->zs = NULL;
    p->out = NULL;
    if (req_comp < 0 || req_comp > 4) return epuc("bad req_comp", "Internal error");
    if (parse_png_file(p, SCAN_load, req_comp)) {
       result = p->out;
       p->out = NULL;
       if (req_comp && req_comp != p->s.img_out_n) {
-         result = convert_format(result, p->s.img_out_n, req_comp, p->s.img_x, p->s.img_y);
+         result = convert_format_to(&p->s, result, p->s.img_out_n, req_comp, p->s.img_x, p->s.img_y);
          p->s.img_out_n = req_comp;
          if (result == NULL) return result;
       }
@@ -2373,9 +2937,8 @@ static unsigned char *do_png(png *p, int *x, int *y, int *n, int req_comp)
       *y = p->s.img_y;
       if (n) *n = p->s.img_n;
    }
-   free(p->out);      p->out      = NULL;
-   free(p->expanded); p->expanded = NULL;
-   free(p->idata);    p->idata    = NULL;
+   free_output(&p->s, p->out); p->out   = NULL;
+   stbi_zstream_close(p->zs); p->zs = NULL;
 
    return result;
 }
@@ -2426,12 +2989,122 @@ int stbi_png_test_memory(stbi_uc const *buffer, int len)
    return parse_png_file(&p, SCAN_type,STBI_default);
 }
 
-// TODO: load header from png
+static int png_info(png *p, int *x, int *y, int *comp)
+{
+   p->zs = NULL;
+   if (!parse_png_file(p, SCAN_header, STBI_default)) return 0;
+   if (x) *x = p->s.img_x;
+   if (y) *y = p->s.img_y;
+   if (comp) *comp = p->s.img_n;
+   return 1;
+}
+
+#ifndef STBI_NO_STDIO
+extern int      stbi_png_info             (char const *filename,           int *x, int *y, int *comp)
+{
+   FILE *f = fopen(filename, "rb");
+   int result;
+   if (!f) return e("can't fopen", "Unable to open file");
+   result = stbi_png_info_from_file(f, x, y, comp);
+   fclose(f);
+   return result;
+}
+
+extern int      stbi_png_info_from_file   (FILE *f,                  int *x, int *y, int *comp)
+{
+   int n,r;
+   png p;
+   n = ftell(f);
+   start_file(&p.s, f);
+   r = png_info(&p, x, y, comp);
+   fseek(f,n,SEEK_SET);
+   return r;
+}
+#endif
+
+extern int      stbi_png_info_from_memory (stbi_uc const *buffer, int len, int *x, int *y, int *comp)
+{
+   png p;
+   start_mem(&p.s, buffer, len);
+   return png_info(&p, x, y, comp);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//
+//  decode into caller-owned memory; lives here so it can see the jpeg and
+//  png decoders, the only two that hand their final pass to the caller
+//
+
+// hand-off for formats that can't decode in place: check the size, copy
+// the temporary into 'out' and release it
+static int copy_into(stbi_uc *data, stbi_uc *out, int out_len, int w, int h, int n, int req_comp, int *x, int *y, int *comp)
+{
+   int size;
+   if (data == NULL) return 0;
+   size = w * h * (req_comp ? req_comp : n);
+   if (size > out_len) {
+      stbi_image_free(data);
+      return e("buffer too small", "Output buffer too small for image");
+   }
+   memcpy(out, data, size);
+   stbi_image_free(data);
+   *x = w;
+   *y = h;
+   if (comp) *comp = n;
+   return 1;
+}
+
 #ifndef STBI_NO_STDIO
-extern int      stbi_png_info             (char const *filename,           int *x, int *y, int *comp);
-extern int      stbi_png_info_from_file   (FILE *f,                  int *x, int *y, int *comp);
+int stbi_load_into(char const *filename, stbi_uc *out, int out_len, int *x, int *y, int *comp, int req_comp)
+{
+   FILE *f = fopen(filename, "rb");
+   stbi_uc *data;
+   int w,h,n,result;
+   if (out == NULL || out_len <= 0) return e("bad output buffer", "Internal error");
+   if (!f) return e("can't fopen", "Unable to open file");
+   if (stbi_jpeg_test_file(f)) {
+      jpeg j;
+      start_file(&j.s, f);
+      j.s.dest = out;
+      j.s.dest_len = out_len;
+      result = load_jpeg_image(&j, x,y,comp,req_comp) != NULL;
+   } else if (stbi_png_test_file(f)) {
+      png p;
+      start_file(&p.s, f);
+      p.s.dest = out;
+      p.s.dest_len = out_len;
+      result = do_png(&p, x,y,comp,req_comp) != NULL;
+   } else {
+      data = stbi_load_from_file(f, &w, &h, &n, req_comp);
+      result = copy_into(data, out, out_len, w, h, n, req_comp, x, y, comp);
+   }
+   fclose(f);
+   return result;
+}
 #endif
-extern int      stbi_png_info_from_memory (stbi_uc const *buffer, int len, int *x, int *y, int *comp);
+
+int stbi_load_from_memory_into(stbi_uc const *buffer, int len, stbi_uc *out, int out_len, int *x, int *y, int *comp, int req_comp)
+{
+   stbi_uc *data;
+   int w,h,n;
+   if (out == NULL || out_len <= 0) return e("bad output buffer", "Internal error");
+   if (stbi_jpeg_test_memory(buffer,len)) {
+      jpeg j;
+      start_mem(&j.s, buffer,len);
+      j.s.dest = out;
+      j.s.dest_len = out_len;
+      return load_jpeg_image(&j, x,y,comp,req_comp) != NULL;
+   }
+   if (stbi_png_test_memory(buffer,len)) {
+      png p;
+      start_mem(&p.s, buffer,len);
+      p.s.dest = out;
+      p.s.dest_len = out_len;
+      return do_png(&p, x,y,comp,req_comp) != NULL;
+   }
+   data = stbi_load_from_memory(buffer, len, &w, &h, &n, req_comp);
+   return copy_into(data, out, out_len, w, h, n, req_comp, x, y, comp);
+}
 
 // Microsoft/Windows BMP image
 
@@ -2595,11 +3268,11 @@ static stbi_uc *bmp_load(stbi *s, int *x, int *y, int *comp, int req_comp)
       target = req_comp;
    else
       target = s->img_n; // if they want monochrome, we'll post-convert
-   out = (stbi_uc *) malloc(target * s->img_x * s->img_y);
+   out = (stbi_uc *) stbi_malloc(target * s->img_x * s->img_y);
    if (!out) return epuc("outofmem", "Out of memory");
    if (bpp < 16) {
       int z=0;
-      if (psize == 0 || psize > 256) { free(out); return epuc("invalid", "Corrupt BMP"); }
+      if (psize == 0 || psize > 256) { stbi_free(out); return epuc("invalid", "Corrupt BMP"); }
       for (i=0; i < psize; ++i) {
          pal[i][2] = get8(s);
          pal[i][1] = get8(s);
@@ -2610,7 +3283,7 @@ static stbi_uc *bmp_load(stbi *s, int *x, int *y, int *comp, int req_comp)
       skip(s, offset - 14 - hsz - psize * (hsz == 12 ? 3 : 4));
       if (bpp == 4) width = (s->img_x + 1) >> 1;
       else if (bpp == 8) width = s->img_x;
-      else { free(out); return epuc("bad bpp", "Corrupt BMP"); }
+      else { stbi_free(out); return epuc("bad bpp", "Corrupt BMP"); }
       pad = (-width)&3;
       for (j=0; j < (int) s->img_y; ++j) {
          for (i=0; i < (int) s->img_x; i += 2) {
@@ -2834,7 +3507,7 @@ static stbi_uc *tga_load(stbi *s, int *x, int *y, int *comp, int req_comp)
 		//	force a new number of components
 		*comp = tga_bits_per_pixel/8;
 	}
-	tga_data = (unsigned char*)malloc( tga_width * tga_height * req_comp );
+	tga_data = (unsigned char*)stbi_malloc( tga_width * tga_height * req_comp );
 
 	//	skip to the data's starting position (offset usually = 0)
 	skip(s, tga_offset );
@@ -2844,7 +3517,7 @@ static stbi_uc *tga_load(stbi *s, int *x, int *y, int *comp, int req_comp)
 		//	any data to skip? (offset usually = 0)
 		skip(s, tga_palette_start );
 		//	load the palette
-		tga_palette = (unsigned char*)malloc( tga_palette_len * tga_palette_bits / 8 );
+		tga_palette = (unsigned char*)stbi_malloc( tga_palette_len * tga_palette_bits / 8 );
 		getn(s, tga_palette, tga_palette_len * tga_palette_bits / 8 );
 	}
 	//	load the data
@@ -2978,7 +3651,7 @@ static stbi_uc *tga_load(stbi *s, int *x, int *y, int *comp, int req_comp)
 	//	clear my palette, if I had one
 	if( tga_palette != NULL )
 	{
-		free( tga_palette );
+		stbi_free( tga_palette );
 	}
 	//	the things I do to get rid of an error message, and yet keep
 	//	Microsoft's C compilers happy... [8^(
@@ -3106,7 +3779,7 @@ static stbi_uc *psd_load(stbi *s, int *x, int *y, int *comp, int req_comp)
 		return epuc("bad compression", "PSD has an unknown compression format");
 
 	// Create the destination image.
-	out = (stbi_uc *) malloc(4 * w*h);
+	out = (stbi_uc *) stbi_malloc(4 * w*h);
 	if (!out) return epuc("outofmem", "Out of memory");
    pixelCount = w*h;
 
@@ -3358,7 +4031,7 @@ static float *hdr_load(stbi *s, int *x, int *y, int *comp, int req_comp)
 	if (req_comp == 0) req_comp = 3;
 
 	// Read data
-	hdr_data = (float *) malloc(height * width * req_comp * sizeof(float));
+	hdr_data = (float *) stbi_malloc(height * width * req_comp * sizeof(float));
 
 	// Load image data
    // image data is stored as some number of sca
@@ -3387,13 +4060,13 @@ static float *hdr_load(stbi *s, int *x, int *y, int *comp, int req_comp)
             hdr_convert(hdr_data, rgbe, req_comp);
             i = 1;
             j = 0;
-            free(scanline);
+            stbi_free(scanline);
             goto main_decode_loop; // yes, this is fucking insane; blame the fucking insane format
          }
          len <<= 8;
          len |= get8(s);
-         if (len != width) { free(hdr_data); free(scanline); return epf("invalid decoded scanline length", "corrupt HDR"); }
-         if (scanline == NULL) scanline = (stbi_uc *) malloc(width * 4);
+         if (len != width) { stbi_free(hdr_data); stbi_free(scanline); return epf("invalid decoded scanline length", "corrupt HDR"); }
+         if (scanline == NULL) scanline = (stbi_uc *) stbi_malloc(width * 4);
 
 			for (k = 0; k < 4; ++k) {
 				i = 0;
@@ -3415,7 +4088,7 @@ static float *hdr_load(stbi *s, int *x, int *y, int *comp, int req_comp)
          for (i=0; i < width; ++i)
             hdr_convert(hdr_data+(j*width + i)*req_comp, scanline + i*4, req_comp);
 		}
-      free(scanline);
+      stbi_free(scanline);
 	}
 
    return hdr_data;
@@ -3466,7 +4139,7 @@ static stbi_uc *hdr_load_rgbe(stbi *s, int *x, int *y, int *comp, int req_comp)
 	req_comp = 4;
 
 	// Read data
-	rgbe_data = (stbi_uc *) malloc(height * width * req_comp * sizeof(stbi_uc));
+	rgbe_data = (stbi_uc *) stbi_malloc(height * width * req_comp * sizeof(stbi_uc));
 	//	point to the beginning
 	scanline = rgbe_data;
 
@@ -3502,7 +4175,7 @@ static stbi_uc *hdr_load_rgbe(stbi *s, int *x, int *y, int *comp, int req_comp)
          }
          len <<= 8;
          len |= get8(s);
-         if (len != width) { free(rgbe_data); return epuc("invalid decoded scanline length", "corrupt HDR"); }
+         if (len != width) { stbi_free(rgbe_data); return epuc("invalid decoded scanline length", "corrupt HDR"); }
 			for (k = 0; k < 4; ++k) {
 				i = 0;
 				while (i < width) {
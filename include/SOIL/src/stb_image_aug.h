@@ -15,10 +15,11 @@
       decoded from memory or through stdio FILE (define STBI_NO_STDIO to remove code)
       supports installable dequantizing-IDCT, YCbCr-to-RGB conversion (define STBI_SIMD)
         
-   TODO:
-      stbi_info_*
-  
    history:
+      1.20   incremental zlib decoding (stbi_zstream); PNG unfilters rows as they inflate
+      1.19   reduced-size IDCT for 1/2, 1/4, 1/8 scale JPEG decoding
+      1.18   per-thread failure reason and HDR settings, static zlib tables
+      1.17   pluggable allocator, decode into caller memory, stbi_info_*
       1.16   major bugfix - convert_format converted one too many pixels
       1.15   initialize some fields for thread safety
       1.14   fix threadsafe conversion bug; header-file-only version (#define STBI_HEADER_FILE_ONLY before including)
@@ -71,7 +72,9 @@
 // Limitations:
 //    - no progressive/interlaced support (jpeg, png)
 //    - 8-bit samples only (jpeg, png)
-//    - not threadsafe
+//    - decoding is reentrant; the failure reason is per thread, HDR
+//      settings are global with per-thread overrides, the allocator and
+//      registered loaders are global
 //    - channel subsampling of at most 2 in each dimension (jpeg)
 //    - no delayed line count (jpeg) -- IJG doesn't support either
 //
@@ -157,6 +160,7 @@
 #ifndef STBI_NO_STDIO
 #include <stdio.h>
 #endif
+#include <stddef.h>
 
 #define STBI_VERSION 1
 
@@ -204,21 +208,66 @@ extern float *stbi_loadf_from_file  (FILE *f,                  int *x, int *y, i
 #endif
 extern float *stbi_loadf_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp);
 
+// these set the defaults for every thread; set them before decoding
+// starts on other threads
 extern void   stbi_hdr_to_ldr_gamma(float gamma);
 extern void   stbi_hdr_to_ldr_scale(float scale);
 
 extern void   stbi_ldr_to_hdr_gamma(float gamma);
 extern void   stbi_ldr_to_hdr_scale(float scale);
 
+// these override the defaults for conversions made on the calling thread
+// only, until stbi_hdr_thread_defaults() goes back to the defaults
+extern void   stbi_hdr_to_ldr_gamma_thread(float gamma);
+extern void   stbi_hdr_to_ldr_scale_thread(float scale);
+
+extern void   stbi_ldr_to_hdr_gamma_thread(float gamma);
+extern void   stbi_ldr_to_hdr_scale_thread(float scale);
+
+extern void   stbi_hdr_thread_defaults(void);
+
 #endif // STBI_NO_HDR
 
-// get a VERY brief reason for failure
-// NOT THREADSAFE
+// get a VERY brief reason for the last failure on the calling thread
 extern char    *stbi_failure_reason  (void); 
 
-// free the loaded image -- this is just free()
+// free the loaded image -- this goes through the installed allocator
 extern void     stbi_image_free      (void *retval_from_stbi_load);
 
+// allocate a block that can later be released with stbi_image_free
+extern void    *stbi_image_malloc    (size_t size);
+
+// MEMORY MANAGEMENT
+//
+// Every buffer the loaders allocate, both the returned image and the
+// intermediate decode buffers, goes through these hooks; pass NULL to
+// go back to malloc/realloc/free. Don't swap allocators while images
+// from the old one are still alive.
+typedef struct
+{
+   void *(*malloc_fn) (void *user, size_t size);
+   void *(*realloc_fn)(void *user, void *p, size_t size);
+   void  (*free_fn)   (void *user, void *p);
+   void  *user;
+} stbi_allocator;
+
+// NOT THREADSAFE
+extern void     stbi_set_allocator   (stbi_allocator const *allocator);
+
+// number of malloc/realloc calls made through the hooks on the calling
+// thread since its last reset
+extern int      stbi_allocation_count(void);
+extern void     stbi_reset_allocation_count(void);
+
+// decode straight into caller-owned memory (e.g. a mapped pixel buffer);
+// out_len must hold x*y*N bytes (see stbi_info_* to size it up front).
+// JPEG and PNG write their final pass directly into 'out', other formats
+// are decoded to a temporary and copied. returns 1 on success, 0 on failure
+#ifndef STBI_NO_STDIO
+extern int      stbi_load_into       (char const *filename,     stbi_uc *out, int out_len, int *x, int *y, int *comp, int req_comp);
+#endif
+extern int      stbi_load_from_memory_into(stbi_uc const *buffer, int len, stbi_uc *out, int out_len, int *x, int *y, int *comp, int req_comp);
+
 // get image dimensions & components without fully decoding
 extern int      stbi_info_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *comp);
 extern int      stbi_is_hdr_from_memory(stbi_uc const *buffer, int len);
@@ -229,6 +278,8 @@ extern int      stbi_is_hdr_from_file(FILE *f);
 #endif
 
 // ZLIB client - used by PNG, available for other purposes
+// the *_malloc variants return memory from the installed allocator; release
+// it with stbi_image_free
 
 extern char *stbi_zlib_decode_malloc_guesssize(const char *buffer, int len, int initial_size, int *outlen);
 extern char *stbi_zlib_decode_malloc(const char *buffer, int len, int *outlen);
@@ -237,6 +288,24 @@ extern int   stbi_zlib_decode_buffer(char *obuffer, int olen, const char *ibuffe
 extern char *stbi_zlib_decode_noheader_malloc(const char *buffer, int len, int *outlen);
 extern int   stbi_zlib_decode_noheader_buffer(char *obuffer, int olen, const char *ibuffer, int ilen);
 
+// incremental zlib: feed compressed input in chunks of any size, read
+// decoded output into buffers of any size
+//    stbi_zstream_open      pass parse_header=0 for a raw deflate stream
+//    stbi_zstream_feed      copies the chunk in; set final on the last one
+//    stbi_zstream_read      returns bytes written (fewer than olen once the
+//                           input fed so far runs out), or -1 on corrupt data
+//    stbi_zstream_done      true once the stream ended and all output was read
+// the context holds a 64K output buffer (32K of history for back-references
+// plus room to decode into) and any unconsumed input
+
+typedef struct stbi_zstream stbi_zstream;
+
+extern stbi_zstream *stbi_zstream_open(int parse_header);
+extern int   stbi_zstream_feed(stbi_zstream *s, char const *buffer, int len, int final);
+extern int   stbi_zstream_read(stbi_zstream *s, char *obuffer, int olen);
+extern int   stbi_zstream_done(stbi_zstream *s);
+extern void  stbi_zstream_close(stbi_zstream *s);
+
 // TYPE-SPECIFIC ACCESS
 
 // is it a jpeg?
@@ -253,6 +322,15 @@ extern int      stbi_jpeg_info            (char const *filename,     int *x, int
 extern int      stbi_jpeg_info_from_file  (FILE *f,                  int *x, int *y, int *comp);
 #endif
 
+// decode a jpeg at 1/scale_denom size (1, 2, 4 or 8) with a reduced IDCT;
+// the result is about what a box filter of the full image would give, for
+// a fraction of the time and memory. x and y are rounded up
+extern stbi_uc *stbi_jpeg_load_scaled_from_memory(stbi_uc const *buffer, int len, int scale_denom, int *x, int *y, int *comp, int req_comp);
+#ifndef STBI_NO_STDIO
+extern stbi_uc *stbi_jpeg_load_scaled     (char const *filename,     int scale_denom, int *x, int *y, int *comp, int req_comp);
+extern stbi_uc *stbi_jpeg_load_scaled_from_file(FILE *f,             int scale_denom, int *x, int *y, int *comp, int req_comp);
+#endif
+
 // is it a png?
 extern int      stbi_png_test_memory      (stbi_uc const *buffer, int len);
 extern stbi_uc *stbi_png_load_from_memory (stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp);
@@ -0,0 +1,191 @@
+//	Decodes images on many threads at once and checks each decode against
+//	the same one done alone; plain C++11 threads, no window or GL needed.
+//
+//		test_SOIL_threads [images]
+//
+//	Prints what it checked and exits with 0 when every check passed.
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <cstring>
+#include <sstream>
+#include <iostream>
+
+#include "SOIL.h"
+#include "stb_image_aug.h"
+
+//	One image decoded alone, to hold the threaded decodes against
+struct reference_image
+{
+	std::string file;
+	int force_channels;
+	int width, height, channels;
+	std::vector<unsigned char> pixels;
+};
+
+//	Decodes every image with every force_channels on 16 threads at once,
+//	8 rounds each, and checks that each decode matches the one done alone.
+//	Each thread also fails to load a file of its own between decodes, so a
+//	result string leaking across threads shows up in SOIL_last_result.
+//	Images are the file names in args, plus a TGA and a BMP made here.
+//	Returns 0 when every check passed.
+int stress_test(const std::string &args)
+{
+	const int threads = 16, rounds = 8;
+	std::vector<std::string> files;
+	std::istringstream names( args );
+	for( std::string name; names >> name; )
+	{
+		files.push_back( name );
+	}
+	//	a pattern with odd sizes, so rows are padded in the BMP
+	const int pattern_width = 67, pattern_height = 45;
+	std::vector<unsigned char> pattern( pattern_width * pattern_height * 4 );
+	for( size_t i = 0; i < pattern.size(); ++i )
+	{
+		pattern[i] = (unsigned char)( i * 7 + i / 251 );
+	}
+	if( !SOIL_save_image( "stress_test.tga", SOIL_SAVE_TYPE_TGA, pattern_width, pattern_height, 4, &pattern[0] )
+		|| !SOIL_save_image( "stress_test.bmp", SOIL_SAVE_TYPE_BMP, pattern_width, pattern_height, 4, &pattern[0] ) )
+	{
+		std::cout << "stress test: can not write its images" << std::endl;
+		return 1;
+	}
+	files.push_back( "stress_test.tga" );
+	files.push_back( "stress_test.bmp" );
+
+	std::vector<reference_image> references;
+	for( size_t f = 0; f < files.size(); ++f )
+	{
+		for( int force = 0; force <= 4; ++force )
+		{
+			reference_image ref;
+			ref.file = files[f];
+			ref.force_channels = force;
+			unsigned char *img = SOIL_load_image( ref.file.c_str(), &ref.width, &ref.height, &ref.channels, force );
+			if( img == NULL )
+			{
+				std::cout << "stress test: can not load '" << ref.file << "': " << SOIL_last_result() << std::endl;
+				return 1;
+			}
+			int stored = force ? force : ref.channels;
+			ref.pixels.assign( img, img + ref.width * ref.height * stored );
+			SOIL_free_image_data( img );
+			references.push_back( ref );
+		}
+	}
+
+	std::atomic<int> decodes( 0 ), failures( 0 );
+	std::vector<std::thread> workers;
+	for( int t = 0; t < threads; ++t )
+	{
+		workers.push_back( std::thread( [&, t]()
+		{
+			std::ostringstream missing;
+			missing << "stress_missing_" << t << ".png";
+			for( int round = 0; round < rounds; ++round )
+			{
+				for( size_t r = 0; r < references.size(); ++r )
+				{
+					//	each thread starts at a different image
+					const reference_image &ref = references[( r + t * 3 ) % references.size()];
+					int width = 0, height = 0, channels = 0;
+					unsigned char *img = SOIL_load_image( ref.file.c_str(), &width, &height, &channels, ref.force_channels );
+					bool same = img != NULL && width == ref.width && height == ref.height && channels == ref.channels
+						&& memcmp( img, &ref.pixels[0], ref.pixels.size() ) == 0
+						&& strcmp( SOIL_last_result(), "Image loaded" ) == 0;
+					SOIL_free_image_data( img );
+					if( !same )
+					{
+						++failures;
+					}
+					++decodes;
+					if( SOIL_load_image( missing.str().c_str(), &width, &height, &channels, 0 ) != NULL
+						|| strcmp( SOIL_last_result(), "Image loaded" ) == 0 )
+					{
+						++failures;
+					}
+				}
+			}
+		} ) );
+	}
+	for( size_t i = 0; i < workers.size(); ++i )
+	{
+		workers[i].join();
+	}
+	std::cout << "stress test: " << decodes << " decodes of " << files.size() << " images on " << threads
+		<< " threads, " << failures << " failures" << std::endl;
+	return failures == 0 ? 0 : 1;
+}
+
+//	The HDR conversion settings made on the main thread are the defaults
+//	every worker sees, and an override on one worker is seen by it alone.
+//	Half the threads load the TGA as floats with the defaults, the other
+//	half with a scale of their own. Returns 0 when every check passed.
+int hdr_settings_test()
+{
+	const int threads = 8;
+	const float scale = 2.0f;
+	int width = 0, height = 0, channels = 0;
+	stbi_ldr_to_hdr_gamma( 1.0f );
+	float *img = stbi_loadf( "stress_test.tga", &width, &height, &channels, 0 );
+	if( img == NULL )
+	{
+		std::cout << "HDR settings test: can not load 'stress_test.tga': " << stbi_failure_reason() << std::endl;
+		return 1;
+	}
+	std::vector<float> reference( img, img + width * height * channels );
+	stbi_image_free( img );
+
+	std::atomic<int> failures( 0 );
+	std::vector<std::thread> workers;
+	for( int t = 0; t < threads; ++t )
+	{
+		workers.push_back( std::thread( [&, t]()
+		{
+			float expected = 1.0f;
+			if( t & 1 )
+			{
+				stbi_ldr_to_hdr_scale_thread( scale );
+				expected = scale;
+			}
+			int w = 0, h = 0, c = 0;
+			float *mine = stbi_loadf( "stress_test.tga", &w, &h, &c, 0 );
+			bool same = mine != NULL && w == width && h == height && c == channels;
+			for( int i = 0; same && i < w * h * c; ++i )
+			{
+				//	alpha is never scaled
+				float want = ( i % c == c - 1 && !( c & 1 ) ) ? reference[i] : reference[i] * expected;
+				same = mine[i] == want;
+			}
+			stbi_image_free( mine );
+			if( !same )
+			{
+				++failures;
+			}
+		} ) );
+	}
+	for( size_t i = 0; i < workers.size(); ++i )
+	{
+		workers[i].join();
+	}
+	stbi_ldr_to_hdr_gamma( 2.2f );
+	std::cout << "HDR settings test: " << threads << " threads, " << failures << " failures" << std::endl;
+	return failures == 0 ? 0 : 1;
+}
+
+int main( int argc, char **argv )
+{
+	std::string images;
+	for( int i = 1; i < argc; ++i )
+	{
+		images += std::string( argv[i] ) + " ";
+	}
+	int failed = stress_test( images );
+	if( failed == 0 )
+	{
+		failed = hdr_settings_test();
+	}
+	return failed;
+}